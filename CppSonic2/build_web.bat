@@ -23,7 +23,14 @@ set SOURCES=src/renderer.cpp^
  src/input.cpp^
  src/input_bindings.cpp^
  src/bunnymark.cpp^
- src/common.cpp
+ src/common.cpp^
+ src/movie.cpp^
+ src/rewind.cpp^
+ src/batch.cpp^
+ src/netplay.cpp^
+ src/fuzz.cpp^
+ src/software_renderer.cpp^
+ src/jobs.cpp
 
 set INCLUDES=-I../external/glad/include -I../external/glm/include -I../external/stb/include
 
@@ -0,0 +1,33 @@
+layout(location = 0) out vec4 FragColor;
+
+// tile positions don't fit in mediump on GLES
+precision highp int;
+
+in vec4 v_Color;
+in vec2 v_TexCoord; // position in the tilemap in pixels
+
+uniform sampler2D u_Texture;      // tileset
+uniform highp usampler2D u_Tiles; // one Tile per texel
+
+void main() {
+	ivec2 pixel = ivec2(floor(v_TexCoord));
+
+	// see "struct Tile"
+	uint tile  = texelFetch(u_Tiles, pixel / 16, 0).r;
+	uint index = tile & 0xFFFFu;
+
+	if (index == 0u) {
+		discard;
+	}
+
+	ivec2 coord = pixel % 16;
+	if ((tile & (1u << 16)) != 0u) coord.x = 15 - coord.x;
+	if ((tile & (1u << 17)) != 0u) coord.y = 15 - coord.y;
+
+	int tiles_per_row = textureSize(u_Texture, 0).x / 16;
+	ivec2 src = ivec2(int(index) % tiles_per_row, int(index) / tiles_per_row) * 16;
+
+	vec4 color = texelFetch(u_Texture, src + coord, 0);
+
+	FragColor = color * v_Color;
+}
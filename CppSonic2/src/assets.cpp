@@ -3,6 +3,7 @@
 #include "package.h"
 #include "util.h"
 #include "texture.h"
+#include "window_creation.h"
 
 static Texture    textures[NUM_TEXTURES];
 static Sprite     sprites [NUM_SPRITES];
@@ -10,15 +11,211 @@ static Font       fonts   [NUM_FONTS];
 static Mix_Chunk* sounds  [NUM_SOUNDS];
 static Shader     shaders [NUM_SHADERS];
 
+// 
+// Texture atlas.
+// 
+// Small textures that are only drawn through sprites and fonts are packed into
+// big pages once everything is loaded, so that sprites from different sheets and
+// text don't break the batch. Their sprites and fonts are moved to the page and
+// the textures are freed, "get_texture" only keeps their size.
+// 
+// NO_TEXTURE_ATLAS=1 turns it off, to compare "renderer.draw_calls".
+// 
+
+constexpr int ATLAS_PAGE_SIZE = 1024;
+
+// transparent, so that scaled and rotated sprites don't pick up their neighbours
+constexpr int ATLAS_PADDING = 1;
+
+struct Atlas_Entry {
+	const char* filepath;
+	Texture texture; // as it was loaded
+	u32* pixels;     // decoded once, kept until "pack_atlas" because GLES can't read textures back
+
+	int page;
+	int x;
+	int y;
+};
+
+static dynamic_array<Atlas_Entry> atlas_entries; // waiting for "pack_atlas"
+static dynamic_array<Texture>     atlas_pages;
+
+static Texture load_texture_for_atlas(const char* filepath) {
+	// headless mode only needs the size, unless the software renderer draws
+	if (window.headless && !renderer.software) {
+		return load_texture_from_file(filepath);
+	}
+
+	auto buffer = get_file_arr(filepath);
+	if (buffer.count == 0) {
+		return create_texture_stub();
+	}
+
+	int width;
+	int height;
+	u32* pixels = (u32*) decode_image_data(buffer, &width, &height);
+	if (!pixels) {
+		return create_texture_stub();
+	}
+
+	Texture t = load_texture((u8*) pixels, width, height, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_RGBA);
+	log_info("Loaded texture %s (%d x %d)", filepath, t.width, t.height);
+
+	Atlas_Entry e = {};
+	e.filepath = filepath;
+	e.texture = t;
+	e.pixels = pixels;
+	array_add(&atlas_entries, e);
+
+	return t;
+}
+
+static int compare_atlas_entries_by_height(const void* _a, const void* _b) {
+	const Atlas_Entry* a = (const Atlas_Entry*) _a;
+	const Atlas_Entry* b = (const Atlas_Entry*) _b;
+
+	// tallest first, so that shelves waste less space
+	if (a->texture.height != b->texture.height) return b->texture.height - a->texture.height;
+	return b->texture.width - a->texture.width;
+}
+
+static void move_to_atlas_page(const Atlas_Entry& e, const Texture& page) {
+	for (int i = 0; i < NUM_SPRITES; i++) {
+		Sprite* s = &sprites[i];
+		if (s->texture.id != e.texture.id) continue;
+
+		s->texture = page;
+		For (f, s->frames) {
+			f->u += e.x;
+			f->v += e.y;
+		}
+	}
+
+	for (int i = 0; i < NUM_FONTS; i++) {
+		Font* f = &fonts[i];
+		if (f->atlas.id != e.texture.id) continue;
+
+		Assert(f->should_free_glyphs);
+
+		f->atlas = page;
+		f->should_free_atlas = false;
+		For (g, f->glyphs) {
+			g->u += e.x;
+			g->v += e.y;
+		}
+	}
+
+	Texture t = e.texture;
+	free_texture(&t);
+
+	for (int i = 0; i < NUM_TEXTURES; i++) {
+		if (textures[i].id == e.texture.id) {
+			textures[i].id = 0;
+		}
+	}
+}
+
+static void pack_atlas() {
+	if (atlas_entries.count == 0) return;
+
+	defer {
+		For (e, atlas_entries) {
+			free(e->pixels);
+		}
+		atlas_entries.count = 0;
+	};
+
+	if (SDL_GetHintBoolean("NO_TEXTURE_ATLAS", SDL_FALSE)) {
+		return;
+	}
+
+	qsort(atlas_entries.data, atlas_entries.count, sizeof(atlas_entries[0]), compare_atlas_entries_by_height);
+
+	// shelves, left to right and top to bottom
+	int num_pages = 0;
+	{
+		int x = ATLAS_PADDING;
+		int y = ATLAS_PADDING;
+		int shelf_height = 0;
+
+		For (e, atlas_entries) {
+			int w = e->texture.width  + ATLAS_PADDING;
+			int h = e->texture.height + ATLAS_PADDING;
+
+			if (ATLAS_PADDING + w > ATLAS_PAGE_SIZE || ATLAS_PADDING + h > ATLAS_PAGE_SIZE) {
+				log_warn("Texture %s (%d x %d) doesn't fit in the atlas.", e->filepath, e->texture.width, e->texture.height);
+				e->page = -1;
+				continue;
+			}
+
+			if (x + w > ATLAS_PAGE_SIZE) {
+				x = ATLAS_PADDING;
+				y += shelf_height;
+				shelf_height = 0;
+			}
+
+			if (y + h > ATLAS_PAGE_SIZE || num_pages == 0) {
+				if (num_pages > 0) {
+					x = ATLAS_PADDING;
+					y = ATLAS_PADDING;
+					shelf_height = 0;
+				}
+				num_pages++;
+			}
+
+			e->page = num_pages - 1;
+			e->x = x;
+			e->y = y;
+
+			x += w;
+			shelf_height = max(shelf_height, h);
+		}
+	}
+
+	u32* pixels = (u32*) malloc(ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * sizeof(u32));
+	Assert(pixels);
+	defer { free(pixels); };
+
+	for (int page = 0; page < num_pages; page++) {
+		memset(pixels, 0, ATLAS_PAGE_SIZE * ATLAS_PAGE_SIZE * sizeof(u32));
+
+		For (e, atlas_entries) {
+			if (e->page != page) continue;
+
+			int width = e->texture.width;
+			for (int y = 0; y < e->texture.height; y++) {
+				memcpy(&pixels[(e->y + y) * ATLAS_PAGE_SIZE + e->x], &e->pixels[y * width], width * sizeof(u32));
+			}
+		}
+
+		Texture t = load_texture((u8*) pixels, ATLAS_PAGE_SIZE, ATLAS_PAGE_SIZE, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_RGBA);
+		array_add(&atlas_pages, t);
+
+		int count = 0;
+		For (e, atlas_entries) {
+			if (e->page != page) continue;
+
+			move_to_atlas_page(*e, t);
+			count++;
+		}
+
+		log_info("Packed %d textures into atlas page %d.", count, (int) atlas_pages.count - 1);
+	}
+}
+
 void load_global_assets() {
-	fonts[fnt_ms_gothic]     = load_bmfont_file("fonts/ms_gothic.fnt",      "fonts/ms_gothic_0.png");
-	fonts[fnt_ms_mincho]     = load_bmfont_file("fonts/ms_mincho.fnt",      "fonts/ms_mincho_0.png");
-	fonts[fnt_consolas]      = load_bmfont_file("fonts/consolas.fnt",       "fonts/consolas_0.png");
-	fonts[fnt_consolas_bold] = load_bmfont_file("fonts/consolas_bold.fnt",  "fonts/consolas_bold_0.png");
-	fonts[fnt_cp437]         = load_bmfont_file("fonts/cp437.fnt",          "fonts/cp437_0.png");
+	// headless mode only needs sprites (for animations), fonts are only used for drawing,
+	// unless the software renderer draws
+	if (!window.headless || renderer.software) {
+		fonts[fnt_ms_gothic]     = load_bmfont_file("fonts/ms_gothic.fnt",      load_texture_for_atlas("fonts/ms_gothic_0.png"));
+		fonts[fnt_ms_mincho]     = load_bmfont_file("fonts/ms_mincho.fnt",      load_texture_for_atlas("fonts/ms_mincho_0.png"));
+		fonts[fnt_consolas]      = load_bmfont_file("fonts/consolas.fnt",       load_texture_for_atlas("fonts/consolas_0.png"));
+		fonts[fnt_consolas_bold] = load_bmfont_file("fonts/consolas_bold.fnt",  load_texture_for_atlas("fonts/consolas_bold_0.png"));
+		fonts[fnt_cp437]         = load_bmfont_file("fonts/cp437.fnt",          load_texture_for_atlas("fonts/cp437_0.png"));
+	}
 	
 	{
-		textures[tex_global_objects] = load_texture_from_file("textures/global_objects.png");
+		textures[tex_global_objects] = load_texture_for_atlas("textures/global_objects.png");
 		const Texture& t = get_texture(tex_global_objects);
 
 		int oy = 11;
@@ -66,7 +263,7 @@ void load_global_assets() {
 	}
 
 	{
-		textures[tex_EEZ_objects] = load_texture_from_file("textures/EEZ_objects.png");
+		textures[tex_EEZ_objects] = load_texture_for_atlas("textures/EEZ_objects.png");
 		const Texture& t = get_texture(tex_EEZ_objects);
 
 		sprites[spr_EEZ_platform1] = create_sprite(t, 0,  0,  64, 32, 32, 16);
@@ -104,52 +301,57 @@ void load_assets_for_game() {
 
 	textures[tex_sonic_palette] = load_texture_from_file("textures/sonic_palette.png");
 
-	fonts[fnt_hud]           = load_bmfont_file("fonts/fnt_hud.fnt",        "fonts/fnt_hud.png");
-	fonts[fnt_titlecard]     = load_bmfont_file("fonts/fnt_titlecard.fnt",  "fonts/fnt_titlecard.png");
-
-	fonts[fnt_menu] = load_font_from_texture("fonts/fnt_menu.png", 16, 16, 8, 9, 17);
-
-	sounds[snd_jump_cd]         = load_sound("sounds/jump_cd.wav");
-	sounds[snd_jump_s2]         = load_sound("sounds/jump_s2.wav");
-	sounds[snd_ring]            = load_sound("sounds/ring.wav");
-	sounds[snd_spindash]        = load_sound("sounds/spindash.wav");
-	sounds[snd_spindash_end]    = load_sound("sounds/spindash_end.wav");
-	sounds[snd_skid]            = load_sound("sounds/skid.wav");
-	sounds[snd_destroy_monitor] = load_sound("sounds/destroy_monitor.wav");
-	sounds[snd_spring_bounce]   = load_sound("sounds/spring_bounce.wav");
-	sounds[snd_lose_rings]      = load_sound("sounds/lose_rings.wav");
-	sounds[snd_die]             = load_sound("sounds/die.wav");
-	sounds[snd_life]            = load_sound("sounds/life.wav");
-	sounds[snd_blip]            = load_sound("sounds/blip.wav");
-	sounds[snd_get_paid]        = load_sound("sounds/get_paid.wav");
-	sounds[snd_sign_post]       = load_sound("sounds/sign_post.wav");
+	if (!window.headless || renderer.software) {
+		fonts[fnt_hud]           = load_bmfont_file("fonts/fnt_hud.fnt",        load_texture_for_atlas("fonts/fnt_hud.png"));
+		fonts[fnt_titlecard]     = load_bmfont_file("fonts/fnt_titlecard.fnt",  load_texture_for_atlas("fonts/fnt_titlecard.png"));
+
+		fonts[fnt_menu] = load_font_from_texture(load_texture_for_atlas("fonts/fnt_menu.png"), 16, 16, 8, 9, 17);
+	}
+
+	// the mixer isn't initialized in headless mode
+	if (!window.headless) {
+		sounds[snd_jump_cd]         = load_sound("sounds/jump_cd.wav");
+		sounds[snd_jump_s2]         = load_sound("sounds/jump_s2.wav");
+		sounds[snd_ring]            = load_sound("sounds/ring.wav");
+		sounds[snd_spindash]        = load_sound("sounds/spindash.wav");
+		sounds[snd_spindash_end]    = load_sound("sounds/spindash_end.wav");
+		sounds[snd_skid]            = load_sound("sounds/skid.wav");
+		sounds[snd_destroy_monitor] = load_sound("sounds/destroy_monitor.wav");
+		sounds[snd_spring_bounce]   = load_sound("sounds/spring_bounce.wav");
+		sounds[snd_lose_rings]      = load_sound("sounds/lose_rings.wav");
+		sounds[snd_die]             = load_sound("sounds/die.wav");
+		sounds[snd_life]            = load_sound("sounds/life.wav");
+		sounds[snd_blip]            = load_sound("sounds/blip.wav");
+		sounds[snd_get_paid]        = load_sound("sounds/get_paid.wav");
+		sounds[snd_sign_post]       = load_sound("sounds/sign_post.wav");
+	}
 
 	{
-		textures[tex_title_medal] = load_texture_from_file("textures/title_medal.png");
+		textures[tex_title_medal] = load_texture_for_atlas("textures/title_medal.png");
 		const Texture& t = get_texture(tex_title_medal);
 		sprites[spr_title_medal] = create_sprite(t, 0, 0, t.width, t.height, t.width, t.height / 2);
 	}
 
 	{
-		textures[tex_title_sonic] = load_texture_from_file("textures/title_sonic.png");
+		textures[tex_title_sonic] = load_texture_for_atlas("textures/title_sonic.png");
 		const Texture& t = get_texture(tex_title_sonic);
 		sprites[spr_title_sonic] = create_sprite(t, 0, 0, 103, 120, 103 / 2, 120 / 2, 7);
 	}
 
 	{
-		textures[tex_title_label] = load_texture_from_file("textures/title_label.png");
+		textures[tex_title_label] = load_texture_for_atlas("textures/title_label.png");
 		const Texture& t = get_texture(tex_title_label);
 		sprites[spr_title_label] = create_sprite(t, 0, 0, t.width, t.height, t.width / 2, t.height / 2);
 	}
 
 	{
-		textures[tex_title_mountains_left] = load_texture_from_file("textures/title_mountains_left.png");
+		textures[tex_title_mountains_left] = load_texture_for_atlas("textures/title_mountains_left.png");
 		const Texture& t = get_texture(tex_title_mountains_left);
 		sprites[spr_title_mountains_left] = create_sprite(t, 0, 0, t.width, t.height, 0, t.height);
 	}
 
 	{
-		textures[tex_title_mountains_right] = load_texture_from_file("textures/title_mountains_right.png");
+		textures[tex_title_mountains_right] = load_texture_for_atlas("textures/title_mountains_right.png");
 		const Texture& t = get_texture(tex_title_mountains_right);
 		sprites[spr_title_mountains_right] = create_sprite(t, 0, 0, t.width, t.height, t.width, t.height);
 	}
@@ -168,7 +370,7 @@ void load_assets_for_game() {
 	textures[tex_titlecard_line] = load_texture_from_file("textures/titlecard_line.png", GL_NEAREST, GL_REPEAT);
 
 	{
-		textures[tex_pause_menu] = load_texture_from_file("textures/pause_menu.png");
+		textures[tex_pause_menu] = load_texture_for_atlas("textures/pause_menu.png");
 		const Texture& t = get_texture(tex_pause_menu);
 
 		sprites[spr_pause_menu_bg]     = create_sprite(t, 0,   0, 128, 32, 0, 0);
@@ -180,7 +382,7 @@ void load_assets_for_game() {
 
 #if defined(__ANDROID__) || defined(PRETEND_MOBILE)
 	{
-		textures[tex_mobile_controls] = load_texture_from_file("textures/mobile_controls.png");
+		textures[tex_mobile_controls] = load_texture_for_atlas("textures/mobile_controls.png");
 		const Texture& t = get_texture(tex_mobile_controls);
 
 		sprites[spr_mobile_dpad]       = create_sprite(t,  0,  0, 62, 62, 0, 0);
@@ -194,7 +396,7 @@ void load_assets_for_game() {
 	}
 #endif
 
-	{
+	if (!window.headless) {
 		u32 shd_palette_vert = compile_shader(GL_VERTEX_SHADER, get_file_str("shaders/palette.vert"), "shd_palette_vert");
 		defer { glDeleteShader(shd_palette_vert); };
 
@@ -207,16 +409,25 @@ void load_assets_for_game() {
 		u32 shd_sine_frag = compile_shader(GL_FRAGMENT_SHADER, get_file_str("shaders/sine.frag"), "shd_sine_frag");
 		defer { glDeleteShader(shd_sine_frag); };
 
+		u32 shd_tilemap_vert = compile_shader(GL_VERTEX_SHADER, get_file_str("shaders/tilemap.vert"), "shd_tilemap_vert");
+		defer { glDeleteShader(shd_tilemap_vert); };
+
+		u32 shd_tilemap_frag = compile_shader(GL_FRAGMENT_SHADER, get_file_str("shaders/tilemap.frag"), "shd_tilemap_frag");
+		defer { glDeleteShader(shd_tilemap_frag); };
+
 		shaders[shd_palette].id = link_program(shd_palette_vert, shd_palette_frag, "shd_palette");
 		shaders[shd_sine].id    = link_program(shd_sine_vert,    shd_sine_frag,    "shd_sine");
+		shaders[shd_tilemap].id = link_program(shd_tilemap_vert, shd_tilemap_frag, "shd_tilemap");
 	}
+
+	pack_atlas();
 }
 
 void load_assets_for_editor() {
 	textures[tex_editor_bg] = load_texture_from_file("textures/editor_bg.png", GL_NEAREST, GL_REPEAT);
 
 	{
-		textures[tex_editor_sprites] = load_texture_from_file("textures/editor_sprites.png");
+		textures[tex_editor_sprites] = load_texture_for_atlas("textures/editor_sprites.png");
 		const Texture& t = get_texture(tex_editor_sprites);
 
 		sprites[spr_layer_flip]                          = create_sprite(t,   0,  0, 16, 48,  8, 24);
@@ -230,6 +441,8 @@ void load_assets_for_editor() {
 		sprites[spr_camera_region]                       = create_sprite(t, 128,  0, 32, 32, 16, 16);
 		sprites[spr_force_spin]                          = create_sprite(t, 160,  0, 32, 32, 16, 16);
 	}
+
+	pack_atlas();
 }
 
 void free_all_assets() {
@@ -251,12 +464,23 @@ void free_all_assets() {
 	for (int i = 0; i < NUM_SHADERS; i++) {
 		free_shader(&shaders[i]);
 	}
+
+	For (it, atlas_pages) {
+		free_texture(it);
+	}
+	array_free(&atlas_pages);
+
+	For (e, atlas_entries) {
+		free(e->pixels);
+	}
+	array_free(&atlas_entries);
 }
 
 const Texture& get_texture(u32 texture_index) {
 	Assert(texture_index < NUM_TEXTURES);
 
-	if (textures[texture_index].id == 0) {
+	// check the size instead of the id, headless mode doesn't create GL textures
+	if (textures[texture_index].width == 0) {
 		log_warn("Trying to access texture %u that hasn't been loaded.", texture_index);
 	}
 
@@ -286,7 +510,7 @@ const Font& get_font(u32 font_index) {
 Mix_Chunk* get_sound(u32 sound_index) {
 	Assert(sound_index < NUM_SOUNDS);
 
-	if (!sounds[sound_index]) {
+	if (!sounds[sound_index] && !window.headless) {
 		log_warn("Trying to access sound %u that hasn't been loaded.", sound_index);
 	}
 
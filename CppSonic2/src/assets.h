@@ -166,10 +166,13 @@ enum {
 enum {
 	shd_palette,
 	shd_sine,
+	shd_tilemap,
 
 	NUM_SHADERS,
 };
 
+// "load_assets_for_game" and "load_assets_for_editor" pack the small textures loaded
+// so far into an atlas, so call "load_global_assets" first.
 void load_global_assets();
 void load_assets_for_game();
 void load_assets_for_editor();
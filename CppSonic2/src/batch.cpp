@@ -0,0 +1,121 @@
+#include "batch.h"
+
+#include "game.h"
+#include "window_creation.h"
+
+struct Batch {
+	Game* instances;
+	int num_instances;
+	int num_frames;
+
+	Batch_Input_Proc input_proc;
+	void* userdata;
+
+	Batch_Result* results;
+
+	SDL_atomic_t next_instance;
+};
+
+static int batch_worker(void* userdata) {
+	Batch* b = (Batch*) userdata;
+
+	while (true) {
+		int i = SDL_AtomicAdd(&b->next_instance, 1);
+		if (i >= b->num_instances) break;
+
+		Game* g = &b->instances[i];
+
+		int frame = 0;
+		while (frame < b->num_frames && !g->batch_finished) {
+			u32 prev = g->batch_input;
+
+			g->batch_input = b->input_proc ? b->input_proc(i, frame, b->userdata) : 0;
+			g->batch_input_press = ~prev & g->batch_input;
+			g->batch_input_release = prev & ~g->batch_input;
+
+			g->update(1);
+			frame++;
+		}
+
+		b->results[i].frames = frame;
+		b->results[i].finished = g->batch_finished;
+		b->results[i].state_hash = g->get_state_hash();
+	}
+
+	return 0;
+}
+
+void run_batch(const char* level_path,
+			   int num_instances,
+			   int num_frames,
+			   int num_threads,
+			   Batch_Input_Proc input_proc,
+			   void* userdata,
+			   Batch_Result* results) {
+	if (num_threads <= 0) {
+		num_threads = SDL_GetCPUCount();
+	}
+	num_threads = clamp(num_threads, 1, num_instances);
+
+	Batch b = {};
+	b.num_instances = num_instances;
+	b.num_frames = num_frames;
+	b.input_proc = input_proc;
+	b.userdata = userdata;
+	b.results = results;
+
+	// load levels on this thread, loading isn't thread safe
+	b.instances = (Game*) malloc(num_instances * sizeof(Game));
+	Assert(b.instances);
+	defer { free(b.instances); };
+
+	double t = get_time();
+
+	for (int i = 0; i < num_instances; i++) {
+		b.instances[i] = {};
+		b.instances[i].init_batch_instance(level_path);
+	}
+
+	defer {
+		for (int i = 0; i < num_instances; i++) {
+			b.instances[i].deinit();
+		}
+	};
+
+	log_info("Loaded %d instances in %fs.", num_instances, get_time() - t);
+
+	t = get_time();
+
+	// this thread is one of the workers
+	int num_extra_threads = num_threads - 1;
+
+	SDL_Thread** threads = (SDL_Thread**) calloc(max(num_extra_threads, 1), sizeof(SDL_Thread*));
+	Assert(threads);
+	defer { free(threads); };
+
+	for (int i = 0; i < num_extra_threads; i++) {
+		threads[i] = SDL_CreateThread(batch_worker, "batch_worker", &b);
+
+		if (!threads[i]) {
+			log_warn("Couldn't create a worker thread: %s", SDL_GetError());
+		}
+	}
+
+	batch_worker(&b);
+
+	for (int i = 0; i < num_extra_threads; i++) {
+		if (threads[i]) {
+			SDL_WaitThread(threads[i], nullptr);
+		}
+	}
+
+	double took = get_time() - t;
+
+	long long total_frames = 0;
+	for (int i = 0; i < num_instances; i++) {
+		total_frames += results[i].frames;
+	}
+
+	log_info("Ran %d instances (%lld frames) on %d threads in %fs (%.0f fps).",
+			 num_instances, total_frames, num_threads, took, total_frames / took);
+}
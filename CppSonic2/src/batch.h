@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common.h"
+
+/*
+* Batch runner: steps many independent Game instances on a pool of worker threads.
+*
+* Every instance loads its own copy of the level on the calling thread. Then the workers
+* take instances off a shared counter and run each one to the end. Instances only run the
+* simulation (see "Game::batch_instance"): they don't draw, play sounds or read the keyboard.
+*
+* Only use it in headless mode, so that levels don't create textures.
+*/
+
+// Returns the input for an instance's next update. Called on a worker thread.
+typedef u32 (*Batch_Input_Proc)(int instance, int frame, void* userdata);
+
+struct Batch_Result {
+	int frames;
+	bool finished; // the player died or cleared the level
+	u64 state_hash;
+};
+
+// "results" has to have room for "num_instances" results.
+// If "num_threads" is 0, uses one thread per CPU core.
+void run_batch(const char* level_path,
+			   int num_instances,
+			   int num_frames,
+			   int num_threads,
+			   Batch_Input_Proc input_proc,
+			   void* userdata,
+			   Batch_Result* results);
@@ -599,6 +599,21 @@ inline void Lerp_delta(T* a, T b, float f, float delta) { *a = lerp_delta(*a, b,
 template <typename T>
 inline void Approach(T* start, T end, T shift) { *start = approach(*start, end, shift); }
 
+// 
+// FNV-1a. Pass the previous result as "hash" to hash several buffers in a row.
+// 
+
+constexpr u64 FNV1A_OFFSET_BASIS = 14695981039346656037ull;
+
+inline u64 hash_fnv1a(const void* data, size_t size, u64 hash = FNV1A_OFFSET_BASIS) {
+	const u8* bytes = (const u8*) data;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
 
 
 // ----------------------------------------------------
@@ -1132,6 +1147,33 @@ inline T* array_add_many(bump_array<T>* arr, array<T> values) {
 	return result;
 }
 
+template <typename T>
+inline T* array_add_many(dynamic_array<T>* arr, array<T> values) {
+	Assert(arr->count <= arr->capacity && "invalid array");
+
+	while (arr->count + values.count > arr->capacity) {
+		_array_grow(arr);
+	}
+
+	T* result = &arr->data[arr->count];
+	memcpy(result, values.data, sizeof(values[0]) * values.count);
+	arr->count += values.count;
+
+	return result;
+}
+
+// new elements aren't initialized
+template <typename T>
+inline void array_resize(dynamic_array<T>* arr, size_t count) {
+	Assert(arr->count <= arr->capacity && "invalid array");
+
+	while (count > arr->capacity) {
+		_array_grow(arr);
+	}
+
+	arr->count = count;
+}
+
 
 
 // -----------------------------------------------
@@ -736,6 +736,8 @@ void Editor::try_open_level(const char* path) {
 		return;
 	}
 
+	compile_collision_layers(&tm, ts);
+
 	objects = allocate_bump_array<Object>(MAX_OBJECTS, get_libc_allocator());
 
 	if (!read_objects(&objects, (current_level_dir / "Objects.bin").u8string().c_str())) {
@@ -846,6 +848,9 @@ void Editor::try_load_layer_from_binary_file() {
 			tiles[x + y * tm.width] = loaded[x + y * width];
 		}
 	}
+
+	compile_collision_layers(&tm, ts);
+	invalidate_tile_chunks(&tm);
 }
 
 void Editor::update(float delta) {
@@ -859,6 +864,9 @@ void Editor::update(float delta) {
 		array<Tile> tiles = get_tiles_array(tm, tilemap_editor.layer_index);
 
 		For (it, tiles) *it = {};
+
+		compile_collision_layers(&tm, ts);
+		invalidate_tile_chunks(&tm);
 	};
 
 	auto try_delete_all_objects = [&]() {
@@ -4,6 +4,22 @@
 #include "texture.h"
 
 Font load_bmfont_file(const char* fnt_filepath, const char* png_filepath) {
+	Texture atlas = load_texture_from_file(png_filepath);
+
+	Font f = load_bmfont_file(fnt_filepath, atlas);
+	if (f.atlas.id == 0) {
+		free_texture(&atlas);
+	}
+
+	return f;
+}
+
+Font load_bmfont_file(const char* fnt_filepath, const Texture& atlas) {
+	if (atlas.id == 0) {
+		log_error("Couldn't load font %s: couldn't load texture.", fnt_filepath);
+		return {};
+	}
+
 	Font f = {};
 
 	string text = get_file_str(fnt_filepath);
@@ -134,14 +150,7 @@ Font load_bmfont_file(const char* fnt_filepath, const char* png_filepath) {
 		f.glyphs[glyph_index] = glyph;
 	}
 
-	f.atlas = load_texture_from_file(png_filepath);
-
-	if (f.atlas.id == 0) {
-		log_error("Couldn't load font %s: couldn't load texture.", fnt_filepath);
-		free_font(&f);
-		return {};
-	}
-
+	f.atlas = atlas;
 	f.should_free_atlas = true;
 
 	log_info("Loaded font %s", fnt_filepath);
@@ -152,17 +161,29 @@ Font load_bmfont_file(const char* fnt_filepath, const char* png_filepath) {
 Font load_font_from_texture(const char* filepath,
 							int size, int line_height, int char_width,
 							int xoffset, int yoffset) {
-	Font f = {};
-
-	f.atlas = load_texture_from_file(filepath);
-	f.should_free_atlas = true;
+	Texture atlas = load_texture_from_file(filepath);
 
+	Font f = load_font_from_texture(atlas, size, line_height, char_width, xoffset, yoffset);
 	if (f.atlas.id == 0) {
+		free_texture(&atlas);
+	}
+
+	return f;
+}
+
+Font load_font_from_texture(const Texture& atlas,
+							int size, int line_height, int char_width,
+							int xoffset, int yoffset) {
+	if (atlas.id == 0) {
 		log_error("Couldn't create font: invalid texture.");
-		free_font(&f);
 		return {};
 	}
 
+	Font f = {};
+
+	// not "should_free_atlas" yet, the caller keeps it if this fails
+	f.atlas = atlas;
+
 	if (xoffset == 0) xoffset = char_width;
 	if (yoffset == 0) yoffset = size;
 
@@ -194,6 +215,8 @@ Font load_font_from_texture(const char* filepath,
 		f.glyphs[i] = glyph;
 	}
 
+	f.should_free_atlas = true;
+
 	log_info("Loaded font (%d x %d) from texture (%d x %d).", char_width, size, f.atlas.width, f.atlas.height);
 
 	return f;
@@ -39,11 +39,19 @@ enum VAlign {
 // load files generated by AngelCode's BMFont.
 Font load_bmfont_file(const char* fnt_filepath, const char* png_filepath);
 
+// Takes "atlas" if it succeeds, the caller keeps it otherwise.
+Font load_bmfont_file(const char* fnt_filepath, const Texture& atlas);
+
 // Monospace.
 Font load_font_from_texture(const char* filepath,
 							int size, int line_height, int char_width,
 							int xoffset = 0, int yoffset = 0);
 
+// Takes "atlas" if it succeeds, the caller keeps it otherwise.
+Font load_font_from_texture(const Texture& atlas,
+							int size, int line_height, int char_width,
+							int xoffset = 0, int yoffset = 0);
+
 void free_font(Font* f);
 
 // Returns the position of the next-to-be-drawn character.
@@ -0,0 +1,364 @@
+#include "fuzz.h"
+
+#include "game.h"
+#include "input_bindings.h"
+#include "window_creation.h"
+
+constexpr int NUM_ANOMALY_KINDS = FUZZ_OUT_OF_BOUNDS + 1;
+
+// the mode changed on at least this many of the last 32 frames
+constexpr int MODE_OSCILLATION_CHANGES = 16;
+
+// anomalies kept per worker for the report, the rest are only counted
+constexpr int MAX_ANOMALIES_PER_WORKER = 1000;
+
+// anomalies printed in the report
+constexpr int MAX_ANOMALIES_PRINTED = 32;
+
+struct Fuzz_Anomaly {
+	u32 seed;
+	int frame;
+	Fuzz_Anomaly_Kind kind;
+
+	vec2 pos;
+	vec2 speed;
+	PlayerState state;
+	PlayerMode mode;
+};
+
+struct Fuzz_Input {
+	u32 random_state;
+	bool mash; // new random buttons every frame
+
+	u32 held;
+	int hold_frames;
+};
+
+struct Fuzz;
+
+struct Fuzz_Worker {
+	Fuzz* fuzz;
+
+	Game game;
+	Game_State initial_state;
+
+	dynamic_array<Fuzz_Anomaly> anomalies;
+	long long num_anomalies[NUM_ANOMALY_KINDS];
+
+	long long frames;
+	int runs_with_anomalies;
+};
+
+struct Fuzz {
+	int num_runs;
+	int num_frames;
+	u32 seed;
+
+	SDL_atomic_t next_run;
+};
+
+//
+// Input.
+//
+
+static u32 next_random(Fuzz_Input* in) {
+	// xorshift32
+	u32 x = in->random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	in->random_state = x;
+	return x;
+}
+
+static void init_input(Fuzz_Input* in, u32 seed) {
+	*in = {};
+
+	// scramble the seed, so that neighbouring runs don't start out with similar input
+	u32 x = seed + 0x9E3779B9u;
+	x ^= x >> 16; x *= 0x85EBCA6Bu;
+	x ^= x >> 13; x *= 0xC2B2AE35u;
+	x ^= x >> 16;
+
+	// xorshift gets stuck on zero
+	in->random_state = (x != 0) ? x : 1;
+
+	in->mash = (next_random(in) % 4 == 0);
+}
+
+static u32 next_input(Fuzz_Input* in) {
+	if (in->mash) {
+		u32 r = next_random(in);
+		u32 result = 0;
+		if (r & (1 << 8))  result |= INPUT_MOVE_RIGHT;
+		if (r & (1 << 9))  result |= INPUT_MOVE_LEFT;
+		if (r & (1 << 10)) result |= INPUT_MOVE_UP;
+		if (r & (1 << 11)) result |= INPUT_MOVE_DOWN;
+		if (r & (1 << 12)) result |= INPUT_A;
+		if (r & (1 << 13)) result |= INPUT_B;
+		return result;
+	}
+
+	// hold an input for a while, mostly running right
+	if (in->hold_frames <= 0) {
+		u32 r = next_random(in);
+		u32 result = 0;
+
+		u32 dir = r % 16;
+		if (dir < 10) {
+			result |= INPUT_MOVE_RIGHT;
+		} else if (dir < 13) {
+			result |= INPUT_MOVE_LEFT;
+		}
+
+		if ((r >> 4)  % 3  == 0) result |= INPUT_A;
+		if ((r >> 8)  % 6  == 0) result |= INPUT_MOVE_DOWN;
+		if ((r >> 12) % 12 == 0) result |= INPUT_MOVE_UP;
+
+		in->held = result;
+		in->hold_frames = 1 + (r >> 16) % 60;
+	}
+
+	in->hold_frames--;
+	return in->held;
+}
+
+//
+// Simulation.
+//
+
+static int count_bits(u32 x) {
+	int result = 0;
+	while (x) {
+		x &= x - 1;
+		result++;
+	}
+	return result;
+}
+
+static bool is_finite(vec2 v) {
+	return isfinite(v.x) && isfinite(v.y);
+}
+
+static void report_anomaly(Fuzz_Worker* w, u32 seed, int frame, Fuzz_Anomaly_Kind kind) {
+	w->num_anomalies[kind]++;
+
+	if (w->anomalies.count >= MAX_ANOMALIES_PER_WORKER) return;
+
+	Player* p = &w->game.player;
+
+	Fuzz_Anomaly a = {};
+	a.seed  = seed;
+	a.frame = frame;
+	a.kind  = kind;
+	a.pos   = p->pos;
+	a.speed = p->speed;
+	a.state = p->state;
+	a.mode  = player_get_current_mode(p);
+	array_add(&w->anomalies, a);
+}
+
+// returns true if the run had an anomaly
+static bool fuzz_run(Fuzz_Worker* w, u32 seed) {
+	Fuzz* f = w->fuzz;
+	Game* g = &w->game;
+	Player* p = &g->player;
+
+	load_state(g, w->initial_state);
+
+	Fuzz_Input in;
+	init_input(&in, seed);
+
+	u32 found = 0; // every kind is reported once per run
+
+	PlayerMode mode = player_get_current_mode(p);
+	u32 mode_changes = 0; // one bit per frame
+
+	int frame = 0;
+	while (frame < f->num_frames && !g->batch_finished) {
+		u32 prev = g->batch_input;
+
+		g->batch_input = next_input(&in);
+		g->batch_input_press = ~prev & g->batch_input;
+		g->batch_input_release = prev & ~g->batch_input;
+
+		g->update_gameplay(1);
+		frame++;
+
+		// dying falls through the level, debug mode flies through walls
+		if (p->state == STATE_DEAD || p->state == STATE_DEBUG) continue;
+
+		PlayerMode new_mode = player_get_current_mode(p);
+		mode_changes = (mode_changes << 1) | (new_mode != mode);
+		mode = new_mode;
+
+		u32 anomalies = 0;
+
+		if (!is_finite(p->pos) || !is_finite(p->speed)
+			|| !isfinite(p->ground_speed) || !isfinite(p->ground_angle))
+		{
+			anomalies |= 1 << FUZZ_NAN;
+		} else {
+			if (player_is_in_solid(g, p))                             anomalies |= 1 << FUZZ_IN_SOLID;
+			if (count_bits(mode_changes) >= MODE_OSCILLATION_CHANGES) anomalies |= 1 << FUZZ_MODE_OSCILLATION;
+			if (player_is_out_of_bounds(g, p))                        anomalies |= 1 << FUZZ_OUT_OF_BOUNDS;
+		}
+
+		anomalies &= ~found;
+		found |= anomalies;
+
+		for (int kind = 0; anomalies; kind++, anomalies >>= 1) {
+			if (anomalies & 1) {
+				report_anomaly(w, seed, frame, (Fuzz_Anomaly_Kind) kind);
+			}
+		}
+
+		// nothing after this means anything
+		if (found & (1 << FUZZ_NAN)) break;
+	}
+
+	w->frames += frame;
+	return found != 0;
+}
+
+static int fuzz_worker(void* userdata) {
+	Fuzz_Worker* w = (Fuzz_Worker*) userdata;
+	Fuzz* f = w->fuzz;
+
+	while (true) {
+		int run = SDL_AtomicAdd(&f->next_run, 1);
+		if (run >= f->num_runs) break;
+
+		if (fuzz_run(w, f->seed + (u32) run)) {
+			w->runs_with_anomalies++;
+		}
+	}
+
+	return 0;
+}
+
+static int compare_anomalies(const void* _a, const void* _b) {
+	const Fuzz_Anomaly* a = (const Fuzz_Anomaly*) _a;
+	const Fuzz_Anomaly* b = (const Fuzz_Anomaly*) _b;
+
+	if (a->seed  != b->seed)  return (a->seed  < b->seed)  ? -1 : 1;
+	if (a->frame != b->frame) return (a->frame < b->frame) ? -1 : 1;
+	return a->kind - b->kind;
+}
+
+int run_fuzz(const char* level_path,
+			 int num_runs,
+			 int num_frames,
+			 int num_threads,
+			 u32 seed) {
+	if (num_threads <= 0) {
+		num_threads = SDL_GetCPUCount();
+	}
+	num_threads = clamp(num_threads, 1, num_runs);
+
+	Fuzz f = {};
+	f.num_runs = num_runs;
+	f.num_frames = num_frames;
+	f.seed = seed;
+
+	// load levels on this thread, loading isn't thread safe
+	Fuzz_Worker* workers = (Fuzz_Worker*) malloc(num_threads * sizeof(Fuzz_Worker));
+	Assert(workers);
+	defer { free(workers); };
+
+	double t = get_time();
+
+	for (int i = 0; i < num_threads; i++) {
+		Fuzz_Worker* w = &workers[i];
+		*w = {};
+		w->fuzz = &f;
+
+		w->game.init_batch_instance(level_path);
+		save_state(&w->game, &w->initial_state);
+	}
+
+	defer {
+		for (int i = 0; i < num_threads; i++) {
+			array_free(&workers[i].anomalies);
+			free_state(&workers[i].initial_state);
+			workers[i].game.deinit();
+		}
+	};
+
+	log_info("Loaded %d instances in %fs.", num_threads, get_time() - t);
+
+	t = get_time();
+
+	// this thread is one of the workers
+	int num_extra_threads = num_threads - 1;
+
+	SDL_Thread** threads = (SDL_Thread**) calloc(max(num_extra_threads, 1), sizeof(SDL_Thread*));
+	Assert(threads);
+	defer { free(threads); };
+
+	for (int i = 0; i < num_extra_threads; i++) {
+		threads[i] = SDL_CreateThread(fuzz_worker, "fuzz_worker", &workers[i + 1]);
+
+		if (!threads[i]) {
+			log_warn("Couldn't create a worker thread: %s", SDL_GetError());
+		}
+	}
+
+	fuzz_worker(&workers[0]);
+
+	for (int i = 0; i < num_extra_threads; i++) {
+		if (threads[i]) {
+			SDL_WaitThread(threads[i], nullptr);
+		}
+	}
+
+	double took = get_time() - t;
+
+	// gather the results
+	long long total_frames = 0;
+	long long num_anomalies[NUM_ANOMALY_KINDS] = {};
+	int runs_with_anomalies = 0;
+
+	dynamic_array<Fuzz_Anomaly> anomalies = {};
+	defer { array_free(&anomalies); };
+
+	for (int i = 0; i < num_threads; i++) {
+		Fuzz_Worker* w = &workers[i];
+
+		total_frames += w->frames;
+		runs_with_anomalies += w->runs_with_anomalies;
+
+		for (int kind = 0; kind < NUM_ANOMALY_KINDS; kind++) {
+			num_anomalies[kind] += w->num_anomalies[kind];
+		}
+
+		For (it, w->anomalies) {
+			array_add(&anomalies, *it);
+		}
+	}
+
+	// same order no matter which thread found what
+	qsort(anomalies.data, anomalies.count, sizeof(anomalies[0]), compare_anomalies);
+
+	for (size_t i = 0; i < anomalies.count && i < MAX_ANOMALIES_PRINTED; i++) {
+		const Fuzz_Anomaly& a = anomalies[i];
+		log_info("seed %u, frame %d: %s at (%.2f, %.2f), speed (%.2f, %.2f), %s, mode %d",
+				 a.seed, a.frame, GetFuzz_Anomaly_KindName(a.kind),
+				 a.pos.x, a.pos.y, a.speed.x, a.speed.y, GetPlayerStateName(a.state), a.mode);
+	}
+
+	if (anomalies.count > 0) {
+		log_info("To play a run again: --fuzz %s 1 %d 1 <seed>", level_path, num_frames);
+	}
+
+	for (int kind = 0; kind < NUM_ANOMALY_KINDS; kind++) {
+		log_info("%s: %lld", GetFuzz_Anomaly_KindName((Fuzz_Anomaly_Kind) kind), num_anomalies[kind]);
+	}
+
+	log_info("%d of %d runs had anomalies (seeds %u..%u).", runs_with_anomalies, num_runs, seed, seed + (u32) (num_runs - 1));
+
+	log_info("Ran %d runs (%lld frames) on %d threads in %fs (%.0f fps, %.0f fps per core).",
+			 num_runs, total_frames, num_threads, took, total_frames / took, total_frames / took / num_threads);
+
+	return runs_with_anomalies;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "common.h"
+
+/*
+* Physics fuzzer: plays a level many times with random input and checks the player
+* for things that should never happen.
+*
+* Every worker thread loads its own copy of the level once and saves a state right after
+* loading. Each run loads that state back and plays up to "num_frames" gameplay updates
+* with input generated from the run's seed, either random button mashing or held
+* inputs biased towards running right, jumping and spindashing.
+*
+* After every update the player is checked for:
+*   - NaN or infinite position, speed or angle,
+*   - the center being inside a solid tile (tunneling, see "player_is_in_solid"),
+*   - the mode (floor, wall, ceiling) flipping back and forth on most frames,
+*   - being outside the level bounds (see "player_keep_in_bounds").
+*
+* Run "i" uses seed "seed + i", so any run can be played again on its own
+* by passing its seed with one run.
+*
+* Only use it in headless mode, like the batch runner.
+*/
+
+#define FUZZ_ANOMALY_ENUM(X) \
+	X(FUZZ_NAN) \
+	X(FUZZ_IN_SOLID) \
+	X(FUZZ_MODE_OSCILLATION) \
+	X(FUZZ_OUT_OF_BOUNDS)
+
+DEFINE_NAMED_ENUM(Fuzz_Anomaly_Kind, int, FUZZ_ANOMALY_ENUM)
+
+// Returns the number of runs that had an anomaly.
+// If "num_threads" is 0, uses one thread per CPU core.
+int run_fuzz(const char* level_path,
+			 int num_runs,
+			 int num_frames,
+			 int num_threads,
+			 u32 seed);
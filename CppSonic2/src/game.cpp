@@ -8,38 +8,641 @@
 #include "program.h"
 #include "texture.h"
 #include "input.h"
+#include "movie.h"
+#include "rewind.h"
+#include "netplay.h"
+#include "software_renderer.h"
+#include "jobs.h"
 
 Game game;
 
+// 
+// Object type registry.
+// 
+// What each type does is in "object_types" (after "draw_objects"), instead of
+// a switch over the type in every loop.
+// 
+// The objects themselves stay in one array in id order rather than in per-type pools.
+// The update and draw passes go in id order, which is the order objects interact and
+// overlap in, and save states, rewind and handles copy and index that one array. Rings
+// are the only type there are many of, so they're the one with their positions in
+// separate arrays (see "Ring_Cell").
+// 
+
+enum {
+	OBJECT_TYPE_SOLID          = 1 << 0, // pushes the player out, "react" is called when the player hits it
+	OBJECT_TYPE_NONSOLID       = 1 << 1, // "touch" is called when the player overlaps it
+	OBJECT_TYPE_PLATFORM       = 1 << 2, // the player can stand on top of it
+	OBJECT_TYPE_WATCHES_PLAYER = 1 << 3, // "touch" is called every frame, even while it's sleeping
+	OBJECT_TYPE_EDITOR_ONLY    = 1 << 4, // only drawn in the editor
+};
+
+struct Object_Type_Info {
+	u32 flags;
+
+	void (*early_update)(Game* g, Object* o, float delta); // before the player
+	void (*update)      (Game* g, Object* o, float delta); // after the player
+
+	// The player hit a solid object from "dir", DIR_DOWN means landing on it.
+	// Returns true if the object handled the collision (a spring bounces the player off).
+	bool (*react)(Game* g, Player* p, Object* obj, Direction dir);
+
+	void (*touch)(Game* g, Player* p, Object* obj);
+
+	void (*draw)(const Object& o, float time_frames, bool cull);
+};
+
+static const Object_Type_Info& get_object_type_info(ObjType type);
+
 static bool object_is_solid(ObjType type) {
-	switch (type) {
-		case OBJ_MONITOR:         return true;
-		case OBJ_SPRING:          return true;
-		case OBJ_SPIKE:           return true;
-		case OBJ_SPRING_DIAGONAL: return true;
-	}
-	return false;
+	return (get_object_type_info(type).flags & OBJECT_TYPE_SOLID) != 0;
 }
 
 static bool object_is_nonsolid(ObjType type) {
-	switch (type) {
-		case OBJ_RING:         return true;
-		case OBJ_RING_DROPPED: return true;
-		case OBJ_MOSQUI:       return true;
-		case OBJ_FORCE_SPIN:   return true;
+	return (get_object_type_info(type).flags & OBJECT_TYPE_NONSOLID) != 0;
+}
+
+// "o" has to be in "g->objects"
+static Object_Derived* get_object_derived(Game* g, const Object* o) {
+	return &g->object_derived[o - g->objects.begin()];
+}
+
+static Object_Handle get_object_handle(Game* g, const Object* o) {
+	return {get_object_derived(g, o)->slot, o->id};
+}
+
+// Level objects get their slots in id order when the level is loaded.
+// The handle is stale once the object is gone, even if the slot was taken again.
+static Object_Handle get_level_object_handle(instance_id id) {
+	return {id - 1, id};
+}
+
+// 
+// Object grid.
+// 
+
+// Rings that don't move, most of the rings of a level. Dropped rings move every frame,
+// so keeping a copy of their position wouldn't save anything.
+static bool object_is_in_ring_cells(ObjType type) {
+	return type == OBJ_RING;
+}
+
+// types that player collision looks at
+static bool object_is_in_grid(ObjType type) {
+	u32 flags = get_object_type_info(type).flags;
+	return (flags & (OBJECT_TYPE_SOLID | OBJECT_TYPE_NONSOLID | OBJECT_TYPE_PLATFORM | OBJECT_TYPE_WATCHES_PLAYER)) != 0;
+}
+
+static bool object_is_always_checked(const Object& o) {
+	// like layer switchers, which remember which side of them the player is on
+	if (get_object_type_info(o.type).flags & OBJECT_TYPE_WATCHES_PLAYER) {
+		return true;
 	}
-	return false;
+
+	vec2 size = get_object_size(o);
+	return (size.x > OBJECT_GRID_CELL_SIZE || size.y > OBJECT_GRID_CELL_SIZE);
+}
+
+static int get_object_grid_cell(const Object_Grid& grid, const Object& o) {
+	if (object_is_always_checked(o)) {
+		return grid.width * grid.height;
+	}
+
+	int x = clamp((int) floorf(o.pos.x / OBJECT_GRID_CELL_SIZE), 0, grid.width  - 1);
+	int y = clamp((int) floorf(o.pos.y / OBJECT_GRID_CELL_SIZE), 0, grid.height - 1);
+	return x + y * grid.width;
+}
+
+static void ring_cell_add(Ring_Cell* cell, const Object& o, Object_Handle handle) {
+	array_add(&cell->x, o.pos.x);
+	array_add(&cell->y, o.pos.y);
+	array_add(&cell->handles, handle);
+}
+
+static size_t ring_cell_find(const Ring_Cell& cell, instance_id id) {
+	for (size_t i = 0; i < cell.handles.count; i++) {
+		if (cell.handles[i].id == id) return i;
+	}
+	Assert(!"ring isn't in its cell");
+	return 0;
+}
+
+static void object_grid_insert(Game* g, Object* o) {
+	Object_Grid* grid = &g->object_grid;
+	Object_Derived* d = get_object_derived(g, o);
+
+	if (!object_is_in_grid(o->type)) {
+		d->grid_cell = 0;
+		return;
+	}
+
+	int cell = get_object_grid_cell(*grid, *o);
+	if (object_is_in_ring_cells(o->type)) {
+		// never bigger than a cell
+		Assert(cell < grid->width * grid->height);
+		ring_cell_add(&grid->ring_cells[cell], *o, get_object_handle(g, o));
+	} else {
+		array_add(&grid->cells[cell], get_object_handle(g, o));
+	}
+	d->grid_cell = cell + 1;
+}
+
+static void object_grid_erase(Game* g, Object* o) {
+	Object_Grid* grid = &g->object_grid;
+	Object_Derived* d = get_object_derived(g, o);
+
+	if (d->grid_cell == 0) return;
+
+	if (object_is_in_ring_cells(o->type)) {
+		Ring_Cell* cell = &grid->ring_cells[d->grid_cell - 1];
+		size_t i = ring_cell_find(*cell, o->id);
+		size_t last = cell->handles.count - 1;
+
+		cell->x[i]       = cell->x[last];
+		cell->y[i]       = cell->y[last];
+		cell->handles[i] = cell->handles[last];
+
+		cell->x.count--;
+		cell->y.count--;
+		cell->handles.count--;
+	} else {
+		auto& cell = grid->cells[d->grid_cell - 1];
+		For (it, cell) {
+			if (it->id == o->id) {
+				*it = cell[cell.count - 1];
+				cell.count--;
+				break;
+			}
+		}
+	}
+
+	d->grid_cell = 0;
+}
+
+// call after moving an object
+static void object_grid_move(Game* g, Object* o) {
+	Object_Grid* grid = &g->object_grid;
+	Object_Derived* d = get_object_derived(g, o);
+
+	if (d->grid_cell == 0) return;
+
+	if (get_object_grid_cell(*grid, *o) + 1 != d->grid_cell) {
+		object_grid_erase(g, o);
+		object_grid_insert(g, o);
+	} else if (object_is_in_ring_cells(o->type)) {
+		// the cell has a copy of the position
+		Ring_Cell* cell = &grid->ring_cells[d->grid_cell - 1];
+		size_t i = ring_cell_find(*cell, o->id);
+		cell->x[i] = o->pos.x;
+		cell->y[i] = o->pos.y;
+	}
+}
+
+static int compare_handles_by_id(const void* _a, const void* _b) {
+	instance_id a = ((const Object_Handle*) _a)->id;
+	instance_id b = ((const Object_Handle*) _b)->id;
+	return (a < b) ? -1 : (a > b);
+}
+
+// Returns the objects in the cells that "rect" touches and the ones that are always checked.
+// Sorted by id, which is also their order in "objects". Rings that don't move aren't in it,
+// see "find_rings_touching_rect".
+static array<Object_Handle> object_grid_query(Object_Grid* grid, Rectf rect) {
+	auto& result = *grid->query;
+	result.count = 0;
+
+	int x1 = clamp((int) floorf(rect.x / OBJECT_GRID_CELL_SIZE),            0, grid->width  - 1);
+	int y1 = clamp((int) floorf(rect.y / OBJECT_GRID_CELL_SIZE),            0, grid->height - 1);
+	int x2 = clamp((int) floorf((rect.x + rect.w) / OBJECT_GRID_CELL_SIZE), 0, grid->width  - 1);
+	int y2 = clamp((int) floorf((rect.y + rect.h) / OBJECT_GRID_CELL_SIZE), 0, grid->height - 1);
+
+	for (int y = y1; y <= y2; y++) {
+		for (int x = x1; x <= x2; x++) {
+			For (it, grid->cells[x + y * grid->width]) {
+				array_add(&result, *it);
+			}
+		}
+	}
+
+	For (it, grid->cells[grid->width * grid->height]) {
+		array_add(&result, *it);
+	}
+
+	qsort(result.data, result.count, sizeof(result[0]), compare_handles_by_id);
+
+	array<Object_Handle> arr = {};
+	arr.data = result.data;
+	arr.count = result.count;
+	return arr;
+}
+
+static void init_object_grid(Object_Grid* grid, const Tilemap& tm) {
+	grid->width  = max((int) ceilf(tm.width  * 16 / OBJECT_GRID_CELL_SIZE), 1);
+	grid->height = max((int) ceilf(tm.height * 16 / OBJECT_GRID_CELL_SIZE), 1);
+
+	grid->cells = (dynamic_array<Object_Handle>*) calloc(grid->width * grid->height + 1, sizeof(grid->cells[0]));
+	grid->query = (dynamic_array<Object_Handle>*) calloc(1, sizeof(grid->query[0]));
+	grid->ring_cells = (Ring_Cell*) calloc(grid->width * grid->height, sizeof(grid->ring_cells[0]));
+	Assert(grid->cells);
+	Assert(grid->query);
+	Assert(grid->ring_cells);
+}
+
+static void deinit_object_grid(Object_Grid* grid) {
+	if (grid->cells) {
+		for (int i = 0; i < grid->width * grid->height + 1; i++) {
+			array_free(&grid->cells[i]);
+		}
+	}
+
+	if (grid->query) {
+		array_free(grid->query);
+	}
+
+	if (grid->ring_cells) {
+		for (int i = 0; i < grid->width * grid->height; i++) {
+			array_free(&grid->ring_cells[i].x);
+			array_free(&grid->ring_cells[i].y);
+			array_free(&grid->ring_cells[i].handles);
+		}
+	}
+
+	free(grid->cells);
+	free(grid->query);
+	free(grid->ring_cells);
+	*grid = {};
+}
+
+static void clear_ring_cells(Object_Grid* grid) {
+	for (int i = 0; i < grid->width * grid->height; i++) {
+		grid->ring_cells[i].x.count       = 0;
+		grid->ring_cells[i].y.count       = 0;
+		grid->ring_cells[i].handles.count = 0;
+	}
+}
+
+static void free_ring_batch(Ring_Batch* batch) {
+	array_free(&batch->hit);
+	array_free(&batch->hits);
+
+	array_free(&batch->dropped);
+	array_free(&batch->probe_x);
+	array_free(&batch->probe_y);
+	array_free(&batch->floor_dist);
+}
+
+static void rebuild_object_grid(Game* g) {
+	Object_Grid* grid = &g->object_grid;
+
+	for (int i = 0; i < grid->width * grid->height + 1; i++) {
+		grid->cells[i].count = 0;
+	}
+	clear_ring_cells(grid);
+
+	For (it, g->objects) {
+		object_grid_insert(g, it);
+	}
+}
+
+static void rebuild_object_derived(Game* g) {
+	g->object_derived.count = g->objects.count;
+
+	for (size_t slot = 0; slot < g->object_slots.count; slot++) {
+		const Object_Slot& s = g->object_slots[slot];
+		if (s.id == 0) continue;
+
+		g->object_derived[s.index].slot = (u32) slot;
+	}
+
+	// nothing to interpolate from
+	for (size_t i = 0; i < g->objects.count; i++) {
+		g->object_derived[i].prev_pos = g->objects[i].pos;
+	}
+
+	rebuild_object_grid(g);
+
+	g->object_derived_stale = false;
+}
+
+static void update_object_derived(Game* g) {
+	if (g->object_derived_stale) {
+		rebuild_object_derived(g);
+	}
+}
+
+// 
+// Object slots.
+// 
+
+static void alloc_object_slot(Game* g, Object* o) {
+	u32 slot;
+	if (g->first_free_slot != 0) {
+		slot = g->first_free_slot - 1;
+		g->first_free_slot = g->object_slots[slot].index;
+	} else {
+		slot = (u32) g->object_slots.count;
+		array_add(&g->object_slots, {});
+	}
+
+	g->object_slots[slot].index = (u32) (o - g->objects.begin());
+	g->object_slots[slot].id = o->id;
+	get_object_derived(g, o)->slot = slot;
+}
+
+static void free_object_slot(Game* g, Object* o) {
+	u32 slot = get_object_derived(g, o)->slot;
+
+	Object_Slot* s = &g->object_slots[slot];
+	Assert(s->id == o->id);
+
+	s->id = 0;
+	s->index = g->first_free_slot;
+	g->first_free_slot = slot + 1;
+}
+
+Object* Game::get_object(Object_Handle handle) {
+	if (handle.id == 0) return nullptr;
+	if (handle.slot >= object_slots.count) return nullptr;
+
+	const Object_Slot& s = object_slots[handle.slot];
+	if (s.id != handle.id) return nullptr;
+
+	return &objects[s.index];
+}
+
+static Object* add_object(Game* g, const Object& o) {
+	Object* result = array_add(&g->objects, o);
+
+	Object_Derived d = {};
+	d.prev_pos = o.pos;
+	array_add(&g->object_derived, d);
+
+	alloc_object_slot(g, result);
+	object_grid_insert(g, result);
+	return result;
+}
+
+// Returns the object that took its place, like "array_remove".
+// To remove many objects, flag them with FLAG_INSTANCE_DEAD and call "remove_dead_objects".
+static Object* remove_object(Game* g, Object* o) {
+	object_grid_erase(g, o);
+	free_object_slot(g, o);
+
+	array_remove(&g->object_derived, get_object_derived(g, o));
+	Object* result = array_remove(&g->objects, o);
+
+	// the objects after it moved down by one
+	for (Object* it = result; it != g->objects.end(); it++) {
+		g->object_slots[get_object_derived(g, it)->slot].index--;
+	}
+
+	return result;
+}
+
+// 
+// Object activation window.
+// 
+
+static bool object_is_sleeping(Game* g, const Object& o) {
+	return (o.id <= g->num_level_objects
+			&& (o.id < g->active_first_id || o.id >= g->active_last_id));
+}
+
+// first object with an id of at least "id"
+static Object* lower_bound_object(Game* g, instance_id id) {
+	size_t left = 0;
+	size_t right = g->objects.count;
+
+	while (left < right) {
+		size_t middle = (left + right) / 2;
+		if (g->objects[middle].id < id) {
+			left = middle + 1;
+		} else {
+			right = middle;
+		}
+	}
+
+	return g->objects.begin() + left;
+}
+
+static Object* skip_sleeping_objects(Game* g, Object* it) {
+	if (it != g->objects.end() && object_is_sleeping(g, *it)) {
+		// the rest of the level objects are out of the window too
+		it = lower_bound_object(g, g->num_level_objects + 1);
+	}
+	return it;
+}
+
+// Iterate the active objects with
+//   for (Object* it = get_first_active_object(g); it != g->objects.end(); it = get_next_active_object(g, it))
+// "it" can be removed with "Remove" while iterating.
+static Object* get_first_active_object(Game* g) {
+	return skip_sleeping_objects(g, lower_bound_object(g, g->active_first_id));
+}
+
+static Object* get_next_active_object(Game* g, Object* it) {
+	return skip_sleeping_objects(g, it + 1);
+}
+
+// the active level objects, and the objects spawned during gameplay
+static void get_active_objects(Game* g, array<Object>* level_objects, array<Object>* spawned_objects) {
+	Object* first   = lower_bound_object(g, g->active_first_id);
+	Object* last    = lower_bound_object(g, g->active_last_id);
+	Object* spawned = lower_bound_object(g, g->num_level_objects + 1);
+
+	*level_objects   = array<Object>(first, last - first);
+	*spawned_objects = array<Object>(spawned, g->objects.end() - spawned);
+}
+
+// Handles of the level objects of one type, in id order. Some of them may be gone already.
+static array<Object_Handle> get_level_objects_of_type(Game* g, ObjType type) {
+	u32 first = g->level_objects_by_type_offsets[type];
+	u32 last  = g->level_objects_by_type_offsets[type + 1];
+	return array<Object_Handle>(g->level_objects_by_type + first, last - first);
+}
+
+// Removes the objects flagged with FLAG_INSTANCE_DEAD in one pass, keeping the order.
+// Objects only die while they're active, so the search starts in the window.
+static void remove_dead_objects(Game* g) {
+	Object* first_dead = get_first_active_object(g);
+	while (first_dead != g->objects.end() && !(first_dead->flags & FLAG_INSTANCE_DEAD)) {
+		first_dead = get_next_active_object(g, first_dead);
+	}
+
+	if (first_dead == g->objects.end()) return;
+
+	Object* out = first_dead;
+
+	for (Object* it = first_dead; it != g->objects.end(); it++) {
+		if (it->flags & FLAG_INSTANCE_DEAD) {
+			object_grid_erase(g, it);
+			free_object_slot(g, it);
+			continue;
+		}
+
+		Object_Derived* out_derived = get_object_derived(g, out);
+		*out_derived = *get_object_derived(g, it);
+		*out = *it;
+
+		g->object_slots[out_derived->slot].index = (u32) (out - g->objects.begin());
+		out++;
+	}
+
+	g->objects.count = out - g->objects.begin();
+	g->object_derived.count = g->objects.count;
+}
+
+static void reset_object(Game* g, Object* o) {
+	*o = g->level_objects[o->id - 1];
+
+	get_object_derived(g, o)->prev_pos = o->pos;
+	object_grid_move(g, o);
+}
+
+static void wake_object(Game* g, instance_id id) {
+	// collected or destroyed
+	Object* o = g->get_object(get_level_object_handle(id));
+	if (!o) return;
+
+	// it kept track of the player while sleeping
+	if (get_object_type_info(o->type).flags & OBJECT_TYPE_WATCHES_PLAYER) return;
+
+	if (o->type == OBJ_MOVING_PLATFORM) {
+		reset_object(g, o);
+
+		// put the mounts back on the platform
+		for (int i = 0; i < (int) ArrayLength(o->mplatform.mounts); i++) {
+			if (Object* mount = g->get_object(o->mplatform.mounts[i])) {
+				reset_object(g, mount);
+			}
+		}
+		return;
+	}
+
+	// the platform puts it back when it wakes up
+	if (o->flags & FLAG_INSTANCE_MOUNTED) return;
+
+	reset_object(g, o);
+}
+
+// Call before updating the objects.
+static void update_object_window(Game* g) {
+	float left  = g->camera_pos.x - OBJECT_WINDOW_MARGIN;
+	float right = g->camera_pos.x + window.game_width + OBJECT_WINDOW_MARGIN;
+
+	// "level_objects" is sorted by "start_pos.x"
+	auto lower_bound_x = [&](float x, bool inclusive) -> instance_id {
+		size_t lo = 0;
+		size_t hi = g->num_level_objects;
+
+		while (lo < hi) {
+			size_t middle = (lo + hi) / 2;
+			float start_x = g->level_objects[middle].start_pos.x;
+			if (inclusive ? (start_x <= x) : (start_x < x)) {
+				lo = middle + 1;
+			} else {
+				hi = middle;
+			}
+		}
+
+		return (instance_id) (lo + 1);
+	};
+
+	instance_id first = lower_bound_x(left,  false);
+	instance_id last  = lower_bound_x(right, true);
+
+	for (instance_id id = first; id < last; id++) {
+		if (id < g->active_first_id || id >= g->active_last_id) {
+			wake_object(g, id);
+		}
+	}
+
+	g->active_first_id = first;
+	g->active_last_id  = last;
+}
+
+static int compare_objects_by_x(const void* _a, const void* _b) {
+	const Object* a = (const Object*) _a;
+	const Object* b = (const Object*) _b;
+
+	if (a->pos.x != b->pos.x) return (a->pos.x < b->pos.x) ? -1 : 1;
+
+	// keep the order from the file, "id" is the index there
+	return (a->id < b->id) ? -1 : (a->id > b->id);
+}
+
+// 
+// Index over the solid objects, for neighbour searches while the level loads.
+// The objects are sorted by x by then, so it's the solid ones in the same order,
+// searched by x, and a search only has to look as far as the widest one reaches.
+// 
+struct Load_Index {
+	array<Object*> solids;
+	float max_half_width;
+};
+
+static Load_Index build_load_index(array<Object> objects) {
+	Load_Index index = {};
+
+	size_t count = 0;
+	For (it, objects) {
+		if (object_is_solid(it->type)) count++;
+	}
+
+	index.solids = calloc_array<Object*>(max(count, (size_t) 1));
+	index.solids.count = 0;
+
+	For (it, objects) {
+		if (!object_is_solid(it->type)) continue;
+
+		index.solids[index.solids.count++] = it;
+		index.max_half_width = fmaxf(index.max_half_width, get_object_size(*it).x / 2);
+	}
+
+	return index;
+}
+
+static void free_load_index(Load_Index* index) {
+	free(index->solids.data);
+	*index = {};
+}
+
+// Solid objects whose rect could overlap [left, right] horizontally, in array order.
+static array<Object*> load_index_query(const Load_Index& index, float left, float right) {
+	// one more pixel, so that rounding can't miss an object right at the edge
+	float min_x = left  - index.max_half_width - 1;
+	float max_x = right + index.max_half_width + 1;
+
+	size_t lo = 0;
+	size_t hi = index.solids.count;
+	while (lo < hi) {
+		size_t middle = lo + (hi - lo) / 2;
+		if (index.solids[middle]->pos.x < min_x) {
+			lo = middle + 1;
+		} else {
+			hi = middle;
+		}
+	}
+
+	size_t end = lo;
+	while (end < index.solids.count && index.solids[end]->pos.x <= max_x) {
+		end++;
+	}
+
+	return array<Object*>(index.solids.data + lo, end - lo);
 }
 
 void Game::load_level(const char* path) {
 	log_info("Loading level %s...", path);
 
+	double load_start = get_time();
+
 	// load tileset texture
 	char buf[512];
 	stbsp_snprintf(buf, sizeof(buf), "%s/Tileset.png", path);
 
 	tileset_texture = load_texture_from_file(buf);
-	if (tileset_texture.id == 0) {
+	if (tileset_texture.width == 0) {
 		log_error("Couldn't load tileset texture for level %s", path);
 		return;
 	}
@@ -58,8 +661,11 @@ void Game::load_level(const char* path) {
 	stbsp_snprintf(buf, sizeof(buf), "%s/Tileset.bin", path);
 	read_tileset(&ts, buf);
 
+	compile_collision_layers(&tm, ts);
+
 	// load object data
-	objects = allocate_bump_array<Object>(MAX_OBJECTS, get_libc_allocator());
+	objects = allocate_bump_array<Object>(MAX_OBJECTS, get_arena_allocator(&arena));
+	object_derived = allocate_bump_array<Object_Derived>(MAX_OBJECTS, get_libc_allocator());
 	stbsp_snprintf(buf, sizeof(buf), "%s/Objects.bin", path);
 	read_objects(&objects, buf);
 
@@ -89,32 +695,50 @@ void Game::load_level(const char* path) {
 		}
 	}
 
+	// sorted by x for the activation window
+	for (size_t i = 0; i < objects.count; i++) {
+		objects[i].id = (instance_id) i;
+	}
+
+	qsort(objects.data, objects.count, sizeof(objects[0]), compare_objects_by_x);
+
+	object_slots = allocate_bump_array<Object_Slot>(MAX_OBJECTS, get_arena_allocator(&arena));
+
+	object_derived.count = objects.count;
+
 	For (it, objects) {
 		it->id = next_id++;
+		alloc_object_slot(this, it);
 	}
 
+	Load_Index index = build_load_index(objects);
+	defer { free_load_index(&index); };
+
 	// init objects
 	For (it, objects) {
 		it->start_pos = it->pos;
 
 		switch (it->type) {
 			case OBJ_MOVING_PLATFORM: {
-				it->mplatform.init_pos = it->pos;
 				it->mplatform.prev_pos = it->pos;
 
+				vec2 size = get_object_size(*it);
+
 				// search for mount
-				For (obj, objects) {
-					if (it == obj) continue;
+				array<Object*> nearby = load_index_query(index, it->pos.x - size.x/2 - 1, it->pos.x + size.x/2 + 1);
 
-					if (!object_is_solid(obj->type)) continue;
+				For (candidate, nearby) {
+					Object* obj = *candidate;
+					if (it == obj) continue;
 
-					vec2 size = get_object_size(*it);
 					vec2 obj_size = get_object_size(*obj);
 					if (rect_vs_rect({it->pos.x - size.x/2 - 1, it->pos.y - size.y/2 - 1, size.x + 2, size.y + 2}, {obj->pos.x - obj_size.x/2, obj->pos.y - obj_size.y/2, obj_size.x, obj_size.y})) {
-						if (it->mplatform.mounts[0] == 0) {
-							it->mplatform.mounts[0] = obj->id;
-						} else if (it->mplatform.mounts[1] == 0) {
-							it->mplatform.mounts[1] = obj->id;
+						if (it->mplatform.mounts[0].id == 0) {
+							it->mplatform.mounts[0] = get_object_handle(this, obj);
+							obj->flags |= FLAG_INSTANCE_MOUNTED;
+						} else if (it->mplatform.mounts[1].id == 0) {
+							it->mplatform.mounts[1] = get_object_handle(this, obj);
+							obj->flags |= FLAG_INSTANCE_MOUNTED;
 						}
 					}
 				}
@@ -138,8 +762,33 @@ void Game::load_level(const char* path) {
 		}
 	}
 
-	gen_heightmap_texture(&heightmap, ts, tileset_texture);
-	gen_widthmap_texture (&widthmap,  ts, tileset_texture);
+	// keep the initial state for when objects come back into the window
+	num_level_objects = (instance_id) objects.count;
+	level_objects = calloc_array<Object>(max(objects.count, (size_t) 1)).data;
+	memcpy(level_objects, objects.data, objects.count * sizeof(Object));
+
+	// group them by type, so that systems that only care about one type don't go through all of them
+	level_objects_by_type = calloc_array<Object_Handle>(max(objects.count, (size_t) 1)).data;
+	{
+		u32* offsets = level_objects_by_type_offsets;
+		memset(offsets, 0, sizeof(level_objects_by_type_offsets));
+
+		For (it, objects) offsets[it->type + 1]++;
+		for (int type = 0; type < NUM_OBJ_TYPES; type++) offsets[type + 1] += offsets[type];
+
+		u32 next[NUM_OBJ_TYPES];
+		memcpy(next, offsets, sizeof(next));
+
+		For (it, objects) level_objects_by_type[next[it->type]++] = get_object_handle(this, it);
+	}
+
+	// these are only for debug views
+	if (!window.headless) {
+		gen_heightmap_texture(&heightmap, ts, tileset_texture);
+		gen_widthmap_texture (&widthmap,  ts, tileset_texture);
+	}
+
+	log_info("Loaded level %s in %fs (%d objects).", path, get_time() - load_start, (int) objects.count);
 }
 
 constexpr float PLAYER_DEC = 0.5f;
@@ -555,32 +1204,32 @@ static void get_push_sensors_pos(Player* p, vec2* sensor_e, vec2* sensor_f) {
 	}
 }
 
-static SensorResult sensor_check_down(vec2 pos, int layer) {
-	auto get_height = [&](Tile tile, int ix, int iy) -> int {
-		if (!tile.top_solid) {
-			return 0;
-		}
-
-		int result = 0;
-		auto heights = get_tile_heights(game.ts, tile.index);
-
-		if (tile.hflip && tile.vflip) {
-			int h = heights[15 - ix % 16];
-			if (h >= 0xF0) result = 16 - (h - 0xF0);
-			else if (h == 16) result = 16;
-		} else if (!tile.hflip && tile.vflip) {
-			int h = heights[ix % 16];
-			if (h >= 0xF0) result = 16 - (h - 0xF0);
-			else if (h == 16) result = 16;
-		} else if (tile.hflip && !tile.vflip) {
-			int h = heights[15 - ix % 16];
-			if (h <= 0x10) result = h;
-		} else if (!tile.hflip && !tile.vflip) {
-			int h = heights[ix % 16];
-			if (h <= 0x10) result = h;
-		}
+// 
+// A sensor looks for the nearest solid surface in direction "dir", starting at "pos".
+// It checks the tile at "pos", then the next tile if that one is empty, or the previous one
+// if it's full, so it sees up to 16 pixels beyond the tile and into a wall.
+// 
+// "dist" is the distance to the surface along "dir", negative if "pos" is inside the surface.
+// 
+// The axis and the sign are known at compile time, so each direction compiles to its own
+// straight-line code.
+// 
+template <Direction dir>
+static SensorResult sensor_check(const Tileset& ts, const Tilemap& tm, const Collision_Layer& layer, array<Tile> tiles, vec2 pos) {
+	constexpr bool vertical = (dir == DIR_DOWN || dir == DIR_UP);
+	constexpr int  sign     = (dir == DIR_DOWN || dir == DIR_RIGHT) ? 1 : -1;
+
+	// only floors can be jumped through from below
+	constexpr u32 solid = (dir == DIR_DOWN) ? COLLISION_TOP_SOLID : COLLISION_LRB_SOLID;
+
+	auto get_cell = [&](int tile_x, int tile_y) -> u32 {
+		return layer.cells.data[(tile_x + COLLISION_BORDER) + (tile_y + COLLISION_BORDER) * layer.stride];
+	};
 
-		return result;
+	auto get_height = [&](u32 cell, int coord) -> int {
+		// empty cells are 0, which is a valid index too
+		int height = ts.sensor_heights.data[(cell & COLLISION_HEIGHTS_MASK) + dir * 4 * 16 + coord % 16];
+		return (cell & solid) ? height : 0;
 	};
 
 	SensorResult result = {};
@@ -588,340 +1237,166 @@ static SensorResult sensor_check_down(vec2 pos, int layer) {
 	// 
 	// NOTE: To make this work correctly with negative numbers,
 	// we would have to replace these casts for ix, iy, tile_x, tile_y with floorf's
-	// and replace the modulo operator in get_height with calls to wrap()
+	// and replace the modulo operator with calls to wrap()
 	// 
 
 	int ix = max((int)pos.x, 0);
 	int iy = max((int)pos.y, 0);
 
-	int tile_x = pos.x / 16;
-	int tile_y = pos.y / 16;
-
-	Tile tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-	int height = get_height(tile, ix, iy);
+	// anything further out is empty, and stepping one tile from here stays in the border
+	int tile_x = clamp((int)(pos.x / 16), 1 - COLLISION_BORDER, tm.width  + COLLISION_BORDER - 2);
+	int tile_y = clamp((int)(pos.y / 16), 1 - COLLISION_BORDER, tm.height + COLLISION_BORDER - 2);
 
-	if (height == 0) {
-		tile_y++;
-		tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-		height = get_height(tile, ix, iy);
+	int along  = vertical ? iy : ix; // pixel along the sensor
+	int across = vertical ? ix : iy; // column (or row) of the tile's heights
 
-		if (height != 0) {
-			result.tile = tile;
-			result.found = true;
-			result.tile_x = tile_x;
-			result.tile_y = tile_y;
-		}
+	u32 cell = get_cell(tile_x, tile_y);
+	int height = get_height(cell, across);
 
-		// NOTE: this should be wrap(iy,16) instead of modulo if we care about negative numbers. Also change it in get_height.
-		result.dist = (32 - (iy % 16)) - (height + 1);
+	// check the next tile if this one is empty, the previous one if it's full
+	int step = 0;
+	if (height == 0) {
+		step = 1;
 	} else if (height == 16) {
-		tile_y--;
-		tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-		height = get_height(tile, ix, iy);
-
-		if (height != 0) {
-			result.tile = tile;
-			result.found = true;
-			result.tile_x = tile_x;
-			result.tile_y = tile_y;
-		}
-
-		result.dist = -(iy % 16) - (height + 1);
-	} else {
-		result.tile = tile;
-		result.found = true;
-		result.tile_x = tile_x;
-		result.tile_y = tile_y;
-
-		result.dist = (16 - (iy % 16)) - (height + 1);
+		step = -1;
 	}
 
-	return result;
-}
-
-static SensorResult sensor_check_right(vec2 pos, int layer) {
-	auto get_height = [&](Tile tile, int ix, int iy) -> int {
-		if (!tile.lrb_solid) {
-			return 0;
-		}
-
-		int result = 0;
-		auto heights = get_tile_widths(game.ts, tile.index);
-
-		if (tile.hflip && tile.vflip) {
-			int h = heights[15 - iy % 16];
-			if (h >= 0xF0) result = 16 - (h - 0xF0);
-			else if (h == 16) result = 16;
-		} else if (!tile.hflip && tile.vflip) {
-			int h = heights[15 - iy % 16];
-			if (h <= 0x10) result = h;
-		} else if (tile.hflip && !tile.vflip) {
-			int h = heights[iy % 16];
-			if (h >= 0xF0) result = 16 - (h - 0xF0);
-			else if (h == 16) result = 16;
-		} else if (!tile.hflip && !tile.vflip) {
-			int h = heights[iy % 16];
-			if (h <= 0x10) result = h;
-		}
-
-		return result;
-	};
-
-	SensorResult result = {};
-
-	int ix = max((int)pos.x, 0);
-	int iy = max((int)pos.y, 0);
-
-	int tile_x = pos.x / 16;
-	int tile_y = pos.y / 16;
-
-	Tile tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-	int height = get_height(tile, ix, iy);
-
-	if (height == 0) {
-		tile_x++;
-		tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-		height = get_height(tile, ix, iy);
-
-		if (height != 0) {
-			result.tile = tile;
-			result.found = true;
-			result.tile_x = tile_x;
-			result.tile_y = tile_y;
+	if (step != 0) {
+		if (vertical) {
+			tile_y += step * sign;
+		} else {
+			tile_x += step * sign;
 		}
 
-		result.dist = (32 - (ix % 16)) - (height + 1);
-	} else if (height == 16) {
-		tile_x--;
-		tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-		height = get_height(tile, ix, iy);
-
-		if (height != 0) {
-			result.tile = tile;
-			result.found = true;
-			result.tile_x = tile_x;
-			result.tile_y = tile_y;
-		}
+		cell = get_cell(tile_x, tile_y);
+		height = get_height(cell, across);
+	}
 
-		result.dist = -(ix % 16) - (height + 1);
-	} else {
-		result.tile = tile;
+	if (height != 0) {
+		// border cells are empty, so this is inside the map
+		result.tile = tiles.data[tile_x + tile_y * tm.width];
 		result.found = true;
 		result.tile_x = tile_x;
 		result.tile_y = tile_y;
-
-		result.dist = (16 - (ix % 16)) - (height + 1);
 	}
 
+	// distance to the far side of the pixel's tile, then one tile further or back
+	int to_edge = (sign > 0) ? (15 - along % 16) : (along % 16);
+	result.dist = to_edge + step * 16 - height;
+
 	return result;
 }
 
-static SensorResult sensor_check_up(vec2 pos, int layer) {
-	auto get_height = [&](Tile tile, int ix, int iy) {
-		if (!tile.lrb_solid) {
-			return 0;
-		}
-
-		int result = 0;
-		auto heights = get_tile_heights(game.ts, tile.index);
-
-		if (tile.hflip && tile.vflip) {
-			int h = heights[15 - ix % 16];
-			if (h <= 0x10) result = h;
-		} else if (!tile.hflip && tile.vflip) {
-			int h = heights[ix % 16];
-			if (h <= 0x10) result = h;
-		} else if (tile.hflip && !tile.vflip) {
-			int h = heights[15 - ix % 16];
-			if (h >= 0xF0) result = 16 - (h - 0xF0);
-			else if (h == 16) result = 16;
-		} else if (!tile.hflip && !tile.vflip) {
-			int h = heights[ix % 16];
-			if (h >= 0xF0) result = 16 - (h - 0xF0);
-			else if (h == 16) result = 16;
-		}
-
-		return result;
-	};
-
-	SensorResult result = {};
-
-	int ix = max((int)pos.x, 0);
-	int iy = max((int)pos.y, 0);
-
-	int tile_x = pos.x / 16;
-	int tile_y = pos.y / 16;
-
-	Tile tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-	int height = get_height(tile, ix, iy);
-
-	if (height == 0) {
-		tile_y--;
-		tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-		height = get_height(tile, ix, iy);
-
-		if (height != 0) {
-			result.tile = tile;
-			result.found = true;
-			result.tile_x = tile_x;
-			result.tile_y = tile_y;
-		}
-
-		result.dist = 16 + (iy % 16) - (height);
-	} else if (height == 16) {
-		tile_y++;
-		tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-		height = get_height(tile, ix, iy);
-
-		if (height != 0) {
-			result.tile = tile;
-			result.found = true;
-			result.tile_x = tile_x;
-			result.tile_y = tile_y;
-		}
-
-		result.dist = -16 + (iy % 16) - (height);
-	} else {
-		result.tile = tile;
-		result.found = true;
-		result.tile_x = tile_x;
-		result.tile_y = tile_y;
-
-		result.dist = (iy % 16) - (height);
-	}
-
-	return result;
+template <Direction dir>
+static SensorResult sensor_check(Game* g, vec2 pos, int layer) {
+	return sensor_check<dir>(g->ts, g->tm, get_collision_layer(g->tm, layer), get_tiles_array(g->tm, layer), pos);
 }
 
-static SensorResult sensor_check_left(vec2 pos, int layer) {
-	auto get_height = [&](Tile tile, int ix, int iy) {
-		if (!tile.lrb_solid) {
-			return 0;
-		}
+// 
+// Checks two sensors at once, for pairs that are checked from the same player position
+// (A and B, C and D). The layer is looked up once, and because the checks don't depend
+// on each other the compiler can interleave their loads. Each sensor still fetches its
+// own cells: A and B are 14-18 pixels apart, so they're rarely over the same tile, and
+// sharing the row and the step between them measured slower (more branches on data).
+// 
+template <Direction dir_a, Direction dir_b>
+static void sensor_check_pair(Game* g, vec2 pos_a, vec2 pos_b, int layer,
+							  SensorResult* res_a, SensorResult* res_b) {
+	const Collision_Layer& collision = get_collision_layer(g->tm, layer);
+	array<Tile> tiles = get_tiles_array(g->tm, layer);
+
+	*res_a = sensor_check<dir_a>(g->ts, g->tm, collision, tiles, pos_a);
+	*res_b = sensor_check<dir_b>(g->ts, g->tm, collision, tiles, pos_b);
+}
 
-		int result = 0;
-		auto heights = get_tile_widths(game.ts, tile.index);
+// 
+// Checks "count" sensors on one layer and returns only the distances, for objects that are
+// updated together (see "update_dropped_rings"). The same steps as "sensor_check", without
+// the tile and without branches: the second cell is always loaded, it's the first one again
+// when there's no step. The probes don't depend on each other, so their loads can overlap.
+// 
+template <Direction dir>
+static void sensor_check_batch(Game* g, int layer, const float* x, const float* y, size_t count, int* dist) {
+	constexpr bool vertical = (dir == DIR_DOWN || dir == DIR_UP);
+	constexpr int  sign     = (dir == DIR_DOWN || dir == DIR_RIGHT) ? 1 : -1;
 
-		if (tile.hflip && tile.vflip) {
-			int h = heights[15 - iy % 16];
-			if (h <= 0x10) result = h;
-		} else if (!tile.hflip && tile.vflip) {
-			int h = heights[15 - iy % 16];
-			if (h >= 0xF0) result = 16 - (h - 0xF0);
-			else if (h == 16) result = 16;
-		} else if (tile.hflip && !tile.vflip) {
-			int h = heights[iy % 16];
-			if (h <= 0x10) result = h;
-		} else if (!tile.hflip && !tile.vflip) {
-			int h = heights[iy % 16];
-			if (h >= 0xF0) result = 16 - (h - 0xF0);
-			else if (h == 16) result = 16;
-		}
+	// only floors can be jumped through from below
+	constexpr u32 solid = (dir == DIR_DOWN) ? COLLISION_TOP_SOLID : COLLISION_LRB_SOLID;
 
-		return result;
-	};
+	const Collision_Layer& collision = get_collision_layer(g->tm, layer);
 
-	SensorResult result = {};
+	const u32* cells  = collision.cells.data;
+	int stride        = collision.stride;
+	const u8* heights = g->ts.sensor_heights.data + dir * 4 * 16;
 
-	int ix = max((int)pos.x, 0);
-	int iy = max((int)pos.y, 0);
+	int max_tile_x = g->tm.width  + COLLISION_BORDER - 2;
+	int max_tile_y = g->tm.height + COLLISION_BORDER - 2;
 
-	int tile_x = pos.x / 16;
-	int tile_y = pos.y / 16;
+	for (size_t i = 0; i < count; i++) {
+		int ix = max((int)x[i], 0);
+		int iy = max((int)y[i], 0);
 
-	Tile tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-	int height = get_height(tile, ix, iy);
+		int tile_x = clamp((int)(x[i] / 16), 1 - COLLISION_BORDER, max_tile_x);
+		int tile_y = clamp((int)(y[i] / 16), 1 - COLLISION_BORDER, max_tile_y);
 
-	if (height == 0) {
-		tile_x--;
-		tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-		height = get_height(tile, ix, iy);
+		int along  = vertical ? iy : ix;
+		int across = vertical ? ix : iy;
 
-		if (height != 0) {
-			result.tile = tile;
-			result.found = true;
-			result.tile_x = tile_x;
-			result.tile_y = tile_y;
-		}
+		u32 cell = cells[(tile_x + COLLISION_BORDER) + (tile_y + COLLISION_BORDER) * stride];
+		int height = (cell & solid) ? heights[(cell & COLLISION_HEIGHTS_MASK) + across % 16] : 0;
 
-		result.dist = 16 + (ix % 16) - (height);
-	} else if (height == 16) {
-		tile_x++;
-		tile = get_tile_safe(game.tm, tile_x, tile_y, layer);
-		height = get_height(tile, ix, iy);
+		int step = (height == 0) - (height == 16);
 
-		if (height != 0) {
-			result.tile = tile;
-			result.found = true;
-			result.tile_x = tile_x;
-			result.tile_y = tile_y;
-		}
+		tile_x += vertical ? 0 : step * sign;
+		tile_y += vertical ? step * sign : 0;
 
-		result.dist = -16 + (ix % 16) - (height);
-	} else {
-		result.tile = tile;
-		result.found = true;
-		result.tile_x = tile_x;
-		result.tile_y = tile_y;
+		cell = cells[(tile_x + COLLISION_BORDER) + (tile_y + COLLISION_BORDER) * stride];
+		height = (cell & solid) ? heights[(cell & COLLISION_HEIGHTS_MASK) + across % 16] : 0;
 
-		result.dist = (ix % 16) - (height);
+		int to_edge = (sign > 0) ? (15 - along % 16) : (along % 16);
+		dist[i] = to_edge + step * 16 - height;
 	}
-
-	return result;
 }
 
-static SensorResult ground_sensor_check(Player* p, vec2 pos) {
+// sensors A and B
+static void ground_sensors_check(Game* g, Player* p, vec2 sensor_a, vec2 sensor_b,
+								 SensorResult* res_a, SensorResult* res_b) {
 	switch (player_get_mode(p)) {
-		case MODE_FLOOR:
-			return sensor_check_down(pos, p->layer);
-		case MODE_RIGHT_WALL:
-			return sensor_check_right(pos, p->layer);
-		case MODE_CEILING:
-			return sensor_check_up(pos, p->layer);
-		case MODE_LEFT_WALL:
-			return sensor_check_left(pos, p->layer);
+		case MODE_FLOOR:      sensor_check_pair<DIR_DOWN,  DIR_DOWN> (g, sensor_a, sensor_b, p->layer, res_a, res_b); break;
+		case MODE_RIGHT_WALL: sensor_check_pair<DIR_RIGHT, DIR_RIGHT>(g, sensor_a, sensor_b, p->layer, res_a, res_b); break;
+		case MODE_CEILING:    sensor_check_pair<DIR_UP,    DIR_UP>   (g, sensor_a, sensor_b, p->layer, res_a, res_b); break;
+		case MODE_LEFT_WALL:  sensor_check_pair<DIR_LEFT,  DIR_LEFT> (g, sensor_a, sensor_b, p->layer, res_a, res_b); break;
 	}
-	return {};
 }
 
-static SensorResult ceiling_sensor_check(Player* p, vec2 pos) {
+// sensors C and D
+static void ceiling_sensors_check(Game* g, Player* p, vec2 sensor_c, vec2 sensor_d,
+								  SensorResult* res_c, SensorResult* res_d) {
 	switch (player_get_mode(p)) {
-		case MODE_FLOOR:
-			return sensor_check_up(pos, p->layer);
-		case MODE_RIGHT_WALL:
-			return sensor_check_left(pos, p->layer);
-		case MODE_CEILING:
-			return sensor_check_down(pos, p->layer);
-		case MODE_LEFT_WALL:
-			return sensor_check_right(pos, p->layer);
+		case MODE_FLOOR:      sensor_check_pair<DIR_UP,    DIR_UP>   (g, sensor_c, sensor_d, p->layer, res_c, res_d); break;
+		case MODE_RIGHT_WALL: sensor_check_pair<DIR_LEFT,  DIR_LEFT> (g, sensor_c, sensor_d, p->layer, res_c, res_d); break;
+		case MODE_CEILING:    sensor_check_pair<DIR_DOWN,  DIR_DOWN> (g, sensor_c, sensor_d, p->layer, res_c, res_d); break;
+		case MODE_LEFT_WALL:  sensor_check_pair<DIR_RIGHT, DIR_RIGHT>(g, sensor_c, sensor_d, p->layer, res_c, res_d); break;
 	}
-	return {};
 }
 
-static SensorResult push_sensor_e_check(Player* p, vec2 pos) {
+// E and F are never active at the same time, so they're checked one at a time
+static SensorResult push_sensor_e_check(Game* g, Player* p, vec2 pos) {
 	switch (player_get_mode(p)) {
-		case MODE_FLOOR:
-			return sensor_check_left(pos, p->layer);
-		case MODE_RIGHT_WALL:
-			return sensor_check_down(pos, p->layer);
-		case MODE_CEILING:
-			return sensor_check_right(pos, p->layer);
-		case MODE_LEFT_WALL:
-			return sensor_check_up(pos, p->layer);
+		case MODE_FLOOR:      return sensor_check<DIR_LEFT> (g, pos, p->layer);
+		case MODE_RIGHT_WALL: return sensor_check<DIR_DOWN> (g, pos, p->layer);
+		case MODE_CEILING:    return sensor_check<DIR_RIGHT>(g, pos, p->layer);
+		case MODE_LEFT_WALL:  return sensor_check<DIR_UP>   (g, pos, p->layer);
 	}
 	return {};
 }
 
-static SensorResult push_sensor_f_check(Player* p, vec2 pos) {
+static SensorResult push_sensor_f_check(Game* g, Player* p, vec2 pos) {
 	switch (player_get_mode(p)) {
-		case MODE_FLOOR:
-			return sensor_check_right(pos, p->layer);
-		case MODE_RIGHT_WALL:
-			return sensor_check_up(pos, p->layer);
-		case MODE_CEILING:
-			return sensor_check_left(pos, p->layer);
-		case MODE_LEFT_WALL:
-			return sensor_check_down(pos, p->layer);
+		case MODE_FLOOR:      return sensor_check<DIR_RIGHT>(g, pos, p->layer);
+		case MODE_RIGHT_WALL: return sensor_check<DIR_UP>   (g, pos, p->layer);
+		case MODE_CEILING:    return sensor_check<DIR_LEFT> (g, pos, p->layer);
+		case MODE_LEFT_WALL:  return sensor_check<DIR_DOWN> (g, pos, p->layer);
 	}
 	return {};
 }
@@ -942,7 +1417,7 @@ static bool player_roll_condition(Player* p) {
 			&& input_h == 0);
 }
 
-static void ground_sensor_collision(Player* p) {
+static void ground_sensor_collision(Game* g, Player* p) {
 	if (!are_ground_sensors_active(p)) {
 		return;
 	}
@@ -963,8 +1438,9 @@ static void ground_sensor_collision(Player* p) {
 		check_dist = fminf(fabsf(check_speed) + 4, 14);
 	}
 
-	SensorResult res_a = ground_sensor_check(p, sensor_a);
-	SensorResult res_b = ground_sensor_check(p, sensor_b);
+	SensorResult res_a;
+	SensorResult res_b;
+	ground_sensors_check(g, p, sensor_a, sensor_b, &res_a, &res_b);
 
 	bool sensor_a_found_tile = res_a.dist <= check_dist;
 	bool sensor_b_found_tile = res_b.dist <= check_dist;
@@ -976,7 +1452,7 @@ static void ground_sensor_collision(Player* p) {
 				vec2 extra_sensor = p->pos;
 				extra_sensor.y += player_get_radius(p).y;
 
-				SensorResult extra_res = sensor_check_down(extra_sensor, p->layer);
+				SensorResult extra_res = sensor_check<DIR_DOWN>(g, extra_sensor, p->layer);
 
 				bool extra_sensor_found_tile = extra_res.dist <= check_dist;
 
@@ -995,7 +1471,7 @@ static void ground_sensor_collision(Player* p) {
 	SensorResult res;
 	if (res_a.dist == res_b.dist) {
 		// if same distance, pick the sensor that stands on unangled tile
-		if (get_tile_angle(game.ts, res_a.tile.index) == -1) {
+		if (get_tile_angle(g->ts, res_a.tile.index) == -1) {
 			res = res_a;
 		} else {
 			res = res_b;
@@ -1009,7 +1485,7 @@ static void ground_sensor_collision(Player* p) {
 		return;
 	}
 
-	float angle = get_tile_angle(game.ts, res.tile.index);
+	float angle = get_tile_angle(g->ts, res.tile.index);
 
 	/*auto set_ground_angle = [&](float ground_angle) {
 		vec2 prev_a;
@@ -1165,7 +1641,7 @@ static void ground_sensor_collision(Player* p) {
 	}
 }
 
-static void ceiling_sensor_collision(Player* p) {
+static void ceiling_sensor_collision(Game* g, Player* p) {
 	if (!are_ceiling_sensors_active(p)) {
 		return;
 	}
@@ -1180,8 +1656,9 @@ static void ceiling_sensor_collision(Player* p) {
 	vec2 sensor_d;
 	get_ceiling_sensors_pos(p, &sensor_c, &sensor_d);
 
-	SensorResult res_c = ceiling_sensor_check(p, sensor_c);
-	SensorResult res_d = ceiling_sensor_check(p, sensor_d);
+	SensorResult res_c;
+	SensorResult res_d;
+	ceiling_sensors_check(g, p, sensor_c, sensor_d, &res_c, &res_d);
 
 	SensorResult res = (res_c.dist < res_d.dist) ? res_c : res_d;
 
@@ -1191,7 +1668,7 @@ static void ceiling_sensor_collision(Player* p) {
 
 	p->pos.y -= res.dist;
 
-	float angle = get_tile_angle(game.ts, res.tile.index);
+	float angle = get_tile_angle(g->ts, res.tile.index);
 
 	// Landing on ceilings.
 	bool landed_on_ceiling = false;
@@ -1217,13 +1694,13 @@ static void ceiling_sensor_collision(Player* p) {
 	}
 }
 
-static void push_sensor_collision(Player* p) {
+static void push_sensor_collision(Game* g, Player* p) {
 	vec2 sensor_e;
 	vec2 sensor_f;
 	get_push_sensors_pos(p, &sensor_e, &sensor_f);
 
 	if (is_push_sensor_f_active(p)) {
-		SensorResult res = push_sensor_f_check(p, sensor_f);
+		SensorResult res = push_sensor_f_check(g, p, sensor_f);
 		if (res.dist <= 0) {
 			switch (player_get_push_mode(p)) {
 				case MODE_FLOOR:      p->pos.x += res.dist; break;
@@ -1243,7 +1720,7 @@ static void push_sensor_collision(Player* p) {
 	}
 
 	if (is_push_sensor_e_active(p)) {
-		SensorResult res = push_sensor_e_check(p, sensor_e);
+		SensorResult res = push_sensor_e_check(g, p, sensor_e);
 		if (res.dist <= 0) {
 			switch (player_get_push_mode(p)) {
 				case MODE_FLOOR:      p->pos.x -= res.dist; break;
@@ -1293,7 +1770,7 @@ static bool player_try_slip(Player* p) {
 	return false;
 }
 
-static bool player_try_jump(Player* p) {
+static bool player_try_jump(Game* g, Player* p) {
 	constexpr float PLAYER_JUMP_FORCE = 6.5f;
 
 	// if (p->control_lock > 0) return false;
@@ -1304,8 +1781,9 @@ static bool player_try_jump(Player* p) {
 		vec2 sensor_d;
 		get_ceiling_sensors_pos(p, &sensor_c, &sensor_d);
 
-		SensorResult res_c = ceiling_sensor_check(p, sensor_c);
-		SensorResult res_d = ceiling_sensor_check(p, sensor_d);
+		SensorResult res_c;
+		SensorResult res_d;
+		ceiling_sensors_check(g, p, sensor_c, sensor_d, &res_c, &res_d);
 
 		SensorResult res = (res_c.dist < res_d.dist) ? res_c : res_d;
 
@@ -1327,28 +1805,27 @@ static bool player_try_jump(Player* p) {
 	return true;
 }
 
-static Object* player_find_camera_region(Player* p) {
-	// TODO: optimize?
-	// if all OBJ_CAMERA_REGION objects are at the beginning of the array then it's probably fine
+static Object* player_find_camera_region(Game* g, Player* p) {
 	Object* region = nullptr;
-	For (it, game.objects) {
-		if (it->type == OBJ_CAMERA_REGION) {
-			float l = it->pos.x - it->radius.x;
-			float r = it->pos.x + it->radius.x;
-			float t = it->pos.y - it->radius.y;
-			float b = it->pos.y + it->radius.y;
-
-			if (l <= p->pos.x && p->pos.x < r && t <= p->pos.y && p->pos.y < b) {
-				region = it;
-				break;
-			}
+	For (handle, get_level_objects_of_type(g, OBJ_CAMERA_REGION)) {
+		Object* it = g->get_object(*handle);
+		if (!it) continue;
+
+		float l = it->pos.x - it->radius.x;
+		float r = it->pos.x + it->radius.x;
+		float t = it->pos.y - it->radius.y;
+		float b = it->pos.y + it->radius.y;
+
+		if (l <= p->pos.x && p->pos.x < r && t <= p->pos.y && p->pos.y < b) {
+			region = it;
+			break;
 		}
 	}
 
 	return region;
 }
 
-static void player_keep_in_bounds(Player* p) {
+static void player_keep_in_bounds(Game* g, Player* p) {
 	// Handle camera boundaries (keep the Player inside the view and kill them if they touch the kill plane).
 	vec2 radius = player_get_radius(p);
 
@@ -1381,13 +1858,13 @@ static void player_keep_in_bounds(Player* p) {
 	};
 
 	Rectf rect;
-	rect.x = game.camera_sign_post_left;
+	rect.x = g->camera_sign_post_left;
 	rect.y = 0;
-	rect.w = game.tm.width  * 16 - rect.x;
-	rect.h = game.tm.height * 16 - rect.y;
+	rect.w = g->tm.width  * 16 - rect.x;
+	rect.h = g->tm.height * 16 - rect.y;
 	keep_in_rect(rect);
 
-	Object* region = player_find_camera_region(p);
+	Object* region = player_find_camera_region(g, p);
 	if (region) {
 		Rectf rect;
 		rect.x = region->pos.x - region->radius.x;
@@ -1399,6 +1876,37 @@ static void player_keep_in_bounds(Player* p) {
 	}
 }
 
+bool player_is_in_solid(Game* g, Player* p) {
+	// How far into a tile the center can be before we call it tunneling.
+	const int tolerance = 2;
+
+	// The center has to be inside a tile from above and from below, so that we don't
+	// count jumping up through a top-solid platform.
+	SensorResult down = sensor_check<DIR_DOWN>(g, p->pos, p->layer);
+	SensorResult up   = sensor_check<DIR_UP>  (g, p->pos, p->layer);
+
+	return (down.dist < -tolerance && up.dist < -tolerance);
+}
+
+bool player_is_out_of_bounds(Game* g, Player* p) {
+	// Same bounds as "player_keep_in_bounds", with the smallest radius, so that
+	// a radius change after the check doesn't count.
+	vec2 radius = {7, 14};
+	const float tolerance = 1;
+
+	float left   = g->camera_sign_post_left + radius.x + 3;
+	float right  = g->tm.width  * 16 - radius.x - 4;
+	float bottom = g->tm.height * 16 - radius.y - 4;
+
+	return (p->pos.x < left   - tolerance
+			|| p->pos.x > right  + tolerance
+			|| p->pos.y > bottom + tolerance);
+}
+
+PlayerMode player_get_current_mode(Player* p) {
+	return player_get_mode(p);
+}
+
 static Direction opposite_dir(Direction dir) {
 	/*switch (dir) {
 		case DIR_RIGHT: return DIR_LEFT;
@@ -1427,7 +1935,7 @@ static u32 get_spring_sprite_animating(const Object& o) {
 	return ((o.type == OBJ_SPRING_DIAGONAL) ? spr_spring_diagonal_bounce_yellow : spr_spring_bounce_yellow) + o.spring.color;
 }
 
-static void player_drop_rings(Player* p, int amount) {
+static void player_drop_rings(Game* g, Player* p, int amount) {
 	amount = min(amount, 32);
 
 	float offset = 0;
@@ -1445,13 +1953,13 @@ static void player_drop_rings(Player* p, int amount) {
 		}
 
 		Object ring_dropped = {};
-		ring_dropped.id = game.next_id++;
+		ring_dropped.id = g->next_id++;
 		ring_dropped.type = OBJ_RING_DROPPED;
 		ring_dropped.pos = p->pos;
 		ring_dropped.ring_dropped.speed = lengthdir_v2(speed, direction);
 		ring_dropped.ring_dropped.anim_spd = 0.5f;
 
-		array_add(&game.objects, ring_dropped);
+		add_object(g, ring_dropped);
 
 		amount--;
 	}
@@ -1469,8 +1977,8 @@ static void player_die(Player* p) {
 	play_sound(get_sound(snd_die));
 }
 
-static void player_get_hit(Player* p, int side) {
-	if (game.player_rings != 0 || p->has_shield) {
+static void player_get_hit(Game* g, Player* p, int side) {
+	if (g->player_rings != 0 || p->has_shield) {
 		p->state = STATE_AIR;
 		p->speed.x = side * 2;
 		p->speed.y = -4;
@@ -1482,8 +1990,8 @@ static void player_get_hit(Player* p, int side) {
 		if (p->has_shield) {
 			p->has_shield = false;
 		} else {
-			player_drop_rings(p, game.player_rings);
-			game.player_rings = 0;
+			player_drop_rings(g, p, g->player_rings);
+			g->player_rings = 0;
 
 			play_sound(get_sound(snd_lose_rings));
 		}
@@ -1504,16 +2012,16 @@ static bool player_can_get_hit(Player* p) {
 			&& p->anim != anim_hurt);
 }
 
-static void player_get_life() {
-	program.player_lives++;
+static void player_get_life(Game* g) {
+	g->player_lives++;
 	play_sound(get_sound(snd_life));
 }
 
-static void player_get_rings(int rings) {
+static void player_get_rings(Game* g, int rings) {
 	while (rings > 0) {
-		game.player_rings++;
-		if (game.player_rings % 100 == 0) {
-			player_get_life();
+		g->player_rings++;
+		if (g->player_rings % 100 == 0) {
+			player_get_life(g);
 		}
 
 		rings--;
@@ -1521,7 +2029,7 @@ static void player_get_rings(int rings) {
 	play_sound(get_sound(snd_ring));
 }
 
-static bool player_reaction_monitor(Player* p, Object* obj, Direction dir) {
+static bool player_reaction_monitor(Game* g, Player* p, Object* obj, Direction dir) {
 	if (p->anim != anim_roll) {
 		return false;
 	}
@@ -1543,21 +2051,21 @@ static bool player_reaction_monitor(Player* p, Object* obj, Direction dir) {
 
 	{
 		Object icon = {};
-		icon.id = game.next_id++;
+		icon.id = g->next_id++;
 		icon.type = OBJ_MONITOR_ICON;
 		icon.pos = obj->pos;
 		icon.monitor.icon = obj->monitor.icon;
 
-		array_add(&game.objects, icon);
+		add_object(g, icon);
 	}
 
 	{
 		Object broken_monitor = {};
-		broken_monitor.id = game.next_id++;
+		broken_monitor.id = g->next_id++;
 		broken_monitor.type = OBJ_MONITOR_BROKEN;
 		broken_monitor.pos = obj->pos;
 
-		array_add(&game.objects, broken_monitor);
+		add_object(g, broken_monitor);
 	}
 
 	{
@@ -1566,7 +2074,7 @@ static bool player_reaction_monitor(Player* p, Object* obj, Direction dir) {
 		p.sprite_index = spr_explosion;
 		p.lifespan = 30;
 
-		add_particle(p);
+		add_particle(&g->particles, p);
 	}
 
 	play_sound(get_sound(snd_destroy_monitor));
@@ -1574,7 +2082,7 @@ static bool player_reaction_monitor(Player* p, Object* obj, Direction dir) {
 	return true;
 }
 
-static bool player_reaction_spring(Player* p, Object* obj, Direction dir) {
+static bool player_reaction_spring(Game* g, Player* p, Object* obj, Direction dir) {
 	if (obj->spring.direction != opposite_dir(dir)) {
 		return false;
 	}
@@ -1609,7 +2117,7 @@ static bool player_reaction_spring(Player* p, Object* obj, Direction dir) {
 	return true;
 }
 
-static bool player_reaction_spring_diagonal(Player* p, Object* obj, Direction dir) {
+static bool player_reaction_spring_diagonal(Game* g, Player* p, Object* obj, Direction dir) {
 	float force = get_spring_force(*obj);
 
 	float spring_direction = obj->spring.direction * 90 - 45;
@@ -1630,7 +2138,7 @@ static bool player_reaction_spring_diagonal(Player* p, Object* obj, Direction di
 	return true;
 }
 
-static bool player_reaction_spike(Player* p, Object* obj, Direction dir) {
+static bool player_reaction_spike(Game* g, Player* p, Object* obj, Direction dir) {
 	if (obj->spike.direction != opposite_dir(dir)) {
 		return false;
 	}
@@ -1641,59 +2149,42 @@ static bool player_reaction_spike(Player* p, Object* obj, Direction dir) {
 
 	int side = sign_int(p->pos.x - obj->pos.x);
 	if (side == 0) side = 1;
-	player_get_hit(p, side);
+	player_get_hit(g, p, side);
 
 	return true;
 }
 
-static void player_collide_with_solid_objects(Player* p) {
+// Objects that the player could touch this frame. Lasts until the next query.
+static Rectf get_player_query_rect(Player* p) {
+	// objects in the grid are at most a cell big, and colliding can push the player a bit
+	float margin = OBJECT_GRID_CELL_SIZE / 2 + 16;
+
+	Rectf rect = player_get_rect(p);
+	rect.x -= margin;
+	rect.y -= margin;
+	rect.w += margin * 2;
+	rect.h += margin * 2;
+	return rect;
+}
+
+static array<Object_Handle> query_objects_near_player(Game* g, Player* p) {
+	return object_grid_query(&g->object_grid, get_player_query_rect(p));
+}
+
+static void player_collide_with_solid_objects(Game* g, Player* p) {
 	vec2 player_radius = player_get_radius(p);
 	
 	// reset the flag
 	p->landed_on_solid_object = false;
 
 	auto player_land_on_solid_object = [&](Player* p, Object* obj) -> bool {
-		switch (obj->type) {
-			case OBJ_MONITOR: {
-				return player_reaction_monitor(p, obj, DIR_DOWN);
-			}
-
-			case OBJ_SPRING: {
-				return player_reaction_spring(p, obj, DIR_DOWN);
-			}
-
-			case OBJ_SPIKE: {
-				return player_reaction_spike(p, obj, DIR_DOWN);
-			}
-
-			case OBJ_SPRING_DIAGONAL: {
-				return player_reaction_spring_diagonal(p, obj, DIR_DOWN);
-			}
-		}
-
-		return false;
+		auto react = get_object_type_info(obj->type).react;
+		return react ? react(g, p, obj, DIR_DOWN) : false;
 	};
 
-	auto player_collide_solid_object_side = [&](Player* p, Object* obj, Direction dir) {
-		switch (obj->type) {
-			case OBJ_MONITOR: {
-				return player_reaction_monitor(p, obj, dir);
-			}
-
-			case OBJ_SPRING: {
-				return player_reaction_spring(p, obj, dir);
-			}
-
-			case OBJ_SPIKE: {
-				return player_reaction_spike(p, obj, dir);
-			}
-
-			case OBJ_SPRING_DIAGONAL: {
-				return player_reaction_spring_diagonal(p, obj, dir);
-			}
-		}
-
-		return false;
+	auto player_collide_solid_object_side = [&](Player* p, Object* obj, Direction dir) -> bool {
+		auto react = get_object_type_info(obj->type).react;
+		return react ? react(g, p, obj, dir) : false;
 	};
 
 	auto handle_solid_object = [&](Object* it) {
@@ -1875,24 +2366,25 @@ static void player_collide_with_solid_objects(Player* p) {
 		p->landed_on_solid_object = true;
 	};
 
-	// because we add objects while iterating
-	int object_count = game.objects.count;
+	// objects added while iterating aren't in the list
+	array<Object_Handle> nearby = query_objects_near_player(g, p);
+
+	For (handle, nearby) {
+		Object* it = g->get_object(*handle);
+		if (!it) continue;
+
+		// removed at the end of the update
+		if (it->flags & FLAG_INSTANCE_DEAD) continue;
+
+		if (object_is_sleeping(g, *it)) continue;
 
-	for (int i = 0; i < object_count; i++) {
-		Object* it = &game.objects[i];
+		u32 flags = get_object_type_info(it->type).flags;
 
-		if (object_is_solid(it->type)) {
+		if (flags & OBJECT_TYPE_SOLID) {
 			handle_solid_object(it);
-		} else if (it->type == OBJ_MOVING_PLATFORM) {
+		} else if (flags & OBJECT_TYPE_PLATFORM) {
 			handle_moving_platform(it);
 		}
-
-		if (it->flags & FLAG_INSTANCE_DEAD) {
-			array_remove(&game.objects, i);
-			i--;
-			object_count--;
-			continue;
-		}
 	}
 }
 
@@ -1906,147 +2398,236 @@ static bool player_collides_with_nonsolid_object(Player* p, const Object& o) {
 	return rect_vs_rect(r1, r2);
 }
 
-static void player_collide_with_nonsolid_objects(Player* p) {
-	p->force_spin = false;
-
-	// because we add objects while iterating
-	int object_count = game.objects.count;
+static void player_touch_layer_switcher_vertical(Game* g, Player* p, Object* obj) {
+	bool skip = false;
 
-	for (int i = 0; i < object_count; i++) {
-		Object* it = &game.objects[i];
-
-		if (it->type == OBJ_LAYER_SWITCHER_VERTICAL) {
-			bool skip = false;
+	if (obj->flags & FLAG_LAYER_SWITCHER_GROUND_ONLY) {
+		if (!player_is_grounded(p)) {
+			skip = true;
+		}
+	}
 
-			if (it->flags & FLAG_LAYER_SWITCHER_GROUND_ONLY) {
-				if (!player_is_grounded(p)) {
-					skip = true;
+	if (!skip) {
+		if (p->pos.y > obj->pos.y - obj->radius.y && p->pos.y < obj->pos.y + obj->radius.y) {
+			if (obj->layswitch.current_side == 0) {
+				if (p->pos.x >= obj->pos.x) {
+					p->layer = obj->layswitch.layer_2;
+					p->priority = obj->layswitch.priority_2;
 				}
-			}
-
-			if (!skip) {
-				if (p->pos.y > it->pos.y - it->radius.y && p->pos.y < it->pos.y + it->radius.y) {
-					if (it->layswitch.current_side == 0) {
-						if (p->pos.x >= it->pos.x) {
-							p->layer = it->layswitch.layer_2;
-							p->priority = it->layswitch.priority_2;
-						}
-					} else { // current_side == 1
-						if (p->pos.x < it->pos.x) {
-							p->layer = it->layswitch.layer_1;
-							p->priority = it->layswitch.priority_1;
-						}
-					}
+			} else { // current_side == 1
+				if (p->pos.x < obj->pos.x) {
+					p->layer = obj->layswitch.layer_1;
+					p->priority = obj->layswitch.priority_1;
 				}
 			}
+		}
+	}
 
-			if (p->pos.x >= it->pos.x) {
-				it->layswitch.current_side = 1;
-			} else {
-				it->layswitch.current_side = 0;
+	if (p->pos.x >= obj->pos.x) {
+		obj->layswitch.current_side = 1;
+	} else {
+		obj->layswitch.current_side = 0;
+	}
+}
+
+static void player_touch_ring(Game* g, Player* p, Object* obj) {
+	if (p->ignore_rings > 0) return;
+
+	player_get_rings(g, 1);
+
+	Particle particle = {};
+	particle.pos = obj->pos;
+	particle.sprite_index = spr_ring_disappear;
+
+	const Sprite& s = get_sprite(particle.sprite_index);
+	particle.lifespan = (1.0f / s.anim_spd) * s.frames.count;
+
+	add_particle(&g->particles, particle);
+
+	obj->flags |= FLAG_INSTANCE_DEAD;
+}
+
+static void player_touch_mosqui(Game* g, Player* p, Object* obj) {
+	if (player_can_attack(p)) {
+		// kill enemy
+		obj->flags |= FLAG_INSTANCE_DEAD;
+
+		// bounce
+		if (player_is_moving_mostly_down(p)) {
+			float bounce_speed = 0;
+			if (p->input & INPUT_JUMP) {
+				bounce_speed = fabsf(p->speed.y);
 			}
-			continue;
+			if (bounce_speed < 4) bounce_speed = 4;
+
+			p->state   = STATE_AIR;
+			p->speed.y = -bounce_speed;
 		}
 
-		if (it->type == OBJ_LAYER_SWITCHER_HORIZONTAL) {
-			// TODO
-			continue;
+		Particle p = {};
+		p.pos = obj->pos;
+		p.sprite_index = spr_explosion;
+		p.lifespan = 30;
+		add_particle(&g->particles, p);
+
+		play_sound(get_sound(snd_destroy_monitor));
+
+		Object flower = {};
+		flower.id = g->next_id++;
+		flower.type = OBJ_FLOWER;
+		flower.pos = obj->pos;
+		flower.flower.timer = 30;
+		add_object(g, flower);
+
+		g->player_score += 100;
+
+		Particle score_popup = {};
+		score_popup.pos = obj->pos;
+		score_popup.sprite_index = spr_score_popup;
+		score_popup.frame_index = 1;
+		score_popup.lifespan = 32;
+		score_popup.spd = 1; // TODO: original game had different movement
+		score_popup.dir = 90;
+		add_particle(&g->particles, score_popup);
+	} else {
+		if (player_can_get_hit(p)) {
+			int side = sign_int(p->pos.x - obj->pos.x);
+			if (side == 0) side = 1;
+			player_get_hit(g, p, side);
 		}
+	}
+}
 
-		if (!object_is_nonsolid(it->type)) continue;
+static void player_touch_force_spin(Game* g, Player* p, Object* obj) {
+	p->force_spin = true;
+	p->ground_speed = max(p->ground_speed, 4.0f);
+}
 
-		if (!player_collides_with_nonsolid_object(p, *it)) continue;
+static vec2 get_ring_size() {
+	Object ring = {};
+	ring.type = OBJ_RING;
+	return get_object_size(ring);
+}
 
-		switch (it->type) {
-			case OBJ_RING:
-			case OBJ_RING_DROPPED: {
-				if (p->ignore_rings > 0) break;
+// 
+// The same test as "player_collides_with_nonsolid_object", for "count" rings at once.
+// 
+static void test_rings_against_rect(const float* x, const float* y, u8* hit, size_t count,
+									Rectf rect, vec2 ring_size) {
+	vec2 half = ring_size / 2.0f;
 
-				player_get_rings(1);
+	float right  = rect.x + rect.w;
+	float bottom = rect.y + rect.h;
 
-				Particle p = {};
-				p.pos = it->pos;
-				p.sprite_index = spr_ring_disappear;
+	// no branches, so that the compiler can vectorize it
+	for (size_t i = 0; i < count; i++) {
+		float left = x[i] - half.x;
+		float top  = y[i] - half.y;
 
-				const Sprite& s = get_sprite(p.sprite_index);
-				p.lifespan = (1.0f / s.anim_spd) * s.frames.count;
+		hit[i] = (right  >  left)
+			& (rect.x <= left + ring_size.x)
+			& (bottom >  top)
+			& (rect.y <= top + ring_size.y);
+	}
+}
 
-				add_particle(p);
+// Tests the rings in the grid cells that "area" touches against "rect". Returns the ones
+// that touch it with an id from "min_id" to "max_id", sorted by id like a grid query.
+static array<Object_Handle> find_rings_touching_rect(Game* g, Rectf area, Rectf rect,
+													 instance_id min_id, instance_id max_id) {
+	Object_Grid* grid = &g->object_grid;
+	Ring_Batch* batch = g->ring_batch;
 
-				it->flags |= FLAG_INSTANCE_DEAD;
-				break;
-			}
+	batch->hits.count = 0;
 
-			case OBJ_MOSQUI: {
-				if (player_can_attack(p)) {
-					// kill enemy
-					it->flags |= FLAG_INSTANCE_DEAD;
-
-					// bounce
-					if (player_is_moving_mostly_down(p)) {
-						float bounce_speed = 0;
-						if (p->input & INPUT_JUMP) {
-							bounce_speed = fabsf(p->speed.y);
-						}
-						if (bounce_speed < 4) bounce_speed = 4;
+	vec2 ring_size = get_ring_size();
 
-						p->state   = STATE_AIR;
-						p->speed.y = -bounce_speed;
-					}
+	// the same cells as "object_grid_query"
+	int x1 = clamp((int) floorf(area.x / OBJECT_GRID_CELL_SIZE),            0, grid->width  - 1);
+	int y1 = clamp((int) floorf(area.y / OBJECT_GRID_CELL_SIZE),            0, grid->height - 1);
+	int x2 = clamp((int) floorf((area.x + area.w) / OBJECT_GRID_CELL_SIZE), 0, grid->width  - 1);
+	int y2 = clamp((int) floorf((area.y + area.h) / OBJECT_GRID_CELL_SIZE), 0, grid->height - 1);
 
-					Particle p = {};
-					p.pos = it->pos;
-					p.sprite_index = spr_explosion;
-					p.lifespan = 30;
-					add_particle(p);
-
-					play_sound(get_sound(snd_destroy_monitor));
-
-					Object flower = {};
-					flower.id = game.next_id++;
-					flower.type = OBJ_FLOWER;
-					flower.pos = it->pos;
-					flower.flower.timer = 30;
-					array_add(&game.objects, flower);
-
-					program.player_score += 100;
-
-					Particle score_popup = {};
-					score_popup.pos = it->pos;
-					score_popup.sprite_index = spr_score_popup;
-					score_popup.frame_index = 1;
-					score_popup.lifespan = 32;
-					score_popup.spd = 1; // TODO: original game had different movement
-					score_popup.dir = 90;
-					add_particle(score_popup);
-				} else {
-					if (player_can_get_hit(p)) {
-						int side = sign_int(p->pos.x - it->pos.x);
-						if (side == 0) side = 1;
-						player_get_hit(p, side);
-					}
-				}
-				break;
-			}
+	for (int y = y1; y <= y2; y++) {
+		for (int x = x1; x <= x2; x++) {
+			const Ring_Cell& cell = grid->ring_cells[x + y * grid->width];
+			if (cell.handles.count == 0) continue;
 
-			case OBJ_FORCE_SPIN: {
-				p->force_spin = true;
-				p->ground_speed = max(p->ground_speed, 4.0f);
-				break;
+			array_resize(&batch->hit, cell.handles.count);
+
+			test_rings_against_rect(cell.x.data, cell.y.data, batch->hit.data, cell.handles.count, rect, ring_size);
+
+			for (size_t i = 0; i < cell.handles.count; i++) {
+				if (!batch->hit[i]) continue;
+
+				Object_Handle handle = cell.handles[i];
+				if (handle.id < min_id || handle.id > max_id) continue;
+
+				array_add(&batch->hits, handle);
 			}
 		}
+	}
+
+	qsort(batch->hits.data, batch->hits.count, sizeof(batch->hits[0]), compare_handles_by_id);
+
+	return array<Object_Handle>(batch->hits.data, batch->hits.count);
+}
+
+static void player_collide_with_nonsolid_objects(Game* g, Player* p) {
+	p->force_spin = false;
+
+	Rectf area = get_player_query_rect(p);
+
+	// objects added while iterating aren't in the list
+	array<Object_Handle> nearby = object_grid_query(&g->object_grid, area);
+	instance_id max_id = g->next_id - 1;
+
+	// The rings that touch the player, in the same order as the other objects. They're
+	// found again if touching something changes the player's rect, like bouncing off an
+	// enemy changes the player's mode or radius.
+	Rectf ring_rect = player_get_rect(p);
+	array<Object_Handle> rings = find_rings_touching_rect(g, area, ring_rect, 0, max_id);
+
+	size_t next_object = 0;
+	size_t next_ring = 0;
+
+	while (next_object < nearby.count || next_ring < rings.count) {
+		bool ring = (next_ring < rings.count
+					 && (next_object == nearby.count || rings[next_ring].id < nearby[next_object].id));
+
+		Object_Handle handle = ring ? rings[next_ring++] : nearby[next_object++];
+
+		Object* it = g->get_object(handle);
+		if (!it) continue;
+
+		// removed at the end of the update
+		if (it->flags & FLAG_INSTANCE_DEAD) continue;
+
+		const Object_Type_Info& info = get_object_type_info(it->type);
+		if (!info.touch) continue;
+
+		if (info.flags & OBJECT_TYPE_WATCHES_PLAYER) {
+			info.touch(g, p, it);
+		} else {
+			if (object_is_sleeping(g, *it)) continue;
+
+			if (!ring && !player_collides_with_nonsolid_object(p, *it)) continue;
+
+			info.touch(g, p, it);
+		}
 
-		if (it->flags & FLAG_INSTANCE_DEAD) {
-			array_remove(&game.objects, i);
-			object_count--;
-			continue;
+		Rectf rect = player_get_rect(p);
+		if (rect.x != ring_rect.x || rect.y != ring_rect.y || rect.w != ring_rect.w || rect.h != ring_rect.h) {
+			ring_rect = rect;
+			rings = find_rings_touching_rect(g, area, ring_rect, handle.id + 1, max_id);
+			next_ring = 0;
 		}
 	}
 }
 
 constexpr int NUM_PHYSICS_STEPS = 16;
 
-static void player_state_ground(Player* p, float delta) {
+static void player_state_ground(Game* g, Player* p, float delta) {
 	int input_h = 0;
 	if (p->control_lock == 0) {
 		if (p->input & INPUT_MOVE_RIGHT) input_h++;
@@ -2101,10 +2682,10 @@ static void player_state_ground(Player* p, float delta) {
 		p->pos += p->speed * delta;
 
 		// Push Sensor collision occurs.
-		push_sensor_collision(p);
+		push_sensor_collision(g, p);
 
 		// Grounded Ground Sensor collision occurs.
-		ground_sensor_collision(p);
+		ground_sensor_collision(g, p);
 	};
 
 	for (int i = 0; i < NUM_PHYSICS_STEPS; i++) {
@@ -2127,22 +2708,22 @@ static void player_state_ground(Player* p, float delta) {
 			p->pos += speed * delta;
 
 			// Push Sensor collision occurs.
-			push_sensor_collision(p);
+			push_sensor_collision(g, p);
 
 			// Grounded Ground Sensor collision occurs.
-			ground_sensor_collision(p);
+			ground_sensor_collision(g, p);
 
 			ground_speed -= step;
 		}
 	}*/
 
 	// collide with objects
-	player_collide_with_solid_objects(p);
+	player_collide_with_solid_objects(g, p);
 
-	player_collide_with_nonsolid_objects(p);
+	player_collide_with_nonsolid_objects(g, p);
 
 	// Handle camera boundaries (keep the Player inside the view and kill them if they touch the kill plane).
-	player_keep_in_bounds(p);
+	player_keep_in_bounds(g, p);
 
 	// @Cleanup???
 	if (p->state != STATE_GROUND) {
@@ -2236,7 +2817,7 @@ static void player_state_ground(Player* p, float delta) {
 		} else if (p->peelout) {
 			// do nothing
 		} else {
-			if (player_try_jump(p)) {
+			if (player_try_jump(g, p)) {
 				return;
 			}
 		}
@@ -2250,7 +2831,7 @@ static void player_state_ground(Player* p, float delta) {
 			p->ground_speed = (8 + floorf(p->spinrev) / 2) * p->facing;
 			p->next_anim = anim_roll;
 			p->frame_duration = fmaxf(0, 4 - fabsf(p->ground_speed));
-			game.camera_lock = 24 - floorf(fabsf(p->ground_speed));
+			g->camera_lock = 24 - floorf(fabsf(p->ground_speed));
 
 			stop_sound(get_sound(snd_spindash));
 			play_sound(get_sound(snd_spindash_end));
@@ -2280,7 +2861,7 @@ static void player_state_ground(Player* p, float delta) {
 			if (p->spinrev >= 15) {
 				p->state = STATE_GROUND;
 				p->ground_speed = speed;
-				game.camera_lock = 24 - floorf(fabsf(p->ground_speed));
+				g->camera_lock = 24 - floorf(fabsf(p->ground_speed));
 
 				play_sound(get_sound(snd_spindash_end));
 				return;
@@ -2297,7 +2878,7 @@ static void player_state_ground(Player* p, float delta) {
 	}
 
 	if (p->anim == anim_skid) {
-		static float t = 0;
+		float& t = p->skid_dust_timer;
 		while (t >= 4) {
 			Particle dust_particle = {};
 			dust_particle.sprite_index = spr_skid_dust;
@@ -2307,7 +2888,7 @@ static void player_state_ground(Player* p, float delta) {
 			dust_particle.pos.y += player_get_radius(p).y;
 			dust_particle.pos.y -= 4;
 
-			add_particle(dust_particle);
+			add_particle(&g->particles, dust_particle);
 
 			t -= 4;
 		}
@@ -2318,20 +2899,20 @@ static void player_state_ground(Player* p, float delta) {
 		p->look_timer += delta;
 
 		if (p->look_timer > 120) {
-			Approach(&game.camera_look_offset, -110.0f, 2.0f * delta);
+			Approach(&g->camera_look_offset, -110.0f, 2.0f * delta);
 		}
 	} else if (p->anim == anim_crouch) {
 		p->look_timer += delta;
 
 		if (p->look_timer > 120) {
-			Approach(&game.camera_look_offset, 110.0f, 2.0f * delta);
+			Approach(&g->camera_look_offset, 110.0f, 2.0f * delta);
 		}
 	} else {
 		p->look_timer = 0;
 	}
 }
 
-static void player_state_roll(Player* p, float delta) {
+static void player_state_roll(Game* g, Player* p, float delta) {
 	int input_h = 0;
 	if (p->control_lock == 0) {
 		if (p->input & INPUT_MOVE_RIGHT) input_h++;
@@ -2358,10 +2939,10 @@ static void player_state_roll(Player* p, float delta) {
 		p->pos += p->speed * delta;
 
 		// Push Sensor collision occurs.
-		push_sensor_collision(p);
+		push_sensor_collision(g, p);
 
 		// Grounded Ground Sensor collision occurs.
-		ground_sensor_collision(p);
+		ground_sensor_collision(g, p);
 	};
 
 	for (int i = 0; i < NUM_PHYSICS_STEPS; i++) {
@@ -2369,12 +2950,12 @@ static void player_state_roll(Player* p, float delta) {
 	}
 
 	// collide with objects
-	player_collide_with_solid_objects(p);
+	player_collide_with_solid_objects(g, p);
 
-	player_collide_with_nonsolid_objects(p);
+	player_collide_with_nonsolid_objects(g, p);
 
 	// Handle camera boundaries (keep the Player inside the view and kill them if they touch the kill plane).
-	player_keep_in_bounds(p);
+	player_keep_in_bounds(g, p);
 
 	p->next_anim = anim_roll;
 	p->frame_duration = fmaxf(0, 4 - fabsf(p->ground_speed));
@@ -2392,7 +2973,7 @@ static void player_state_roll(Player* p, float delta) {
 
 	// Check for starting a jump.
 	if (p->input_press & INPUT_JUMP) {
-		if (player_try_jump(p)) {
+		if (player_try_jump(g, p)) {
 			return;
 		}
 	}
@@ -2400,7 +2981,7 @@ static void player_state_roll(Player* p, float delta) {
 
 constexpr float PLAYER_GRAVITY = 0.21875f;
 
-static void player_state_air(Player* p, float delta) {
+static void player_state_air(Game* g, Player* p, float delta) {
 	int input_h = 0;
 	// control_lock is ignored
 	if (p->input & INPUT_MOVE_RIGHT) input_h++;
@@ -2442,11 +3023,11 @@ static void player_state_air(Player* p, float delta) {
 		p->pos += p->speed * delta;
 
 		// All air collision checks occur here.
-		push_sensor_collision(p);
+		push_sensor_collision(g, p);
 
-		ground_sensor_collision(p);
+		ground_sensor_collision(g, p);
 
-		ceiling_sensor_collision(p);
+		ceiling_sensor_collision(g, p);
 	};
 
 	for (int i = 0; i < NUM_PHYSICS_STEPS; i++) {
@@ -2454,12 +3035,12 @@ static void player_state_air(Player* p, float delta) {
 	}
 
 	// collide with objects
-	player_collide_with_solid_objects(p);
+	player_collide_with_solid_objects(g, p);
 
-	player_collide_with_nonsolid_objects(p);
+	player_collide_with_nonsolid_objects(g, p);
 
 	// Handle camera boundaries (keep the Player inside the view and kill them if they touch the kill plane).
-	player_keep_in_bounds(p);
+	player_keep_in_bounds(g, p);
 
 	// Rotate Ground Angle back to 0.
 	p->ground_angle -= clamp(angle_difference(p->ground_angle, 0.0f), -2.8125f * delta, 2.8125f * delta);
@@ -2506,7 +3087,14 @@ static void get_mobile_controls(vec2* dpad_pos,
 	*debug_rect = {16, 8, 95, 43};
 }
 
-static void player_update_input_state(Player* p) {
+static void player_update_input_state(Game* g, Player* p) {
+	if (g->batch_instance) {
+		p->input = g->batch_input;
+		p->input_press = g->batch_input_press;
+		p->input_release = g->batch_input_release;
+		return;
+	}
+
 	p->input = 0;
 	p->input_press = 0;
 	p->input_release = 0;
@@ -2534,23 +3122,39 @@ static void player_update_input_state(Player* p) {
 	}
 
 #if defined(__ANDROID__) || defined(PRETEND_MOBILE)
-	p->input |= game.mobile_input_state;
-	p->input_press |= game.mobile_input_state_press;
-	p->input_release |= game.mobile_input_state_release;
+	p->input |= g->mobile_input_state;
+	p->input_press |= g->mobile_input_state_press;
+	p->input_release |= g->mobile_input_state_release;
 #endif
+
+	// record or play back
+	movie_update_input(&p->input, &p->input_press, &p->input_release);
+}
+
+// Restarts the level or goes to the title screen. Batch instances just stop.
+static void game_end_level(Game* g, Program_Mode next_mode) {
+	if (g->batch_instance) {
+		g->batch_finished = true;
+		return;
+	}
+
+	program.player_lives = g->player_lives;
+	program.player_score = g->player_score;
+
+	program.set_program_mode(next_mode);
 }
 
-static void player_state_dead(Player* p, float delta) {
+static void player_state_dead(Game* g, Player* p, float delta) {
 	p->speed.y += PLAYER_GRAVITY * delta;
 
 	p->pos += p->speed * delta;
 
-	player_keep_in_bounds(p);
+	player_keep_in_bounds(g, p);
 
 	switch (p->death_state) {
 		case 0: {
 			if (p->death_timer >= 102) {
-				program.player_lives--;
+				g->player_lives--;
 				p->death_state = 1;
 				p->death_timer = 0;
 			}
@@ -2558,14 +3162,14 @@ static void player_state_dead(Player* p, float delta) {
 		}
 
 		case 1: {
-			if (program.player_lives > 0) {
+			if (g->player_lives > 0) {
 				if (p->death_timer >= 60) {
-					program.set_program_mode(PROGRAM_GAME);
+					game_end_level(g, PROGRAM_GAME);
 					p->death_state = -1;
 					p->death_timer = 0;
 				}
 			} else {
-				game.show_game_over_screen = true;
+				g->show_game_over_screen = true;
 				p->death_state = 2;
 				p->death_timer = 0;
 
@@ -2576,7 +3180,7 @@ static void player_state_dead(Player* p, float delta) {
 
 		case 2: {
 			if (p->death_timer >= 686) {
-				program.set_program_mode(PROGRAM_TITLE);
+				game_end_level(g, PROGRAM_TITLE);
 				p->death_state = -1;
 				// keep death_timer for animation
 			}
@@ -2587,7 +3191,7 @@ static void player_state_dead(Player* p, float delta) {
 	p->death_timer += delta;
 }
 
-static void player_update(Player* p, float delta) {
+static void player_update(Game* g, Player* p, float delta) {
 	// :player update
 
 	// clear flags
@@ -2602,26 +3206,26 @@ static void player_update(Player* p, float delta) {
 	p->prev_mode   = player_get_mode(p);
 	p->prev_radius = player_get_radius(p);
 
-	player_update_input_state(p);
+	player_update_input_state(g, p);
 
 	switch (p->state) {
 		case STATE_GROUND: {
-			player_state_ground(p, delta);
+			player_state_ground(g, p, delta);
 			break;
 		}
 
 		case STATE_ROLL: {
-			player_state_roll(p, delta);
+			player_state_roll(g, p, delta);
 			break;
 		}
 
 		case STATE_AIR: {
-			player_state_air(p, delta);
+			player_state_air(g, p, delta);
 			break;
 		}
 
 		case STATE_DEAD: {
-			player_state_dead(p, delta);
+			player_state_dead(g, p, delta);
 			break;
 		}
 
@@ -2703,15 +3307,8 @@ static void player_update(Player* p, float delta) {
 
 #ifdef DEVELOPER
 	{
-		bool pressed = false;
-
-		pressed |= is_input_pressed(INPUT_DEBUG);
-
-#if defined(__ANDROID__) || defined(PRETEND_MOBILE)
-		if (game.mobile_input_state_press & INPUT_DEBUG) {
-			pressed = true;
-		}
-#endif
+		// go through player input so that it's recorded in movies
+		bool pressed = (p->input_press & INPUT_DEBUG) != 0;
 
 		if (pressed) {
 			if (p->state == STATE_DEBUG) {
@@ -2727,10 +3324,10 @@ static void player_update(Player* p, float delta) {
 #endif
 
 	if (p->invincibility > 0) {
-		static float t = 0;
+		float& t = p->sparkle_timer;
 		while (t >= 8) {
 			Object o = {};
-			o.id = game.next_id++;
+			o.id = g->next_id++;
 			o.type = OBJ_INVINCIBILITY_SPARKLE;
 			o.pos = p->pos;
 #ifdef PLAYER_NEW_RADIUS
@@ -2739,7 +3336,7 @@ static void player_update(Player* p, float delta) {
 			}
 #endif
 
-			array_add(&game.objects, o);
+			add_object(g, o);
 
 			t -= 8;
 		}
@@ -2748,14 +3345,53 @@ static void player_update(Player* p, float delta) {
 }
 
 void Game::init(int argc, char* argv[]) {
-	init_particles();
-
 	{
 		char* path = to_c_string(program.level_filepath);
 		defer { free(path); };
 
-		load_level(path);
+		init_simulation(path);
+	}
+
+	movie_on_level_start();
+	netplay_on_level_start();
+
+	player_lives = program.player_lives;
+	player_score = program.player_score;
+
+#ifdef DEVELOPER
+	if (!window.headless) {
+		rewind_init();
 	}
+#endif
+
+	play_music("music/EEZ_Act1.mp3");
+}
+
+void Game::init_batch_instance(const char* level_path) {
+	batch_instance = true;
+
+	init_simulation(level_path);
+
+	player_lives = 3;
+	player_score = 0;
+}
+
+void Game::init_simulation(const char* level_path) {
+	// levels are loaded on the main thread
+	static u32 next_session = 1;
+	session = next_session++;
+
+	arena = allocate_arena(MAX_OBJECTS * sizeof(Object) + MAX_OBJECTS * sizeof(Object_Slot) + MAX_PARTICLES * sizeof(Particle) + 3 * DEFAULT_ALIGNMENT, get_libc_allocator());
+
+	init_particles(&particles, get_arena_allocator(&arena));
+
+	load_level(level_path);
+
+	init_object_grid(&object_grid, tm);
+	rebuild_object_derived(this);
+
+	ring_batch = (Ring_Batch*) calloc(1, sizeof(Ring_Batch));
+	Assert(ring_batch);
 
 	// set camera pos after loading the level
 	camera_pos_real.x = player.pos.x - window.game_width / 2;
@@ -2764,18 +3400,53 @@ void Game::init(int argc, char* argv[]) {
 	// update camera so that it's in the right place when the level starts up
 	camera_update(0);
 
+	update_object_window(this);
+
 	player.prev_mode = player_get_mode(&player);
 	player.prev_radius = player_get_radius(&player);
 
-	debug_rects = allocate_bump_array<Rectf>(100, get_libc_allocator());
+	player.prev_pos = player.pos;
+	prev_camera_pos = camera_pos;
 
-	play_music("music/EEZ_Act1.mp3");
+	debug_rects = allocate_bump_array<Rectf>(100, get_libc_allocator());
 }
 
+static Game_State quick_save;
+
 void Game::deinit() {
+	if (!batch_instance) {
+		free_state(&quick_save);
+
+#ifdef DEVELOPER
+		rewind_deinit();
+#endif
+	}
+
 	free(debug_rects.data);
 
-	free(objects.data);
+	free(object_derived.data);
+	object_derived = {};
+
+	deinit_object_grid(&object_grid);
+
+	if (ring_batch) {
+		free_ring_batch(ring_batch);
+	}
+	free(ring_batch);
+	ring_batch = nullptr;
+
+	free(level_objects);
+	level_objects = nullptr;
+
+	free(level_objects_by_type);
+	level_objects_by_type = nullptr;
+
+	// objects and particles are in the arena
+	deinit_particles(&particles, get_arena_allocator(&arena));
+	objects = {};
+	object_slots = {};
+	afree(arena.data, arena.capacity, get_libc_allocator());
+	arena = {};
 
 	free_tileset(&ts);
 	free_texture(&tileset_texture);
@@ -2784,8 +3455,6 @@ void Game::deinit() {
 	free_texture(&widthmap);
 
 	free_tilemap(&tm);
-
-	deinit_particles();
 }
 
 void Game::camera_update(float delta) {
@@ -2836,7 +3505,7 @@ void Game::camera_update(float delta) {
 		Clamp(&camera_pos_real.x, 0.0f, (float) (tm.width  * 16 - window.game_width));
 		Clamp(&camera_pos_real.y, 0.0f, (float) (tm.height * 16 - window.game_height));
 
-		Object* region = player_find_camera_region(p);
+		Object* region = player_find_camera_region(this, p);
 		if (region) {
 			float l = region->pos.x - region->radius.x;
 			float r = region->pos.x + region->radius.x;
@@ -2863,267 +3532,311 @@ void Game::camera_update(float delta) {
 	}
 }
 
-void Game::update_gameplay(float delta) {
-	update_touch_input();
+// 
+// Object updates.
+// 
 
-	// early update objects
-	For (it, objects) {
-		switch (it->type) {
-			case OBJ_MOVING_PLATFORM: {
-				it->mplatform.prev_pos = it->pos;
+static void early_update_moving_platform(Game* g, Object* o, float delta) {
+	o->mplatform.prev_pos = o->pos;
 
-				float a = player_time * it->mplatform.time_multiplier;
-				if (it->flags & FLAG_PLATFORM_CIRCULAR_MOVEMENT) {
-					it->pos.x = floorf(it->mplatform.init_pos.x + cosf(a) * it->mplatform.offset.x);
-					it->pos.y = floorf(it->mplatform.init_pos.y - sinf(a) * it->mplatform.offset.y);
-				} else {
-					it->pos.x = floorf(it->mplatform.init_pos.x - sinf(a) * it->mplatform.offset.x);
-					it->pos.y = floorf(it->mplatform.init_pos.y + sinf(a) * it->mplatform.offset.y);
+	float a = g->player_time * o->mplatform.time_multiplier;
+	if (o->flags & FLAG_PLATFORM_CIRCULAR_MOVEMENT) {
+		o->pos.x = floorf(o->start_pos.x + cosf(a) * o->mplatform.offset.x);
+		o->pos.y = floorf(o->start_pos.y - sinf(a) * o->mplatform.offset.y);
+	} else {
+		o->pos.x = floorf(o->start_pos.x - sinf(a) * o->mplatform.offset.x);
+		o->pos.y = floorf(o->start_pos.y + sinf(a) * o->mplatform.offset.y);
+	}
+
+	object_grid_move(g, o);
+
+	if (Object* obj = g->get_object(o->mplatform.mounts[0])) {
+		obj->pos += o->pos - o->mplatform.prev_pos;
+		object_grid_move(g, obj);
+	}
+	if (Object* obj = g->get_object(o->mplatform.mounts[1])) {
+		obj->pos += o->pos - o->mplatform.prev_pos;
+		object_grid_move(g, obj);
+	}
+}
+
+static void update_spring(Game* g, Object* o, float delta) {
+	if (o->spring.animating) {
+		const Sprite& s = get_sprite(get_spring_sprite_animating(*o));
+
+		o->spring.frame_index += s.anim_spd * delta;
+		if (o->spring.frame_index >= s.frames.count) {
+			o->spring.animating = false;
+		}
+	}
+}
+
+static void update_monitor_icon(Game* g, Object* o, float delta) {
+	o->monitor.timer += delta;
+
+	if (o->monitor.timer > 64) {
+		o->flags |= FLAG_INSTANCE_DEAD;
+	} else if (o->monitor.timer > 32) {
+		if (!(o->flags & FLAG_MONITOR_ICON_GOT_REWARD)) {
+			switch (o->monitor.icon) {
+				case MONITOR_ICON_ROBOTNIK: {
+					player_get_hit(g, &g->player, 1);
+					break;
 				}
 
-				if (it->mplatform.mounts[0] != 0) {
-					if (Object* obj = find_object(it->mplatform.mounts[0])) {
-						obj->pos += it->pos - it->mplatform.prev_pos;
-					}
+				case MONITOR_ICON_SUPER_RING: {
+					player_get_rings(g, 10);
+					break;
 				}
-				if (it->mplatform.mounts[1] != 0) {
-					if (Object* obj = find_object(it->mplatform.mounts[1])) {
-						obj->pos += it->pos - it->mplatform.prev_pos;
-					}
+
+				case MONITOR_ICON_POWER_SNEAKERS: {
+					g->player.super_speed = 1200;
+					break;
+				}
+
+				case MONITOR_ICON_SHIELD: {
+					g->player.has_shield = true;
+					break;
+				}
+
+				case MONITOR_ICON_INVINCIBILITY: {
+					g->player.invincibility = 1200;
+					break;
+				}
+
+				case MONITOR_ICON_1UP: {
+					player_get_life(g);
+					break;
 				}
-				break;
 			}
+
+			o->flags |= FLAG_MONITOR_ICON_GOT_REWARD;
 		}
+	} else {
+		o->pos.y -= delta;
 	}
+}
 
-	// update player
-	player_update(&player, delta);
+// 
+// Dropped rings move, bounce off the floor and run out together, see "Ring_Batch".
+// They're spawned objects, so they're never asleep.
+// 
+static void update_dropped_rings(Game* g, float delta) {
+	Ring_Batch* batch = g->ring_batch;
 
-	camera_update(delta);
+	batch->dropped.count    = 0;
+	batch->probe_x.count    = 0;
+	batch->probe_y.count    = 0;
+	batch->floor_dist.count = 0;
 
-	if (!level_cleared) {
-		player_time += delta;
+	for (Object* it = lower_bound_object(g, g->num_level_objects + 1); it != g->objects.end(); it++) {
+		if (it->type != OBJ_RING_DROPPED) continue;
+
+		// collected this frame
+		if (it->flags & FLAG_INSTANCE_DEAD) continue;
+
+		array_add(&batch->dropped, it);
 	}
 
-	// update objects
-	For (it, objects) {
-		switch (it->type) {
-			case OBJ_SPRING:
-			case OBJ_SPRING_DIAGONAL: {
-				if (it->spring.animating) {
-					const Sprite& s = get_sprite(get_spring_sprite_animating(*it));
+	const float gravity = 0.09375f;
+	For (it, batch->dropped) {
+		Object* o = *it;
+		o->ring_dropped.speed.y += gravity * delta;
+		o->pos += o->ring_dropped.speed * delta;
 
-					it->spring.frame_index += s.anim_spd * delta;
-					if (it->spring.frame_index >= s.frames.count) {
-						it->spring.animating = false;
-					}
-				}
-				break;
-			}
+		array_add(&batch->probe_x, o->pos.x);
+		array_add(&batch->probe_y, o->pos.y + 8);
+		array_add(&batch->floor_dist, 0);
+	}
 
-			case OBJ_MONITOR_ICON: {
-				it->monitor.timer += delta;
+	sensor_check_batch<DIR_DOWN>(g, 0, batch->probe_x.data, batch->probe_y.data, batch->dropped.count, batch->floor_dist.data);
 
-				if (it->monitor.timer > 64) {
-					it->flags |= FLAG_INSTANCE_DEAD;
-				} else if (it->monitor.timer > 32) {
-					if (!(it->flags & FLAG_MONITOR_ICON_GOT_REWARD)) {
-						switch (it->monitor.icon) {
-							case MONITOR_ICON_ROBOTNIK: {
-								player_get_hit(&player, 1);
-								break;
-							}
+	float num_frames = (float) get_sprite(spr_ring).frames.count;
 
-							case MONITOR_ICON_SUPER_RING: {
-								player_get_rings(10);
-								break;
-							}
+	for (size_t i = 0; i < batch->dropped.count; i++) {
+		Object* o = batch->dropped[i];
 
-							case MONITOR_ICON_POWER_SNEAKERS: {
-								player.super_speed = 1200;
-								break;
-							}
+		if (batch->floor_dist[i] < 0) {
+			if (o->ring_dropped.speed.y > 0) {
+				o->ring_dropped.speed.y *= -0.75f;
+			}
+		}
 
-							case MONITOR_ICON_SHIELD: {
-								player.has_shield = true;
-								break;
-							}
+		o->ring_dropped.frame_index += o->ring_dropped.anim_spd * delta;
+		o->ring_dropped.frame_index = wrapf(o->ring_dropped.frame_index, num_frames);
 
-							case MONITOR_ICON_INVINCIBILITY: {
-								player.invincibility = 1200;
-								break;
-							}
+		o->ring_dropped.anim_spd -= 0.002f * delta;
 
-							case MONITOR_ICON_1UP: {
-								player_get_life();
-								break;
-							}
-						}
+		o->ring_dropped.lifetime += delta;
+		if (o->ring_dropped.lifetime > 256) {
+			o->flags |= FLAG_INSTANCE_DEAD;
+		}
 
-						it->flags |= FLAG_MONITOR_ICON_GOT_REWARD;
-					}
-				} else {
-					it->pos.y -= delta;
-				}
-				break;
-			}
+		object_grid_move(g, o);
+	}
+}
 
-			case OBJ_RING_DROPPED: {
-				const float gravity = 0.09375f;
-				it->ring_dropped.speed.y += gravity * delta;
-				it->pos += it->ring_dropped.speed * delta;
+static void update_mosqui(Game* g, Object* o, float delta) {
+	auto& obj = *o;
+	auto& mosqui = obj.mosqui;
 
-				SensorResult res = sensor_check_down(it->pos + vec2{0, 8}, 0);
-				if (res.dist < 0) {
-					if (it->ring_dropped.speed.y > 0) {
-						it->ring_dropped.speed.y *= -0.75f;
-					}
-				}
+	if (obj.flags & FLAG_MOSQUI_IS_DIVING) {
+		const float anim_spd = 0.25;
+		obj.frame_index += anim_spd * delta;
 
-				it->ring_dropped.frame_index += it->ring_dropped.anim_spd * delta;
-				it->ring_dropped.frame_index = wrapf(it->ring_dropped.frame_index, get_sprite(spr_ring).frames.count);
+		if (obj.frame_index >= 4) {
+			obj.frame_index = 4;
 
-				it->ring_dropped.anim_spd -= 0.002f * delta;
+			obj.pos.y += obj.speed.y * delta;
 
-				it->ring_dropped.lifetime += delta;
-				if (it->ring_dropped.lifetime > 256) {
-					it->flags |= FLAG_INSTANCE_DEAD;
-				}
-				break;
+			SensorResult res = sensor_check<DIR_DOWN>(g, obj.pos + vec2{0, 14}, 0);
+			if (res.dist < 0) {
+				obj.pos.y += res.dist;
+				obj.pos = floor(obj.pos);
+				obj.speed.y = 0;
 			}
+		}
+	} else {
+		obj.pos.x += obj.speed.x * delta;
 
-			case OBJ_MOSQUI: {
-				auto& obj = *it;
-				auto& mosqui = obj.mosqui;
+		if (obj.pos.x > obj.start_pos.x + mosqui.fly_distance) {
+			obj.speed.x = -fabsf(obj.speed.x);
+		}
 
-				if (obj.flags & FLAG_MOSQUI_IS_DIVING) {
-					const float anim_spd = 0.25;
-					obj.frame_index += anim_spd * delta;
+		if (obj.pos.x < obj.start_pos.x - mosqui.fly_distance) {
+			obj.speed.x = fabsf(obj.speed.x);
+		}
 
-					if (obj.frame_index >= 4) {
-						obj.frame_index = 4;
+		const float anim_spd = 0.25;
+		obj.frame_index += anim_spd * delta;
+		obj.frame_index = fmodf(obj.frame_index, 2);
 
-						obj.pos.y += obj.speed.y * delta;
+		Rectf rect;
+		rect.w = 32;
+		rect.h = 150;
+		rect.x = obj.pos.x - rect.w / 2;
+		rect.y = obj.pos.y;
 
-						SensorResult res = sensor_check_down(obj.pos + vec2{0, 14}, 0);
-						if (res.dist < 0) {
-							obj.pos.y += res.dist;
-							obj.pos = floor(obj.pos);
-							obj.speed.y = 0;
-						}
-					}
-				} else {
-					obj.pos.x += obj.speed.x * delta;
+		if (point_in_rect(g->player.pos, rect)) {
+			obj.flags |= FLAG_MOSQUI_IS_DIVING;
+			obj.speed.y = 4;
+		}
+	}
 
-					if (obj.pos.x > obj.start_pos.x + mosqui.fly_distance) {
-						obj.speed.x = -fabsf(obj.speed.x);
-					}
+	object_grid_move(g, o);
+}
 
-					if (obj.pos.x < obj.start_pos.x - mosqui.fly_distance) {
-						obj.speed.x = fabsf(obj.speed.x);
-					}
+static void update_flower(Game* g, Object* o, float delta) {
+	auto& obj = *o;
+	auto& flower = obj.flower;
 
-					const float anim_spd = 0.25;
-					obj.frame_index += anim_spd * delta;
-					obj.frame_index = fmodf(obj.frame_index, 2);
+	if (flower.timer > 0) {
+		flower.timer -= delta;
 
-					Rectf rect;
-					rect.w = 32;
-					rect.h = 150;
-					rect.x = obj.pos.x - rect.w / 2;
-					rect.y = obj.pos.y;
+		const float anim_spd = 0.25;
+		obj.frame_index += anim_spd * delta;
+		obj.frame_index = fmodf(obj.frame_index, 2);
 
-					if (point_in_rect(player.pos, rect)) {
-						obj.flags |= FLAG_MOSQUI_IS_DIVING;
-						obj.speed.y = 4;
-					}
-				}
-				break;
+		if (flower.timer <= 0) {
+			obj.speed.y = 2;
+		}
+	} else {
+		if (obj.speed.y == 0) {
+			if (obj.frame_index >= 7) {
+				const float anim_spd = 0.05;
+				obj.frame_index += anim_spd * delta;
+				obj.frame_index = 7 + fmodf(obj.frame_index - 7, 2);
+			} else {
+				const float anim_spd = 0.25;
+				obj.frame_index += anim_spd * delta;	
+			}
+		} else {
+			SensorResult res = sensor_check<DIR_DOWN>(g, obj.pos + vec2{0, 2}, 0);
+			if (res.dist < 0) {
+				obj.pos.y += res.dist;
+				obj.pos = floor(obj.pos);
+				obj.speed.y = 0;
 			}
 
-			case OBJ_FLOWER: {
-				auto& obj = *it;
-				auto& flower = obj.flower;
-
-				if (flower.timer > 0) {
-					flower.timer -= delta;
+			const float anim_spd = 0.25;
+			obj.frame_index += anim_spd * delta;
+			obj.frame_index = fmodf(obj.frame_index, 2);
 
-					const float anim_spd = 0.25;
-					obj.frame_index += anim_spd * delta;
-					obj.frame_index = fmodf(obj.frame_index, 2);
+			obj.pos.y += obj.speed.y * delta;
+		}
+	}
+}
 
-					if (flower.timer <= 0) {
-						obj.speed.y = 2;
-					}
-				} else {
-					if (obj.speed.y == 0) {
-						if (obj.frame_index >= 7) {
-							const float anim_spd = 0.05;
-							obj.frame_index += anim_spd * delta;
-							obj.frame_index = 7 + fmodf(obj.frame_index - 7, 2);
-						} else {
-							const float anim_spd = 0.25;
-							obj.frame_index += anim_spd * delta;	
-						}
-					} else {
-						SensorResult res = sensor_check_down(obj.pos + vec2{0, 2}, 0);
-						if (res.dist < 0) {
-							obj.pos.y += res.dist;
-							obj.pos = floor(obj.pos);
-							obj.speed.y = 0;
-						}
+static void update_sign_post(Game* g, Object* o, float delta) {
+	if (g->player.pos.x >= o->pos.x) {
+		if (!g->level_cleared) {
+			g->camera_sign_post_left = g->player.pos.x - window.game_width / 2;
+			g->level_cleared = true;
 
-						const float anim_spd = 0.25;
-						obj.frame_index += anim_spd * delta;
-						obj.frame_index = fmodf(obj.frame_index, 2);
+			play_sound(get_sound(snd_sign_post));
+		}
+	}
 
-						obj.pos.y += obj.speed.y * delta;
-					}
-				}
-				break;
+	if (g->level_cleared) {
+		if (o->signpost.timer >= 120) {
+			if (g->score_card.state == ScoreCard::NONE) {
+				g->score_card.show(g);
 			}
+		}
 
-			case OBJ_SIGN_POST: {
-				if (player.pos.x >= it->pos.x) {
-					if (!level_cleared) {
-						camera_sign_post_left = player.pos.x - window.game_width / 2;
-						level_cleared = true;
+		o->signpost.timer += delta;
+	}
+}
 
-						play_sound(get_sound(snd_sign_post));
-					}
-				}
+static void update_invincibility_sparkle(Game* g, Object* o, float delta) {
+	if (o->sparkle.timer >= 24) {
+		o->flags |= FLAG_INSTANCE_DEAD;
+	}
 
-				if (level_cleared) {
-					if (it->signpost.timer >= 120) {
-						if (score_card.state == ScoreCard::NONE) {
-							score_card.show();
-						}
-					}
+	o->sparkle.timer += delta;
+}
 
-					it->signpost.timer += delta;
-				}
-				break;
-			}
+void Game::update_gameplay(float delta) {
+	update_object_derived(this);
 
-			case OBJ_INVINCIBILITY_SPARKLE: {
-				if (it->sparkle.timer >= 24) {
-					it->flags |= FLAG_INSTANCE_DEAD;
-				}
+	if (!batch_instance) {
+		update_touch_input();
+	}
 
-				it->sparkle.timer += delta;
-				break;
-			}
-		}
+	update_object_window(this);
 
-		if (it->flags & FLAG_INSTANCE_DEAD) {
-			Remove(it, objects);
-			continue;
-		}
+	// early update objects
+	for (Object* it = get_first_active_object(this); it != objects.end(); it = get_next_active_object(this, it)) {
+		auto early_update = get_object_type_info(it->type).early_update;
+		if (early_update) early_update(this, it, delta);
+	}
+
+	// update player
+	player_update(this, &player, delta);
+
+	camera_update(delta);
+
+	if (!level_cleared) {
+		player_time += delta;
+	}
+
+	// update objects
+	for (Object* it = get_first_active_object(this); it != objects.end(); it = get_next_active_object(this, it)) {
+		// killed by the player this frame
+		if (it->flags & FLAG_INSTANCE_DEAD) continue;
+
+		auto update = get_object_type_info(it->type).update;
+		if (update) update(this, it, delta);
 	}
 
-	update_particles(delta);
+	// after the other objects, which can drop more rings
+	update_dropped_rings(this, delta);
+
+	remove_dead_objects(this);
 
-	score_card.update(delta);
+	update_particles(&particles, delta);
+
+	score_card.update(this, delta);
 }
 
 void Game::update_touch_input() {
@@ -3214,6 +3927,18 @@ void Game::update_touch_input() {
 }
 
 void Game::update(float delta) {
+	update_object_derived(this);
+
+	// remember where everything was for drawing in between updates
+	{
+		player.prev_pos = player.pos;
+		prev_camera_pos = camera_pos;
+
+		for (Object* it = get_first_active_object(this); it != objects.end(); it = get_next_active_object(this, it)) {
+			get_object_derived(this, it)->prev_pos = it->pos;
+		}
+	}
+
 	{
 		water_pos_y = 9999 + sinf(player_time/60 * 2) * 4;
 	}
@@ -3226,7 +3951,7 @@ void Game::update(float delta) {
 		should_update_gameplay = false;
 
 #ifdef DEVELOPER
-		if (is_input_pressed(INPUT_DEBUG)) {
+		if (!batch_instance && is_input_pressed(INPUT_DEBUG)) {
 			titlecard_state = TITLECARD_OUT;
 			titlecard_timer = 0;
 			titlecard_t = 0.5f;
@@ -3247,8 +3972,56 @@ void Game::update(float delta) {
 		should_update_gameplay = false;
 	}
 
+#ifdef DEVELOPER
+	if (!batch_instance) {
+		// hold backspace to rewind
+		if (should_update_gameplay && is_key_held(SDL_SCANCODE_BACKSPACE) && movie.state == MOVIE_NONE && netplay.state == NETPLAY_NONE) {
+			rewind_step_back();
+			should_update_gameplay = false;
+		}
+
+		if (is_key_pressed(SDL_SCANCODE_F7)) {
+			double t = get_time();
+
+			save_state(this, &quick_save);
+
+			log_info("Saved state in %fus (" Size_Fmt ").",
+					 (get_time() - t) * 1'000'000.0,
+					 Size_Arg(sizeof(Game) + objects.count * sizeof(Object) + particles.count * sizeof(Particle)));
+		}
+
+		if (is_key_pressed(SDL_SCANCODE_F8)) {
+			if (quick_save.arena.data) {
+				double t = get_time();
+
+				if (load_state(this, quick_save)) {
+					log_info("Loaded state in %fus.", (get_time() - t) * 1'000'000.0);
+
+					// the rewind history is for a different timeline now
+					rewind_reset();
+				}
+			}
+		}
+	}
+#endif
+
+	// the other player is too far behind
+	if (should_update_gameplay && !batch_instance && netplay_should_wait()) {
+		should_update_gameplay = false;
+	}
+
 	if (should_update_gameplay) {
 		update_gameplay(delta);
+
+		if (!batch_instance) {
+			netplay_update({player.input, player.input_press, player.input_release});
+		}
+
+#ifdef DEVELOPER
+		if (!batch_instance && movie.state == MOVIE_NONE) {
+			rewind_record();
+		}
+#endif
 	}
 
 	// update titlecard
@@ -3290,7 +4063,9 @@ void Game::update(float delta) {
 		}
 	}
 
-	update_pause_menu(delta);
+	if (!batch_instance) {
+		update_pause_menu(delta);
+	}
 
 	if (pause_state == PAUSE_NOT_PAUSED) {
 		time_frames += delta;
@@ -3298,7 +4073,7 @@ void Game::update(float delta) {
 	}
 }
 
-void ScoreCard::show() {
+void ScoreCard::show(Game* g) {
 	state = WAIT;
 	timer = 0;
 	message_offset = 26;
@@ -3308,28 +4083,28 @@ void ScoreCard::show() {
 	ring_bonus = 0;
 	total_bonus = 0;
 
-	if (game.time_seconds < 30) {
+	if (g->time_seconds < 30) {
 		time_bonus = 50'000;
-	} else if (game.time_seconds < 45) {
+	} else if (g->time_seconds < 45) {
 		time_bonus = 10'000;
-	} else if (game.time_seconds < 60) {
+	} else if (g->time_seconds < 60) {
 		time_bonus = 5'000;
-	} else if (game.time_seconds < 90) {
+	} else if (g->time_seconds < 90) {
 		time_bonus = 4'000;
-	} else if (game.time_seconds < 120) {
+	} else if (g->time_seconds < 120) {
 		time_bonus = 3'000;
-	} else if (game.time_seconds < 180) {
+	} else if (g->time_seconds < 180) {
 		time_bonus = 2'000;
-	} else if (game.time_seconds < 240) {
+	} else if (g->time_seconds < 240) {
 		time_bonus = 1'000;
-	} else if (game.time_seconds < 300) {
+	} else if (g->time_seconds < 300) {
 		time_bonus = 500;
 	}
 
-	ring_bonus = game.player_rings * 10; // TODO: 50'000 if all rings collected
+	ring_bonus = g->player_rings * 10; // TODO: 50'000 if all rings collected
 }
 
-void ScoreCard::update(float delta) {
+void ScoreCard::update(Game* g, float delta) {
 	if (state == NONE) {
 		return;
 	}
@@ -3370,14 +4145,14 @@ void ScoreCard::update(float delta) {
 				if (time_bonus > 0) {
 					int i = min(time_bonus, 100);
 					total_bonus += i;
-					program.player_score += i;
+					g->player_score += i;
 					time_bonus -= i;
 				}
 
 				if (ring_bonus > 0) {
 					int i = min(ring_bonus, 100);
 					total_bonus += i;
-					program.player_score += i;
+					g->player_score += i;
 					ring_bonus -= i;
 				}
 
@@ -3385,7 +4160,7 @@ void ScoreCard::update(float delta) {
 			}
 
 			{
-				static float t = 0;
+				float& t = blip_timer;
 				while (t >= 4) {
 					play_sound(get_sound(snd_blip));
 
@@ -3406,7 +4181,7 @@ void ScoreCard::update(float delta) {
 
 		case WAIT_2: {
 			if (timer >= 220) {
-				program.set_program_mode(PROGRAM_GAME);
+				game_end_level(g, PROGRAM_GAME);
 				state = DONE;
 			}
 			break;
@@ -3598,12 +4373,28 @@ void Game::update_pause_menu(float delta) {
 	}
 }
 
-void draw_tilemap_layer(const Tilemap& tm,
-						int layer_index,
-						const Texture& tileset_texture,
-						int xfrom, int yfrom,
-						int xto, int yto,
-						vec4 color) {
+static Rect get_tile_src(const Texture& tileset_texture, Tile tile) {
+	Rect src;
+	src.x = (tile.index % (tileset_texture.width / 16)) * 16;
+	src.y = (tile.index / (tileset_texture.width / 16)) * 16;
+	src.w = 16;
+	src.h = 16;
+	return src;
+}
+
+// 
+// Writes the quads of the non-empty tiles in the rectangle, row by row, 4 vertices each.
+// Returns the number of vertices. Only reads the tilemap, so jobs can call it.
+// 
+static size_t get_tile_vertices(Vertex* vertices,
+								const Tilemap& tm,
+								int layer_index,
+								const Texture& tileset_texture,
+								int xfrom, int yfrom,
+								int xto, int yto,
+								vec4 color) {
+	size_t count = 0;
+
 	for (int y = yfrom; y < yto; y++) {
 		for (int x = xfrom; x < xto; x++) {
 			Tile tile = get_tile(tm, x, y, layer_index);
@@ -3612,272 +4403,529 @@ void draw_tilemap_layer(const Tilemap& tm,
 				continue;
 			}
 
-			Rect src;
-			src.x = (tile.index % (tileset_texture.width / 16)) * 16;
-			src.y = (tile.index / (tileset_texture.width / 16)) * 16;
-			src.w = 16;
-			src.h = 16;
+			Rect src = get_tile_src(tileset_texture, tile);
 
-			draw_texture_simple(tileset_texture, src, {x * 16.0f, y * 16.0f}, {}, color, {tile.hflip, tile.vflip});
+			get_texture_simple_vertices(&vertices[count], tileset_texture, src, {x * 16.0f, y * 16.0f}, {}, color, {tile.hflip, tile.vflip});
+			count += 4;
 		}
 	}
+
+	return count;
 }
 
-void draw_objects(array<Object> objects,
-				  float time_frames,
-				  bool show_editor_objects,
-				  bool cull_objects) {
-	auto out_of_bounds = [&](const Sprite& s, vec2 pos) -> bool {
-		if (!cull_objects) {
-			return false;
-		}
+constexpr size_t TILE_CHUNK_MAX_VERTICES = TILE_CHUNK_SIZE * TILE_CHUNK_SIZE * 4;
 
-		pos -= game.camera_pos;
-		pos.x -= s.xorigin;
-		pos.y -= s.yorigin;
+// Where the chunk jobs write their vertices. Kept between frames so that rebuilding
+// chunks doesn't allocate every time, they only grow.
+static dynamic_array<Vertex> tile_job_vertices;
+static dynamic_array<size_t> tile_job_num_vertices;
 
-		float left   = pos.x;
-		float right  = pos.x + s.width;
-		float top    = pos.y;
-		float bottom = pos.y + s.height;
+static void free_tile_job_buffers() {
+	array_free(&tile_job_vertices);
+	array_free(&tile_job_num_vertices);
+}
 
-		return (right < 0
-				|| left > window.game_width
-				|| bottom < 0
-				|| top > window.game_height);
-	};
+struct Tile_Chunk_Jobs {
+	const Tilemap* tm;
+	int layer_index;
+	Texture tileset_texture;
 
-	For (it, objects) {
-		switch (it->type) {
-			case OBJ_PLAYER_INIT_POS: {
-				if (!show_editor_objects) break;
+	array<int> chunk_indices;
 
-				const Sprite& s = get_object_sprite(it->type);
-				draw_sprite(s, 0, it->pos);
-				break;
-			}
+	Vertex* vertices; // TILE_CHUNK_MAX_VERTICES per chunk
+	size_t* num_vertices;
+};
 
-			case OBJ_LAYER_FLIP_DEPRECATED: {
-				if (!show_editor_objects) break;
-				
-				const Sprite& s = get_object_sprite(it->type);
-				vec2 scale = (it->radius * 2.0f) / vec2{s.width, s.height};
-				draw_sprite(s, 0, it->pos, scale);
-				break;
-			}
+static void tile_chunk_job(int index, void* userdata) {
+	Tile_Chunk_Jobs* j = (Tile_Chunk_Jobs*) userdata;
+	const Tilemap& tm = *j->tm;
 
-			case OBJ_LAYER_SET_DEPRECATED: {
-				if (!show_editor_objects) break;
+	int chunk_x = j->chunk_indices[index] % tm.chunks->width;
+	int chunk_y = j->chunk_indices[index] / tm.chunks->width;
 
-				const Sprite& s = get_object_sprite(it->type);
-				vec2 scale = (it->radius * 2.0f) / vec2{s.width, s.height};
-				draw_sprite(s, 0, it->pos, scale);
-				break;
-			}
+	int xfrom = chunk_x * TILE_CHUNK_SIZE;
+	int yfrom = chunk_y * TILE_CHUNK_SIZE;
+	int xto = min(xfrom + TILE_CHUNK_SIZE, tm.width);
+	int yto = min(yfrom + TILE_CHUNK_SIZE, tm.height);
 
-			case OBJ_RING: {
-				const Sprite& s = get_object_sprite(it->type);
-				int frame_index = (int)(time_frames * 0.1f) % s.frames.count;
-				if (out_of_bounds(s, it->pos)) break;
-				draw_sprite(s, frame_index, it->pos);
-				break;
-			}
+	// the chunks are built white
+	j->num_vertices[index] = get_tile_vertices(&j->vertices[index * TILE_CHUNK_MAX_VERTICES],
+											   tm, j->layer_index, j->tileset_texture,
+											   xfrom, yfrom, xto, yto, color_white);
+}
 
-			case OBJ_MONITOR: {
-				const Sprite& s = get_object_sprite(it->type);
-				int frame_index = (int)(time_frames * 0.25f) % s.frames.count;
-				if (out_of_bounds(s, it->pos)) break;
-				draw_sprite(s, frame_index, it->pos);
-
-				// draw monitor icon
-				if ((int)time_frames % 4 < 3) {
-					const Sprite& s = get_sprite(spr_monitor_icon);
-					int frame_index = it->monitor.icon;
-
-					vec2 pos = it->pos;
-					pos.y -= 3;
-					draw_sprite(s, frame_index, pos);
-				}
-				break;
-			}
+// The vertices are built on the job pool (a zoomed out editor can rebuild hundreds
+// of chunks at once) and uploaded on this thread, in order.
+static void build_tile_chunks(const Tilemap& tm,
+							  int layer_index,
+							  const Texture& tileset_texture,
+							  array<int> chunk_indices) {
+	if (chunk_indices.count == 0) {
+		return;
+	}
 
-			case OBJ_MONITOR_ICON: {
-				const Sprite& s = get_object_sprite(it->type);
-				int frame_index = it->monitor.icon;
-				if (out_of_bounds(s, it->pos)) break;
-				draw_sprite(s, frame_index, it->pos);
-				break;
-			}
+	Tile_Chunk_Jobs j = {};
+	j.tm = &tm;
+	j.layer_index = layer_index;
+	j.tileset_texture = tileset_texture;
+	j.chunk_indices = chunk_indices;
 
-			case OBJ_SPRING:
-			case OBJ_SPRING_DIAGONAL: {
-				u32 sprite_index = get_spring_sprite_stationary(*it);
-				float frame_index = 0;
+	array_resize(&tile_job_vertices, chunk_indices.count * TILE_CHUNK_MAX_VERTICES);
+	j.vertices = tile_job_vertices.data;
 
-				if (it->spring.animating) {
-					sprite_index = get_spring_sprite_animating(*it);
-					frame_index = it->spring.frame_index;
-				}
+	array_resize(&tile_job_num_vertices, chunk_indices.count);
+	j.num_vertices = tile_job_num_vertices.data;
 
-				float angle = it->spring.direction * 90 - 90;
+	run_jobs((int) chunk_indices.count, tile_chunk_job, &j);
 
-				if (out_of_bounds(get_sprite(sprite_index), it->pos)) break;
-				draw_sprite(get_sprite(sprite_index), frame_index, it->pos, {1, 1}, angle);
-				break;
-			}
+	for (size_t i = 0; i < chunk_indices.count; i++) {
+		Tile_Chunk* chunk = &tm.chunks->chunks[layer_index][chunk_indices[i]];
 
-			case OBJ_SPIKE: {
-				const Sprite& s = get_object_sprite(it->type);
-				float frame_index = 0;
-				float angle = it->spike.direction * 90 - 90;
-				if (out_of_bounds(s, it->pos)) break;
-				draw_sprite(s, frame_index, it->pos, {1, 1}, angle);
-				break;
+		upload_static_quads(&chunk->quads, array<Vertex>(&j.vertices[i * TILE_CHUNK_MAX_VERTICES], j.num_vertices[i]));
+		chunk->up_to_date = true;
+	}
+}
+
+static void alloc_tile_chunks(Tilemap* tm) {
+	Tile_Chunks* chunks = (Tile_Chunks*) calloc(1, sizeof(Tile_Chunks));
+	Assert(chunks);
+
+	chunks->width  = (tm->width  + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE;
+	chunks->height = (tm->height + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE;
+
+	for (int layer_index = 0; layer_index < 4; layer_index++) {
+		chunks->chunks[layer_index] = calloc_array<Tile_Chunk>(chunks->width * chunks->height);
+	}
+
+	tm->chunks = chunks;
+}
+
+static void free_tile_chunks(Tilemap* tm) {
+	if (!tm->chunks) {
+		return;
+	}
+
+	for (int layer_index = 0; layer_index < 4; layer_index++) {
+		For (it, tm->chunks->chunks[layer_index]) {
+			free_static_quads(&it->quads);
+		}
+		free(tm->chunks->chunks[layer_index].data);
+
+		free_texture(&tm->chunks->tile_textures[layer_index]);
+	}
+
+	free(tm->chunks);
+	tm->chunks = nullptr;
+}
+
+void invalidate_tile_chunks(Tilemap* tm) {
+	if (!tm->chunks) {
+		return;
+	}
+
+	for (int layer_index = 0; layer_index < 4; layer_index++) {
+		For (it, tm->chunks->chunks[layer_index]) {
+			it->up_to_date = false;
+		}
+
+		tm->chunks->tile_textures_up_to_date[layer_index] = false;
+	}
+}
+
+void draw_tilemap_layer(const Tilemap& tm,
+						int layer_index,
+						const Texture& tileset_texture,
+						int xfrom, int yfrom,
+						int xto, int yto,
+						vec4 color) {
+	// the chunks are built white
+	if (tm.chunks && color == color_white) {
+		Tile_Chunks* chunks = tm.chunks;
+
+		if (chunks->texture_id     != tileset_texture.id
+			|| chunks->texture_width  != tileset_texture.width
+			|| chunks->texture_height != tileset_texture.height)
+		{
+			for (int i = 0; i < 4; i++) {
+				For (it, chunks->chunks[i]) it->up_to_date = false;
 			}
 
-			case OBJ_RING_DROPPED: {
-				const Sprite& s = get_object_sprite(it->type);
-				float frame_index = it->ring_dropped.frame_index;
+			chunks->texture_id     = tileset_texture.id;
+			chunks->texture_width  = tileset_texture.width;
+			chunks->texture_height = tileset_texture.height;
+		}
+
+		int chunk_xfrom = max(xfrom, 0) / TILE_CHUNK_SIZE;
+		int chunk_yfrom = max(yfrom, 0) / TILE_CHUNK_SIZE;
+		int chunk_xto = min((xto + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE, chunks->width);
+		int chunk_yto = min((yto + TILE_CHUNK_SIZE - 1) / TILE_CHUNK_SIZE, chunks->height);
 
-				if (out_of_bounds(s, it->pos)) break;
+		{
+			int max_chunks = max(chunk_xto - chunk_xfrom, 0) * max(chunk_yto - chunk_yfrom, 0);
+			bump_array<int> stale = allocate_bump_array<int>(max_chunks, get_temp_allocator());
 
-				bool dont_draw = false;
+			for (int chunk_y = chunk_yfrom; chunk_y < chunk_yto; chunk_y++) {
+				for (int chunk_x = chunk_xfrom; chunk_x < chunk_xto; chunk_x++) {
+					int i = chunk_x + chunk_y * chunks->width;
 
-				if (it->ring_dropped.lifetime > 64) {
-					if ((int)time_frames % 2 < 1) {
-						dont_draw = true;
+					if (!chunks->chunks[layer_index][i].up_to_date) {
+						array_add(&stale, i);
 					}
 				}
+			}
 
-				if (!dont_draw) {
-					draw_sprite(s, frame_index, it->pos);
+			build_tile_chunks(tm, layer_index, tileset_texture, array<int>(stale.data, stale.count));
+		}
+
+		{
+			int max_chunks = max(chunk_xto - chunk_xfrom, 0) * max(chunk_yto - chunk_yfrom, 0);
+			bump_array<const Static_Quads*> visible = allocate_bump_array<const Static_Quads*>(max_chunks, get_temp_allocator());
+
+			for (int chunk_y = chunk_yfrom; chunk_y < chunk_yto; chunk_y++) {
+				for (int chunk_x = chunk_xfrom; chunk_x < chunk_xto; chunk_x++) {
+					Tile_Chunk* chunk = &chunks->chunks[layer_index][chunk_x + chunk_y * chunks->width];
+
+					if (chunk->quads.num_quads > 0) {
+						array_add(&visible, (const Static_Quads*) &chunk->quads);
+					}
 				}
-				break;
 			}
 
-			case OBJ_MOVING_PLATFORM: {
-				static const u32 sprite_indices[] = {
-					spr_EEZ_platform1,
-					spr_EEZ_platform2,
-				};
+			// the whole layer with one shader setup
+			draw_static_quads(array<const Static_Quads*>(visible.data, visible.count), tileset_texture);
+		}
 
-				u32 sprite_index = sprite_indices[it->mplatform.sprite_index];
+		return;
+	}
 
-				if (out_of_bounds(get_sprite(sprite_index), it->pos)) break;
-				draw_sprite(get_sprite(sprite_index), 0, it->pos);
-				break;
+	for (int y = yfrom; y < yto; y++) {
+		for (int x = xfrom; x < xto; x++) {
+			Tile tile = get_tile(tm, x, y, layer_index);
+
+			if (tile.index == 0) {
+				continue;
 			}
 
-			case OBJ_LAYER_SWITCHER_VERTICAL: {
-				if (!show_editor_objects) break;
+			Rect src = get_tile_src(tileset_texture, tile);
 
-				const float w = it->radius.x;
+			draw_texture_simple(tileset_texture, src, {x * 16.0f, y * 16.0f}, {}, color, {tile.hflip, tile.vflip});
+		}
+	}
+}
 
-				float x = it->pos.x;
-				if (it->layswitch.current_side == 1) {
-					x -= w;
-				}
-				draw_rectangle({x, it->pos.y - it->radius.y, w, it->radius.y * 2}, get_color(0xff7d1262));
+void draw_tilemap_layer_shader(const Tilemap& tm,
+							   int layer_index,
+							   const Texture& tileset_texture,
+							   int xfrom, int yfrom,
+							   int xto, int yto,
+							   vec4 color) {
+	Tile_Chunks* chunks = tm.chunks;
+
+	// the tile textures are kept with the chunks, and the software renderer has no shaders
+	if (!chunks || renderer.software) {
+		draw_tilemap_layer(tm, layer_index, tileset_texture, xfrom, yfrom, xto, yto, color);
+		return;
+	}
 
-				draw_line_thick(it->pos - vec2{0, it->radius.y} + vec2{0.5f, 0.5f},
-								it->pos + vec2{0, it->radius.y} + vec2{0.5f, 0.5f},
-								1,
-								get_color(0xf0761fff));
+	xfrom = max(xfrom, 0);
+	yfrom = max(yfrom, 0);
+	xto = min(xto, tm.width);
+	yto = min(yto, tm.height);
 
-				draw_rectangle({it->pos.x + 1, it->pos.y, 1, 1}, color_white);
-				draw_rectangle({it->pos.x - 1, it->pos.y, 1, 1}, color_white);
-				draw_rectangle({it->pos.x, it->pos.y + 1, 1, 1}, color_white);
-				draw_rectangle({it->pos.x, it->pos.y - 1, 1, 1}, color_white);
+	if (xfrom >= xto || yfrom >= yto) {
+		return;
+	}
 
-				draw_sprite(get_sprite(spr_layer_switcher_layer_letter), it->layswitch.layer_1, it->pos + vec2{-6, -8});
-				draw_sprite(get_sprite(spr_layer_switcher_layer_letter), it->layswitch.layer_2, it->pos + vec2{ 2, -8});
+	// the shader reads the Tile bitfield
+	static_assert(sizeof(Tile) == sizeof(u32));
+	const u32* data = (const u32*) get_tiles_array(tm, layer_index).data;
 
-				draw_sprite(get_sprite(spr_layer_switcher_priority_letter), it->layswitch.priority_1, it->pos + vec2{-6, 2});
-				draw_sprite(get_sprite(spr_layer_switcher_priority_letter), it->layswitch.priority_2, it->pos + vec2{ 2, 2});
+	Texture* tiles = &chunks->tile_textures[layer_index];
 
-				if (it->flags & FLAG_LAYER_SWITCHER_GROUND_ONLY) {
-					draw_sprite(get_sprite(spr_layer_switcher_grounded_flag_letter), 0, it->pos + vec2{-6, 12});
-				}
-				break;
-			}
+	if (tiles->id == 0) {
+		*tiles = load_texture_u32(data, tm.width, tm.height);
+		chunks->tile_textures_up_to_date[layer_index] = true;
+	} else if (!chunks->tile_textures_up_to_date[layer_index]) {
+		update_texture_u32(*tiles, data);
+		chunks->tile_textures_up_to_date[layer_index] = true;
+	}
 
-			case OBJ_MOSQUI: {
-				u32 sprite_index = spr_mosqui;
-				float frame_index = it->frame_index;
+	set_shader(get_shader(shd_tilemap).id);
+	set_shader_texture(*tiles);
 
-				vec2 scale = {1, 1};
-				if (it->speed.x != 0) {
-					scale.x = -signf(it->speed.x);
-				}
+	// texture coordinates are positions in pixels
+	float x1 = xfrom * 16.0f;
+	float y1 = yfrom * 16.0f;
+	float x2 = xto   * 16.0f;
+	float y2 = yto   * 16.0f;
 
-				if (out_of_bounds(get_sprite(sprite_index), it->pos)) break;
-				draw_sprite(get_sprite(sprite_index), frame_index, it->pos, scale);
-				break;
-			}
+	Vertex vertices[4] = {
+		{{x1, y1, 0.0f}, {}, pack_color_u32(color), {x1, y1}}, // LT
+		{{x2, y1, 0.0f}, {}, pack_color_u32(color), {x2, y1}}, // RT
+		{{x2, y2, 0.0f}, {}, pack_color_u32(color), {x2, y2}}, // RB
+		{{x1, y2, 0.0f}, {}, pack_color_u32(color), {x1, y2}}, // LB
+	};
 
-			case OBJ_FLOWER: {
-				u32 sprite_index = spr_flower;
-				float frame_index = it->frame_index;
-				if (out_of_bounds(get_sprite(sprite_index), it->pos)) break;
-				draw_sprite(get_sprite(sprite_index), frame_index, it->pos);
-				break;
-			}
+	draw_quad(tileset_texture, vertices);
 
-			case OBJ_CAMERA_REGION: {
-				if (!show_editor_objects) break;
+	reset_shader();
+}
 
-				float x = it->pos.x - it->radius.x;
-				float y = it->pos.y - it->radius.y;
-				float w = it->radius.x * 2;
-				float h = it->radius.y * 2;
-				draw_rectangle_outline_thick({x, y, w, h}, 2, get_color(0xf0761fff));
-				break;
-			}
+// for culling objects outside the screen
+static bool object_out_of_bounds(bool cull, const Sprite& s, vec2 pos) {
+	if (!cull) {
+		return false;
+	}
 
-			case OBJ_SIGN_POST: {
-				const Sprite& s = get_object_sprite(it->type);
-				if (out_of_bounds(s, it->pos)) break;
+	pos -= game.camera_pos;
+	pos.x -= s.xorigin;
+	pos.y -= s.yorigin;
 
-				int frame_index;
-				if (it->signpost.timer >= 120) {
-					frame_index = 4;
-				} else {
-					int anim_frame = ((int)(it->signpost.timer * 0.5f)) % 8;
+	float left   = pos.x;
+	float right  = pos.x + s.width;
+	float top    = pos.y;
+	float bottom = pos.y + s.height;
 
-					frame_index = anim_frame % 4;
-					if (anim_frame == 4) frame_index = 4;
-				}
+	return (right < 0
+			|| left > window.game_width
+			|| bottom < 0
+			|| top > window.game_height);
+}
 
-				draw_sprite(s, frame_index, it->pos);
-				break;
-			}
+static void draw_player_init_pos(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	draw_sprite(s, 0, o.pos);
+}
 
-			case OBJ_INVINCIBILITY_SPARKLE: {
-				// don't draw
-				break;
-			}
+static void draw_layer_deprecated(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	vec2 scale = (o.radius * 2.0f) / vec2{s.width, s.height};
+	draw_sprite(s, 0, o.pos, scale);
+}
 
-			case OBJ_FORCE_SPIN: {
-				if (!show_editor_objects) break;
+static void draw_ring(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	int frame_index = (int)(time_frames * 0.1f) % s.frames.count;
+	if (object_out_of_bounds(cull, s, o.pos)) return;
+	draw_sprite(s, frame_index, o.pos);
+}
 
-				const Sprite& s = get_object_sprite(it->type);
-				vec2 scale = (it->radius * 2.0f) / vec2{s.width, s.height};
-				vec4 color = {1, 1, 1, 0.5f};
-				draw_sprite(s, 0, it->pos, scale, 0, color);
-				break;
-			}
+static void draw_monitor(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	int frame_index = (int)(time_frames * 0.25f) % s.frames.count;
+	if (object_out_of_bounds(cull, s, o.pos)) return;
+	draw_sprite(s, frame_index, o.pos);
 
-			default: {
-				const Sprite& s = get_object_sprite(it->type);
-				if (out_of_bounds(s, it->pos)) break;
-				draw_sprite(s, 0, it->pos);
-				break;
-			}
+	// draw monitor icon
+	if ((int)time_frames % 4 < 3) {
+		const Sprite& s = get_sprite(spr_monitor_icon);
+		int frame_index = o.monitor.icon;
+
+		vec2 pos = o.pos;
+		pos.y -= 3;
+		draw_sprite(s, frame_index, pos);
+	}
+}
+
+static void draw_monitor_icon(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	int frame_index = o.monitor.icon;
+	if (object_out_of_bounds(cull, s, o.pos)) return;
+	draw_sprite(s, frame_index, o.pos);
+}
+
+static void draw_spring(const Object& o, float time_frames, bool cull) {
+	u32 sprite_index = get_spring_sprite_stationary(o);
+	float frame_index = 0;
+
+	if (o.spring.animating) {
+		sprite_index = get_spring_sprite_animating(o);
+		frame_index = o.spring.frame_index;
+	}
+
+	float angle = o.spring.direction * 90 - 90;
+
+	if (object_out_of_bounds(cull, get_sprite(sprite_index), o.pos)) return;
+	draw_sprite(get_sprite(sprite_index), frame_index, o.pos, {1, 1}, angle);
+}
+
+static void draw_spike(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	float frame_index = 0;
+	float angle = o.spike.direction * 90 - 90;
+	if (object_out_of_bounds(cull, s, o.pos)) return;
+	draw_sprite(s, frame_index, o.pos, {1, 1}, angle);
+}
+
+static void draw_ring_dropped(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	float frame_index = o.ring_dropped.frame_index;
+
+	if (object_out_of_bounds(cull, s, o.pos)) return;
+
+	bool dont_draw = false;
+
+	if (o.ring_dropped.lifetime > 64) {
+		if ((int)time_frames % 2 < 1) {
+			dont_draw = true;
 		}
 	}
+
+	if (!dont_draw) {
+		draw_sprite(s, frame_index, o.pos);
+	}
+}
+
+static void draw_moving_platform(const Object& o, float time_frames, bool cull) {
+	static const u32 sprite_indices[] = {
+		spr_EEZ_platform1,
+		spr_EEZ_platform2,
+	};
+
+	u32 sprite_index = sprite_indices[o.mplatform.sprite_index];
+
+	if (object_out_of_bounds(cull, get_sprite(sprite_index), o.pos)) return;
+	draw_sprite(get_sprite(sprite_index), 0, o.pos);
+}
+
+static void draw_layer_switcher_vertical(const Object& o, float time_frames, bool cull) {
+	const float w = o.radius.x;
+
+	float x = o.pos.x;
+	if (o.layswitch.current_side == 1) {
+		x -= w;
+	}
+	draw_rectangle({x, o.pos.y - o.radius.y, w, o.radius.y * 2}, get_color(0xff7d1262));
+
+	draw_line_thick(o.pos - vec2{0, o.radius.y} + vec2{0.5f, 0.5f},
+					o.pos + vec2{0, o.radius.y} + vec2{0.5f, 0.5f},
+					1,
+					get_color(0xf0761fff));
+
+	draw_rectangle({o.pos.x + 1, o.pos.y, 1, 1}, color_white);
+	draw_rectangle({o.pos.x - 1, o.pos.y, 1, 1}, color_white);
+	draw_rectangle({o.pos.x, o.pos.y + 1, 1, 1}, color_white);
+	draw_rectangle({o.pos.x, o.pos.y - 1, 1, 1}, color_white);
+
+	draw_sprite(get_sprite(spr_layer_switcher_layer_letter), o.layswitch.layer_1, o.pos + vec2{-6, -8});
+	draw_sprite(get_sprite(spr_layer_switcher_layer_letter), o.layswitch.layer_2, o.pos + vec2{ 2, -8});
+
+	draw_sprite(get_sprite(spr_layer_switcher_priority_letter), o.layswitch.priority_1, o.pos + vec2{-6, 2});
+	draw_sprite(get_sprite(spr_layer_switcher_priority_letter), o.layswitch.priority_2, o.pos + vec2{ 2, 2});
+
+	if (o.flags & FLAG_LAYER_SWITCHER_GROUND_ONLY) {
+		draw_sprite(get_sprite(spr_layer_switcher_grounded_flag_letter), 0, o.pos + vec2{-6, 12});
+	}
+}
+
+static void draw_mosqui(const Object& o, float time_frames, bool cull) {
+	u32 sprite_index = spr_mosqui;
+	float frame_index = o.frame_index;
+
+	vec2 scale = {1, 1};
+	if (o.speed.x != 0) {
+		scale.x = -signf(o.speed.x);
+	}
+
+	if (object_out_of_bounds(cull, get_sprite(sprite_index), o.pos)) return;
+	draw_sprite(get_sprite(sprite_index), frame_index, o.pos, scale);
+}
+
+static void draw_flower(const Object& o, float time_frames, bool cull) {
+	u32 sprite_index = spr_flower;
+	float frame_index = o.frame_index;
+	if (object_out_of_bounds(cull, get_sprite(sprite_index), o.pos)) return;
+	draw_sprite(get_sprite(sprite_index), frame_index, o.pos);
+}
+
+static void draw_camera_region(const Object& o, float time_frames, bool cull) {
+	float x = o.pos.x - o.radius.x;
+	float y = o.pos.y - o.radius.y;
+	float w = o.radius.x * 2;
+	float h = o.radius.y * 2;
+	draw_rectangle_outline_thick({x, y, w, h}, 2, get_color(0xf0761fff));
+}
+
+static void draw_sign_post(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	if (object_out_of_bounds(cull, s, o.pos)) return;
+
+	int frame_index;
+	if (o.signpost.timer >= 120) {
+		frame_index = 4;
+	} else {
+		int anim_frame = ((int)(o.signpost.timer * 0.5f)) % 8;
+
+		frame_index = anim_frame % 4;
+		if (anim_frame == 4) frame_index = 4;
+	}
+
+	draw_sprite(s, frame_index, o.pos);
+}
+
+static void draw_force_spin(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	vec2 scale = (o.radius * 2.0f) / vec2{s.width, s.height};
+	vec4 color = {1, 1, 1, 0.5f};
+	draw_sprite(s, 0, o.pos, scale, 0, color);
+}
+
+static void draw_object_sprite(const Object& o, float time_frames, bool cull) {
+	const Sprite& s = get_object_sprite(o.type);
+	if (object_out_of_bounds(cull, s, o.pos)) return;
+	draw_sprite(s, 0, o.pos);
+}
+
+void draw_objects(array<Object> objects,
+				  float time_frames,
+				  bool show_editor_objects,
+				  bool cull_objects) {
+	For (it, objects) {
+		const Object_Type_Info& info = get_object_type_info(it->type);
+
+		if (!info.draw) continue;
+		if ((info.flags & OBJECT_TYPE_EDITOR_ONLY) && !show_editor_objects) continue;
+
+		info.draw(*it, time_frames, cull_objects);
+	}
+}
+
+// 
+// Object types, in the order of ObjType.
+// 
+
+static const Object_Type_Info object_types[] = {
+	//                                   flags                                                 early_update                  update                        react                            touch                                 draw
+	/* OBJ_PLAYER_INIT_POS */           {OBJECT_TYPE_EDITOR_ONLY,                              nullptr,                      nullptr,                      nullptr,                         nullptr,                              draw_player_init_pos},
+	/* OBJ_LAYER_SET_DEPRECATED */      {OBJECT_TYPE_EDITOR_ONLY,                              nullptr,                      nullptr,                      nullptr,                         nullptr,                              draw_layer_deprecated},
+	/* OBJ_LAYER_FLIP_DEPRECATED */     {OBJECT_TYPE_EDITOR_ONLY,                              nullptr,                      nullptr,                      nullptr,                         nullptr,                              draw_layer_deprecated},
+	/* OBJ_RING */                      {OBJECT_TYPE_NONSOLID,                                 nullptr,                      nullptr,                      nullptr,                         player_touch_ring,                    draw_ring},
+	/* OBJ_MONITOR */                   {OBJECT_TYPE_SOLID,                                    nullptr,                      nullptr,                      player_reaction_monitor,         nullptr,                              draw_monitor},
+	/* OBJ_SPRING */                    {OBJECT_TYPE_SOLID,                                    nullptr,                      update_spring,                player_reaction_spring,          nullptr,                              draw_spring},
+	/* OBJ_MONITOR_BROKEN */            {0,                                                    nullptr,                      nullptr,                      nullptr,                         nullptr,                              draw_object_sprite},
+	/* OBJ_MONITOR_ICON */              {0,                                                    nullptr,                      update_monitor_icon,          nullptr,                         nullptr,                              draw_monitor_icon},
+	/* OBJ_SPIKE */                     {OBJECT_TYPE_SOLID,                                    nullptr,                      nullptr,                      player_reaction_spike,           nullptr,                              draw_spike},
+	/* OBJ_RING_DROPPED */              {OBJECT_TYPE_NONSOLID,                                 nullptr,                      nullptr,                      nullptr,                         player_touch_ring,                    draw_ring_dropped}, // see "update_dropped_rings"
+	/* OBJ_MOVING_PLATFORM */           {OBJECT_TYPE_PLATFORM,                                 early_update_moving_platform, nullptr,                      nullptr,                         nullptr,                              draw_moving_platform},
+	/* OBJ_LAYER_SWITCHER_VERTICAL */   {OBJECT_TYPE_WATCHES_PLAYER | OBJECT_TYPE_EDITOR_ONLY, nullptr,                      nullptr,                      nullptr,                         player_touch_layer_switcher_vertical, draw_layer_switcher_vertical},
+	/* OBJ_LAYER_SWITCHER_HORIZONTAL */ {OBJECT_TYPE_WATCHES_PLAYER,                           nullptr,                      nullptr,                      nullptr,                         nullptr,                              draw_object_sprite}, // TODO: touch
+	/* OBJ_SPRING_DIAGONAL */           {OBJECT_TYPE_SOLID,                                    nullptr,                      update_spring,                player_reaction_spring_diagonal, nullptr,                              draw_spring},
+	/* OBJ_MOSQUI */                    {OBJECT_TYPE_NONSOLID,                                 nullptr,                      update_mosqui,                nullptr,                         player_touch_mosqui,                  draw_mosqui},
+	/* OBJ_FLOWER */                    {0,                                                    nullptr,                      update_flower,                nullptr,                         nullptr,                              draw_flower},
+	/* OBJ_CAMERA_REGION */             {OBJECT_TYPE_EDITOR_ONLY,                              nullptr,                      nullptr,                      nullptr,                         nullptr,                              draw_camera_region},
+	/* OBJ_SIGN_POST */                 {0,                                                    nullptr,                      update_sign_post,             nullptr,                         nullptr,                              draw_sign_post},
+	/* OBJ_INVINCIBILITY_SPARKLE */     {0,                                                    nullptr,                      update_invincibility_sparkle, nullptr,                         nullptr,                              nullptr}, // drawn with the player
+	/* OBJ_FORCE_SPIN */                {OBJECT_TYPE_NONSOLID | OBJECT_TYPE_EDITOR_ONLY,       nullptr,                      nullptr,                      nullptr,                         player_touch_force_spin,              draw_force_spin},
+};
+
+static_assert(ArrayLength(object_types) == NUM_OBJ_TYPES, "Every ObjType needs an entry in object_types.");
+
+static const Object_Type_Info& get_object_type_info(ObjType type) {
+	Assert(type >= 0 && type < NUM_OBJ_TYPES);
+	return object_types[type];
 }
 
-static void player_draw(Player* p) {
+static void player_draw(Player* p, vec4 color = color_white) {
 	// draw player
 
 	int frame_index = p->frame_index;
@@ -3912,17 +4960,10 @@ static void player_draw(Player* p) {
 	if (!dont_draw) {
 		set_shader(get_shader(shd_palette).id);
 
-		glUniform1i(glGetUniformLocation(get_shader(shd_palette).id, "u_Palette"), 1);
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, get_texture(tex_sonic_palette).id);
-
 		int palette_index = 1;
+		set_palette(get_texture(tex_sonic_palette), palette_index);
 
-		glUniform1f(glGetUniformLocation(get_shader(shd_palette).id, "u_PaletteIndex"),  palette_index);
-		glUniform1f(glGetUniformLocation(get_shader(shd_palette).id, "u_PaletteWidth"),  get_texture(tex_sonic_palette).width);
-		glUniform1f(glGetUniformLocation(get_shader(shd_palette).id, "u_PaletteHeight"), get_texture(tex_sonic_palette).height);
-
-		draw_sprite(s, frame_index, floor(p->pos), {p->facing, 1}, angle);
+		draw_sprite(s, frame_index, floor(p->pos), {p->facing, 1}, angle, color);
 
 		reset_shader();
 	}
@@ -3938,18 +4979,18 @@ static void player_draw(Player* p) {
 	}
 }
 
-static void draw_eez_background_old() {
+static void draw_eez_background_old(Game* g) {
 	render_clear_color(get_color(0x01abe8ff));
 
 	auto draw_part = [&](float bg_height, float bg_pos_y, const Texture& t, Rect src, float parallax, float time_mul) -> void {
 		vec2 pos;
-		pos.x = game.camera_pos.x * parallax + game.time_seconds * time_mul;
-		pos.y = lerp(0.0f, game.tm.height * 16.0f - bg_height, game.camera_pos.y / (game.tm.height * 16.0f - window.game_height));
+		pos.x = g->camera_pos.x * parallax + g->time_seconds * time_mul;
+		pos.y = lerp(0.0f, g->tm.height * 16.0f - bg_height, g->camera_pos.y / (g->tm.height * 16.0f - window.game_height));
 
 		pos.y += src.y;
 		pos.y += bg_pos_y;
 
-		while (pos.x + t.width < game.camera_pos.x) {
+		while (pos.x + t.width < g->camera_pos.x) {
 			pos.x += t.width;
 		}
 
@@ -3957,7 +4998,7 @@ static void draw_eez_background_old() {
 
 		draw_texture(t, src, pos);
 
-		if (pos.x + t.width < game.camera_pos.x + window.game_width) {
+		if (pos.x + t.width < g->camera_pos.x + window.game_width) {
 			pos.x += t.width;
 			draw_texture(t, src, pos);
 		}
@@ -3971,10 +5012,10 @@ static void draw_eez_background_old() {
 	set_shader(get_shader(shd_sine).id);
 
 	{
-		glUniform1f(glGetUniformLocation(get_shader(shd_sine).id, "u_Time"), game.time_seconds);
+		glUniform1f(glGetUniformLocation(get_shader(shd_sine).id, "u_Time"), g->time_seconds);
 	}
 	{
-		float water_pos_y_on_screen = game.water_pos_y - game.camera_pos.y;
+		float water_pos_y_on_screen = g->water_pos_y - g->camera_pos.y;
 		glUniform1f(glGetUniformLocation(get_shader(shd_sine).id, "u_WaterPosY"), water_pos_y_on_screen);
 	}
 
@@ -3995,13 +5036,30 @@ static void draw_eez_background_old() {
 	reset_shader();
 }
 
-static void draw_eez_background() {
+// 
+// Layers for "Game::render_queue", back to front. Passes that have to keep their
+// order inside a layer use priorities.
+// 
+enum {
+	DRAW_LAYER_BACKGROUND,
+	DRAW_LAYER_TILES_D,
+	DRAW_LAYER_PLAYER_LOW,
+	DRAW_LAYER_TILES_A,
+	DRAW_LAYER_OBJECTS, // batched by texture, only objects that overlap keep their order
+	DRAW_LAYER_PLAYER,
+	DRAW_LAYER_TILES_C,
+	DRAW_LAYER_EFFECTS,
+	DRAW_LAYER_PLAYER_HIGH,
+	DRAW_LAYER_DEBUG,
+};
+
+static void draw_eez_background(Game* g) {
 	auto draw_parallax = [&](const Texture& t, float rel_x, float rel_y) {
 		vec2 pos;
-		pos.x = game.camera_pos.x * rel_x;
-		pos.y = game.camera_pos.y * rel_y;
+		pos.x = g->camera_pos.x * rel_x;
+		pos.y = g->camera_pos.y * rel_y;
 
-		while (pos.x + t.width < game.camera_pos.x) {
+		while (pos.x + t.width < g->camera_pos.x) {
 			pos.x += t.width;
 		}
 
@@ -4009,19 +5067,20 @@ static void draw_eez_background() {
 
 		draw_texture(t, {}, pos);
 
-		if (pos.x + t.width < game.camera_pos.x + window.game_width) {
+		if (pos.x + t.width < g->camera_pos.x + window.game_width) {
 			pos.x += t.width;
 			draw_texture(t, {}, pos);
 		}
 	};
 
-	float room_height = game.tm.height * 16;
+	float room_height = g->tm.height * 16;
 
 	{
 		u32 tex = tex_back_EE_highbg2;
 		int w = get_texture(tex).width;
 		int h = get_texture(tex).height;
 		float rel_y = (room_height - h) / (room_height - window.game_height);
+		set_render_priority(0);
 		draw_parallax(get_texture(tex), 1 - 0.02, rel_y);
 	}
 
@@ -4030,6 +5089,7 @@ static void draw_eez_background() {
 		int w = get_texture(tex).width;
 		int h = get_texture(tex).height;
 		float rel_y = (room_height - h) / (room_height - window.game_height);
+		set_render_priority(1);
 		draw_parallax(get_texture(tex), 1 - 0.18, rel_y);
 	}
 
@@ -4038,11 +5098,62 @@ static void draw_eez_background() {
 		int w = get_texture(tex).width;
 		int h = get_texture(tex).height;
 		float rel_y = (room_height - h) / (room_height - window.game_height);
+		set_render_priority(2);
 		draw_parallax(get_texture(tex), 1 - 0.35, rel_y);
 	}
 }
 
+static vec2 interpolate_pos(vec2 prev_pos, vec2 pos, float t) {
+	// don't interpolate teleports and objects that were created during the last update
+	if (fabsf(pos.x - prev_pos.x) > 64 || fabsf(pos.y - prev_pos.y) > 64) {
+		return pos;
+	}
+
+	return lerp(prev_pos, pos, t);
+}
+
 void Game::draw(float delta) {
+	// 
+	// Draw in between the previous and the current update (see "window.interp_t").
+	// Positions are swapped out for the interpolated ones and put back at the end.
+	// 
+	update_object_derived(this);
+
+	// only the objects in the activation window are drawn
+	array<Object> active_level_objects;
+	array<Object> spawned_objects;
+	get_active_objects(this, &active_level_objects, &spawned_objects);
+
+	vec2 real_camera_pos = camera_pos;
+	vec2 real_player_pos = player.pos;
+	auto real_object_pos = allocate_bump_array<vec2>(active_level_objects.count + spawned_objects.count, get_temp_allocator());
+
+	{
+		float t = window.interp_t;
+
+		camera_pos = floor(interpolate_pos(prev_camera_pos, camera_pos, t));
+		player.pos = interpolate_pos(player.prev_pos, player.pos, t);
+
+		For (it, active_level_objects) {
+			array_add(&real_object_pos, it->pos);
+			it->pos = interpolate_pos(get_object_derived(this, it)->prev_pos, it->pos, t);
+		}
+
+		For (it, spawned_objects) {
+			array_add(&real_object_pos, it->pos);
+			it->pos = interpolate_pos(get_object_derived(this, it)->prev_pos, it->pos, t);
+		}
+	}
+
+	defer {
+		camera_pos = real_camera_pos;
+		player.pos = real_player_pos;
+
+		size_t i = 0;
+		For (it, active_level_objects) it->pos = real_object_pos[i++];
+		For (it, spawned_objects)      it->pos = real_object_pos[i++];
+	};
+
 	set_view_mat(get_translation({-camera_pos.x, -camera_pos.y, 0}));
 	// don't need to reset view mat since we do that later for the ui
 	// defer { set_view_mat(get_identity()); };
@@ -4050,9 +5161,15 @@ void Game::draw(float delta) {
 	// glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 	// defer { glPolygonMode(GL_FRONT_AND_BACK, GL_FILL); };
 
+	// ends before the ui
+	if (render_queue) {
+		begin_render_queue();
+	}
+
 	// draw bg
 	{
-		draw_eez_background();
+		set_render_layer(DRAW_LAYER_BACKGROUND);
+		draw_eez_background(this);
 	}
 
 	int xfrom = clamp((int)camera_pos.x / 16, 0, tm.width  - 1);
@@ -4061,21 +5178,43 @@ void Game::draw(float delta) {
 	int xto = clamp((int)(camera_pos.x + window.game_width  + 15) / 16, 0, tm.width);
 	int yto = clamp((int)(camera_pos.y + window.game_height + 15) / 16, 0, tm.height);
 
+	auto draw_layer = [&](int layer_index) {
+		if (tilemap_shader) {
+			draw_tilemap_layer_shader(tm, layer_index, tileset_texture, xfrom, yfrom, xto, yto, color_white);
+		} else {
+			draw_tilemap_layer(tm, layer_index, tileset_texture, xfrom, yfrom, xto, yto, color_white);
+		}
+	};
+
 	// draw layer D
-	draw_tilemap_layer(tm, 3, tileset_texture, xfrom, yfrom, xto, yto, color_white);
+	set_render_layer(DRAW_LAYER_TILES_D);
+	draw_layer(3);
 
+	set_render_layer(DRAW_LAYER_PLAYER_LOW);
 	if (player.priority == 0) player_draw(&player);
 
 	// draw layer A
-	draw_tilemap_layer(tm, 0, tileset_texture, xfrom, yfrom, xto, yto, color_white);
+	set_render_layer(DRAW_LAYER_TILES_A);
+	draw_layer(0);
 
 	// draw objects
-	draw_objects(objects, time_frames, false, true);
+	set_render_layer(DRAW_LAYER_OBJECTS);
+	draw_objects(active_level_objects, time_frames, false, true);
+	draw_objects(spawned_objects,      time_frames, false, true);
+
+	set_render_layer(DRAW_LAYER_PLAYER);
+
+	// the other player in netplay
+	if (netplay.state == NETPLAY_RUNNING) {
+		player_draw(&netplay.remote_game.player, {1, 1, 1, 0.5f});
+	}
 
+	set_render_priority(1);
 	if (player.priority == 1) player_draw(&player);
 
 	// draw invincibility sparkles
-	For (it, game.objects) {
+	set_render_priority(2);
+	For (it, spawned_objects) {
 		switch (it->type) {
 			case OBJ_INVINCIBILITY_SPARKLE: {
 				const Sprite& s = get_object_sprite(it->type);
@@ -4104,8 +5243,9 @@ void Game::draw(float delta) {
 	}
 
 	// draw player shield
+	set_render_priority(3);
 	if (player.has_shield && player.invincibility == 0) {
-		int frame = game.time_frames;
+		int frame = time_frames;
 		if (frame % 4 >= 2) {
 			const Sprite& s = get_sprite(spr_shield);
 			frame /= 4;
@@ -4123,7 +5263,10 @@ void Game::draw(float delta) {
 	}
 
 	// draw layer C
-	draw_tilemap_layer(tm, 2, tileset_texture, xfrom, yfrom, xto, yto, color_white);
+	set_render_layer(DRAW_LAYER_TILES_C);
+	draw_layer(2);
+
+	set_render_layer(DRAW_LAYER_EFFECTS);
 
 	// show_height
 #ifdef DEVELOPER
@@ -4160,13 +5303,16 @@ void Game::draw(float delta) {
 #endif
 
 	// draw debug rects
+	set_render_priority(1);
 	For (it, debug_rects) draw_rectangle_outline(*it, color_red);
 	debug_rects.count = 0;
 
 	// draw particles
-	draw_particles(delta);
+	set_render_priority(2);
+	draw_particles(&particles, delta);
 
 	// draw water
+	set_render_priority(3);
 	{
 		vec4 color = get_color(50, 255, 255, 100);
 
@@ -4180,6 +5326,7 @@ void Game::draw(float delta) {
 	}
 
 	// draw water surface
+	set_render_priority(4);
 	{
 		const Sprite& s = get_sprite(spr_water_surface);
 
@@ -4204,8 +5351,11 @@ void Game::draw(float delta) {
 		}
 	}
 
+	set_render_layer(DRAW_LAYER_PLAYER_HIGH);
 	if (player.priority == 2) player_draw(&player);
 
+	set_render_layer(DRAW_LAYER_DEBUG);
+
 	// draw object hitboxes
 	if (show_hitboxes) {
 		For (it, objects) {
@@ -4303,20 +5453,24 @@ void Game::draw(float delta) {
 		SensorResult res;
 		vec2 pos = floor(input.mouse_world_pos + camera_pos);
 
-		res = sensor_check_up(pos, player.layer);
+		res = sensor_check<DIR_UP>(this, pos, player.layer);
 		draw_line(pos, pos + vec2{0, -res.dist}, color_blue);
 
-		res = sensor_check_left(pos, player.layer);
+		res = sensor_check<DIR_LEFT>(this, pos, player.layer);
 		draw_line(pos, pos + vec2{-res.dist, 0}, color_blue);
 
-		res = sensor_check_down(pos, player.layer);
+		res = sensor_check<DIR_DOWN>(this, pos, player.layer);
 		draw_line(pos, pos + vec2{0, res.dist}, color_red);
 
-		res = sensor_check_right(pos, player.layer);
+		res = sensor_check<DIR_RIGHT>(this, pos, player.layer);
 		draw_line(pos, pos + vec2{res.dist, 0}, color_red);
 	}
 #endif
 
+	if (render_queue) {
+		end_render_queue();
+	}
+
 	// :ui
 	set_view_mat(get_identity());
 
@@ -4426,7 +5580,7 @@ void Game::draw(float delta) {
 				if (player.state == STATE_DEBUG) {
 					str = tprintf("%8d", (int)player.pos.x);
 				} else {
-					str = tprintf("%d", program.player_score);
+					str = tprintf("%d", player_score);
 				}
 
 				draw_text(get_font(fnt_hud), str, pos, HALIGN_RIGHT);
@@ -4473,7 +5627,7 @@ void Game::draw(float delta) {
 			pos.x += 25;
 			pos.y += 5;
 
-			string str = tprintf("%d", program.player_lives);
+			string str = tprintf("%d", player_lives);
 			draw_text(get_font(fnt_hud), str, pos);
 		}
 	}
@@ -4700,24 +5854,129 @@ void free_tilemap(Tilemap* tm) {
 	free(tm->tiles_c.data);
 	free(tm->tiles_d.data);
 
+	free(tm->collision_a.cells.data);
+	free(tm->collision_b.cells.data);
+
+	free_tile_chunks(tm);
+
+	// every tilemap shares them, another one grows them again
+	free_tile_job_buffers();
+
 	*tm = {};
 }
 
-void free_tileset(Tileset* ts) {
-	free(ts->heights.data);
-	free(ts->widths.data);
-	free(ts->angles.data);
+static void compile_collision_layer(Collision_Layer* layer, array<Tile> tiles, int width, int height, u32 num_tiles, char name) {
+	free(layer->cells.data);
 
-	*ts = {};
-}
+	layer->stride = width + 2 * COLLISION_BORDER;
+	layer->cells = calloc_array<u32>(layer->stride * (height + 2 * COLLISION_BORDER));
+	layer->num_tiles = num_tiles;
 
-void read_tilemap_old_format(Tilemap* tm, const char* fname) {
-	free_tilemap(tm);
+	int invalid = 0;
 
-	SDL_RWops* f = SDL_RWFromFile(fname, "rb");
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			Tile tile = tiles[x + y * width];
+			if (tile.index >= num_tiles && (tile.top_solid || tile.lrb_solid)) {
+				invalid++;
+			}
 
-	if (!f) {
-		log_error("Couldn't open old tilemap \"%s\".", fname);
+			layer->cells[(x + COLLISION_BORDER) + (y + COLLISION_BORDER) * layer->stride] = compile_collision_cell(tile, num_tiles);
+		}
+	}
+
+	if (invalid > 0) {
+		log_warn("%d solid tiles in layer %c are past the end of the tileset (%u tiles), they won't collide.", invalid, name, num_tiles);
+	}
+}
+
+void compile_collision_layers(Tilemap* tm, const Tileset& ts) {
+	// both tables have to cover the tile
+	u32 num_tiles = (u32) min(ts.heights.count / 16, ts.angles.count);
+	num_tiles = min(num_tiles, (u32) (ts.sensor_heights.count / (NUM_DIRS * 4 * 16)));
+
+	double t = get_time();
+
+	compile_collision_layer(&tm->collision_a, tm->tiles_a, tm->width, tm->height, num_tiles, 'A');
+	compile_collision_layer(&tm->collision_b, tm->tiles_b, tm->width, tm->height, num_tiles, 'B');
+
+	log_info("Compiled collision layers (%d x %d) in %.2fms.", tm->width, tm->height, (get_time() - t) * 1000.0);
+}
+
+// 
+// Decodes the height of a tile at "coord" the slow way, the way the sensors used to on every probe.
+// "coord" is x for vertical sensors and y for horizontal ones.
+// 
+// Heights of 0xF0 and up (and 16) are solid from the other side of the tile, so a sensor
+// that looks at the tile upside down (because of the flip or because it points up or left)
+// sees "16 - (h - 0xF0)" instead.
+// 
+template <Direction dir>
+static int decode_sensor_height(const Tileset& ts, int tile_index, bool hflip, bool vflip, int coord) {
+	bool vertical = (dir == DIR_DOWN || dir == DIR_UP);
+
+	array<u8> heights = vertical ? get_tile_heights(ts, tile_index) : get_tile_widths(ts, tile_index);
+
+	bool reverse     = vertical ? hflip : vflip;
+	bool upside_down = vertical ? vflip : hflip;
+	if (dir == DIR_UP || dir == DIR_LEFT) {
+		upside_down = !upside_down;
+	}
+
+	int h = heights[reverse ? (15 - coord % 16) : (coord % 16)];
+
+	if (upside_down) {
+		if (h >= 0xF0) return 16 - (h - 0xF0);
+		if (h == 16) return 16;
+		return 0;
+	} else {
+		if (h <= 0x10) return h;
+		return 0;
+	}
+}
+
+template <Direction dir>
+static void build_sensor_heights_for_direction(Tileset* ts, int tile_count) {
+	for (int tile_index = 0; tile_index < tile_count; tile_index++) {
+		for (int flip = 0; flip < 4; flip++) {
+			for (int coord = 0; coord < 16; coord++) {
+				int h = decode_sensor_height<dir>(*ts, tile_index, flip & 1, flip & 2, coord);
+				ts->sensor_heights[get_sensor_height_index(tile_index, dir, flip, coord)] = (u8) h;
+			}
+		}
+	}
+}
+
+// Has to be called after the heights or widths change.
+static void build_sensor_heights(Tileset* ts) {
+	int tile_count = (int) ts->heights.count / 16;
+	Assert(ts->widths.count == tile_count * 16);
+
+	free(ts->sensor_heights.data);
+	ts->sensor_heights = calloc_array<u8>(tile_count * NUM_DIRS * 4 * 16);
+
+	build_sensor_heights_for_direction<DIR_RIGHT>(ts, tile_count);
+	build_sensor_heights_for_direction<DIR_UP>   (ts, tile_count);
+	build_sensor_heights_for_direction<DIR_LEFT> (ts, tile_count);
+	build_sensor_heights_for_direction<DIR_DOWN> (ts, tile_count);
+}
+
+void free_tileset(Tileset* ts) {
+	free(ts->heights.data);
+	free(ts->widths.data);
+	free(ts->angles.data);
+	free(ts->sensor_heights.data);
+
+	*ts = {};
+}
+
+void read_tilemap_old_format(Tilemap* tm, const char* fname) {
+	free_tilemap(tm);
+
+	SDL_RWops* f = SDL_RWFromFile(fname, "rb");
+
+	if (!f) {
+		log_error("Couldn't open old tilemap \"%s\".", fname);
 		return;
 	}
 
@@ -4777,6 +6036,8 @@ void read_tilemap_old_format(Tilemap* tm, const char* fname) {
 		tm->tiles_b[i].top_solid = old_tiles_b[i].top_solid;
 		tm->tiles_b[i].lrb_solid = old_tiles_b[i].left_right_bottom_solid;
 	}
+
+	alloc_tile_chunks(tm);
 }
 
 void read_tileset_old_format(Tileset* ts, const char* fname) {
@@ -4804,6 +6065,8 @@ void read_tileset_old_format(Tileset* ts, const char* fname) {
 	SDL_RWread(f, ts->heights.data, 16 * sizeof(ts->heights[0]), tile_count_);
 	SDL_RWread(f, ts->widths.data,  16 * sizeof(ts->widths[0]), tile_count_);
 	SDL_RWread(f, ts->angles.data,  sizeof(ts->angles[0]), tile_count_);
+
+	build_sensor_heights(ts);
 }
 
 void write_tilemap(const Tilemap& tm, const char* fname) {
@@ -4945,6 +6208,8 @@ bool read_tilemap(Tilemap* tm, const char* fname) {
 		}
 	}
 
+	alloc_tile_chunks(tm);
+
 	return true;
 }
 
@@ -4986,6 +6251,8 @@ void read_tileset(Tileset* ts, const char* fname) {
 	ts->heights = heights;
 	ts->widths = widths;
 	ts->angles = angles;
+
+	build_sensor_heights(ts);
 }
 
 void write_objects(array<Object> objects, const char* fname) {
@@ -5372,17 +6639,8 @@ void gen_heightmap_texture(Texture* heightmap, const Tileset& ts, const Texture&
 		}
 	}
 
-	glGenTextures(1, &heightmap->id);
-	glBindTexture(GL_TEXTURE_2D, heightmap->id);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, heightmap->width, heightmap->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, surf->pixels);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
+	// through the renderer, so that it works with the software renderer too
+	*heightmap = load_texture((u8*) surf->pixels, heightmap->width, heightmap->height, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_RGBA);
 }
 
 void gen_widthmap_texture(Texture* widthmap, const Tileset& ts, const Texture& tileset_texture) {
@@ -5426,17 +6684,7 @@ void gen_widthmap_texture(Texture* widthmap, const Tileset& ts, const Texture& t
 		}
 	}
 
-	glGenTextures(1, &widthmap->id);
-	glBindTexture(GL_TEXTURE_2D, widthmap->id);
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, widthmap->width, widthmap->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, wsurf->pixels);
-
-	glBindTexture(GL_TEXTURE_2D, 0);
+	*widthmap = load_texture((u8*) wsurf->pixels, widthmap->width, widthmap->height, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_RGBA);
 }
 
 const Sprite& get_object_sprite(ObjType type) {
@@ -5504,25 +6752,958 @@ vec2 get_object_size(const Object& o) {
 	return {s.width, s.height};
 }
 
-template <typename T>
-static T* binary_search(array<T> arr, instance_id id) {
-	isize left = 0;
-	isize right = (isize)arr.count - 1;
+u64 Game::get_state_hash() {
+	u64 hash = FNV1A_OFFSET_BASIS;
 
-	while (left <= right) {
-		isize middle = (left + right) / 2;
-		if (arr[middle].id < id) {
-			left = middle + 1;
-		} else if (arr[middle].id > id) {
-			right = middle - 1;
+	hash = hash_fnv1a(&player,       sizeof(player),       hash);
+	hash = hash_fnv1a(&player_time,  sizeof(player_time),  hash);
+	hash = hash_fnv1a(&player_rings, sizeof(player_rings), hash);
+	hash = hash_fnv1a(&camera_pos,   sizeof(camera_pos),   hash);
+	hash = hash_fnv1a(&time_frames,  sizeof(time_frames),  hash);
+
+	hash = hash_fnv1a(&objects.count, sizeof(objects.count), hash);
+	hash = hash_fnv1a(objects.data, objects.count * sizeof(Object), hash);
+
+	return hash;
+}
+
+void save_state(Game* g, Game_State* state) {
+	if (!state->arena.data) {
+		state->arena = allocate_arena(g->arena.capacity, get_libc_allocator());
+	}
+
+	Assert(state->arena.capacity == g->arena.capacity);
+
+	state->game = *g;
+
+	// copy the used parts of the arrays to the same offsets
+	size_t objects_offset   = (u8*)g->objects.data      - g->arena.data;
+	size_t slots_offset     = (u8*)g->object_slots.data - g->arena.data;
+	size_t particles_offset = (u8*)g->particles.data    - g->arena.data;
+
+	memcpy(state->arena.data + objects_offset,   g->objects.data,      g->objects.count      * sizeof(Object));
+	memcpy(state->arena.data + slots_offset,     g->object_slots.data, g->object_slots.count * sizeof(Object_Slot));
+	memcpy(state->arena.data + particles_offset, g->particles.data,    g->particles.count    * sizeof(Particle));
+}
+
+bool load_state(Game* g, const Game_State& state) {
+	// pointers to level data have to be the same
+	if (state.game.session != g->session) {
+		log_error("Couldn't load state: it was saved in a different level session.");
+		return false;
+	}
+
+	restore_game(g, state.game);
+
+	size_t objects_offset   = (u8*)g->objects.data      - g->arena.data;
+	size_t slots_offset     = (u8*)g->object_slots.data - g->arena.data;
+	size_t particles_offset = (u8*)g->particles.data    - g->arena.data;
+
+	memcpy(g->objects.data,      state.arena.data + objects_offset,   g->objects.count      * sizeof(Object));
+	memcpy(g->object_slots.data, state.arena.data + slots_offset,     g->object_slots.count * sizeof(Object_Slot));
+	memcpy(g->particles.data,    state.arena.data + particles_offset, g->particles.count    * sizeof(Particle));
+
+	g->object_derived_stale = true;
+
+	return true;
+}
+
+void free_state(Game_State* state) {
+	afree(state->arena.data, state->arena.capacity, get_libc_allocator());
+	*state = {};
+}
+
+void restore_game(Game* g, const Game& src) {
+	// keep debug views
+	bool collision_test     = g->collision_test;
+	bool show_height        = g->show_height;
+	bool show_width         = g->show_width;
+	bool show_player_hitbox = g->show_player_hitbox;
+	bool show_hitboxes      = g->show_hitboxes;
+	bool tilemap_shader     = g->tilemap_shader;
+	bool render_queue       = g->render_queue;
+
+	// these belong to "g", the caller rebuilds them
+	bump_array<Object_Derived> object_derived = g->object_derived;
+	Object_Grid object_grid = g->object_grid;
+	Ring_Batch* ring_batch = g->ring_batch;
+
+	*g = src;
+
+	g->object_derived = object_derived;
+	g->object_grid = object_grid;
+	g->ring_batch = ring_batch;
+
+	g->collision_test     = collision_test;
+	g->show_height        = show_height;
+	g->show_width         = show_width;
+	g->show_player_hitbox = show_player_hitbox;
+	g->show_hitboxes      = show_hitboxes;
+	g->tilemap_shader     = tilemap_shader;
+	g->render_queue       = render_queue;
+}
+
+// 
+// Sensor benchmark.
+// 
+
+struct Sensor_Probe {
+	vec2 pos;
+	Tile tile;
+	int layer;
+};
+
+template <Direction dir>
+static double time_sensor_heights(const Tileset& ts, array<Sensor_Probe> probes, bool use_table, int* checksum) {
+	int sum = 0;
+	double t = get_time();
+
+	if (use_table) {
+		For (p, probes) {
+			sum += get_sensor_height(ts, p->tile, dir, (dir == DIR_DOWN || dir == DIR_UP) ? (int)p->pos.x : (int)p->pos.y);
+		}
+	} else {
+		For (p, probes) {
+			sum += decode_sensor_height<dir>(ts, p->tile.index, p->tile.hflip, p->tile.vflip, (dir == DIR_DOWN || dir == DIR_UP) ? (int)p->pos.x : (int)p->pos.y);
+		}
+	}
+
+	*checksum += sum;
+	return get_time() - t;
+}
+
+// "sensor_check" the way it read the tile arrays, before the collision layers
+template <Direction dir>
+static SensorResult sensor_check_tiles(const Tileset& ts, const Tilemap& tm, array<Tile> tiles, vec2 pos) {
+	constexpr bool vertical = (dir == DIR_DOWN || dir == DIR_UP);
+	constexpr int  sign     = (dir == DIR_DOWN || dir == DIR_RIGHT) ? 1 : -1;
+
+	auto get_tile = [&](int tile_x, int tile_y) -> Tile {
+		if (!(tile_x >= 0
+			  && tile_x < tm.width
+			  && tile_y >= 0
+			  && tile_y < tm.height))
+		{
+			return {};
+		}
+
+		return tiles.data[tile_x + tile_y * tm.width];
+	};
+
+	auto get_height = [&](Tile tile, int coord) -> int {
+		// only floors can be jumped through from below
+		bool solid = (dir == DIR_DOWN) ? tile.top_solid : tile.lrb_solid;
+		if (!solid) {
+			return 0;
+		}
+
+		return get_sensor_height(ts, tile, dir, coord);
+	};
+
+	SensorResult result = {};
+
+	// 
+	// NOTE: To make this work correctly with negative numbers,
+	// we would have to replace these casts for ix, iy, tile_x, tile_y with floorf's
+	// and replace the modulo operator with calls to wrap()
+	// 
+
+	int ix = max((int)pos.x, 0);
+	int iy = max((int)pos.y, 0);
+
+	int tile_x = pos.x / 16;
+	int tile_y = pos.y / 16;
+
+	int along  = vertical ? iy : ix; // pixel along the sensor
+	int across = vertical ? ix : iy; // column (or row) of the tile's heights
+
+	Tile tile = get_tile(tile_x, tile_y);
+	int height = get_height(tile, across);
+
+	// check the next tile if this one is empty, the previous one if it's full
+	int step = 0;
+	if (height == 0) {
+		step = 1;
+	} else if (height == 16) {
+		step = -1;
+	}
+
+	if (step != 0) {
+		if (vertical) {
+			tile_y += step * sign;
 		} else {
-			return &arr[middle];
+			tile_x += step * sign;
 		}
+
+		tile = get_tile(tile_x, tile_y);
+		height = get_height(tile, across);
+	}
+
+	if (height != 0) {
+		result.tile = tile;
+		result.found = true;
+		result.tile_x = tile_x;
+		result.tile_y = tile_y;
 	}
 
-	return nullptr;
+	// distance to the far side of the pixel's tile, then one tile further or back
+	int to_edge = (sign > 0) ? (15 - along % 16) : (along % 16);
+	result.dist = to_edge + step * 16 - height;
+
+	return result;
 }
 
-Object* Game::find_object(instance_id id) {
-	return binary_search<Object>(objects, id);
+void benchmark_sensors(Game* g, int num_probes) {
+	array<Sensor_Probe> probes = calloc_array<Sensor_Probe>(num_probes);
+	defer { free(probes.data); };
+
+	// random points in the level, the same ones every time
+	u32 random_state = 1;
+	auto random = [&]() {
+		u32 x = random_state;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		random_state = x;
+		return x;
+	};
+
+	For (p, probes) {
+		p->pos.x = (float) (random() % (g->tm.width  * 16));
+		p->pos.y = (float) (random() % (g->tm.height * 16));
+		p->layer = random() % 2;
+		p->tile = get_tile_safe(g->tm, (int)p->pos.x / 16, (int)p->pos.y / 16, p->layer);
+	}
+
+	log_info("Sensor benchmark: %d probes.", num_probes);
+
+	// decoding one height, like the sensors did before the tables
+	{
+		int checksum_decode = 0;
+		int checksum_table  = 0;
+
+		double decode_time = 0;
+		decode_time += time_sensor_heights<DIR_RIGHT>(g->ts, probes, false, &checksum_decode);
+		decode_time += time_sensor_heights<DIR_UP>   (g->ts, probes, false, &checksum_decode);
+		decode_time += time_sensor_heights<DIR_LEFT> (g->ts, probes, false, &checksum_decode);
+		decode_time += time_sensor_heights<DIR_DOWN> (g->ts, probes, false, &checksum_decode);
+
+		double table_time = 0;
+		table_time += time_sensor_heights<DIR_RIGHT>(g->ts, probes, true, &checksum_table);
+		table_time += time_sensor_heights<DIR_UP>   (g->ts, probes, true, &checksum_table);
+		table_time += time_sensor_heights<DIR_LEFT> (g->ts, probes, true, &checksum_table);
+		table_time += time_sensor_heights<DIR_DOWN> (g->ts, probes, true, &checksum_table);
+
+		if (checksum_decode != checksum_table) {
+			log_error("Sensor height tables don't match the tileset (checksum %d, expected %d).", checksum_table, checksum_decode);
+		}
+
+		double total = 4.0 * num_probes;
+		log_info("Height decode: %.1f M probes/s", total / decode_time / 1'000'000.0);
+		log_info("Height tables: %.1f M probes/s (%.2fx)", total / table_time / 1'000'000.0, decode_time / table_time);
+	}
+
+	// whole sensor checks
+	{
+		int checksum = 0;
+		double t = get_time();
+
+		For (p, probes) {
+			checksum += sensor_check<DIR_DOWN> (g, p->pos, p->layer).dist;
+			checksum += sensor_check<DIR_RIGHT>(g, p->pos, p->layer).dist;
+			checksum += sensor_check<DIR_UP>   (g, p->pos, p->layer).dist;
+			checksum += sensor_check<DIR_LEFT> (g, p->pos, p->layer).dist;
+		}
+
+		double took = get_time() - t;
+
+		int checksum_tiles = 0;
+		t = get_time();
+
+		For (p, probes) {
+			array<Tile> tiles = get_tiles_array(g->tm, p->layer);
+			checksum_tiles += sensor_check_tiles<DIR_DOWN> (g->ts, g->tm, tiles, p->pos).dist;
+			checksum_tiles += sensor_check_tiles<DIR_RIGHT>(g->ts, g->tm, tiles, p->pos).dist;
+			checksum_tiles += sensor_check_tiles<DIR_UP>   (g->ts, g->tm, tiles, p->pos).dist;
+			checksum_tiles += sensor_check_tiles<DIR_LEFT> (g->ts, g->tm, tiles, p->pos).dist;
+		}
+
+		double tiles_time = get_time() - t;
+
+		if (checksum != checksum_tiles) {
+			log_error("Collision layers don't match the tile arrays (checksum %d, expected %d).", checksum, checksum_tiles);
+		}
+
+		log_info("Tile arrays:   %.1f M probes/s", 4.0 * num_probes / tiles_time / 1'000'000.0);
+		log_info("Sensor checks: %.1f M probes/s (%.2fx, checksum %d)", 4.0 * num_probes / took / 1'000'000.0, tiles_time / took, checksum);
+
+		// what a probe can touch, the tile arrays also have layers C and D in between
+		size_t tiles_size     = (g->tm.tiles_a.count + g->tm.tiles_b.count) * sizeof(Tile);
+		size_t collision_size = (g->tm.collision_a.cells.count + g->tm.collision_b.cells.count) * sizeof(u32);
+		log_info("Collision data: %zu KB compiled, %zu KB of tiles", collision_size / 1024, tiles_size / 1024);
+	}
+
+	// ground sensors A and B, 18 pixels apart
+	{
+		vec2 offset = {18, 0};
+
+		int checksum_single = 0;
+		double t = get_time();
+
+		// the tiles too, the player uses them
+		For (p, probes) {
+			SensorResult res_a = sensor_check<DIR_DOWN>(g, p->pos,          p->layer);
+			SensorResult res_b = sensor_check<DIR_DOWN>(g, p->pos + offset, p->layer);
+
+			checksum_single += res_a.dist + res_a.tile.index;
+			checksum_single += res_b.dist + res_b.tile.index;
+		}
+
+		double single_time = get_time() - t;
+
+		int checksum_pair = 0;
+		t = get_time();
+
+		For (p, probes) {
+			SensorResult res_a;
+			SensorResult res_b;
+			sensor_check_pair<DIR_DOWN, DIR_DOWN>(g, p->pos, p->pos + offset, p->layer, &res_a, &res_b);
+
+			checksum_pair += res_a.dist + res_a.tile.index;
+			checksum_pair += res_b.dist + res_b.tile.index;
+		}
+
+		double pair_time = get_time() - t;
+
+		if (checksum_single != checksum_pair) {
+			log_error("Sensor pairs don't match single checks (checksum %d, expected %d).", checksum_pair, checksum_single);
+		}
+
+		log_info("Single A/B:    %.1f M probes/s", 2.0 * num_probes / single_time / 1'000'000.0);
+		log_info("Paired A/B:    %.1f M probes/s (%.2fx)", 2.0 * num_probes / pair_time / 1'000'000.0, single_time / pair_time);
+	}
+
+	// only the distances, on layer A, like the dropped rings
+	{
+		array<float> x    = calloc_array<float>(num_probes);
+		array<float> y    = calloc_array<float>(num_probes);
+		array<int> single = calloc_array<int>(num_probes);
+		array<int> batch  = calloc_array<int>(num_probes);
+		defer {
+			free(x.data);
+			free(y.data);
+			free(single.data);
+			free(batch.data);
+		};
+
+		for (int i = 0; i < num_probes; i++) {
+			x[i] = probes[i].pos.x;
+			y[i] = probes[i].pos.y;
+		}
+
+		double single_time = 0;
+		double batch_time = 0;
+		int mismatches = 0;
+
+		auto compare = [&](auto check_single, auto check_batch) {
+			double t = get_time();
+			for (int i = 0; i < num_probes; i++) {
+				single[i] = check_single(vec2{x[i], y[i]});
+			}
+			single_time += get_time() - t;
+
+			t = get_time();
+			check_batch();
+			batch_time += get_time() - t;
+
+			for (int i = 0; i < num_probes; i++) {
+				mismatches += (single[i] != batch[i]);
+			}
+		};
+
+		compare([&](vec2 pos) { return sensor_check<DIR_DOWN> (g, pos, 0).dist; }, [&]() { sensor_check_batch<DIR_DOWN> (g, 0, x.data, y.data, num_probes, batch.data); });
+		compare([&](vec2 pos) { return sensor_check<DIR_RIGHT>(g, pos, 0).dist; }, [&]() { sensor_check_batch<DIR_RIGHT>(g, 0, x.data, y.data, num_probes, batch.data); });
+		compare([&](vec2 pos) { return sensor_check<DIR_UP>   (g, pos, 0).dist; }, [&]() { sensor_check_batch<DIR_UP>   (g, 0, x.data, y.data, num_probes, batch.data); });
+		compare([&](vec2 pos) { return sensor_check<DIR_LEFT> (g, pos, 0).dist; }, [&]() { sensor_check_batch<DIR_LEFT> (g, 0, x.data, y.data, num_probes, batch.data); });
+
+		if (mismatches > 0) {
+			log_error("Batched sensor checks don't match single checks (%d of %d distances).", mismatches, 4 * num_probes);
+		}
+
+		log_info("Single dists:  %.1f M probes/s", 4.0 * num_probes / single_time / 1'000'000.0);
+		log_info("Batched dists: %.1f M probes/s (%.2fx)", 4.0 * num_probes / batch_time / 1'000'000.0, single_time / batch_time);
+	}
+}
+
+// 
+// Object removal benchmark.
+// 
+
+// Replaces the level's objects with "num_objects" rings, in rows of 16 all over the level.
+static void make_ring_level(Game* g, int num_objects) {
+	g->objects.count = 0;
+	g->object_slots.count = 0;
+	g->first_free_slot = 0;
+
+	// they're all spawned objects, so the window doesn't skip any
+	g->num_level_objects = 0;
+	g->active_first_id = 0;
+	g->active_last_id = 0;
+	memset(g->level_objects_by_type_offsets, 0, sizeof(g->level_objects_by_type_offsets));
+
+	rebuild_object_derived(g);
+
+	int rows_per_line = max(g->tm.width * 16 / (16 * 24), 1);
+
+	for (int i = 0; i < num_objects; i++) {
+		int row = i / 16;
+
+		Object o = {};
+		o.id = g->next_id++;
+		o.type = OBJ_RING;
+		o.pos.x = (float) ((row % rows_per_line) * 16 * 24 + (i % 16) * 24);
+		o.pos.y = (float) ((row / rows_per_line) * 32 % max(g->tm.height * 16, 1));
+		o.start_pos = o.pos;
+		add_object(g, o);
+	}
+}
+
+// Kills the same objects every time: a row of 16 rings (collecting a line of rings)
+// and 32 scattered ones (dropped rings running out) per frame, until half are gone.
+static double time_object_removal(Game* g, int num_objects, bool compact, u64* checksum, int* num_frames) {
+	// every call gets new ids, the checksum uses them relative to the first one
+	instance_id first_id = g->next_id;
+
+	make_ring_level(g, num_objects);
+
+	u32 random_state = 1;
+	auto random = [&]() {
+		u32 x = random_state;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		random_state = x;
+		return x;
+	};
+
+	double took = 0;
+	int frames = 0;
+
+	while (g->objects.count > (size_t) num_objects / 2) {
+		size_t row = random() % g->objects.count;
+		for (size_t i = row; i < row + 16 && i < g->objects.count; i++) {
+			g->objects[i].flags |= FLAG_INSTANCE_DEAD;
+		}
+
+		Repeat (32) {
+			g->objects[random() % g->objects.count].flags |= FLAG_INSTANCE_DEAD;
+		}
+
+		double t = get_time();
+
+		if (compact) {
+			remove_dead_objects(g);
+		} else {
+			// Like the update loop used to, before the grid and slots. They go stale here,
+			// "make_ring_level" resets them.
+			For (it, g->objects) {
+				if (it->flags & FLAG_INSTANCE_DEAD) {
+					Remove(it, g->objects);
+				}
+			}
+		}
+
+		took += get_time() - t;
+		frames++;
+	}
+
+	u64 hash = FNV1A_OFFSET_BASIS;
+	For (it, g->objects) {
+		if (compact) {
+			Assert(g->get_object(get_object_handle(g, it)) == it);
+		}
+
+		instance_id id = it->id - first_id;
+		hash = hash_fnv1a(&id, sizeof(id), hash);
+	}
+
+	*checksum = hash;
+	*num_frames = frames;
+	return took;
+}
+
+void benchmark_object_removal(Game* g, int num_objects) {
+	num_objects = clamp(num_objects, 1, (int) MAX_OBJECTS);
+
+	log_info("Object removal benchmark: %d rings.", num_objects);
+
+	u64 checksum_remove;
+	u64 checksum_compact;
+	int frames;
+
+	double remove_time  = time_object_removal(g, num_objects, false, &checksum_remove,  &frames);
+	double compact_time = time_object_removal(g, num_objects, true,  &checksum_compact, &frames);
+
+	if (checksum_remove != checksum_compact) {
+		log_error("Compacting left different objects than removing one by one.");
+	}
+
+	log_info("Remove one by one: %.2f us per frame", remove_time  / frames * 1'000'000.0);
+	log_info("Compact:           %.2f us per frame (%.2fx)", compact_time / frames * 1'000'000.0, remove_time / compact_time);
+	log_info("(%d frames, 48 objects removed per frame)", frames);
+}
+
+// 
+// Ring benchmark.
+// 
+
+void benchmark_rings(Game* g, int num_rings) {
+	num_rings = clamp(num_rings, 1, (int) MAX_OBJECTS);
+
+	make_ring_level(g, num_rings);
+
+	log_info("Ring benchmark: %d rings.", num_rings);
+
+	// player rects all over the level, the same ones every time
+	u32 random_state = 1;
+	auto random = [&]() {
+		u32 x = random_state;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		random_state = x;
+		return x;
+	};
+
+	const int num_rects = 1000;
+
+	array<Rectf> rects = calloc_array<Rectf>(num_rects);
+	defer { free(rects.data); };
+
+	For (r, rects) {
+		r->x = (float) (random() % max(g->tm.width  * 16, 1));
+		r->y = (float) (random() % max(g->tm.height * 16, 1));
+		r->w = 18;
+		r->h = 38;
+	}
+
+	// every rect against every ring, so that it doesn't depend on the grid
+	{
+		int hits_single = 0;
+		double t = get_time();
+
+		For (r, rects) {
+			For (it, g->objects) {
+				// like "player_collides_with_nonsolid_object"
+				vec2 size = get_object_size(*it);
+				vec2 pos = it->pos - size / 2.0f;
+				hits_single += rect_vs_rect(*r, {pos.x, pos.y, size.x, size.y});
+			}
+		}
+
+		double single_time = get_time() - t;
+
+		// the positions the grid keeps for the rings, every cell
+		Object_Grid* grid = &g->object_grid;
+		Ring_Batch* batch = g->ring_batch;
+
+		vec2 ring_size = get_ring_size();
+
+		int hits_batch = 0;
+		t = get_time();
+
+		For (r, rects) {
+			for (int i = 0; i < grid->width * grid->height; i++) {
+				const Ring_Cell& cell = grid->ring_cells[i];
+
+				array_resize(&batch->hit, cell.handles.count);
+				test_rings_against_rect(cell.x.data, cell.y.data, batch->hit.data, cell.handles.count, *r, ring_size);
+
+				For (hit, batch->hit) hits_batch += *hit;
+			}
+		}
+
+		double batch_time = get_time() - t;
+
+		if (hits_single != hits_batch) {
+			log_error("Batched ring tests found %d hits, one by one found %d.", hits_batch, hits_single);
+		}
+
+		log_info("Rings one by one: %.2f us per rect", single_time / num_rects * 1'000'000.0);
+		log_info("Rings batched:    %.2f us per rect (%.2fx, %d hits)", batch_time / num_rects * 1'000'000.0, single_time / batch_time, hits_batch);
+	}
+
+	// the whole pass the player makes every frame, with the grid query, standing on rings
+	{
+		Player* p = &g->player;
+		Player saved = *p;
+		defer { *p = saved; };
+
+		// touching doesn't collect, so every position sees the same rings
+		p->ignore_rings = 1'000'000;
+
+		array<vec2> positions = calloc_array<vec2>(num_rects);
+		defer { free(positions.data); };
+
+		For (pos, positions) {
+			*pos = g->objects[random() % g->objects.count].pos;
+		}
+
+		const int passes = 10;
+
+		double t = get_time();
+
+		Repeat (passes) {
+			For (pos, positions) {
+				p->pos = *pos;
+				player_collide_with_nonsolid_objects(g, p);
+			}
+		}
+
+		double took = get_time() - t;
+
+		log_info("Player vs rings:  %.2f us per frame (player_collide_with_nonsolid_objects)", took / (passes * num_rects) * 1'000'000.0);
+	}
+
+	// dropped rings, in bursts of 32 all over the level
+	{
+		make_ring_level(g, 0);
+
+		Player* p = &g->player;
+		while (g->objects.count + 32 <= (size_t) num_rings) {
+			p->pos.x = (float) (random() % max(g->tm.width  * 16, 1));
+			p->pos.y = (float) (random() % max(g->tm.height * 16, 1));
+			player_drop_rings(g, p, 32);
+		}
+
+		// they run out after 256 frames
+		const int frames = 256;
+
+		double t = get_time();
+
+		Repeat (frames) {
+			update_dropped_rings(g, 1);
+		}
+
+		double took = get_time() - t;
+
+		log_info("Dropped rings:    %.2f us per frame (%d rings)", took / frames * 1'000'000.0, (int) g->objects.count);
+	}
+}
+
+// 
+// Save state benchmark.
+// 
+
+void benchmark_save_states(Game* g, int num_objects) {
+	num_objects = clamp(num_objects, 1, (int) MAX_OBJECTS);
+
+	make_ring_level(g, num_objects);
+
+	log_info("Save state benchmark: %d objects.", num_objects);
+
+	Game_State state = {};
+	defer { free_state(&state); };
+
+	// the first save allocates
+	save_state(g, &state);
+
+	u64 hash = g->get_state_hash();
+
+	const int iterations = 1000;
+
+	double t = get_time();
+
+	Repeat (iterations) {
+		save_state(g, &state);
+	}
+
+	double save_time = get_time() - t;
+
+	// so that the first load has something to undo
+	For (it, g->objects) it->pos.x += 1;
+	g->player.pos.x += 1;
+
+	t = get_time();
+
+	Repeat (iterations) {
+		load_state(g, state);
+	}
+
+	double load_time = get_time() - t;
+
+	// what the next update does after a load
+	t = get_time();
+
+	Repeat (iterations) {
+		rebuild_object_derived(g);
+	}
+
+	double rebuild_time = get_time() - t;
+
+	if (g->get_state_hash() != hash) {
+		log_error("Loading the state didn't restore the game.");
+	}
+
+	size_t size = sizeof(Game) + g->objects.count * sizeof(Object) + g->object_slots.count * sizeof(Object_Slot) + g->particles.count * sizeof(Particle);
+
+	// the budget that makes rewind and rollback practical
+	const double target = 50;
+
+	log_info("Save: %.2f us (" Size_Fmt ", target %.0f us)", save_time / iterations * 1'000'000.0, Size_Arg(size), target);
+	log_info("Load: %.2f us (target %.0f us)", load_time / iterations * 1'000'000.0, target);
+	log_info("Rebuilding the object grid after a load: %.2f us", rebuild_time / iterations * 1'000'000.0);
+}
+
+// 
+// Software renderer benchmark.
+// 
+
+void benchmark_software_renderer(Game* g, int num_frames) {
+	Assert(renderer.software);
+
+	log_info("Software renderer benchmark: %d frames at %dx%d.", num_frames, window.game_width, window.game_height);
+
+	// the camera pans right from the start, the same frames every time
+	vec2 start_pos = g->camera_pos;
+	float max_x = max(g->tm.width * 16.0f - window.game_width, 0.0f);
+
+	double t = get_time();
+
+	for (int frame = 0; frame < num_frames; frame++) {
+		reset_temporary_storage();
+
+		g->camera_pos.x = fminf(start_pos.x + (float) (frame % 1000), max_x);
+		g->prev_camera_pos = g->camera_pos;
+
+		render_begin_frame(color_black);
+		g->draw(1);
+		render_end_frame();
+	}
+
+	double took = get_time() - t;
+
+	g->camera_pos = start_pos;
+	g->prev_camera_pos = start_pos;
+
+	array<u32> pixels = get_texture_pixels_software(renderer.framebuffer.texture);
+	u64 hash = hash_fnv1a(pixels.data, pixels.count * sizeof(u32), FNV1A_OFFSET_BASIS);
+
+	log_info("%d frames in %fs (%.0f fps), %d draw calls and %d triangles in the last one.",
+			 num_frames, took, num_frames / took, renderer.curr_draw_calls, renderer.curr_total_triangles);
+	log_info("Last frame hash: %016llx", (unsigned long long) hash);
+}
+
+// 
+// Zoomed out editor benchmark.
+// 
+
+void benchmark_editor_tilemap(Game* g, int num_frames) {
+	Assert(renderer.software);
+
+	// the editor's tilemap view at 1280x720 and its smallest zoom, scaled down into the framebuffer
+	const float view_width  = 1280.0f;
+	const float view_height = 720.0f;
+	const float zoom = 0.25f;
+
+	float width  = fminf(view_width  / zoom, g->tm.width  * 16.0f);
+	float height = fminf(view_height / zoom, g->tm.height * 16.0f);
+	float scale  = window.game_width / width;
+
+	int xto = (int) (width  / 16);
+	int yto = (int) (height / 16);
+
+	log_info("Editor tilemap benchmark: %d frames, %dx%d tiles per layer, %d CPU cores.",
+			 num_frames, xto, yto, SDL_GetCPUCount());
+
+	if (SDL_GetCPUCount() < 8) {
+		log_info("More job threads than cores only share the cores, they can't be faster.");
+	}
+
+	auto draw_frames = [&](bool rebuild_chunks) {
+		const Tilemap& tm = g->tm;
+
+		// built once before timing
+		if (!rebuild_chunks) {
+			invalidate_tile_chunks(&g->tm);
+			for (int layer_index : {3, 0, 2}) {
+				draw_tilemap_layer(tm, layer_index, g->tileset_texture, 0, 0, xto, yto, color_white);
+			}
+			break_batch();
+		}
+
+		double t = get_time();
+
+		for (int frame = 0; frame < num_frames; frame++) {
+			reset_temporary_storage();
+
+			if (rebuild_chunks) {
+				invalidate_tile_chunks(&g->tm);
+			}
+
+			render_begin_frame(color_black);
+
+			set_model_mat(glm::scale(mat4{1}, vec3{scale, scale, 1}));
+
+			for (int layer_index : {3, 0, 2}) {
+				draw_tilemap_layer(tm, layer_index, g->tileset_texture, 0, 0, xto, yto, color_white);
+			}
+
+			set_model_mat(get_identity());
+
+			render_end_frame();
+		}
+
+		return (get_time() - t) / num_frames;
+	};
+
+	for (int num_threads : {1, 2, 4, 8}) {
+		init_jobs(num_threads);
+
+		double rebuilt = draw_frames(true);
+		double chunks  = draw_frames(false);
+
+		log_info("%d job threads: rebuilding the chunks %.2f ms, built chunks %.2f ms per frame.",
+				 get_num_job_threads(), rebuilt * 1000.0, chunks * 1000.0);
+
+		deinit_jobs();
+	}
+}
+
+// 
+// Tilemap shader test.
+// 
+// Every view is drawn into two framebuffers, one layer at a time, and read back.
+// The per-tile path is the reference.
+// 
+
+int test_tilemap_shader(Game* g, int num_views) {
+	int width  = window.game_width;
+	int height = window.game_height;
+
+	Framebuffer expected = load_framebuffer(width, height, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_RGBA, false);
+	defer { free_framebuffer(&expected); };
+
+	Framebuffer actual = load_framebuffer(width, height, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_RGBA, false);
+	defer { free_framebuffer(&actual); };
+
+	array<u32> expected_pixels = calloc_array<u32>(width * height);
+	defer { free(expected_pixels.data); };
+
+	array<u32> actual_pixels = calloc_array<u32>(width * height);
+	defer { free(actual_pixels.data); };
+
+	enum Draw_Path {
+		DRAW_TILES,
+		DRAW_CHUNKS,
+		DRAW_SHADER,
+	};
+
+	// camera positions all over the level, the same ones every time
+	u32 random_state = 1;
+	auto random = [&]() {
+		u32 x = random_state;
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		random_state = x;
+		return x;
+	};
+
+	const int layers[] = {3, 0, 2};
+
+	double time_tiles  = 0;
+	double time_chunks = 0;
+	double time_shader = 0;
+
+	int failed_views = 0;
+
+	render_begin_frame({});
+
+	for (int view = 0; view < num_views; view++) {
+		vec2 camera_pos;
+		camera_pos.x = (float) (random() % max(g->tm.width  * 16 - width,  1));
+		camera_pos.y = (float) (random() % max(g->tm.height * 16 - height, 1));
+
+		int xfrom = clamp((int)camera_pos.x / 16, 0, g->tm.width  - 1);
+		int yfrom = clamp((int)camera_pos.y / 16, 0, g->tm.height - 1);
+
+		int xto = clamp((int)(camera_pos.x + width  + 15) / 16, 0, g->tm.width);
+		int yto = clamp((int)(camera_pos.y + height + 15) / 16, 0, g->tm.height);
+
+		int mismatched_chunks = 0;
+		int mismatched_shader = 0;
+
+		for (int layer_index : layers) {
+			auto draw_into = [&](const Framebuffer& f, array<u32> pixels, Draw_Path path) -> double {
+				set_render_target(f);
+				set_view_mat(get_translation({-camera_pos.x, -camera_pos.y, 0}));
+				render_clear_color({});
+
+				double t = get_time();
+
+				switch (path) {
+					case DRAW_TILES: {
+						// without the chunks, the way the layers used to be drawn
+						Tilemap tm = g->tm;
+						tm.chunks = nullptr;
+						draw_tilemap_layer(tm, layer_index, g->tileset_texture, xfrom, yfrom, xto, yto, color_white);
+						break;
+					}
+
+					case DRAW_CHUNKS: {
+						draw_tilemap_layer(g->tm, layer_index, g->tileset_texture, xfrom, yfrom, xto, yto, color_white);
+						break;
+					}
+
+					case DRAW_SHADER: {
+						draw_tilemap_layer_shader(g->tm, layer_index, g->tileset_texture, xfrom, yfrom, xto, yto, color_white);
+						break;
+					}
+				}
+				break_batch();
+
+				double took = get_time() - t;
+
+				glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data);
+				return took;
+			};
+
+			time_tiles += draw_into(expected, expected_pixels, DRAW_TILES);
+
+			time_chunks += draw_into(actual, actual_pixels, DRAW_CHUNKS);
+			for (int i = 0; i < width * height; i++) {
+				mismatched_chunks += (expected_pixels[i] != actual_pixels[i]);
+			}
+
+			time_shader += draw_into(actual, actual_pixels, DRAW_SHADER);
+			for (int i = 0; i < width * height; i++) {
+				mismatched_shader += (expected_pixels[i] != actual_pixels[i]);
+			}
+		}
+
+		if (mismatched_chunks > 0) {
+			log_error("Tilemap chunk test: camera at (%.0f, %.0f): %d pixels don't match.", camera_pos.x, camera_pos.y, mismatched_chunks);
+		}
+
+		if (mismatched_shader > 0) {
+			log_error("Tilemap shader test: camera at (%.0f, %.0f): %d pixels don't match.", camera_pos.x, camera_pos.y, mismatched_shader);
+		}
+
+		if (mismatched_chunks > 0 || mismatched_shader > 0) {
+			failed_views++;
+		}
+	}
+
+	set_view_mat(get_identity());
+	reset_render_target();
+
+	int num_draws = num_views * ArrayLength(layers);
+
+	log_info("Tilemap test: %d of %d views match with the chunks and the shader.", num_views - failed_views, num_views);
+	log_info("Per-tile quads: %f ms per layer (CPU).", time_tiles  / num_draws * 1000.0);
+	log_info("Tile chunks:    %f ms per layer (CPU, building them included).", time_chunks / num_draws * 1000.0);
+	log_info("Tilemap shader: %f ms per layer (CPU).", time_shader / num_draws * 1000.0);
+
+	return failed_views;
 }
@@ -4,6 +4,7 @@
 
 #include "renderer.h"
 #include "font.h"
+#include "particle_system.h"
 
 #define PLAYER_STATE_ENUM(X) \
 	X(STATE_GROUND) \
@@ -46,6 +47,8 @@ struct Player {
 	vec2 pos;
 	vec2 speed;
 
+	vec2 prev_pos; // pos before the last update, for interpolation
+
 	float ground_speed;
 	float ground_angle;
 
@@ -89,6 +92,9 @@ struct Player {
 	float death_timer;
 	int death_state;
 
+	float skid_dust_timer;
+	float sparkle_timer; // for invincibility
+
 	u32 input;
 	u32 input_press;
 	u32 input_release;
@@ -119,10 +125,28 @@ struct Player {
 
 DEFINE_NAMED_ENUM_WITH_VALUES(ObjType, int, OBJ_TYPE_ENUM)
 
+constexpr int NUM_OBJ_TYPES = OBJ_FORCE_SPIN + 1;
+
 typedef u32 instance_id;
 
+// 
+// Refers to an object wherever it is in "Game::objects", see "Game::get_object".
+// The instance id is the generation: id's are never reused, so a handle to a removed
+// object stays invalid after its slot is given to a new object.
+// 
+struct Object_Handle {
+	u32 slot;       // in "Game::object_slots"
+	instance_id id; // 0 for no object
+};
+
+struct Object_Slot {
+	u32 index;      // of the object in "Game::objects", or (next free slot + 1) if the slot is free
+	instance_id id; // 0 if the slot is free
+};
+
 enum {
 	FLAG_INSTANCE_DEAD = 1 << 0,
+	FLAG_INSTANCE_MOUNTED = 1 << 1, // moved by a moving platform
 
 	FLAG_MONITOR_ICON_GOT_REWARD = 1 << 16,
 
@@ -221,10 +245,9 @@ struct Object {
 			vec2 offset;
 			float time_multiplier;
 
-			vec2 init_pos;
 			vec2 prev_pos;
 
-			instance_id mounts[2];
+			Object_Handle mounts[2];
 		} mplatform; // OBJ_MOVING_PLATFORM
 
 		struct {
@@ -253,6 +276,15 @@ struct Object {
 	};
 };
 
+// What goes with an object but can be worked out from the rest of the state. It's kept
+// out of "Object" so that save states don't copy it, and rebuilt after a state is loaded
+// (see "Game::object_derived_stale").
+struct Object_Derived {
+	u32 slot;      // in "Game::object_slots"
+	int grid_cell; // index + 1 of the cell in "Game::object_grid", 0 if it's not in the grid
+	vec2 prev_pos; // pos before the last update, for interpolation
+};
+
 struct Sprite;
 const Sprite& get_object_sprite(ObjType type);
 
@@ -260,6 +292,67 @@ vec2 get_object_size(const Object& o);
 
 constexpr size_t MAX_OBJECTS = 10'000;
 
+// 
+// Uniform grid over the objects that the player collides with, so that player collision
+// only looks at the objects around the player. An object is in the cell of its center.
+// Objects bigger than a cell, and layer switchers (which have to see the player every
+// frame), are in one more list that every query returns.
+// 
+// Cells hold handles, so they don't change when objects are removed from the array.
+// 
+// Rings that don't move aren't in the cells' handles: every cell keeps them apart, with
+// their positions in separate x and y arrays (see "Ring_Batch").
+// 
+constexpr float OBJECT_GRID_CELL_SIZE = 128;
+
+struct Ring_Cell {
+	dynamic_array<float> x;
+	dynamic_array<float> y;
+	dynamic_array<Object_Handle> handles;
+};
+
+struct Object_Grid {
+	int width;  // in cells
+	int height;
+
+	// Heap allocated, so that copies of the Game struct (save states) share them.
+	// "width * height" cells, then the objects that are always checked.
+	dynamic_array<Object_Handle>* cells;
+	dynamic_array<Object_Handle>* query; // result of the last query
+
+	Ring_Cell* ring_cells; // "width * height"
+};
+
+// 
+// Rings are most of the objects in a level, so they're handled in batches: the rings near
+// the player are tested against the player's rect all at once, and the dropped rings move
+// and probe the floor together. The object grid keeps the positions of the rings that don't
+// move in separate x and y arrays as they're added and collected, and the dropped rings'
+// probes are gathered every frame, so the tests are plain loops over floats that the
+// compiler can vectorize.
+// 
+// Scratch space, heap allocated like the object grid's cells.
+// 
+struct Ring_Batch {
+	// rings near the player
+	dynamic_array<u8> hit;  // for one cell at a time
+	dynamic_array<Object_Handle> hits;
+
+	// dropped rings
+	dynamic_array<Object*> dropped;
+	dynamic_array<float> probe_x;
+	dynamic_array<float> probe_y;
+	dynamic_array<int> floor_dist;
+};
+
+// 
+// Objects from the level file only update and draw while their start position is
+// within this distance of the screen horizontally, like in the original games.
+// When an object comes back into the window, it starts over from its initial state.
+// Objects spawned during gameplay (dropped rings, monitor icons...) are always active.
+// 
+constexpr float OBJECT_WINDOW_MARGIN = 320;
+
 struct Tile {
 	unsigned int index : 16;
 
@@ -284,6 +377,64 @@ struct Tileset {
 	array<u8> heights;
 	array<u8> widths;
 	array<float> angles;
+
+	// heights and widths decoded for every direction and flip, built on load
+	array<u8> sensor_heights;
+};
+
+// 
+// Collision layers A and B compiled for the sensors. A cell is 0 if the tile isn't solid,
+// otherwise it has the solid flags and where the tile's heights start in
+// "Tileset::sensor_heights" (for DIR_RIGHT and coordinate 0), so a sensor reads one u32
+// instead of decoding the Tile bitfield.
+// 
+// There are COLLISION_BORDER empty cells around the map, so sensors clamp their tile
+// coordinates into the border instead of checking the bounds. Tiles with an index past
+// the tileset's tables compile to empty cells, so a cell never points outside them.
+// 
+// Built by "compile_collision_layers" once the tilemap and the tileset are read, and kept
+// up to date by "set_tile". Code that writes the tile arrays directly has to call
+// "compile_collision_layers" too.
+// 
+constexpr int COLLISION_BORDER = 3;
+
+constexpr u32 COLLISION_HEIGHTS_MASK = (1u << 24) - 1;
+constexpr u32 COLLISION_TOP_SOLID    = 1u << 30;
+constexpr u32 COLLISION_LRB_SOLID    = 1u << 31;
+
+struct Collision_Layer {
+	int stride; // width + 2 * COLLISION_BORDER
+	array<u32> cells;
+	u32 num_tiles; // in the tileset it was compiled against
+};
+
+// 
+// Visible layers are drawn in chunks of TILE_CHUNK_SIZE x TILE_CHUNK_SIZE tiles. A chunk's
+// quads are built and uploaded the first time it's drawn, and then drawn straight from
+// its vertex buffer until one of its tiles changes. "set_tile" marks the chunk out of date,
+// code that writes the tile arrays directly has to call "invalidate_tile_chunks".
+// 
+constexpr int TILE_CHUNK_SIZE = 16;
+
+struct Tile_Chunk {
+	Static_Quads quads;
+	bool up_to_date;
+};
+
+struct Tile_Chunks {
+	int width;  // in chunks
+	int height;
+
+	// what the chunks were built with
+	u32 texture_id;
+	int texture_width;
+	int texture_height;
+
+	array<Tile_Chunk> chunks[4]; // per layer
+
+	// whole layers uploaded for the tilemap shader, see "draw_tilemap_layer_shader"
+	Texture tile_textures[4];
+	bool tile_textures_up_to_date[4];
 };
 
 struct Tilemap {
@@ -304,8 +455,17 @@ struct Tilemap {
 	// no collision, visible
 	// for background
 	array<Tile> tiles_d;
+
+	// compiled from "tiles_a" and "tiles_b"
+	Collision_Layer collision_a;
+	Collision_Layer collision_b;
+
+	// allocated when the tilemap is read, built when drawn
+	Tile_Chunks* chunks;
 };
 
+struct Game;
+
 struct ScoreCard {
 	enum State : int {
 		NONE,
@@ -326,9 +486,11 @@ struct ScoreCard {
 	int ring_bonus;
 	int total_bonus;
 
-	void update(float delta);
+	float blip_timer;
+
+	void update(Game* g, float delta);
 	void draw(float delta);
-	void show();
+	void show(Game* g);
 };
 
 struct Game {
@@ -337,12 +499,61 @@ struct Game {
 	float player_time;
 	int player_rings;
 
+	// copied from "program" when the level starts, written back when it restarts
+	int player_lives;
+	int player_score;
+
 	bump_array<Object> objects;
+	bump_array<Particle> particles;
+
+	// "object_derived[i]" goes with "objects[i]". Heap allocated, so that copies of the
+	// Game struct (save states) share it.
+	bump_array<Object_Derived> object_derived;
+
+	// Set after "objects" and "object_slots" were replaced (a state was loaded). The next
+	// update or draw rebuilds "object_derived" and the object grid, so that loading a state
+	// is only a copy.
+	bool object_derived_stale;
+
+	bump_array<Object_Slot> object_slots;
+	u32 first_free_slot; // + 1, 0 if there are none
+
+	Object_Grid object_grid;
+	Ring_Batch* ring_batch;
 
 	instance_id next_id = 1;
 
+	// Objects from the level file have id's 1..num_level_objects, sorted by "start_pos.x".
+	// "level_objects" (heap allocated) is their initial state, indexed by id - 1.
+	instance_id num_level_objects;
+	Object* level_objects;
+
+	// handles of the level objects grouped by type, in id order, see "get_level_objects_of_type"
+	Object_Handle* level_objects_by_type;
+	u32 level_objects_by_type_offsets[NUM_OBJ_TYPES + 1];
+
+	// level objects with id's in [active_first_id, active_last_id) are active, see OBJECT_WINDOW_MARGIN
+	instance_id active_first_id;
+	instance_id active_last_id;
+
+	// objects, slots and particles are allocated from here, see "save_state"
+	Arena arena;
+
+	// different for every "init_simulation", states only load into the session that saved them
+	u32 session;
+
+	// Batch instances (see batch.h) only run the simulation: they get input from
+	// "batch_input" and set "batch_finished" instead of restarting the level or
+	// going to the title screen.
+	bool batch_instance;
+	bool batch_finished;
+	u32 batch_input;
+	u32 batch_input_press;
+	u32 batch_input_release;
+
 	vec2 camera_pos;
 	vec2 camera_pos_real;
+	vec2 prev_camera_pos; // for interpolation
 	float camera_lock;
 	float camera_look_offset;
 	float camera_sign_post_left;
@@ -420,7 +631,15 @@ struct Game {
 	bool show_player_hitbox;
 	bool show_hitboxes;
 
+	// draw the tilemap with "draw_tilemap_layer_shader"
+	bool tilemap_shader;
+
+	// draw the level through the renderer's command queue (see "begin_render_queue")
+	bool render_queue;
+
 	void init(int argc, char* argv[]);
+	void init_batch_instance(const char* level_path);
+	void init_simulation(const char* level_path);
 	void deinit();
 
 	void update(float delta);
@@ -433,11 +652,71 @@ struct Game {
 	void draw_pause_menu(float delta);
 
 	void load_level(const char* path);
-	Object* find_object(instance_id id);
+	// null if the object was removed
+	Object* get_object(Object_Handle handle);
+
+	// hash of the gameplay state, for comparing runs
+	u64 get_state_hash();
 };
 
 extern Game game;
 
+// 
+// Save states.
+// 
+// Everything that changes during gameplay is either in the Game struct or allocated
+// from "game.arena" (objects and particles), so a snapshot is a copy of the struct plus
+// a memcpy of the used part of each array. Level data (tilemap, tileset, textures) doesn't
+// change during gameplay and is shared with the live game, so a state can only be loaded
+// back into the same level session ("Game::session").
+// 
+struct Game_State {
+	Game game;
+	Arena arena; // same layout as "game.arena", allocated on the first save
+};
+
+void save_state(Game* g, Game_State* state);
+bool load_state(Game* g, const Game_State& state);
+void free_state(Game_State* state);
+
+// copies the gameplay state into "g", keeps the debug views
+void restore_game(Game* g, const Game& src);
+
+// 
+// Physics invariants, checked by the fuzzer (see fuzz.h).
+// 
+
+// the player's center is inside a solid tile
+bool player_is_in_solid(Game* g, Player* p);
+
+// the player got past the level bounds that "player_keep_in_bounds" enforces
+bool player_is_out_of_bounds(Game* g, Player* p);
+
+PlayerMode player_get_current_mode(Player* p);
+
+// logs probes per second for sensor checks, at random points in the level
+void benchmark_sensors(Game* g, int num_probes);
+
+// Logs the time it takes to remove dead objects on a level full of rings. Replaces the level's objects.
+void benchmark_object_removal(Game* g, int num_objects);
+
+// Logs the time it takes to test rings against the player's rect one by one and in a batch,
+// and to update dropped rings. Replaces the level's objects.
+void benchmark_rings(Game* g, int num_rings);
+
+// Logs the time "save_state" and "load_state" take on a level with "num_objects" rings.
+// Replaces the level's objects.
+void benchmark_save_states(Game* g, int num_objects);
+
+// Logs how many frames of "Game::draw" the software renderer draws in a second, panning
+// the camera through the level, and a hash of the last frame. Needs "init_renderer_software".
+void benchmark_software_renderer(Game* g, int num_frames);
+
+// Logs the frame time of drawing the tilemap layers the way the editor does when it's zoomed
+// all the way out, rebuilding every chunk and with built chunks, for 1 to 8 job threads.
+// Needs "init_renderer_software".
+void benchmark_editor_tilemap(Game* g, int num_frames);
+
 void draw_tilemap_layer(const Tilemap& tm,
 						int layer_index,
 						const Texture& tileset_texture,
@@ -445,6 +724,24 @@ void draw_tilemap_layer(const Tilemap& tm,
 						int xto, int yto,
 						vec4 color);
 
+// 
+// Draws the same thing as "draw_tilemap_layer" with one quad. The layer is uploaded as
+// a GL_R32UI texture with one Tile per texel, and the tilemap shader finds the tile
+// under every pixel and samples the tileset. Breaks the batch.
+// 
+void draw_tilemap_layer_shader(const Tilemap& tm,
+							   int layer_index,
+							   const Texture& tileset_texture,
+							   int xfrom, int yfrom,
+							   int xto, int yto,
+							   vec4 color);
+
+// Draws the tilemap layers from "num_views" camera positions all over the level with
+// per-tile quads, with the chunks and with the tilemap shader, and compares the pixels of
+// the last two against the first. Needs a GL context. Returns the number of views that
+// didn't match.
+int test_tilemap_shader(Game* g, int num_views);
+
 void draw_objects(array<Object> objects,
 				  float time_frames,
 				  bool show_editor_objects,
@@ -462,12 +759,78 @@ void write_tileset(const Tileset& ts, const char* fname);
 bool read_tilemap(Tilemap* tm, const char* fname);
 void read_tileset(Tileset* ts, const char* fname);
 
+// Has to be called after reading the tilemap and the tileset, and after the tiles of
+// layer A or B are written without "set_tile".
+void compile_collision_layers(Tilemap* tm, const Tileset& ts);
+
+// Has to be called after the tiles are written without "set_tile".
+void invalidate_tile_chunks(Tilemap* tm);
+
 void write_objects(array<Object>       objects, const char* fname);
 bool read_objects (bump_array<Object>* objects, const char* fname);
 
 void gen_heightmap_texture(Texture* heightmap, const Tileset& ts, const Texture& tileset_texture);
 void gen_widthmap_texture (Texture* widthmap,  const Tileset& ts, const Texture& tileset_texture);
 
+// all 4 directions and 4 flips of a tile are next to each other
+inline int get_sensor_height_index(int tile_index, Direction dir, int flip, int coord) {
+	return ((tile_index * NUM_DIRS + dir) * 4 + flip) * 16 + coord;
+}
+
+inline u32 compile_collision_cell(Tile tile, u32 num_tiles) {
+	if (!tile.top_solid && !tile.lrb_solid) {
+		return 0;
+	}
+
+	// no heights or angle for it
+	if (tile.index >= num_tiles) {
+		return 0;
+	}
+
+	int flip = tile.hflip | (tile.vflip << 1);
+	u32 cell = (u32) get_sensor_height_index(tile.index, DIR_RIGHT, flip, 0);
+	Assert(cell <= COLLISION_HEIGHTS_MASK);
+
+	if (tile.top_solid) cell |= COLLISION_TOP_SOLID;
+	if (tile.lrb_solid) cell |= COLLISION_LRB_SOLID;
+	return cell;
+}
+
+// only layers A and B have collision
+inline const Collision_Layer& get_collision_layer(const Tilemap& tm, int layer_index) {
+	Assert(layer_index == 0 || layer_index == 1);
+	return (layer_index == 0) ? tm.collision_a : tm.collision_b;
+}
+
+inline void update_collision_cell(Tilemap* tm, int tile_x, int tile_y, int layer_index, Tile tile) {
+	if (layer_index != 0 && layer_index != 1) {
+		return;
+	}
+
+	Collision_Layer* layer = (layer_index == 0) ? &tm->collision_a : &tm->collision_b;
+
+	// not compiled yet
+	if (layer->cells.count == 0) {
+		return;
+	}
+
+	layer->cells[(tile_x + COLLISION_BORDER) + (tile_y + COLLISION_BORDER) * layer->stride] = compile_collision_cell(tile, layer->num_tiles);
+}
+
+inline void invalidate_tile_chunk(Tilemap* tm, int tile_x, int tile_y, int layer_index) {
+	Tile_Chunks* chunks = tm->chunks;
+
+	// not allocated yet
+	if (!chunks) {
+		return;
+	}
+
+	int chunk_x = tile_x / TILE_CHUNK_SIZE;
+	int chunk_y = tile_y / TILE_CHUNK_SIZE;
+	chunks->chunks[layer_index][chunk_x + chunk_y * chunks->width].up_to_date = false;
+	chunks->tile_textures_up_to_date[layer_index] = false;
+}
+
 inline array<Tile> get_tiles_array(const Tilemap& tm, int layer_index) {
 	switch (layer_index) {
 		case 0: return tm.tiles_a;
@@ -515,6 +878,8 @@ inline void set_tile(Tilemap* tm, int tile_x, int tile_y, int layer_index, Tile
 		   && tile_y < tm->height);
 
 	get_tiles_array(*tm, layer_index)[tile_x + tile_y * tm->width] = tile;
+	update_collision_cell(tm, tile_x, tile_y, layer_index, tile);
+	invalidate_tile_chunk(tm, tile_x, tile_y, layer_index);
 }
 
 inline void set_tile_safe(Tilemap* tm, int tile_x, int tile_y, int layer_index, Tile tile) {
@@ -527,6 +892,8 @@ inline void set_tile_safe(Tilemap* tm, int tile_x, int tile_y, int layer_index,
 	}
 
 	get_tiles_array(*tm, layer_index)[tile_x + tile_y * tm->width] = tile;
+	update_collision_cell(tm, tile_x, tile_y, layer_index, tile);
+	invalidate_tile_chunk(tm, tile_x, tile_y, layer_index);
 }
 
 inline void set_tile_by_index(Tilemap* tm, int tile_index, int layer_index, Tile tile) {
@@ -534,10 +901,12 @@ inline void set_tile_by_index(Tilemap* tm, int tile_index, int layer_index, Tile
 		   && tile_index < tm->width * tm->height);
 
 	get_tiles_array(*tm, layer_index)[tile_index] = tile;
+	update_collision_cell(tm, tile_index % tm->width, tile_index / tm->width, layer_index, tile);
+	invalidate_tile_chunk(tm, tile_index % tm->width, tile_index / tm->width, layer_index);
 }
 
 inline array<u8> get_tile_heights(const Tileset& ts, int tile_index) {
-	Assert(tile_index >= 0 && tile_index < ts.heights.count/16);
+	Assert(tile_index >= 0 && (size_t) tile_index < ts.heights.count/16);
 
 	array<u8> result = {};
 	result.data = ts.heights.data + tile_index * 16;
@@ -547,7 +916,7 @@ inline array<u8> get_tile_heights(const Tileset& ts, int tile_index) {
 }
 
 inline array<u8> get_tile_widths(const Tileset& ts, int tile_index) {
-	Assert(tile_index >= 0 && tile_index < ts.widths.count/16);
+	Assert(tile_index >= 0 && (size_t) tile_index < ts.widths.count/16);
 
 	array<u8> result = {};
 	result.data = ts.widths.data + tile_index * 16;
@@ -556,8 +925,18 @@ inline array<u8> get_tile_widths(const Tileset& ts, int tile_index) {
 	return result;
 }
 
+// Height of the solid part of a tile at "coord" as seen by a sensor pointing in "dir".
+// "coord" is x for vertical sensors and y for horizontal ones.
+inline int get_sensor_height(const Tileset& ts, Tile tile, Direction dir, int coord) {
+	int flip = tile.hflip | (tile.vflip << 1);
+	int index = get_sensor_height_index(tile.index, dir, flip, coord % 16);
+
+	Assert(index >= 0 && (size_t) index < ts.sensor_heights.count);
+	return ts.sensor_heights.data[index];
+}
+
 inline float get_tile_angle(const Tileset& ts, int tile_index) {
-	Assert(tile_index >= 0 && tile_index < ts.angles.count);
+	Assert(tile_index >= 0 && (size_t) tile_index < ts.angles.count);
 	return ts.angles[tile_index];
 }
 
@@ -145,8 +145,9 @@ void Input::update(float delta, Rect game_texture_rect, int game_width, int game
 		int mouse_y;
 		mouse_state = SDL_GetMouseState(&mouse_x, &mouse_y);
 
-		mouse_state_press   =  mouse_state & ~prev;
-		mouse_state_release = ~mouse_state &  prev;
+		// accumulate until "clear", a frame can have no updates
+		mouse_state_press   |=  mouse_state & ~prev;
+		mouse_state_release |= ~mouse_state &  prev;
 
 		if (game_texture_rect.w != 0 && game_texture_rect.h != 0) {
 			mouse_world_pos.x = (mouse_x - game_texture_rect.x) / (float)game_texture_rect.w * (float)game_width;
@@ -180,8 +181,8 @@ void Input::update(float delta, Rect game_texture_rect, int game_width, int game
 			axis_state |= INPUT_UI_UP;
 		}
 
-		axis_state_press   = ~prev_axis_state &  axis_state;
-		axis_state_release =  prev_axis_state & ~axis_state;
+		axis_state_press   |= ~prev_axis_state &  axis_state;
+		axis_state_release |=  prev_axis_state & ~axis_state;
 	}
 }
 
@@ -199,6 +200,13 @@ void Input::clear() {
 	// `controller_state` is not cleared
 	memset(controller_state_press,   0, sizeof(controller_state_press));
 	memset(controller_state_release, 0, sizeof(controller_state_release));
+
+	// `axis_state` and `mouse_state` are not cleared
+	axis_state_press = 0;
+	axis_state_release = 0;
+
+	mouse_state_press = 0;
+	mouse_state_release = 0;
 }
 
 bool is_input_held(InputKey key) {
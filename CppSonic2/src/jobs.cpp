@@ -0,0 +1,133 @@
+#include "jobs.h"
+
+constexpr int MAX_JOB_THREADS = 16;
+
+struct Job_Pool {
+	SDL_Thread* threads[MAX_JOB_THREADS];
+	int num_threads; // workers, not counting the calling thread
+
+	SDL_sem* start; // posted once per worker for every "run_jobs"
+	SDL_sem* done;  // posted by every worker when it runs out of indices
+
+	// the current "run_jobs"
+	Job_Proc proc;
+	void* userdata;
+	int count;
+	SDL_atomic_t next_index;
+
+	bool quit;
+};
+
+static Job_Pool jobs;
+
+static void do_jobs() {
+	while (true) {
+		int i = SDL_AtomicAdd(&jobs.next_index, 1);
+		if (i >= jobs.count) break;
+
+		jobs.proc(i, jobs.userdata);
+	}
+}
+
+static int job_worker(void*) {
+	while (true) {
+		SDL_SemWait(jobs.start);
+
+		if (jobs.quit) break;
+
+		do_jobs();
+
+		SDL_SemPost(jobs.done);
+	}
+
+	return 0;
+}
+
+void init_jobs(int num_threads) {
+	if (num_threads <= 0) {
+		num_threads = SDL_GetCPUCount();
+	}
+	num_threads = clamp(num_threads, 1, MAX_JOB_THREADS + 1);
+
+	jobs = {};
+
+	// this thread is one of them
+	int num_workers = num_threads - 1;
+	if (num_workers == 0) {
+		return;
+	}
+
+	jobs.start = SDL_CreateSemaphore(0);
+	jobs.done  = SDL_CreateSemaphore(0);
+
+	if (!jobs.start || !jobs.done) {
+		log_warn("Couldn't create semaphores for the job pool: %s", SDL_GetError());
+		deinit_jobs();
+		return;
+	}
+
+	for (int i = 0; i < num_workers; i++) {
+		SDL_Thread* t = SDL_CreateThread(job_worker, "job_worker", nullptr);
+
+		if (!t) {
+			log_warn("Couldn't create a job thread: %s", SDL_GetError());
+			break;
+		}
+
+		jobs.threads[jobs.num_threads++] = t;
+	}
+
+	log_info("Started %d job threads.", jobs.num_threads);
+}
+
+void deinit_jobs() {
+	jobs.quit = true;
+
+	for (int i = 0; i < jobs.num_threads; i++) {
+		SDL_SemPost(jobs.start);
+	}
+
+	for (int i = 0; i < jobs.num_threads; i++) {
+		SDL_WaitThread(jobs.threads[i], nullptr);
+	}
+
+	if (jobs.start) SDL_DestroySemaphore(jobs.start);
+	if (jobs.done)  SDL_DestroySemaphore(jobs.done);
+
+	jobs = {};
+}
+
+void run_jobs(int count, Job_Proc proc, void* userdata) {
+	if (count <= 0) {
+		return;
+	}
+
+	if (jobs.num_threads == 0 || count == 1) {
+		for (int i = 0; i < count; i++) {
+			proc(i, userdata);
+		}
+		return;
+	}
+
+	jobs.proc = proc;
+	jobs.userdata = userdata;
+	jobs.count = count;
+	SDL_AtomicSet(&jobs.next_index, 0);
+
+	// wake up only as many as there are jobs for
+	int num_workers = min(jobs.num_threads, count - 1);
+
+	for (int i = 0; i < num_workers; i++) {
+		SDL_SemPost(jobs.start);
+	}
+
+	do_jobs();
+
+	for (int i = 0; i < num_workers; i++) {
+		SDL_SemWait(jobs.done);
+	}
+}
+
+int get_num_job_threads() {
+	return jobs.num_threads + 1;
+}
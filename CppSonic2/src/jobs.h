@@ -0,0 +1,30 @@
+#pragma once
+
+#include "common.h"
+
+/*
+* Job pool: worker threads that are started once and split loops with the calling
+* thread, for work that happens every frame. The batch runner and the fuzzer start
+* their own threads, which is fine once per run but too slow once per frame.
+*
+* "run_jobs" calls "proc" for every index on the workers and the calling thread, and
+* returns once all of them are done. Indices are handed out one at a time, so a job
+* should be worth more than an atomic add. Jobs can't use the renderer or the temporary
+* storage: they write into memory the caller set aside, and the caller uses it after
+* "run_jobs" returns, in index order, so the result doesn't depend on the thread count.
+*
+* Without "init_jobs", or when threads can't be created (the web build), everything
+* runs on the calling thread.
+*/
+
+// Called on any thread, once per index.
+typedef void (*Job_Proc)(int index, void* userdata);
+
+// "num_threads" includes the calling thread. If it's 0, uses one thread per CPU core.
+void init_jobs(int num_threads = 0);
+void deinit_jobs();
+
+void run_jobs(int count, Job_Proc proc, void* userdata);
+
+// Including the calling thread.
+int get_num_job_threads();
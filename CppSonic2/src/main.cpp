@@ -1,10 +1,17 @@
 #include "common.h"
 #include "window_creation.h"
 #include "renderer.h"
+#include "software_renderer.h"
 #include "package.h"
 #include "assets.h"
 #include "input.h"
 #include "program.h"
+#include "game.h"
+#include "movie.h"
+#include "batch.h"
+#include "fuzz.h"
+#include "netplay.h"
+#include "jobs.h"
 
 #ifdef EDITOR
 #include "imgui_glue.h"
@@ -26,7 +33,8 @@ static void do_one_frame() {
 
 	// handle events
 	{
-		input.clear();
+		// NOTE: input is cleared after an update, not here. A frame can have no updates
+		// (see "window.update_steps") and we don't want to lose presses.
 
 		SDL_Event ev;
 		while (SDL_PollEvent(&ev)) {
@@ -46,7 +54,13 @@ static void do_one_frame() {
 	{
 		input.update(window.delta, renderer.game_texture_rect, window.game_width, window.game_height);
 
-		program.update(window.delta);
+		// fixed timestep
+		for (int i = 0; i < window.update_steps; i++) {
+			program.update(1);
+
+			// the next steps shouldn't see the same presses again
+			input.clear();
+		}
 
 		#ifdef DEVELOPER
 			console.update(window.delta);
@@ -84,6 +98,9 @@ static int game_main(int argc, char* argv[]) {
 	init_package();
 	defer { deinit_package(); };
 
+	init_jobs();
+	defer { deinit_jobs(); };
+
 	input.init();
 	defer { input.deinit(); };
 
@@ -124,6 +141,9 @@ static int editor_main(int argc, char* argv[]) {
 	init_package();
 	defer { deinit_package(); };
 
+	init_jobs();
+	defer { deinit_jobs(); };
+
 	load_global_assets();
 	load_assets_for_editor();
 	defer { free_all_assets(); };
@@ -171,9 +191,547 @@ static int editor_main(int argc, char* argv[]) {
 	return 0;
 }
 
+// 
+// Runs the game without a window, GL context or audio, as fast as possible.
+// 
+// Usage: --headless [level] [frames] [--play <movie>]
+// 
+// With a movie, the level comes from the movie and it runs until the movie ends.
+// 
+static int headless_main(int argc, char* argv[]) {
+	init_window_headless(424, 240);
+	defer { deinit_window_and_opengl(); };
+
+	init_package();
+	defer { deinit_package(); };
+
+	load_global_assets();
+	load_assets_for_game();
+	defer { free_all_assets(); };
+
+	int num_frames = 60 * 60;
+	bool num_frames_specified = false;
+
+	{
+		int positional = 0;
+		for (int i = 2; i < argc; i++) {
+			if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+				if (!movie_start_playback(argv[i + 1])) {
+					return 1;
+				}
+				free(program.level_filepath.data);
+				program.level_filepath = copy_string(movie.level_filepath);
+				i++;
+			} else if (positional == 0) {
+				free(program.level_filepath.data);
+				program.level_filepath = copy_c_string(argv[i]);
+				positional++;
+			} else if (positional == 1) {
+				num_frames = SDL_atoi(argv[i]);
+				num_frames_specified = true;
+				positional++;
+			}
+		}
+	}
+
+	if (movie.state == MOVIE_PLAYBACK && !num_frames_specified) {
+		num_frames = INT_MAX;
+	}
+
+	program.init(argc, argv);
+	defer { program.deinit(); };
+
+	const float delta = 1;
+
+	double t = get_time();
+
+	int frame = 0;
+	while (frame < num_frames) {
+		reset_temporary_storage();
+
+		program.update(delta);
+		frame++;
+
+		if (movie_playback_finished()) {
+			break;
+		}
+
+		// game over
+		if (program.program_mode != PROGRAM_GAME || program.next_program_mode == PROGRAM_TITLE) {
+			log_info("Stopped early at frame %d.", frame);
+			break;
+		}
+	}
+
+	double took = get_time() - t;
+
+	log_info("Ran %d frames in %fs (%.0f fps, %fms per frame).", frame, took, frame / took, took / frame * 1000.0);
+	log_info("Final state hash: %016llx", (unsigned long long) game.get_state_hash());
+
+	return 0;
+}
+
+// holds right and mashes buttons, differently for every instance
+static u32 batch_input(int instance, int frame, void* userdata) {
+	u32 seed = (u32) instance;
+	u32 step = (u32) (frame / 16);
+
+	u64 hash = FNV1A_OFFSET_BASIS;
+	hash = hash_fnv1a(&seed, sizeof seed, hash);
+	hash = hash_fnv1a(&step, sizeof step, hash);
+
+	u32 result = (hash % 8 != 0) ? INPUT_MOVE_RIGHT : INPUT_MOVE_LEFT;
+	if ((hash >> 8)  % 4 == 0) result |= INPUT_A;
+	if ((hash >> 16) % 8 == 0) result |= INPUT_MOVE_DOWN;
+	return result;
+}
+
+// 
+// Runs many instances of a level on all cores, with generated input.
+// 
+// Usage: --batch [level] [instances] [frames] [threads]
+// 
+static int batch_main(int argc, char* argv[]) {
+	init_window_headless(424, 240);
+	defer { deinit_window_and_opengl(); };
+
+	init_package();
+	defer { deinit_package(); };
+
+	load_global_assets();
+	load_assets_for_game();
+	defer { free_all_assets(); };
+
+	const char* level_path = (argc > 2) ? argv[2] : "levels/EEZ_Act1";
+	int num_instances = (argc > 3) ? SDL_atoi(argv[3]) : 100;
+	int num_frames    = (argc > 4) ? SDL_atoi(argv[4]) : 60 * 60;
+	int num_threads   = (argc > 5) ? SDL_atoi(argv[5]) : 0;
+
+	if (num_instances <= 0) {
+		log_error("Number of instances has to be positive.");
+		return 1;
+	}
+
+	Batch_Result* results = (Batch_Result*) calloc(num_instances, sizeof(Batch_Result));
+	Assert(results);
+	defer { free(results); };
+
+	run_batch(level_path, num_instances, num_frames, num_threads, batch_input, nullptr, results);
+
+	// one hash for the whole batch, to compare runs
+	u64 hash = FNV1A_OFFSET_BASIS;
+	int num_finished = 0;
+	for (int i = 0; i < num_instances; i++) {
+		hash = hash_fnv1a(&results[i].state_hash, sizeof results[i].state_hash, hash);
+		if (results[i].finished) num_finished++;
+	}
+
+	log_info("%d of %d instances finished early.", num_finished, num_instances);
+	log_info("Batch state hash: %016llx", (unsigned long long) hash);
+
+	return 0;
+}
+
+// 
+// Plays a level many times on all cores with random input, looking for physics bugs.
+// 
+// Usage: --fuzz [level] [runs] [frames] [threads] [seed]
+// 
+// Exits with 1 if any run had an anomaly.
+// 
+static int fuzz_main(int argc, char* argv[]) {
+	init_window_headless(424, 240);
+	defer { deinit_window_and_opengl(); };
+
+	init_package();
+	defer { deinit_package(); };
+
+	load_global_assets();
+	load_assets_for_game();
+	defer { free_all_assets(); };
+
+	const char* level_path = (argc > 2) ? argv[2] : "levels/EEZ_Act1";
+	int num_runs    = (argc > 3) ? SDL_atoi(argv[3]) : 10000;
+	int num_frames  = (argc > 4) ? SDL_atoi(argv[4]) : 60 * 60;
+	int num_threads = (argc > 5) ? SDL_atoi(argv[5]) : 0;
+	u32 seed        = (argc > 6) ? (u32) SDL_strtoul(argv[6], nullptr, 10) : (u32) SDL_GetPerformanceCounter();
+
+	if (num_runs <= 0) {
+		log_error("Number of runs has to be positive.");
+		return 1;
+	}
+
+	log_info("Fuzzing %s with seed %u.", level_path, seed);
+
+	int runs_with_anomalies = run_fuzz(level_path, num_runs, num_frames, num_threads, seed);
+
+	return (runs_with_anomalies > 0) ? 1 : 0;
+}
+
+// 
+// Microbenchmarks of parts of the game.
+// 
+// Usage: --bench <name> [level] [count]
+// 
+// "sensors": tile height lookups and sensor checks, "count" probes in each direction
+// "objects": removing dead objects, on a level with "count" rings (at most MAX_OBJECTS)
+// "rings": ring tests against the player's rect and dropped ring updates, with "count" rings (at most MAX_OBJECTS)
+// "states": saving and loading states, with "count" rings (at most MAX_OBJECTS)
+// "render": "count" frames of "Game::draw" with the software renderer (1000 by default)
+// "editor": "count" frames of the tilemap zoomed out like in the editor, with the software
+//           renderer, for 1 to 8 job threads (100 by default)
+// 
+static int bench_main(int argc, char* argv[]) {
+	init_window_headless(424, 240);
+	defer { deinit_window_and_opengl(); };
+
+	const char* name       = (argc > 2) ? argv[2] : "sensors";
+	const char* level_path = (argc > 3) ? argv[3] : "levels/EEZ_Act1";
+
+	bool render = (strcmp(name, "render") == 0);
+	bool editor = (strcmp(name, "editor") == 0);
+
+	bool software_renderer = (render || editor);
+
+	int count = (argc > 4) ? SDL_atoi(argv[4]) : (render ? 1000 : (editor ? 100 : 10'000'000));
+
+	// before loading textures, so that they're kept in memory
+	if (software_renderer) {
+		init_renderer_software();
+	}
+	defer {
+		if (software_renderer) deinit_renderer();
+	};
+
+	init_package();
+	defer { deinit_package(); };
+
+	load_global_assets();
+	load_assets_for_game();
+	defer { free_all_assets(); };
+
+	if (count <= 0) {
+		log_error("Count has to be positive.");
+		return 1;
+	}
+
+	Game* g = (Game*) malloc(sizeof(Game));
+	Assert(g);
+	defer { free(g); };
+
+	*g = {};
+	g->init_batch_instance(level_path);
+	defer { g->deinit(); };
+
+	if (strcmp(name, "sensors") == 0) {
+		benchmark_sensors(g, count);
+	} else if (strcmp(name, "objects") == 0) {
+		benchmark_object_removal(g, count);
+	} else if (strcmp(name, "rings") == 0) {
+		benchmark_rings(g, count);
+	} else if (strcmp(name, "states") == 0) {
+		benchmark_save_states(g, count);
+	} else if (strcmp(name, "render") == 0) {
+		benchmark_software_renderer(g, count);
+	} else if (strcmp(name, "editor") == 0) {
+		benchmark_editor_tilemap(g, count);
+	} else {
+		log_error("Unknown benchmark \"%s\".", name);
+		return 1;
+	}
+
+	return 0;
+}
+
+// 
+// Draws the tilemap of a level with per-tile quads, with the tile chunks and with the
+// tilemap shader from "views" camera positions, and compares the pixels.
+// 
+// Usage: --tilemap-test [level] [views]
+// 
+// Needs a GL context but not a GPU or a display, so it can run on Mesa's llvmpipe:
+// SDL_VIDEODRIVER=offscreen LIBGL_ALWAYS_SOFTWARE=1 (or under xvfb-run).
+// 
+static int tilemap_test_main(int argc, char* argv[]) {
+	init_window_and_opengl("Tilemap Test", 424, 240, 1, false, false);
+	defer { deinit_window_and_opengl(); };
+
+	init_package();
+	defer { deinit_package(); };
+
+	load_global_assets();
+	load_assets_for_game();
+	defer { free_all_assets(); };
+
+	init_renderer();
+	defer { deinit_renderer(); };
+
+	const char* level_path = (argc > 2) ? argv[2] : "levels/EEZ_Act1";
+	int num_views          = (argc > 3) ? SDL_atoi(argv[3]) : 100;
+
+	if (num_views <= 0) {
+		log_error("Number of views has to be positive.");
+		return 1;
+	}
+
+	Game* g = (Game*) malloc(sizeof(Game));
+	Assert(g);
+	defer { free(g); };
+
+	*g = {};
+	g->init_batch_instance(level_path);
+	defer { g->deinit(); };
+
+	int failed_views = test_tilemap_shader(g, num_views);
+
+	return (failed_views > 0) ? 1 : 0;
+}
+
+struct Render_Test_Pass {
+	double draw_time;  // for every frame, until the GPU is done
+	int    draw_calls; // for every frame
+	int    num_kept;
+};
+
+// Plays a level with the input of --batch and draws every frame with the current renderer,
+// through the render queue if "render_queue" is set. Every "keep_every"th frame after the
+// title card is kept in "frames", "width * height" pixels each, the bottom row first. The title card's line scrolls with SDL_GetTicks,
+// so it can't look the same in two runs.
+static Render_Test_Pass draw_render_test_frames(const char* level_path, int num_frames, int keep_every, array<u32> frames,
+												 bool render_queue) {
+	load_global_assets();
+	load_assets_for_game();
+	defer { free_all_assets(); };
+
+	Game* g = (Game*) malloc(sizeof(Game));
+	Assert(g);
+	defer { free(g); };
+
+	*g = {};
+	g->init_batch_instance(level_path);
+	defer { g->deinit(); };
+
+	g->render_queue = render_queue;
+
+	int width  = window.game_width;
+	int height = window.game_height;
+
+	Render_Test_Pass result = {};
+
+	for (int frame = 0; frame < num_frames; frame++) {
+		reset_temporary_storage();
+
+		u32 prev = g->batch_input;
+		g->batch_input = batch_input(0, frame, nullptr);
+		g->batch_input_press = ~prev & g->batch_input;
+		g->batch_input_release = prev & ~g->batch_input;
+
+		g->update(1);
+
+		double t = get_time();
+
+		render_begin_frame(color_black);
+		g->draw(1);
+		break_batch();
+
+		if (!renderer.software) glFinish();
+
+		result.draw_time += get_time() - t;
+		result.draw_calls += renderer.curr_draw_calls;
+
+		bool keep = (g->titlecard_state == Game::TITLECARD_FINISHED
+					 && frame % keep_every == 0
+					 && (size_t) (result.num_kept + 1) * width * height <= frames.count);
+
+		if (keep) {
+			u32* pixels = &frames[result.num_kept * width * height];
+			result.num_kept++;
+
+			if (renderer.software) {
+				array<u32> src = get_texture_pixels_software(renderer.framebuffer.texture);
+				memcpy(pixels, src.data, width * height * sizeof(u32));
+			} else {
+				glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+			}
+		}
+
+		render_end_frame();
+	}
+
+	return result;
+}
+
+// 
+// Plays a level with the input of --batch, draws "Game::draw" with GL, then with GL
+// through the render queue, then with the software renderer, and compares every 10th
+// frame after the title card of the last two against the first.
+// 
+// Usage: --render-test [level] [frames] [tolerance]
+// 
+// A frame fails when more than "tolerance" percent of its pixels differ (0.5 by default).
+// Reports the frame rate of every pass and the draw calls per frame.
+// Needs a GL context, like --tilemap-test.
+// 
+static int render_test_main(int argc, char* argv[]) {
+	init_window_and_opengl("Render Test", 424, 240, 1, false, false);
+	defer { deinit_window_and_opengl(); };
+
+	init_package();
+	defer { deinit_package(); };
+
+	const char* level_path = (argc > 2) ? argv[2] : "levels/EEZ_Act1";
+	int num_frames         = (argc > 3) ? SDL_atoi(argv[3]) : 600;
+	double tolerance       = (argc > 4) ? SDL_atof(argv[4]) : 0.5;
+
+	if (num_frames <= 0) {
+		log_error("Number of frames has to be positive.");
+		return 1;
+	}
+
+	const int keep_every = 10;
+
+	int width  = window.game_width;
+	int height = window.game_height;
+	int num_kept = (num_frames + keep_every - 1) / keep_every;
+
+	array<u32> expected = calloc_array<u32>(num_kept * width * height);
+	defer { free(expected.data); };
+
+	array<u32> actual_queue = calloc_array<u32>(num_kept * width * height);
+	defer { free(actual_queue.data); };
+
+	array<u32> actual_software = calloc_array<u32>(num_kept * width * height);
+	defer { free(actual_software.data); };
+
+	// textures belong to the renderer that loaded them, so every pass loads its own
+	init_renderer();
+	Render_Test_Pass gl = draw_render_test_frames(level_path, num_frames, keep_every, expected, false);
+	deinit_renderer();
+
+	init_renderer();
+	Render_Test_Pass gl_queue = draw_render_test_frames(level_path, num_frames, keep_every, actual_queue, true);
+	deinit_renderer();
+
+	init_renderer_software();
+	Render_Test_Pass software = draw_render_test_frames(level_path, num_frames, keep_every, actual_software, false);
+	deinit_renderer();
+
+	// the same game, so the title card ends on the same frame
+	Assert(gl.num_kept == gl_queue.num_kept);
+	Assert(gl.num_kept == software.num_kept);
+	num_kept = gl.num_kept;
+
+	if (num_kept == 0) {
+		log_error("Render test: no frames after the title card, play more frames.");
+		return 1;
+	}
+
+	auto compare = [&](const char* name, array<u32> actual) {
+		int failed_frames = 0;
+		double worst = 0;
+
+		for (int i = 0; i < num_kept; i++) {
+			int mismatched_pixels = 0;
+			for (int j = 0; j < width * height; j++) {
+				// GL_RGB framebuffers read back with full alpha, but only the colors matter
+				u32 a = expected[i * width * height + j] & 0x00FFFFFF;
+				u32 b = actual  [i * width * height + j] & 0x00FFFFFF;
+				mismatched_pixels += (a != b);
+			}
+
+			double percent = mismatched_pixels * 100.0 / (width * height);
+			worst = max(worst, percent);
+
+			if (percent > tolerance) {
+				log_error("Render test: %s: compared frame %d: %d pixels (%.2f%%) don't match.", name, i, mismatched_pixels, percent);
+				failed_frames++;
+			}
+		}
+
+		log_info("Render test: %s: %d of %d frames match (worst %.2f%% of pixels, tolerance %.2f%%).", name, num_kept - failed_frames, num_kept, worst, tolerance);
+
+		return failed_frames;
+	};
+
+	int failed_frames = 0;
+	failed_frames += compare("GL queue", actual_queue);
+	failed_frames += compare("Software", actual_software);
+
+	log_info("GL:       %.0f fps, %.1f draw calls per frame.", num_frames / gl.draw_time,       gl.draw_calls       / (double) num_frames);
+	log_info("GL queue: %.0f fps, %.1f draw calls per frame.", num_frames / gl_queue.draw_time, gl_queue.draw_calls / (double) num_frames);
+	log_info("Software: %.0f fps, %.1f draw calls per frame.", num_frames / software.draw_time, software.draw_calls / (double) num_frames);
+
+	return (failed_frames > 0) ? 1 : 0;
+}
+
+// 
+// Plays the other side of a netplay session in this process with the input of --batch,
+// and checks that the remote game keeps matching it through the player's deaths
+// and level restarts.
+// 
+// Usage: --netplay-test [level] [frames] [delay]
+// 
+// Plays an instance whose player dies in "frames" frames (8000 by default). Packets
+// arrive "delay" frames late (4 by default, at most NETPLAY_MAX_PREDICTION), so that
+// the restarts are predicted wrong and rolled back.
+// 
+static int netplay_test_main(int argc, char* argv[]) {
+	init_window_headless(424, 240);
+	defer { deinit_window_and_opengl(); };
+
+	init_package();
+	defer { deinit_package(); };
+
+	load_global_assets();
+	load_assets_for_game();
+	defer { free_all_assets(); };
+
+	const char* level_path = (argc > 2) ? argv[2] : "levels/EEZ_Act1";
+	int num_frames         = (argc > 3) ? SDL_atoi(argv[3]) : 8000;
+	int delay              = (argc > 4) ? SDL_atoi(argv[4]) : 4;
+
+	if (num_frames <= 0) {
+		log_error("Number of frames has to be positive.");
+		return 1;
+	}
+
+	// find an instance that stops early, most of them don't
+	const int num_instances = 200;
+
+	Batch_Result* results = (Batch_Result*) calloc(num_instances, sizeof(Batch_Result));
+	Assert(results);
+	defer { free(results); };
+
+	run_batch(level_path, num_instances, num_frames, 0, batch_input, nullptr, results);
+
+	int instance = -1;
+	for (int i = 0; i < num_instances; i++) {
+		if (results[i].finished) {
+			instance = i;
+			break;
+		}
+	}
+
+	if (instance == -1) {
+		log_error("None of %d instances stopped in %d frames.", num_instances, num_frames);
+		return 1;
+	}
+
+	log_info("Netplay test: instance %d, stopped at frame %d.", instance, results[instance].frames);
+
+	return netplay_test(level_path, num_frames, delay, batch_input, instance, nullptr) ? 0 : 1;
+}
+
 enum Launch_Mode {
 	LAUNCH_GAME,
 	LAUNCH_EDITOR,
+	LAUNCH_HEADLESS,
+	LAUNCH_BATCH,
+	LAUNCH_FUZZ,
+	LAUNCH_BENCH,
+	LAUNCH_TILEMAP_TEST,
+	LAUNCH_RENDER_TEST,
+	LAUNCH_NETPLAY_TEST,
 };
 
 int main(int argc, char* argv[]) {
@@ -187,6 +745,20 @@ int main(int argc, char* argv[]) {
 			launch_mode = LAUNCH_EDITOR;
 		} else if (strcmp(argv[1], "--game") == 0) {
 			launch_mode = LAUNCH_GAME;
+		} else if (strcmp(argv[1], "--headless") == 0) {
+			launch_mode = LAUNCH_HEADLESS;
+		} else if (strcmp(argv[1], "--batch") == 0) {
+			launch_mode = LAUNCH_BATCH;
+		} else if (strcmp(argv[1], "--fuzz") == 0) {
+			launch_mode = LAUNCH_FUZZ;
+		} else if (strcmp(argv[1], "--bench") == 0) {
+			launch_mode = LAUNCH_BENCH;
+		} else if (strcmp(argv[1], "--tilemap-test") == 0) {
+			launch_mode = LAUNCH_TILEMAP_TEST;
+		} else if (strcmp(argv[1], "--render-test") == 0) {
+			launch_mode = LAUNCH_RENDER_TEST;
+		} else if (strcmp(argv[1], "--netplay-test") == 0) {
+			launch_mode = LAUNCH_NETPLAY_TEST;
 		}
 	}
 
@@ -194,6 +766,20 @@ int main(int argc, char* argv[]) {
 		return game_main(argc, argv);
 	} else if (launch_mode == LAUNCH_EDITOR) {
 		return editor_main(argc, argv);
+	} else if (launch_mode == LAUNCH_HEADLESS) {
+		return headless_main(argc, argv);
+	} else if (launch_mode == LAUNCH_BATCH) {
+		return batch_main(argc, argv);
+	} else if (launch_mode == LAUNCH_FUZZ) {
+		return fuzz_main(argc, argv);
+	} else if (launch_mode == LAUNCH_BENCH) {
+		return bench_main(argc, argv);
+	} else if (launch_mode == LAUNCH_TILEMAP_TEST) {
+		return tilemap_test_main(argc, argv);
+	} else if (launch_mode == LAUNCH_RENDER_TEST) {
+		return render_test_main(argc, argv);
+	} else if (launch_mode == LAUNCH_NETPLAY_TEST) {
+		return netplay_test_main(argc, argv);
 	}
 
 	return 0;
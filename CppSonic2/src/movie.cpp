@@ -0,0 +1,235 @@
+#include "movie.h"
+
+#include "package.h"
+#include "program.h"
+
+Movie movie;
+
+static void write_movie(const char* fname) {
+	SDL_RWops* f = SDL_RWFromFile(fname, "wb");
+
+	if (!f) {
+		log_error("Couldn't open file \"%s\" for writing.", fname);
+		return;
+	}
+
+	defer { SDL_RWclose(f); };
+
+	char magic[4] = {'M', 'O', 'V', 'I'};
+	SDL_RWwrite(f, magic, sizeof magic, 1);
+
+	u32 version = 1;
+	SDL_RWwrite(f, &version, sizeof version, 1);
+
+	u32 level_filepath_count = (u32) movie.level_filepath.count;
+	SDL_RWwrite(f, &level_filepath_count, sizeof level_filepath_count, 1);
+	SDL_RWwrite(f, movie.level_filepath.data, 1, level_filepath_count);
+
+	SDL_RWwrite(f, &movie.seed, sizeof movie.seed, 1);
+	SDL_RWwrite(f, &movie.num_frames, sizeof movie.num_frames, 1);
+
+	u32 num_runs = (u32) movie.runs.count;
+	SDL_RWwrite(f, &num_runs, sizeof num_runs, 1);
+	SDL_RWwrite(f, movie.runs.data, sizeof(movie.runs[0]), movie.runs.count);
+
+	log_info("Wrote movie %s (%u frames, %u runs).", fname, movie.num_frames, num_runs);
+}
+
+static bool read_movie(const char* fname) {
+	size_t filesize;
+	u8* filedata = get_file(fname, &filesize);
+
+	if (!filedata) {
+		log_error("Couldn't read movie: couldn't open file.");
+		return false;
+	}
+
+	SDL_RWops* f = SDL_RWFromConstMem(filedata, filesize);
+	defer { SDL_RWclose(f); };
+
+	// a truncated file fails instead of leaving fields uninitialized
+	auto read = [&](void* dest, size_t size) -> bool {
+		if (SDL_RWread(f, dest, size, 1) != 1) {
+			log_error("Couldn't read movie: unexpected end of file.");
+			return false;
+		}
+		return true;
+	};
+
+	char magic[4];
+	if (!read(magic, sizeof magic)) return false;
+	if (!(magic[0] == 'M'
+		&& magic[1] == 'O'
+		&& magic[2] == 'V'
+		&& magic[3] == 'I'))
+	{
+		log_error("Couldn't read movie: wrong magic value.");
+		return false;
+	}
+
+	u32 version;
+	if (!read(&version, sizeof version)) return false;
+	if (version != 1) {
+		log_error("Couldn't read movie: version %u is not supported.", version);
+		return false;
+	}
+
+	u32 level_filepath_count;
+	if (!read(&level_filepath_count, sizeof level_filepath_count)) return false;
+
+	if (level_filepath_count == 0 || level_filepath_count > 512) {
+		log_error("Couldn't read movie: invalid level path.");
+		return false;
+	}
+
+	string level_filepath;
+	level_filepath.data  = (char*) malloc(level_filepath_count);
+	level_filepath.count = level_filepath_count;
+	Assert(level_filepath.data);
+
+	free(movie.level_filepath.data);
+	movie.level_filepath = level_filepath;
+
+	if (!read(level_filepath.data, level_filepath_count)) return false;
+
+	if (!read(&movie.seed, sizeof movie.seed)) return false;
+	if (!read(&movie.num_frames, sizeof movie.num_frames)) return false;
+
+	u32 num_runs;
+	if (!read(&num_runs, sizeof num_runs)) return false;
+
+	// 64 bits, a 32-bit sum could wrap around to "num_frames"
+	u64 total = 0;
+	for (u32 i = 0; i < num_runs; i++) {
+		Movie_Run run;
+		if (!read(&run, sizeof run)) return false;
+
+		// playback would still play it for a frame
+		if (run.count == 0) {
+			log_error("Couldn't read movie: run %u is empty.", i);
+			return false;
+		}
+
+		array_add(&movie.runs, run);
+		total += run.count;
+	}
+
+	if (total != movie.num_frames) {
+		log_error("Couldn't read movie: frame count doesn't match.");
+		return false;
+	}
+
+	log_info("Loaded movie %s (" Str_Fmt ", %u frames, %u runs).", fname, Str_Arg(movie.level_filepath), movie.num_frames, num_runs);
+	return true;
+}
+
+void movie_start_recording(const char* fname, string level_filepath) {
+	movie_stop();
+
+	movie.state = MOVIE_RECORDING;
+	movie.filepath = copy_c_string(fname);
+	movie.level_filepath = copy_string(level_filepath);
+}
+
+bool movie_start_playback(const char* fname) {
+	movie_stop();
+
+	if (!read_movie(fname)) {
+		movie_stop();
+		return false;
+	}
+
+	movie.state = MOVIE_PLAYBACK;
+	movie.filepath = copy_c_string(fname);
+	return true;
+}
+
+void movie_stop() {
+	if (movie.state == MOVIE_RECORDING && movie.started) {
+		char* fname = to_c_string(movie.filepath);
+		defer { free(fname); };
+
+		write_movie(fname);
+	}
+
+	free(movie.filepath.data);
+	free(movie.level_filepath.data);
+	array_free(&movie.runs);
+
+	movie = {};
+}
+
+void movie_on_level_start() {
+	if (movie.state == MOVIE_NONE) return;
+
+	// the level also restarts when the player dies, that's a part of the movie
+	if (movie.started) return;
+
+	movie.started = true;
+
+	movie.frame = 0;
+	movie.run_index = 0;
+	movie.run_frame = 0;
+
+	// make sure we start from the same state
+	program.player_lives = 3;
+	program.player_score = 0;
+}
+
+void movie_update_input(u32* input, u32* input_press, u32* input_release) {
+	if (!movie.started) return;
+
+	switch (movie.state) {
+		case MOVIE_NONE: {
+			break;
+		}
+
+		case MOVIE_RECORDING: {
+			Movie_Frame frame = {*input, *input_press, *input_release};
+
+			if (movie.runs.count > 0) {
+				Movie_Run* last = &movie.runs[movie.runs.count - 1];
+
+				if (memcmp(&last->frame, &frame, sizeof frame) == 0) {
+					last->count++;
+					movie.num_frames++;
+					break;
+				}
+			}
+
+			array_add(&movie.runs, {1, frame});
+			movie.num_frames++;
+			break;
+		}
+
+		case MOVIE_PLAYBACK: {
+			if (movie.frame >= movie.num_frames) {
+				// finished, give control back to the player
+				break;
+			}
+
+			const Movie_Run& run = movie.runs[movie.run_index];
+
+			*input         = run.frame.input;
+			*input_press   = run.frame.input_press;
+			*input_release = run.frame.input_release;
+
+			movie.run_frame++;
+			if (movie.run_frame >= run.count) {
+				movie.run_index++;
+				movie.run_frame = 0;
+			}
+
+			movie.frame++;
+
+			if (movie.frame == movie.num_frames) {
+				log_info("Movie playback finished (%u frames).", movie.num_frames);
+			}
+			break;
+		}
+	}
+}
+
+bool movie_playback_finished() {
+	return movie.state == MOVIE_PLAYBACK && movie.started && movie.frame >= movie.num_frames;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "common.h"
+
+/*
+* Input movies: record the player's input for every gameplay update and play it back.
+*
+* The game is deterministic (fixed timestep), so a movie reproduces a run exactly
+* as long as it starts at the beginning of the level.
+*
+* File format (little endian):
+*   "MOVI", u32 version,
+*   u32 level path length, level path chars,
+*   u32 seed, u32 number of frames,
+*   u32 number of runs, runs.
+*
+* Frames are run-length encoded: a run is a frame of input repeated "count" times.
+*/
+
+struct Movie_Frame {
+	u32 input;
+	u32 input_press;
+	u32 input_release;
+};
+
+struct Movie_Run {
+	u32 count;
+	Movie_Frame frame;
+};
+
+enum Movie_State {
+	MOVIE_NONE,
+	MOVIE_RECORDING,
+	MOVIE_PLAYBACK,
+};
+
+struct Movie {
+	Movie_State state;
+	bool started; // waits for the level to start, see "movie_on_level_start"
+
+	string filepath;
+	string level_filepath;
+	u32 seed; // the game doesn't use random numbers yet, always 0 for now
+
+	dynamic_array<Movie_Run> runs;
+	u32 num_frames;
+
+	// playback
+	u32 frame;
+	size_t run_index;
+	u32 run_frame;
+};
+
+extern Movie movie;
+
+// The recording is written to the file when it's stopped.
+void movie_start_recording(const char* fname, string level_filepath);
+bool movie_start_playback(const char* fname);
+void movie_stop();
+
+// call when a level starts
+void movie_on_level_start();
+
+// Call once per gameplay update. Records the input, or replaces it with the movie's.
+void movie_update_input(u32* input, u32* input_press, u32* input_release);
+
+bool movie_playback_finished();
@@ -0,0 +1,611 @@
+#include "netplay.h"
+
+#include "window_creation.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+#include <stddef.h> // for offsetof
+
+Netplay netplay;
+
+static constexpr u32 NETPLAY_MAGIC = 0x54454E53; // "SNET"
+
+//
+// Sockets.
+//
+
+#ifdef _WIN32
+typedef SOCKET Socket;
+#else
+typedef int Socket;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#endif
+
+static Socket get_socket() {
+	return (Socket) netplay.socket;
+}
+
+static bool open_socket(int local_port) {
+#ifdef _WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0) {
+		log_error("Couldn't initialize Winsock.");
+		return false;
+	}
+#endif
+
+	Socket s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (s == INVALID_SOCKET) {
+		log_error("Couldn't create a UDP socket.");
+		return false;
+	}
+
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((u16) local_port);
+
+	if (bind(s, (sockaddr*) &addr, sizeof addr) != 0) {
+		log_error("Couldn't bind to port %d.", local_port);
+		closesocket(s);
+		return false;
+	}
+
+	// non-blocking
+#ifdef _WIN32
+	u_long mode = 1;
+	ioctlsocket(s, FIONBIO, &mode);
+#else
+	fcntl(s, F_SETFL, fcntl(s, F_GETFL, 0) | O_NONBLOCK);
+#endif
+
+	netplay.socket = (u64) s;
+	return true;
+}
+
+static void close_socket() {
+	closesocket(get_socket());
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+}
+
+static bool resolve_address(const char* address, sockaddr_in* result) {
+	// split "host:port"
+	const char* colon = strrchr(address, ':');
+	if (!colon) {
+		log_error("Address \"%s\" has no port.", address);
+		return false;
+	}
+
+	char host[256];
+	size_t host_length = min((size_t) (colon - address), sizeof host - 1);
+	memcpy(host, address, host_length);
+	host[host_length] = 0;
+
+	addrinfo hints = {};
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+
+	addrinfo* info = nullptr;
+	if (getaddrinfo(host, colon + 1, &hints, &info) != 0 || !info) {
+		log_error("Couldn't resolve address \"%s\".", address);
+		return false;
+	}
+	defer { freeaddrinfo(info); };
+
+	memcpy(result, info->ai_addr, sizeof *result);
+	return true;
+}
+
+//
+// Sending and receiving.
+//
+
+static float random_float() {
+	// xorshift32, only used for simulating packet loss
+	u32 x = netplay.random_state;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	netplay.random_state = x;
+
+	return (x >> 8) / (float) (1 << 24);
+}
+
+static size_t get_packet_size(const Netplay_Packet& packet) {
+	return offsetof(Netplay_Packet, inputs) + packet.num_inputs * sizeof(packet.inputs[0]);
+}
+
+static void send_now(const Netplay_Packet& packet) {
+	sendto(get_socket(), (const char*) &packet, (int) get_packet_size(packet), 0,
+		   (const sockaddr*) netplay.remote_addr, sizeof(sockaddr_in));
+}
+
+static void send_packet(const Netplay_Packet& packet) {
+	if (netplay.packet_loss > 0 && random_float() < netplay.packet_loss) {
+		return;
+	}
+
+	if (netplay.latency_ms <= 0 || netplay.num_pending == NETPLAY_MAX_PENDING_PACKETS) {
+		send_now(packet);
+		return;
+	}
+
+	int index = (netplay.first_pending + netplay.num_pending) % NETPLAY_MAX_PENDING_PACKETS;
+	netplay.pending[index].send_time = get_time() + netplay.latency_ms / 1000.0;
+	netplay.pending[index].packet = packet;
+	netplay.num_pending++;
+}
+
+static void flush_pending_packets() {
+	double time = get_time();
+
+	while (netplay.num_pending > 0) {
+		Netplay_Pending_Packet* p = &netplay.pending[netplay.first_pending];
+		if (p->send_time > time) break;
+
+		send_now(p->packet);
+
+		netplay.first_pending = (netplay.first_pending + 1) % NETPLAY_MAX_PENDING_PACKETS;
+		netplay.num_pending--;
+	}
+}
+
+static void send_inputs() {
+	// everything the other side hasn't confirmed yet, oldest first
+	int first_frame = netplay.remote_ack_frame + 1;
+	int num_inputs = min(netplay.frame - first_frame, NETPLAY_INPUTS_PER_PACKET);
+
+	Netplay_Packet packet = {};
+	packet.magic = NETPLAY_MAGIC;
+	packet.first_frame = (u32) first_frame;
+	packet.num_inputs = (u32) max(num_inputs, 0);
+	packet.ack_frame = netplay.last_remote_frame;
+	packet.level_start_frame = netplay.local_level_start;
+
+	for (int i = 0; i < (int) packet.num_inputs; i++) {
+		packet.inputs[i] = netplay.local_inputs[(first_frame + i) % NETPLAY_INPUT_HISTORY];
+	}
+
+	send_packet(packet);
+}
+
+static void mark_wrong_frame(int frame) {
+	if (netplay.first_wrong_frame == -1 || frame < netplay.first_wrong_frame) {
+		netplay.first_wrong_frame = frame;
+	}
+}
+
+static void receive_packet(const Netplay_Packet& packet) {
+	netplay.remote_ack_frame = max(netplay.remote_ack_frame, (int) packet.ack_frame);
+
+	for (int i = 0; i < (int) packet.num_inputs; i++) {
+		int frame = (int) packet.first_frame + i;
+
+		// only take inputs in order
+		if (frame != netplay.last_remote_frame + 1) continue;
+
+		// don't overwrite inputs that haven't been simulated yet
+		if (frame >= netplay.frame + NETPLAY_INPUT_HISTORY / 2) break;
+
+		const Movie_Frame& input = packet.inputs[i];
+
+		netplay.remote_inputs[frame % NETPLAY_INPUT_HISTORY] = input;
+		netplay.last_remote_frame = frame;
+
+		// this frame was already simulated with a prediction
+		if (frame < netplay.frame) {
+			const Movie_Frame& predicted = netplay.predicted_inputs[frame % NETPLAY_INPUT_HISTORY];
+
+			if (memcmp(&predicted, &input, sizeof input) != 0) {
+				mark_wrong_frame(frame);
+			}
+		}
+	}
+
+	// Take a restart together with the inputs before it, so that it's never
+	// older than the frames that can still be rolled back.
+	int level_start = (int) packet.level_start_frame;
+	if (level_start > netplay.remote_level_start && level_start <= netplay.last_remote_frame + 1) {
+		netplay.remote_level_start = level_start;
+
+		// this frame was already simulated in the old level
+		if (level_start < netplay.frame) {
+			mark_wrong_frame(level_start);
+		}
+	}
+}
+
+static void receive_inputs() {
+	const sockaddr_in& remote_addr = *(const sockaddr_in*) netplay.remote_addr;
+
+	while (true) {
+		Netplay_Packet packet;
+		sockaddr_in from;
+		socklen_t from_size = sizeof from;
+
+		int received = (int) recvfrom(get_socket(), (char*) &packet, sizeof packet, 0, (sockaddr*) &from, &from_size);
+		if (received <= 0) break;
+
+		if (from.sin_port != remote_addr.sin_port
+			|| from.sin_addr.s_addr != remote_addr.sin_addr.s_addr)
+		{
+			continue;
+		}
+
+		if (received < (int) offsetof(Netplay_Packet, inputs)
+			|| packet.magic != NETPLAY_MAGIC
+			|| packet.num_inputs > NETPLAY_INPUTS_PER_PACKET
+			|| received != (int) get_packet_size(packet))
+		{
+			continue;
+		}
+
+		receive_packet(packet);
+	}
+}
+
+//
+// Simulation.
+//
+
+// Does what "game_end_level" and "Game::init" do on the other side. Loading the level
+// again would start a new session, and the states from before the restart couldn't be
+// loaded by a rollback anymore.
+static void restart_remote_level() {
+	Game* g = &netplay.remote_game;
+
+	int player_lives = g->player_lives;
+	int player_score = g->player_score;
+
+	load_state(g, netplay.level_start_state);
+
+	g->player_lives = player_lives;
+	g->player_score = player_score;
+	g->batch_finished = false;
+}
+
+static void step_remote_game(int frame) {
+	Game* g = &netplay.remote_game;
+
+	save_state(g, &netplay.states[frame % NETPLAY_NUM_STATES]);
+
+	// the other side restarted its level before this frame
+	if (frame == netplay.remote_level_start) {
+		restart_remote_level();
+	}
+
+	Movie_Frame input = {};
+	if (frame <= netplay.last_remote_frame) {
+		input = netplay.remote_inputs[frame % NETPLAY_INPUT_HISTORY];
+	} else if (netplay.last_remote_frame >= 0) {
+		// predict: keep holding the same buttons
+		input.input = netplay.remote_inputs[netplay.last_remote_frame % NETPLAY_INPUT_HISTORY].input;
+	}
+
+	netplay.predicted_inputs[frame % NETPLAY_INPUT_HISTORY] = input;
+
+	g->batch_input         = input.input;
+	g->batch_input_press   = input.input_press;
+	g->batch_input_release = input.input_release;
+
+	g->update_gameplay(1);
+}
+
+static void rollback() {
+	if (netplay.first_wrong_frame == -1) return;
+
+	int from = netplay.first_wrong_frame;
+	netplay.first_wrong_frame = -1;
+
+	Assert(netplay.frame - from < NETPLAY_NUM_STATES);
+
+	double t = get_time();
+
+	load_state(&netplay.remote_game, netplay.states[from % NETPLAY_NUM_STATES]);
+
+	for (int frame = from; frame < netplay.frame; frame++) {
+		step_remote_game(frame);
+	}
+
+	Netplay_Stats* stats = &netplay.stats;
+	stats->rollbacks++;
+	stats->rollback_frames = netplay.frame - from;
+	stats->max_rollback_frames = max(stats->max_rollback_frames, stats->rollback_frames);
+	stats->resim_time = get_time() - t;
+	stats->max_resim_time = max(stats->max_resim_time, stats->resim_time);
+}
+
+bool netplay_start(int local_port, const char* remote_address, const char* level_path,
+				   float latency_ms, float packet_loss) {
+	netplay_stop();
+
+	sockaddr_in remote_addr;
+	if (!resolve_address(remote_address, &remote_addr)) {
+		return false;
+	}
+
+	if (!open_socket(local_port)) {
+		return false;
+	}
+
+	static_assert(sizeof netplay.remote_addr >= sizeof remote_addr);
+	memcpy(netplay.remote_addr, &remote_addr, sizeof remote_addr);
+
+	netplay.latency_ms = latency_ms;
+	netplay.packet_loss = packet_loss;
+	netplay.random_state = 0x9E3779B9u ^ (u32) local_port;
+
+	netplay.pending = (Netplay_Pending_Packet*) malloc(NETPLAY_MAX_PENDING_PACKETS * sizeof(Netplay_Pending_Packet));
+	Assert(netplay.pending);
+
+	netplay.states = (Game_State*) malloc(NETPLAY_NUM_STATES * sizeof(Game_State));
+	Assert(netplay.states);
+	for (int i = 0; i < NETPLAY_NUM_STATES; i++) {
+		netplay.states[i] = {};
+	}
+
+	netplay.remote_game = {};
+	netplay.remote_game.init_batch_instance(level_path);
+
+	netplay.level_start_state = {};
+	save_state(&netplay.remote_game, &netplay.level_start_state);
+
+	netplay.frame = 0;
+	netplay.remote_ack_frame = -1;
+	netplay.last_remote_frame = -1;
+	netplay.first_wrong_frame = -1;
+
+	// both sides start the first level before their first update
+	netplay.local_level_start = 0;
+	netplay.remote_level_start = 0;
+
+	netplay.state = NETPLAY_RUNNING;
+
+	log_info("Netplay: port %d, remote %s, latency %gms, packet loss %g%%.",
+			 local_port, remote_address, latency_ms, packet_loss * 100.0f);
+	return true;
+}
+
+void netplay_stop() {
+	if (netplay.state == NETPLAY_NONE) return;
+
+	netplay.remote_game.deinit();
+
+	for (int i = 0; i < NETPLAY_NUM_STATES; i++) {
+		free_state(&netplay.states[i]);
+	}
+	free(netplay.states);
+	free_state(&netplay.level_start_state);
+	free(netplay.pending);
+
+	close_socket();
+
+	netplay = {};
+}
+
+bool netplay_should_wait() {
+	if (netplay.state == NETPLAY_NONE) return false;
+
+	receive_inputs();
+	flush_pending_packets();
+
+	bool too_far_ahead = (netplay.frame - netplay.last_remote_frame > NETPLAY_MAX_PREDICTION);
+
+	// the other side hasn't confirmed our inputs for too long, they would fall out of the history
+	bool too_far_unconfirmed = (netplay.frame - netplay.remote_ack_frame > NETPLAY_INPUT_HISTORY / 2);
+
+	if (too_far_ahead || too_far_unconfirmed) {
+		// keep resending, otherwise both sides could wait for each other
+		send_inputs();
+
+		netplay.stats.waits++;
+		return true;
+	}
+
+	return false;
+}
+
+void netplay_update(const Movie_Frame& local_input) {
+	if (netplay.state == NETPLAY_NONE) return;
+
+	netplay.local_inputs[netplay.frame % NETPLAY_INPUT_HISTORY] = local_input;
+
+	receive_inputs();
+	rollback();
+
+	step_remote_game(netplay.frame);
+	netplay.frame++;
+
+	send_inputs();
+	flush_pending_packets();
+}
+
+void netplay_on_level_start() {
+	if (netplay.state == NETPLAY_NONE) return;
+
+	netplay.local_level_start = netplay.frame;
+}
+
+//
+// Test.
+//
+
+// what has to match between the remote game and the other side's game
+struct Netplay_Test_Frame {
+	vec2 player_pos;
+	int player_state;
+	int player_lives;
+	int player_score;
+	int player_rings;
+	float time_frames;
+};
+
+static Netplay_Test_Frame get_test_frame(const Game& g) {
+	Netplay_Test_Frame result = {};
+	result.player_pos   = g.player.pos;
+	result.player_state = (int) g.player.state;
+	result.player_lives = g.player_lives;
+	result.player_score = g.player_score;
+	result.player_rings = g.player_rings;
+	result.time_frames  = g.time_frames;
+	return result;
+}
+
+bool netplay_test(const char* level_path, int num_frames, int delay,
+				  Batch_Input_Proc input_proc, int instance, void* userdata) {
+	delay = clamp(delay, 0, NETPLAY_MAX_PREDICTION);
+
+	// nothing listens on the other side, the packets are passed in directly
+	if (!netplay_start(0, "127.0.0.1:9", level_path)) {
+		return false;
+	}
+	defer { netplay_stop(); };
+
+	// the other side's game, restarted the way "Program" restarts it
+	Game* other = (Game*) malloc(sizeof(Game));
+	Assert(other);
+	defer { free(other); };
+
+	*other = {};
+	other->init_batch_instance(level_path);
+	defer { other->deinit(); };
+
+	// frames that the other side keeps updating during the screen transition
+	const int transition_frames = 20;
+
+	int level_start = 0;
+	int restart_frame = -1;
+	int num_restarts = 0;
+	bool game_over = false;
+
+	Netplay_Test_Frame* expected = (Netplay_Test_Frame*) malloc(num_frames * sizeof(Netplay_Test_Frame));
+	Assert(expected);
+	defer { free(expected); };
+
+	Netplay_Packet* packets = (Netplay_Packet*) malloc(num_frames * sizeof(Netplay_Packet));
+	Assert(packets);
+	defer { free(packets); };
+
+	Movie_Frame* inputs = (Movie_Frame*) malloc(num_frames * sizeof(Movie_Frame));
+	Assert(inputs);
+	defer { free(inputs); };
+
+	int num_checked = 0;
+	int num_mismatched = 0;
+	int last_checked = -1;
+
+	for (int frame = 0; frame < num_frames; frame++) {
+		if (frame == restart_frame) {
+			int player_lives = other->player_lives;
+			int player_score = other->player_score;
+
+			other->deinit();
+			*other = {};
+			other->init_batch_instance(level_path);
+
+			other->player_lives = player_lives;
+			other->player_score = player_score;
+
+			level_start = frame;
+			restart_frame = -1;
+			num_restarts++;
+		}
+
+		u32 prev = other->batch_input;
+
+		Movie_Frame input = {};
+		input.input = input_proc(instance, frame, userdata);
+		input.input_press = ~prev & input.input;
+		input.input_release = prev & ~input.input;
+
+		other->batch_input         = input.input;
+		other->batch_input_press   = input.input_press;
+		other->batch_input_release = input.input_release;
+
+		other->update_gameplay(1);
+
+		inputs[frame] = input;
+		expected[frame] = get_test_frame(*other);
+
+		// the player died, or the game over screen ended and the other side went to the title screen
+		if (other->batch_finished && restart_frame == -1) {
+			if (other->player_lives > 0) {
+				restart_frame = frame + 1 + transition_frames;
+			} else {
+				game_over = true;
+			}
+		}
+
+		// what "send_inputs" on the other side would send after this frame
+		Netplay_Packet* packet = &packets[frame];
+		*packet = {};
+		packet->magic = NETPLAY_MAGIC;
+		packet->first_frame = (u32) max(frame + 1 - NETPLAY_INPUTS_PER_PACKET, 0);
+		packet->num_inputs = (u32) (frame + 1 - (int) packet->first_frame);
+		packet->ack_frame = netplay.frame - 1;
+		packet->level_start_frame = level_start;
+
+		for (int i = 0; i < (int) packet->num_inputs; i++) {
+			packet->inputs[i] = inputs[packet->first_frame + i];
+		}
+
+		if (frame - delay >= 0) {
+			receive_packet(packets[frame - delay]);
+		}
+
+		netplay_update({});
+
+		// compare every frame once all inputs up to it have arrived
+		for (int f = last_checked + 1; f <= netplay.last_remote_frame; f++) {
+			const Game* g = &netplay.remote_game;
+			if (f + 1 < netplay.frame) {
+				g = &netplay.states[(f + 1) % NETPLAY_NUM_STATES].game;
+			}
+
+			Netplay_Test_Frame actual = get_test_frame(*g);
+
+			if (memcmp(&actual, &expected[f], sizeof actual) != 0) {
+				if (num_mismatched == 0) {
+					log_error("Netplay test: the remote game doesn't match at frame %d: player at (%g, %g), expected (%g, %g).",
+							  f, actual.player_pos.x, actual.player_pos.y, expected[f].player_pos.x, expected[f].player_pos.y);
+				}
+				num_mismatched++;
+			}
+
+			num_checked++;
+			last_checked = f;
+		}
+
+		if (game_over) {
+			log_info("Netplay test: game over at frame %d.", frame);
+			break;
+		}
+	}
+
+	log_info("Netplay test: %d of %d frames match, %d restarts, %d rollbacks (max %d frames).",
+			 num_checked - num_mismatched, num_checked, num_restarts,
+			 netplay.stats.rollbacks, netplay.stats.max_rollback_frames);
+
+	if (num_restarts == 0) {
+		log_error("Netplay test: the remote player never restarted the level.");
+		return false;
+	}
+
+	return num_mismatched == 0;
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "common.h"
+#include "game.h"
+#include "movie.h"
+#include "batch.h"
+
+/*
+* Netplay: two players race through the same level, each in their own game.
+*
+* Every gameplay update both sides send their input over UDP. The remote player's game is
+* simulated locally (a batch instance, see "Game::init_batch_instance") and drawn
+* as a ghost. Until the remote input for a frame arrives, it's predicted by repeating
+* the last known input. When the real input turns out to be different, the remote
+* game is rolled back to a save state from before that frame and the frames since
+* then are simulated again.
+*
+* The local game never waits for the network, unless it's more than
+* NETPLAY_MAX_PREDICTION frames ahead of the last input it received.
+*
+* When a side restarts its level, the frame it restarted on is sent with its inputs,
+* and the other side restarts the remote game on the same frame. Until that arrives,
+* the remote game keeps simulating the old level and gets rolled back like after a
+* wrong prediction.
+*
+* For testing on one machine, outgoing packets can be delayed and dropped.
+*/
+
+constexpr int NETPLAY_MAX_PREDICTION = 8;
+
+// number of inputs in every packet, so that a lost packet doesn't lose inputs
+constexpr int NETPLAY_INPUTS_PER_PACKET = 32;
+
+constexpr int NETPLAY_INPUT_HISTORY = 128;
+constexpr int NETPLAY_NUM_STATES = NETPLAY_MAX_PREDICTION + 2;
+constexpr int NETPLAY_MAX_PENDING_PACKETS = 256;
+
+enum Netplay_State {
+	NETPLAY_NONE,
+	NETPLAY_RUNNING,
+};
+
+struct Netplay_Packet {
+	u32 magic;
+	u32 first_frame; // frame of inputs[0]
+	u32 num_inputs;
+	i32 ack_frame;   // last frame of the other side's input that was received
+	i32 level_start_frame; // first frame of the sender's current level
+	Movie_Frame inputs[NETPLAY_INPUTS_PER_PACKET];
+};
+
+struct Netplay_Pending_Packet {
+	double send_time;
+	Netplay_Packet packet;
+};
+
+struct Netplay_Stats {
+	int rollbacks;
+	int rollback_frames;      // frames simulated again by the last rollback
+	int max_rollback_frames;
+	double resim_time;        // time the last rollback took
+	double max_resim_time;
+	int waits;                // updates skipped because the remote input was too far behind
+};
+
+struct Netplay {
+	Netplay_State state;
+
+	u64 socket;
+
+	// the other side's address, stored as "sockaddr_in"
+	u8 remote_addr[16];
+
+	// testing
+	float latency_ms;
+	float packet_loss; // 0..1
+	u32 random_state;
+
+	Netplay_Pending_Packet* pending; // ring buffer
+	int first_pending;
+	int num_pending;
+
+	// gameplay updates since the session started, the same on both sides
+	int frame;
+
+	Movie_Frame local_inputs[NETPLAY_INPUT_HISTORY];
+	int remote_ack_frame;
+
+	Movie_Frame remote_inputs[NETPLAY_INPUT_HISTORY];    // real inputs
+	Movie_Frame predicted_inputs[NETPLAY_INPUT_HISTORY]; // what the remote game was simulated with
+	int last_remote_frame;  // all remote inputs up to this frame have arrived
+	int first_wrong_frame;  // earliest frame that was simulated with a wrong prediction, or -1
+
+	// the remote player's game and save states from before each of the last frames
+	Game remote_game;
+	Game_State* states;
+
+	// the frames that each side's current level started on
+	int local_level_start;
+	int remote_level_start;
+
+	// the remote game right after loading the level, restarting loads it back
+	Game_State level_start_state;
+
+	Netplay_Stats stats;
+};
+
+extern Netplay netplay;
+
+// "remote_address" is "host:port". Both sides have to use the same level.
+bool netplay_start(int local_port, const char* remote_address, const char* level_path,
+				   float latency_ms = 0, float packet_loss = 0);
+void netplay_stop();
+
+// Call before a gameplay update. Returns true if the game should wait for the other side.
+bool netplay_should_wait();
+
+// Call after every gameplay update, with the input that the local player used.
+void netplay_update(const Movie_Frame& local_input);
+
+// Call when the local game starts or restarts a level.
+void netplay_on_level_start();
+
+// Plays the other side of a session in this process, with "input_proc" as the remote
+// player's input and packets arriving "delay" frames late, and checks after every
+// frame whose input has arrived that the remote game matches.
+// Returns false if it didn't match, or if the remote player never restarted the level.
+bool netplay_test(const char* level_path, int num_frames, int delay,
+				  Batch_Input_Proc input_proc, int instance, void* userdata);
@@ -3,19 +3,17 @@
 #include "sprite.h"
 #include "assets.h"
 
-bump_array<Particle> g_Particles;
-
-void init_particles() {
-	g_Particles = allocate_bump_array<Particle>(MAX_PARTICLES, get_libc_allocator());
+void init_particles(bump_array<Particle>* particles, Allocator allocator) {
+	*particles = allocate_bump_array<Particle>(MAX_PARTICLES, allocator);
 }
 
-void deinit_particles() {
-	free(g_Particles.data);
-	g_Particles = {};
+void deinit_particles(bump_array<Particle>* particles, Allocator allocator) {
+	afree(particles->data, particles->capacity * sizeof(Particle), allocator);
+	*particles = {};
 }
 
-void update_particles(float delta) {
-	For (p, g_Particles) {
+void update_particles(bump_array<Particle>* particles, float delta) {
+	For (p, (*particles)) {
 		p->pos.x += lengthdir_x(p->spd, p->dir) * delta;
 		p->pos.y += lengthdir_y(p->spd, p->dir) * delta;
 
@@ -26,14 +24,14 @@ void update_particles(float delta) {
 		p->lifetime += delta;
 
 		if (p->lifetime >= p->lifespan) {
-			Remove(p, g_Particles);
+			Remove(p, (*particles));
 			continue;
 		}
 	}
 }
 
-void draw_particles(float delta) {
-	For (p, g_Particles) {
+void draw_particles(bump_array<Particle>* particles, float delta) {
+	For (p, (*particles)) {
 		float f = p->lifetime / p->lifespan;
 
 		vec2 scale = lerp(p->scale_from, p->scale_to, f);
@@ -43,7 +41,7 @@ void draw_particles(float delta) {
 	}
 }
 
-Particle* add_particle(const Particle& p) {
-	Particle* result = array_add(&g_Particles, p);
+Particle* add_particle(bump_array<Particle>* particles, const Particle& p) {
+	Particle* result = array_add(particles, p);
 	return result;
 }
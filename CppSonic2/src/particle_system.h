@@ -23,12 +23,10 @@ struct Particle {
 
 constexpr size_t MAX_PARTICLES = 10'000;
 
-extern bump_array<Particle> g_Particles;
+void init_particles(bump_array<Particle>* particles, Allocator allocator = get_libc_allocator());
+void deinit_particles(bump_array<Particle>* particles, Allocator allocator = get_libc_allocator());
 
-void init_particles();
-void deinit_particles();
+void update_particles(bump_array<Particle>* particles, float delta);
+void draw_particles(bump_array<Particle>* particles, float delta);
 
-void update_particles(float delta);
-void draw_particles(float delta);
-
-Particle* add_particle(const Particle& p);
+Particle* add_particle(bump_array<Particle>* particles, const Particle& p);
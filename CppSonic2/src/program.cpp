@@ -8,28 +8,84 @@
 #include "game.h"
 #include "title_screen.h"
 #include "bunnymark.h"
+#include "movie.h"
+#include "rewind.h"
+#include "netplay.h"
 
 Program program;
 
 void Program::init(int argc, char* argv[]) {
 	Program_Mode mode = PROGRAM_TITLE;
 
+	const char* record_movie = nullptr;
+	const char* play_movie = nullptr;
+
+	int net_port = 0;
+	const char* net_remote = nullptr;
+	float net_latency = 0;
+	float net_loss = 0;
+
 #ifdef DEVELOPER
 	// if the second argument is --game
 	if (argc >= 2 && strcmp(argv[1], "--game") == 0) {
 		// ...and there's a third arg, then start the level
-		if (argc >= 3) {
+		if (argc >= 3 && argv[2][0] != '-') {
 			mode = PROGRAM_GAME;
 
 			level_filepath = copy_c_string(argv[2]);
 		}
+
+		// --game [level] [--record <movie>] [--play <movie>]
+		//        [--net <local port> <remote host:port>] [--latency <ms>] [--loss <percent>]
+		for (int i = 2; i < argc - 1; i++) {
+			if (strcmp(argv[i], "--record") == 0) {
+				record_movie = argv[i + 1];
+			} else if (strcmp(argv[i], "--play") == 0) {
+				play_movie = argv[i + 1];
+			} else if (strcmp(argv[i], "--net") == 0 && i + 2 < argc) {
+				net_port = SDL_atoi(argv[i + 1]);
+				net_remote = argv[i + 2];
+			} else if (strcmp(argv[i], "--latency") == 0) {
+				net_latency = (float) SDL_atof(argv[i + 1]);
+			} else if (strcmp(argv[i], "--loss") == 0) {
+				net_loss = (float) SDL_atof(argv[i + 1]) / 100.0f;
+			}
+		}
 	}
 #endif
 
+	// level path is set by "headless_main"
+	if (window.headless) {
+		mode = PROGRAM_GAME;
+	}
+
 	if (level_filepath.count == 0) {
 		level_filepath = copy_string("levels/EEZ_Act1");
 	}
 
+	if (record_movie) {
+		mode = PROGRAM_GAME;
+		movie_start_recording(record_movie, level_filepath);
+	}
+
+	if (play_movie) {
+		if (movie_start_playback(play_movie)) {
+			mode = PROGRAM_GAME;
+
+			free(level_filepath.data);
+			level_filepath = copy_string(movie.level_filepath);
+		}
+	}
+
+	if (net_remote) {
+		char* path = to_c_string(level_filepath);
+		defer { free(path); };
+
+		if (netplay_start(net_port, net_remote, path, net_latency, net_loss)) {
+			mode = PROGRAM_GAME;
+		}
+	}
+
 	set_program_mode(mode);
 	transition_t = 1; // skip the fade in
 
@@ -43,6 +99,11 @@ void Program::init(int argc, char* argv[]) {
 
 void Program::deinit() {
 	deinit_program_mode();
+
+	// writes the recording
+	movie_stop();
+
+	netplay_stop();
 }
 
 void Program::update(float delta) {
@@ -156,6 +217,8 @@ void Program::late_draw(float delta) {
 							 "draw: %fms\n"
 							 "draw calls: %d\n"
 							 "total triangles: %d\n"
+							 "vertex upload: " Size_Fmt "\n"
+							 "stalls avoided: %d\n"
 							 "temp frame: " Size_Fmt "\n"
 							 "temp ever: " Size_Fmt "\n",
 							 window.frame_took * 1000.0,
@@ -163,6 +226,8 @@ void Program::late_draw(float delta) {
 							 renderer.draw_took * 1000.0,
 							 renderer.draw_calls,
 							 renderer.total_triangles,
+							 Size_Arg(renderer.bytes_uploaded),
+							 renderer.stalls_avoided,
 							 Size_Arg(temp_memory_max_usage_this_frame),
 							 Size_Arg(temp_memory_max_usage_ever));
 		pos = draw_text_shadow(get_font(fnt_consolas_bold), str, pos);
@@ -176,13 +241,36 @@ void Program::late_draw(float delta) {
 								 "ground speed: %f\n"
 								 "ground angle: %f\n"
 								 "xspeed: %f\n"
-								 "yspeed: %f\n",
+								 "yspeed: %f\n"
+								 "rewind: %.1fs, " Size_Fmt "/s (" Size_Fmt " max)\n",
 								 GetPlayerStateName(p->state),
 								 p->ground_speed,
 								 p->ground_angle,
 								 p->speed.x,
-								 p->speed.y);
+								 p->speed.y,
+								 rewind_seconds_recorded(),
+								 Size_Arg(rewind_bytes_per_second()),
+								 Size_Arg(REWIND_MEMORY));
 			pos = draw_text_shadow(get_font(fnt_consolas_bold), str, pos);
+
+			if (netplay.state == NETPLAY_RUNNING) {
+				const Netplay_Stats& stats = netplay.stats;
+
+				string str = tprintf("net frame: %d (remote %d)\n"
+									 "rollbacks: %d\n"
+									 "rollback frames: %d (max %d)\n"
+									 "resim: %fms (max %fms)\n"
+									 "waits: %d\n",
+									 netplay.frame,
+									 netplay.last_remote_frame,
+									 stats.rollbacks,
+									 stats.rollback_frames,
+									 stats.max_rollback_frames,
+									 stats.resim_time * 1000.0,
+									 stats.max_resim_time * 1000.0,
+									 stats.waits);
+				pos = draw_text_shadow(get_font(fnt_consolas_bold), str, pos);
+			}
 		}
 	}
 #endif
@@ -229,7 +317,12 @@ static string s_ConsoleCommandsBuf[] = {
 	"show_player_hitbox",
 	"show_debug_info",
 	"show_hitboxes",
+	"tilemap_shader",
+	"render_queue",
 	"load_level",
+	"record",
+	"play",
+	"stop_movie",
 	"debugbreak",
 };
 
@@ -276,6 +369,52 @@ bool console_callback(string str, void* userdata) {
 		return true;
 	}
 
+	// restarts the level and records from the beginning
+	if (command == "record") {
+		eat_whitespace(&str);
+		string fname = eat_non_whitespace(&str);
+
+		if (fname.count == 0) {
+			console.write("Usage: record <file>\n");
+			return true;
+		}
+
+		char* c_fname = to_c_string(fname);
+		defer { free(c_fname); };
+
+		movie_start_recording(c_fname, program.level_filepath);
+		program.set_program_mode(PROGRAM_GAME);
+		return true;
+	}
+
+	if (command == "play") {
+		eat_whitespace(&str);
+		string fname = eat_non_whitespace(&str);
+
+		if (fname.count == 0) {
+			console.write("Usage: play <file>\n");
+			return true;
+		}
+
+		char* c_fname = to_c_string(fname);
+		defer { free(c_fname); };
+
+		if (movie_start_playback(c_fname)) {
+			free(program.level_filepath.data);
+			program.level_filepath = copy_string(movie.level_filepath);
+
+			program.set_program_mode(PROGRAM_GAME);
+		} else {
+			console.write("Couldn't load the movie.\n");
+		}
+		return true;
+	}
+
+	if (command == "stop_movie") {
+		movie_stop();
+		return true;
+	}
+
 	if (command == "debugbreak") {
 		Assert(false);
 		return true;
@@ -308,6 +447,16 @@ bool console_callback(string str, void* userdata) {
 			game.show_hitboxes ^= true;
 			return true;
 		}
+
+		if (command == "tilemap_shader") {
+			game.tilemap_shader ^= true;
+			return true;
+		}
+
+		if (command == "render_queue") {
+			game.render_queue ^= true;
+			return true;
+		}
 	}
 
 	return false;
@@ -2,6 +2,7 @@
 
 #include "window_creation.h"
 #include "util.h"
+#include "software_renderer.h"
 
 Renderer renderer = {};
 
@@ -169,10 +170,19 @@ static int get_internal_format_from_gl_format(u32 gl_format) {
 Texture load_texture(u8* pixel_data, int width, int height,
 					 int filter, int wrap,
 					 u32 gl_format) {
+	if (renderer.software) {
+		return load_texture_software(pixel_data, width, height, wrap, gl_format);
+	}
+
 	Texture t = {};
 	t.width = width;
 	t.height = height;
 
+	// no GL context, keep only the size
+	if (window.headless) {
+		return t;
+	}
+
 	glGenTextures(1, &t.id);
 	glBindTexture(GL_TEXTURE_2D, t.id);
 
@@ -208,7 +218,47 @@ Texture load_depth_texture(int width, int height) {
 	return t;
 }
 
+Texture load_texture_u32(const u32* data, int width, int height) {
+	Texture t = {};
+	t.width = width;
+	t.height = height;
+
+	// no GL context, keep only the size
+	if (window.headless) {
+		return t;
+	}
+
+	glGenTextures(1, &t.id);
+	glBindTexture(GL_TEXTURE_2D, t.id);
+
+	// integer textures can't be filtered
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32UI, width, height, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, data);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return t;
+}
+
+void update_texture_u32(const Texture& t, const u32* data) {
+	if (t.id == 0) {
+		return;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, t.id);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, t.width, t.height, GL_RED_INTEGER, GL_UNSIGNED_INT, data);
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+
 void free_texture(Texture* t) {
+	if (renderer.software) {
+		free_texture_software(t);
+		return;
+	}
+
 	if (t->id != 0) glDeleteTextures(1, &t->id);
 	*t = {};
 }
@@ -218,6 +268,12 @@ Framebuffer load_framebuffer(int width, int height,
 							 u32 gl_format, bool depth_texture) {
 	Framebuffer f = {};
 	f.texture = load_texture(nullptr, width, height, filter, wrap, gl_format);
+
+	// the texture is the framebuffer
+	if (renderer.software) {
+		f.id = f.texture.id;
+		return f;
+	}
 	if (depth_texture) {
 		f.depth = load_depth_texture(width, height);
 	}
@@ -239,6 +295,11 @@ void free_framebuffer(Framebuffer* f) {
 	free_texture(&f->texture);
 	free_texture(&f->depth);
 
+	if (renderer.software) {
+		*f = {};
+		return;
+	}
+
 	if (f->id != 0) glDeleteFramebuffers(1, &f->id);
 	*f = {};
 }
@@ -248,35 +309,60 @@ void free_shader(Shader* s) {
 	*s = {};
 }
 
-void set_vertex_attribs(u32 program) {
-	int position = glGetAttribLocation(program, "in_Position");
-	if (position != -1) {
-		glVertexAttribPointer(position, 3, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, pos));
-		glEnableVertexAttribArray(position);
+// -1 for the ones the program doesn't use
+struct Vertex_Attribs {
+	int position;
+	int normal;
+	int color;
+	int texcoord;
+};
+
+static Vertex_Attribs get_vertex_attribs(u32 program) {
+	Vertex_Attribs a;
+	a.position = glGetAttribLocation(program, "in_Position");
+	a.normal   = glGetAttribLocation(program, "in_Normal");
+	a.color    = glGetAttribLocation(program, "in_Color");
+	a.texcoord = glGetAttribLocation(program, "in_TexCoord");
+	return a;
+}
+
+static void enable_vertex_attribs(const Vertex_Attribs& a) {
+	if (a.position != -1) glEnableVertexAttribArray(a.position);
+	if (a.normal   != -1) glEnableVertexAttribArray(a.normal);
+	if (a.color    != -1) glEnableVertexAttribArray(a.color);
+	if (a.texcoord != -1) glEnableVertexAttribArray(a.texcoord);
+}
+
+// into the bound GL_ARRAY_BUFFER
+static void set_vertex_attrib_pointers(const Vertex_Attribs& a, size_t offset) {
+	if (a.position != -1) {
+		glVertexAttribPointer(a.position, 3, GL_FLOAT, false, sizeof(Vertex), (void*) (offset + offsetof(Vertex, pos)));
 	}
 
-	int normal = glGetAttribLocation(program, "in_Normal");
-	if (normal != -1) {
-		glVertexAttribPointer(normal, 3, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, normal));
-		glEnableVertexAttribArray(normal);
+	if (a.normal != -1) {
+		glVertexAttribPointer(a.normal, 3, GL_FLOAT, false, sizeof(Vertex), (void*) (offset + offsetof(Vertex, normal)));
 	}
 
-	int color = glGetAttribLocation(program, "in_Color");
-	if (color != -1) {
-		glVertexAttribPointer(color, 4, GL_UNSIGNED_BYTE, true, sizeof(Vertex), (void*) offsetof(Vertex, color));
-		glEnableVertexAttribArray(color);
+	if (a.color != -1) {
+		glVertexAttribPointer(a.color, 4, GL_UNSIGNED_BYTE, true, sizeof(Vertex), (void*) (offset + offsetof(Vertex, color)));
 	}
 
-	int texcoord = glGetAttribLocation(program, "in_TexCoord");
-	if (texcoord != -1) {
-		glVertexAttribPointer(texcoord, 2, GL_FLOAT, false, sizeof(Vertex), (void*) offsetof(Vertex, uv));
-		glEnableVertexAttribArray(texcoord);
+	if (a.texcoord != -1) {
+		glVertexAttribPointer(a.texcoord, 2, GL_FLOAT, false, sizeof(Vertex), (void*) (offset + offsetof(Vertex, uv)));
 	}
 }
 
+void set_vertex_attribs(u32 program, size_t offset) {
+	Vertex_Attribs a = get_vertex_attribs(program);
+	set_vertex_attrib_pointers(a, offset);
+	enable_vertex_attribs(a);
+}
+
 constexpr size_t VERTICES_ARRAY_SIZE = BATCH_MAX_VERTICES * sizeof(Vertex);
 constexpr size_t INDICES_ARRAY_SIZE = BATCH_MAX_INDICES * sizeof(u16);
 
+constexpr size_t BATCH_VBO_SIZE = BATCH_VBO_SEGMENTS * VERTICES_ARRAY_SIZE;
+
 void init_renderer() {
 	// create a stub vao and bind it forever
 	glGenVertexArrays(1, &renderer.stub_vao);
@@ -287,7 +373,7 @@ void init_renderer() {
 
 	// allocate vertex buffer on the gpu
 	glBindBuffer(GL_ARRAY_BUFFER, renderer.batch_vbo);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * BATCH_MAX_VERTICES, nullptr, GL_DYNAMIC_DRAW);
+	glBufferData(GL_ARRAY_BUFFER, BATCH_VBO_SIZE, nullptr, GL_STREAM_DRAW);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
 	renderer.vertices = allocate_bump_array<Vertex>(BATCH_MAX_VERTICES, get_libc_allocator());
@@ -365,7 +451,41 @@ void init_renderer() {
 	renderer.current_shader = renderer.texture_shader.id;
 }
 
+void init_renderer_software() {
+	renderer.software = true;
+
+	renderer.vertices = allocate_bump_array<Vertex>(BATCH_MAX_VERTICES, get_libc_allocator());
+
+	// create default texture
+	{
+		u8 pixel_data[4] = {255, 255, 255, 255};
+		renderer.texture_for_shapes = load_texture(pixel_data, 1, 1, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_RGBA);
+	}
+
+	renderer.framebuffer = load_framebuffer(window.game_width, window.game_height, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_RGB, false);
+	renderer.software_target = renderer.framebuffer.texture;
+
+	log_info("Using the software renderer.");
+}
+
 void deinit_renderer() {
+	if (renderer.software) {
+		free_framebuffer(&renderer.framebuffer);
+		free_texture(&renderer.texture_for_shapes);
+
+		afree(renderer.vertices.data, VERTICES_ARRAY_SIZE, get_libc_allocator());
+
+		array_free(&renderer.queue);
+		array_free(&renderer.queue_vertices);
+		array_free(&renderer.queue_states);
+		array_free(&renderer.queue_static_quads);
+
+		deinit_software_textures();
+
+		renderer = {};
+		return;
+	}
+
 	glBindVertexArray(0);
 
 	free_shader(&renderer.texture_shader);
@@ -380,9 +500,19 @@ void deinit_renderer() {
 	afree(renderer.vertices.data, VERTICES_ARRAY_SIZE, get_libc_allocator());
 	renderer.vertices = {};
 
+	array_free(&renderer.queue);
+	array_free(&renderer.queue_vertices);
+	array_free(&renderer.queue_states);
+	array_free(&renderer.queue_static_quads);
+
 	glDeleteBuffers(1, &renderer.batch_ebo);
 	renderer.batch_ebo = 0;
 
+	for (GLsync& fence : renderer.batch_vbo_fences) {
+		if (fence) glDeleteSync(fence);
+		fence = nullptr;
+	}
+
 	glDeleteBuffers(1, &renderer.batch_vbo);
 	renderer.batch_vbo = 0;
 
@@ -400,12 +530,22 @@ void render_begin_frame(vec4 clear_color) {
 	renderer.draw_calls      = renderer.curr_draw_calls;
 	renderer.max_batch       = renderer.curr_max_batch;
 	renderer.total_triangles = renderer.curr_total_triangles;
+	renderer.bytes_uploaded  = renderer.curr_bytes_uploaded;
+	renderer.stalls_avoided  = renderer.curr_stalls_avoided;
 
 	renderer.curr_draw_calls      = 0;
 	renderer.curr_max_batch       = 0;
 	renderer.curr_total_triangles = 0;
+	renderer.curr_bytes_uploaded  = 0;
+	renderer.curr_stalls_avoided  = 0;
 
-	if (renderer.framebuffer.id != 0) {
+	if (renderer.software) {
+		renderer.software_target = renderer.framebuffer.texture;
+
+		if (clear_color.a > 0) {
+			clear_software(renderer.software_target, clear_color);
+		}
+	} else if (renderer.framebuffer.id != 0) {
 		glBindFramebuffer(GL_FRAMEBUFFER, renderer.framebuffer.id);
 		glViewport(0, 0, renderer.framebuffer.texture.width, renderer.framebuffer.texture.height);
 	} else {
@@ -417,7 +557,7 @@ void render_begin_frame(vec4 clear_color) {
 		glViewport(0, 0, backbuffer_width, backbuffer_height);
 	}
 
-	if (clear_color.a > 0) {
+	if (clear_color.a > 0 && !renderer.software) {
 		glClearColor(clear_color.r, clear_color.g, clear_color.b, clear_color.a);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	}
@@ -429,8 +569,18 @@ void render_begin_frame(vec4 clear_color) {
 }
 
 void render_end_frame() {
+	if (renderer.queue_active) {
+		end_render_queue();
+	}
+
 	break_batch();
 
+	// the frame stays in "renderer.framebuffer"
+	if (renderer.software) {
+		renderer.draw_took = get_time() - renderer.draw_took_t;
+		return;
+	}
+
 	int backbuffer_width;
 	int backbuffer_height;
 	SDL_GL_GetDrawableSize(window.handle, &backbuffer_width, &backbuffer_height);
@@ -531,6 +681,30 @@ static void setup_uniforms(u32 program) {
 		glUniformMatrix4fv(u_proj, 1, false, &renderer.proj_mat[0][0]);
 	}
 
+	int u_palette = glGetUniformLocation(program, "u_Palette");
+	if (u_palette != -1) {
+		glUniform1i(u_palette, 1);
+
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, renderer.palette.id);
+
+		glUniform1f(glGetUniformLocation(program, "u_PaletteIndex"),  (float) renderer.palette_index);
+		glUniform1f(glGetUniformLocation(program, "u_PaletteWidth"),  (float) renderer.palette.width);
+		glUniform1f(glGetUniformLocation(program, "u_PaletteHeight"), (float) renderer.palette.height);
+
+		glActiveTexture(GL_TEXTURE0);
+	}
+
+	int u_tiles = glGetUniformLocation(program, "u_Tiles");
+	if (u_tiles != -1) {
+		glUniform1i(u_tiles, 1);
+
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, renderer.shader_texture.id);
+
+		glActiveTexture(GL_TEXTURE0);
+	}
+
 	int u_texture = glGetUniformLocation(program, "u_Texture");
 	if (u_texture != -1) {
 		glUniform1i(u_texture, 0);
@@ -540,7 +714,87 @@ static void setup_uniforms(u32 program) {
 	}
 }
 
+// 
+// "batch_vbo" is split into BATCH_VBO_SEGMENTS segments that each fit a full batch.
+// Batches are written one after another without synchronizing, so no draw call ever
+// waits for the gpu to finish reading the buffer, like "glBufferSubData" at offset 0 did.
+// 
+// When the ring leaves a segment it puts a fence after its draws. If the gpu hasn't
+// passed that fence by the time the ring comes back around, the whole buffer is
+// orphaned instead of waiting, and the driver hands out new memory.
+// 
+// Persistent mapping needs GL 4.4 or GL_EXT_buffer_storage, which aren't loaded,
+// so batches are written with unsynchronized maps. WebGL can't map buffers at all,
+// there "glBufferSubData" writes the range, which the gpu isn't using either.
+// 
+// Returns the offset of the vertices in "batch_vbo", which has to be bound.
+// 
+static size_t upload_batch_vertices(array<Vertex> vertices) {
+	size_t size = vertices.count * sizeof(Vertex);
+
+	Assert(size <= VERTICES_ARRAY_SIZE);
+
+	// batches don't straddle segments, so that a fence covers every draw from its segment
+	size_t segment_end = (renderer.batch_vbo_segment + 1) * VERTICES_ARRAY_SIZE;
+
+	if (renderer.batch_vbo_offset + size > segment_end) {
+		renderer.batch_vbo_fences[renderer.batch_vbo_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+		size_t segment = (renderer.batch_vbo_segment + 1) % BATCH_VBO_SEGMENTS;
+
+		if (GLsync fence = renderer.batch_vbo_fences[segment]) {
+			// A timeout of 0 only checks. Flush, otherwise a fence that is still in the
+			// command queue never signals and every check would orphan the buffer.
+			u32 status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+
+			if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+				glDeleteSync(fence);
+				renderer.batch_vbo_fences[segment] = nullptr;
+			} else {
+				glBufferData(GL_ARRAY_BUFFER, BATCH_VBO_SIZE, nullptr, GL_STREAM_DRAW);
+
+				// they were for the old memory
+				for (GLsync& it : renderer.batch_vbo_fences) {
+					if (it) glDeleteSync(it);
+					it = nullptr;
+				}
+
+				renderer.curr_stalls_avoided++;
+			}
+		}
+
+		renderer.batch_vbo_segment = segment;
+		renderer.batch_vbo_offset = segment * VERTICES_ARRAY_SIZE;
+	}
+
+	size_t offset = renderer.batch_vbo_offset;
+
+#ifdef __EMSCRIPTEN__
+	glBufferSubData(GL_ARRAY_BUFFER, offset, size, vertices.data);
+#else
+	u32 access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+
+	if (void* ptr = glMapBufferRange(GL_ARRAY_BUFFER, offset, size, access)) {
+		memcpy(ptr, vertices.data, size);
+		glUnmapBuffer(GL_ARRAY_BUFFER);
+	} else {
+		glBufferSubData(GL_ARRAY_BUFFER, offset, size, vertices.data);
+	}
+#endif
+
+	renderer.batch_vbo_offset += size;
+	renderer.curr_bytes_uploaded += size;
+
+	return offset;
+}
+
+static void flush_render_queue();
+
 void break_batch() {
+	if (renderer.queue_active) {
+		flush_render_queue();
+	}
+
 	if (renderer.vertices.count == 0) {
 		return;
 	}
@@ -548,6 +802,29 @@ void break_batch() {
 	Assert(renderer.current_mode != MODE_NONE);
 	Assert(renderer.current_texture != 0);
 
+	if (renderer.software) {
+		Texture t = {};
+		t.id = renderer.current_texture;
+
+		mat4 mvp = (renderer.proj_mat * renderer.view_mat) * renderer.model_mat;
+		draw_software(renderer.software_target, renderer.current_mode, t, array<Vertex>(renderer.vertices.data, renderer.vertices.count), mvp,
+					  renderer.palette, renderer.palette_index);
+
+		if (renderer.current_mode == MODE_QUADS || renderer.current_mode == MODE_CIRCLES) {
+			renderer.curr_total_triangles += renderer.vertices.count / 4 * 2;
+		} else if (renderer.current_mode == MODE_TRIANGLES) {
+			renderer.curr_total_triangles += renderer.vertices.count / 3;
+		}
+
+		renderer.curr_draw_calls++;
+		renderer.curr_max_batch = max(renderer.curr_max_batch, renderer.vertices.count);
+
+		renderer.vertices.count = 0;
+		renderer.current_texture = 0;
+		renderer.current_mode = MODE_NONE;
+		return;
+	}
+
 	glBindBuffer(GL_ARRAY_BUFFER, renderer.batch_vbo);
 	defer { glBindBuffer(GL_ARRAY_BUFFER, 0); };
 
@@ -555,14 +832,14 @@ void break_batch() {
 	defer { glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); };
 
 	// upload vertices to gpu
-	glBufferSubData(GL_ARRAY_BUFFER, 0, renderer.vertices.count * sizeof(Vertex), renderer.vertices.data);
+	size_t offset = upload_batch_vertices(array<Vertex>(renderer.vertices.data, renderer.vertices.count));
 
 	u32 program = (renderer.current_mode == MODE_CIRCLES) ? renderer.circle_shader.id : renderer.current_shader;
 
 	glUseProgram(program);
 	defer { glUseProgram(0); };
 
-	set_vertex_attribs(program);
+	set_vertex_attribs(program, offset);
 
 	setup_uniforms(program);
 
@@ -622,13 +899,20 @@ void break_batch() {
 }
 
 void set_shader(u32 shader) {
+	if (renderer.software) {
+		return;
+	}
+
 	if (shader == 0) {
 		log_error("Trying to set invalid shader.");
 		return;
 	}
 
 	if (renderer.current_shader != shader) {
-		break_batch();
+		// the queue records it with the draws
+		if (!renderer.queue_active) {
+			break_batch();
+		}
 		renderer.current_shader = shader;
 
 		// to be able to set uniforms
@@ -637,19 +921,48 @@ void set_shader(u32 shader) {
 }
 
 void reset_shader() {
-	u32 shader = renderer.texture_shader.id;
+	set_palette({}, 0);
+	set_shader_texture({});
 
-	if (renderer.current_shader != shader) {
-		break_batch();
-		renderer.current_shader = shader;
+	if (renderer.software) {
+		return;
+	}
 
-		// to be able to set uniforms
-		glUseProgram(renderer.current_shader);
+	set_shader(renderer.texture_shader.id);
+}
+
+void set_shader_texture(const Texture& t) {
+	if (renderer.shader_texture.id != t.id) {
+		if (renderer.queue_active) {
+			renderer.queue_state_changed = true;
+		} else {
+			break_batch();
+		}
+		renderer.shader_texture = t;
+	}
+}
+
+void set_palette(const Texture& palette, int palette_index) {
+	if (renderer.palette.id != palette.id || renderer.palette_index != palette_index) {
+		if (renderer.queue_active) {
+			renderer.queue_state_changed = true;
+		} else {
+			break_batch();
+		}
+		renderer.palette = palette;
+		renderer.palette_index = palette_index;
 	}
 }
 
 void set_render_target(const Framebuffer& f) {
 	break_batch();
+
+	if (renderer.software) {
+		renderer.software_target = f.texture;
+		renderer.proj_mat = get_ortho(0, f.texture.width, f.texture.height, 0);
+		return;
+	}
+
 	glBindFramebuffer(GL_FRAMEBUFFER, f.id);
 	glViewport(0, 0, f.texture.width, f.texture.height);
 
@@ -658,6 +971,13 @@ void set_render_target(const Framebuffer& f) {
 
 void reset_render_target() {
 	break_batch();
+
+	if (renderer.software) {
+		renderer.software_target = renderer.framebuffer.texture;
+		renderer.proj_mat = get_ortho(0, renderer.framebuffer.texture.width, renderer.framebuffer.texture.height, 0);
+		return;
+	}
+
 	glBindFramebuffer(GL_FRAMEBUFFER, renderer.framebuffer.id);
 	glViewport(0, 0, renderer.framebuffer.texture.width, renderer.framebuffer.texture.height);
 
@@ -665,37 +985,329 @@ void reset_render_target() {
 }
 
 void set_proj_mat(const mat4& proj_mat) {
-	break_batch();
+	if (renderer.queue_active) {
+		renderer.queue_state_changed = true;
+	} else {
+		break_batch();
+	}
 	renderer.proj_mat = proj_mat;
 }
 
 void set_view_mat(const mat4& view_mat) {
-	break_batch();
+	if (renderer.queue_active) {
+		renderer.queue_state_changed = true;
+	} else {
+		break_batch();
+	}
 	renderer.view_mat = view_mat;
 }
 
 void set_model_mat(const mat4& model_mat) {
-	break_batch();
+	if (renderer.queue_active) {
+		renderer.queue_state_changed = true;
+	} else {
+		break_batch();
+	}
 	renderer.model_mat = model_mat;
 }
 
 void set_viewport(int x, int y, int width, int height) {
 	break_batch();
+
+	// always the whole target
+	if (renderer.software) {
+		return;
+	}
+
 	glViewport(x, y, width, height);
 }
 
 void render_clear_color(vec4 color) {
 	break_batch();
+
+	if (renderer.software) {
+		clear_software(renderer.software_target, color);
+		return;
+	}
+
 	glClearColor(color.r, color.g, color.b, color.a);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
+// 
+// Command queue.
+// 
+
+// the sequence number has 16 bits
+constexpr size_t RENDER_QUEUE_MAX_COMMANDS = 0x10000;
+
+// the parts of the key
+constexpr u64 RENDER_KEY_GROUP    = 0xFFFF'0000'0000'0000ull; // layer and priority
+constexpr u64 RENDER_KEY_OVERLAP  = 0x0000'FF00'0000'0000ull;
+constexpr u64 RENDER_KEY_BATCH    = 0x0000'00FF'FFFF'0000ull; // shader and texture
+constexpr u64 RENDER_KEY_SEQUENCE = 0x0000'0000'0000'FFFFull;
+
+constexpr int RENDER_KEY_OVERLAP_SHIFT = 40;
+constexpr int MAX_RENDER_OVERLAP = 0xFF;
+
+// the box around the vertices, then its corners through the matrices
+static void get_clip_bounds(array<Vertex> vertices, vec2* out_min, vec2* out_max) {
+	vec2 vmin = { INFINITY,  INFINITY};
+	vec2 vmax = {-INFINITY, -INFINITY};
+
+	For (v, vertices) {
+		vmin.x = fminf(vmin.x, v->pos.x);
+		vmin.y = fminf(vmin.y, v->pos.y);
+		vmax.x = fmaxf(vmax.x, v->pos.x);
+		vmax.y = fmaxf(vmax.y, v->pos.y);
+	}
+
+	*out_min = { INFINITY,  INFINITY};
+	*out_max = {-INFINITY, -INFINITY};
+
+	// overlaps nothing
+	if (vertices.count == 0) {
+		return;
+	}
+
+	mat4 mvp = (renderer.proj_mat * renderer.view_mat) * renderer.model_mat;
+
+	vec2 corners[4] = {{vmin.x, vmin.y}, {vmax.x, vmin.y}, {vmax.x, vmax.y}, {vmin.x, vmax.y}};
+
+	for (vec2 c : corners) {
+		vec4 clip = mvp * vec4{c.x, c.y, 0.0f, 1.0f};
+		vec2 p = {clip.x / clip.w, clip.y / clip.w};
+
+		out_min->x = fminf(out_min->x, p.x);
+		out_min->y = fminf(out_min->y, p.y);
+		out_max->x = fmaxf(out_max->x, p.x);
+		out_max->y = fmaxf(out_max->y, p.y);
+	}
+}
+
+static void record_render_command(RenderMode mode, const Texture& t,
+								  array<Vertex> vertices, array<const Static_Quads*> static_quads = {}) {
+	if (renderer.queue.count >= RENDER_QUEUE_MAX_COMMANDS) {
+		flush_render_queue();
+	}
+
+	bool is_static_quads = (static_quads.count > 0);
+
+	// static quads are whole chunks, they count as covering everything
+	vec2 bounds_min = {-INFINITY, -INFINITY};
+	vec2 bounds_max = { INFINITY,  INFINITY};
+	if (!is_static_quads) {
+		get_clip_bounds(vertices, &bounds_min, &bounds_max);
+	}
+
+	u32 sort_shader = (mode == MODE_CIRCLES) ? renderer.circle_shader.id : renderer.current_shader;
+
+	u64 group = 0;
+	group |= (u64) renderer.queue_layer    << 56;
+	group |= (u64) renderer.queue_priority << 48;
+
+	u64 batch = 0;
+	batch |= (u64) (sort_shader & 0xFF)  << 32;
+	batch |= (u64) (t.id        & 0xFFFF) << 16;
+
+	// above everything earlier in the group that it overlaps and that could sort in front of it
+	int overlap = 0;
+	For (cmd, renderer.queue) {
+		if ((cmd->key & RENDER_KEY_GROUP) != group) continue;
+
+		if (bounds_min.x >= cmd->bounds_max.x || cmd->bounds_min.x >= bounds_max.x) continue;
+		if (bounds_min.y >= cmd->bounds_max.y || cmd->bounds_min.y >= bounds_max.y) continue;
+
+		int level = (int) ((cmd->key & RENDER_KEY_OVERLAP) >> RENDER_KEY_OVERLAP_SHIFT);
+		if ((cmd->key & RENDER_KEY_BATCH) != batch) level++;
+
+		overlap = max(overlap, level);
+	}
+
+	if (overlap > MAX_RENDER_OVERLAP) {
+		flush_render_queue();
+		overlap = 0;
+	}
+
+	if (renderer.queue_state_changed || renderer.queue_states.count == 0) {
+		Render_State s;
+		s.proj_mat  = renderer.proj_mat;
+		s.view_mat  = renderer.view_mat;
+		s.model_mat = renderer.model_mat;
+		s.palette        = renderer.palette;
+		s.palette_index  = renderer.palette_index;
+		s.shader_texture = renderer.shader_texture;
+		array_add(&renderer.queue_states, s);
+
+		renderer.queue_state_changed = false;
+	}
+
+	int state = (int) renderer.queue_states.count - 1;
+
+	// same as the last draw, they'd end up next to each other anyway
+	if (renderer.queue.count > 0 && !is_static_quads) {
+		Render_Command* last = &renderer.queue[renderer.queue.count - 1];
+
+		int last_overlap = (int) ((last->key & RENDER_KEY_OVERLAP) >> RENDER_KEY_OVERLAP_SHIFT);
+
+		if ((last->key & (RENDER_KEY_GROUP | RENDER_KEY_BATCH)) == (group | batch)
+			&& last_overlap >= overlap
+			&& last->mode == mode
+			&& last->texture.id == t.id
+			&& last->shader == renderer.current_shader
+			&& last->state == state
+			&& !last->static_quads
+			&& last->num_vertices + vertices.count <= BATCH_MAX_VERTICES)
+		{
+			array_add_many(&renderer.queue_vertices, vertices);
+			last->num_vertices += (u32) vertices.count;
+
+			last->bounds_min.x = fminf(last->bounds_min.x, bounds_min.x);
+			last->bounds_min.y = fminf(last->bounds_min.y, bounds_min.y);
+			last->bounds_max.x = fmaxf(last->bounds_max.x, bounds_max.x);
+			last->bounds_max.y = fmaxf(last->bounds_max.y, bounds_max.y);
+			return;
+		}
+	}
+
+	Render_Command cmd = {};
+	cmd.key = group | ((u64) overlap << RENDER_KEY_OVERLAP_SHIFT) | batch | (u64) renderer.queue.count;
+	cmd.mode = mode;
+	cmd.texture = t;
+	cmd.state = state;
+	cmd.static_quads = is_static_quads;
+	cmd.shader = renderer.current_shader;
+	cmd.bounds_min = bounds_min;
+	cmd.bounds_max = bounds_max;
+
+	if (is_static_quads) {
+		cmd.first_vertex = (u32) renderer.queue_static_quads.count;
+		cmd.num_vertices = (u32) static_quads.count;
+		array_add_many(&renderer.queue_static_quads, static_quads);
+	} else {
+		cmd.first_vertex = (u32) renderer.queue_vertices.count;
+		cmd.num_vertices = (u32) vertices.count;
+		array_add_many(&renderer.queue_vertices, vertices);
+	}
+
+	array_add(&renderer.queue, cmd);
+}
+
+static int compare_render_commands(const void* _a, const void* _b) {
+	const Render_Command* a = (const Render_Command*) _a;
+	const Render_Command* b = (const Render_Command*) _b;
+
+	if (a->key != b->key) return (a->key < b->key) ? -1 : 1;
+	return 0;
+}
+
+static void push_vertices(RenderMode mode, const Texture& t, array<Vertex> vertices);
+
+static void flush_render_queue() {
+	if (renderer.queue.count == 0) {
+		return;
+	}
+
+	qsort(renderer.queue.data, renderer.queue.count, sizeof(renderer.queue[0]), compare_render_commands);
+
+	// draw it like it wasn't queued
+	renderer.queue_active = false;
+
+	Render_State current;
+	current.proj_mat  = renderer.proj_mat;
+	current.view_mat  = renderer.view_mat;
+	current.model_mat = renderer.model_mat;
+	current.palette        = renderer.palette;
+	current.palette_index  = renderer.palette_index;
+	current.shader_texture = renderer.shader_texture;
+
+	u32 current_shader = renderer.current_shader;
+
+	int state = -1;
+
+	For (cmd, renderer.queue) {
+		if (cmd->state != state) {
+			const Render_State& s = renderer.queue_states[cmd->state];
+			set_proj_mat (s.proj_mat);
+			set_view_mat (s.view_mat);
+			set_model_mat(s.model_mat);
+			set_palette(s.palette, s.palette_index);
+			set_shader_texture(s.shader_texture);
+			state = cmd->state;
+		}
+
+		if (cmd->shader != renderer.current_shader) {
+			set_shader(cmd->shader);
+		}
+
+		if (cmd->static_quads) {
+			draw_static_quads(array<const Static_Quads*>(&renderer.queue_static_quads[cmd->first_vertex], cmd->num_vertices), cmd->texture);
+		} else {
+			push_vertices(cmd->mode, cmd->texture, array<Vertex>(&renderer.queue_vertices[cmd->first_vertex], cmd->num_vertices));
+		}
+	}
+
+	break_batch();
+
+	renderer.proj_mat  = current.proj_mat;
+	renderer.view_mat  = current.view_mat;
+	renderer.model_mat = current.model_mat;
+	renderer.palette        = current.palette;
+	renderer.palette_index  = current.palette_index;
+	renderer.shader_texture = current.shader_texture;
+
+	if (renderer.current_shader != current_shader) {
+		set_shader(current_shader);
+	}
+
+	renderer.queue.count          = 0;
+	renderer.queue_vertices.count = 0;
+	renderer.queue_states.count   = 0;
+	renderer.queue_static_quads.count = 0;
+
+	renderer.queue_active = true;
+}
+
+void begin_render_queue() {
+	Assert(!renderer.queue_active);
+
+	// draw what came before first
+	break_batch();
+
+	renderer.queue_active = true;
+	renderer.queue_state_changed = true;
+	renderer.queue_layer = 0;
+	renderer.queue_priority = 0;
+}
+
+void end_render_queue() {
+	Assert(renderer.queue_active);
+
+	flush_render_queue();
+
+	renderer.queue_active = false;
+}
+
+void set_render_layer(u8 layer) {
+	renderer.queue_layer = layer;
+	renderer.queue_priority = 0;
+}
+
+void set_render_priority(u8 priority) {
+	renderer.queue_priority = priority;
+}
+
 static void push_vertices(RenderMode mode, const Texture& t, array<Vertex> vertices) {
 	if (t.id == 0) {
 		log_error("trying to draw invalid texture");
 		return;
 	}
 
+	if (renderer.queue_active) {
+		record_render_command(mode, t, vertices);
+		return;
+	}
+
 	if (t.id != renderer.current_texture
 		|| renderer.current_mode != mode
 		|| renderer.vertices.count + vertices.count > BATCH_MAX_VERTICES)
@@ -769,8 +1381,8 @@ void draw_texture(const Texture& t, Rect src,
 	draw_quad(t, vertices);
 }
 
-void draw_texture_simple(const Texture& t, Rect src,
-						 vec2 pos, vec2 origin, vec4 color, bvec2 flip) {
+void get_texture_simple_vertices(Vertex vertices[4], const Texture& t, Rect src,
+								 vec2 pos, vec2 origin, vec4 color, bvec2 flip) {
 	if (src.w == 0 && src.h == 0) {
 		src.w = t.width;
 		src.h = t.height;
@@ -798,16 +1410,118 @@ void draw_texture_simple(const Texture& t, Rect src,
 		v2 = temp;
 	}
 
-	Vertex vertices[4] = {
-		{{x1, y1, 0.0f}, {}, pack_color_u32(color), {u1, v1}}, // LT
-		{{x2, y1, 0.0f}, {}, pack_color_u32(color), {u2, v1}}, // RT
-		{{x2, y2, 0.0f}, {}, pack_color_u32(color), {u2, v2}}, // RB
-		{{x1, y2, 0.0f}, {}, pack_color_u32(color), {u1, v2}}, // LB
-	};
+	vertices[0] = {{x1, y1, 0.0f}, {}, pack_color_u32(color), {u1, v1}}; // LT
+	vertices[1] = {{x2, y1, 0.0f}, {}, pack_color_u32(color), {u2, v1}}; // RT
+	vertices[2] = {{x2, y2, 0.0f}, {}, pack_color_u32(color), {u2, v2}}; // RB
+	vertices[3] = {{x1, y2, 0.0f}, {}, pack_color_u32(color), {u1, v2}}; // LB
+}
+
+void draw_texture_simple(const Texture& t, Rect src,
+						 vec2 pos, vec2 origin, vec4 color, bvec2 flip) {
+	Vertex vertices[4];
+	get_texture_simple_vertices(vertices, t, src, pos, origin, color, flip);
 
 	draw_quad(t, vertices);
 }
 
+void upload_static_quads(Static_Quads* q, array<Vertex> vertices) {
+	Assert(vertices.count % 4 == 0);
+	Assert(vertices.count <= BATCH_MAX_VERTICES);
+
+	if (renderer.software) {
+		free(q->software_vertices);
+		q->software_vertices = (Vertex*) malloc(max(vertices.count, (size_t) 1) * sizeof(Vertex));
+		Assert(q->software_vertices);
+
+		memcpy(q->software_vertices, vertices.data, vertices.count * sizeof(Vertex));
+		q->num_quads = (int) (vertices.count / 4);
+		return;
+	}
+
+	if (q->vbo == 0) {
+		glGenBuffers(1, &q->vbo);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, q->vbo);
+	defer { glBindBuffer(GL_ARRAY_BUFFER, 0); };
+
+	glBufferData(GL_ARRAY_BUFFER, vertices.count * sizeof(Vertex), vertices.data, GL_STATIC_DRAW);
+
+	q->num_quads = (int) (vertices.count / 4);
+}
+
+void free_static_quads(Static_Quads* q) {
+	free(q->software_vertices);
+
+	if (q->vbo != 0) {
+		glDeleteBuffers(1, &q->vbo);
+	}
+
+	*q = {};
+}
+
+void draw_static_quads(array<const Static_Quads*> quads, const Texture& t) {
+	if (quads.count == 0) {
+		return;
+	}
+
+	if (renderer.queue_active) {
+		record_render_command(MODE_QUADS, t, {}, quads);
+		return;
+	}
+
+	break_batch();
+
+	if (renderer.software) {
+		mat4 mvp = (renderer.proj_mat * renderer.view_mat) * renderer.model_mat;
+
+		For (it, quads) {
+			const Static_Quads* q = *it;
+			if (q->num_quads == 0) continue;
+
+			draw_software(renderer.software_target, MODE_QUADS, t, array<Vertex>(q->software_vertices, q->num_quads * 4), mvp,
+						  renderer.palette, renderer.palette_index);
+
+			renderer.curr_draw_calls++;
+			renderer.curr_total_triangles += q->num_quads * 2;
+		}
+		return;
+	}
+
+	// the same program and uniforms for all of them
+	u32 program = renderer.current_shader;
+
+	glUseProgram(program);
+	defer { glUseProgram(0); };
+
+	// "setup_uniforms" binds the current texture
+	renderer.current_texture = t.id;
+	setup_uniforms(program);
+	renderer.current_texture = 0;
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, renderer.batch_ebo);
+	defer { glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0); };
+
+	Vertex_Attribs attribs = get_vertex_attribs(program);
+	enable_vertex_attribs(attribs);
+
+	defer { glBindBuffer(GL_ARRAY_BUFFER, 0); };
+
+	// without a VAO per buffer, the pointers have to follow the buffer
+	For (it, quads) {
+		const Static_Quads* q = *it;
+		if (q->num_quads == 0) continue;
+
+		glBindBuffer(GL_ARRAY_BUFFER, q->vbo);
+		set_vertex_attrib_pointers(attribs, 0);
+
+		glDrawElements(GL_TRIANGLES, q->num_quads * 6, GL_UNSIGNED_SHORT, nullptr);
+
+		renderer.curr_draw_calls++;
+		renderer.curr_total_triangles += q->num_quads * 2;
+	}
+}
+
 void draw_texture_centered(const Texture& t,
 						   vec2 pos, vec2 scale,
 						   float angle, vec4 color, bvec2 flip) {
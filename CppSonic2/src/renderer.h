@@ -6,6 +6,8 @@
 * A basic 2D batch renderer.
 * 
 * Call break_batch() before making raw OpenGL calls.
+* 
+* Without a GPU, it can draw on the CPU instead (see "init_renderer_software").
 */
 
 #if defined(__ANDROID__) || defined(__EMSCRIPTEN__)
@@ -19,6 +21,9 @@ constexpr size_t INDICES_PER_QUAD   = 6;
 constexpr size_t BATCH_MAX_VERTICES = (BATCH_MAX_QUADS * VERTICES_PER_QUAD);
 constexpr size_t BATCH_MAX_INDICES  = (BATCH_MAX_QUADS * INDICES_PER_QUAD);
 
+// "batch_vbo" is a ring of this many full batches, see "break_batch"
+constexpr size_t BATCH_VBO_SEGMENTS = 3;
+
 struct Vertex {
 	vec3 pos;
 	vec3 normal;
@@ -49,6 +54,10 @@ Texture load_texture(u8* pixel_data, int width, int height,
 
 Texture load_depth_texture(int width, int height);
 
+// One u32 per texel (GL_R32UI), read in shaders with "usampler2D" and "texelFetch".
+Texture load_texture_u32(const u32* data, int width, int height);
+void update_texture_u32(const Texture& t, const u32* data);
+
 void free_texture(Texture* t);
 
 struct Framebuffer {
@@ -69,6 +78,41 @@ struct Shader {
 
 void free_shader(Shader* s);
 
+struct Static_Quads;
+
+// a draw recorded by the command queue, see "begin_render_queue"
+struct Render_Command {
+	u64 key;
+
+	RenderMode mode;
+	Texture texture;
+	int state; // index into "renderer.queue_states"
+
+	u32 first_vertex; // in "renderer.queue_vertices"
+	u32 num_vertices;
+
+	// drawn from their own buffers instead, then "first_vertex" and "num_vertices"
+	// are the range in "renderer.queue_static_quads"
+	bool static_quads;
+
+	u32 shader;
+
+	// in clip space, to keep overlapping draws in order
+	vec2 bounds_min;
+	vec2 bounds_max;
+};
+
+// the matrices and shader inputs a recorded draw was made with
+struct Render_State {
+	mat4 proj_mat;
+	mat4 view_mat;
+	mat4 model_mat;
+
+	Texture palette;
+	int palette_index;
+	Texture shader_texture;
+};
+
 struct Renderer {
 	u32 current_texture;
 	RenderMode current_mode;
@@ -84,6 +128,9 @@ struct Renderer {
 
 	u32 batch_vbo;
 	u32 batch_ebo;
+	size_t batch_vbo_offset; // where the next batch goes
+	size_t batch_vbo_segment;
+	GLsync batch_vbo_fences[BATCH_VBO_SEGMENTS]; // for the segments the ring left
 	Texture texture_for_shapes; // 1x1 white texture
 
 	Framebuffer framebuffer;
@@ -99,30 +146,102 @@ struct Renderer {
 	int draw_calls;
 	size_t max_batch;
 	int total_triangles;
+	size_t bytes_uploaded;
+	int stalls_avoided; // times "batch_vbo" was orphaned instead of waiting for the gpu
 
 	int curr_draw_calls;
 	size_t curr_max_batch;
 	int curr_total_triangles;
+	size_t curr_bytes_uploaded;
+	int curr_stalls_avoided;
 
 	double draw_took;
 	double draw_took_t;
+
+	// see "begin_render_queue"
+	bool queue_active;
+	bool queue_state_changed;
+	u8 queue_layer;
+	u8 queue_priority;
+	dynamic_array<Render_Command> queue;
+	dynamic_array<Vertex>         queue_vertices;
+	dynamic_array<Render_State>   queue_states;
+	dynamic_array<const Static_Quads*> queue_static_quads;
+
+	// see "set_palette" and "set_shader_texture"
+	Texture palette;
+	int palette_index;
+	Texture shader_texture;
+
+	// see "init_renderer_software"
+	bool software;
+	Texture software_target;
 };
 
 extern Renderer renderer;
 
-void set_vertex_attribs(u32 program);
+// "offset" is where the vertices start in the bound GL_ARRAY_BUFFER
+void set_vertex_attribs(u32 program, size_t offset = 0);
 
 void init_renderer(); // assumes opengl is initialized
 void deinit_renderer();
 
+// 
+// Draws into memory on the CPU instead of with GL, see "software_renderer.h".
+// Call after "init_window_headless" and before loading any textures, and
+// "deinit_renderer" after freeing them. Shaders don't exist, "set_shader" does nothing.
+// What was drawn ends up in "renderer.framebuffer", see "get_texture_pixels_software".
+// 
+void init_renderer_software();
+
 void render_begin_frame(vec4 clear_color);
 void render_end_frame();
 
 void break_batch(); // makes the draw call
 
+// 
+// Command queue. Between "begin_render_queue" and "end_render_queue" draws are
+// recorded instead of batched right away, each with a 64-bit key:
+// 
+//   layer (8 bits) | priority (8 bits) | overlap (8 bits) | shader (8 bits) | texture (16 bits) | sequence (16 bits)
+// 
+// The queue is sorted by key when it ends and drawn with as few batches as possible.
+// Draws in the same layer and priority are grouped by shader and texture, but a draw
+// never moves in front of an earlier one that it overlaps on the screen: it goes one
+// "overlap" level above every earlier overlapping draw that sorts differently. Draws
+// with the same key stay in the order they were made. The overlap check goes through
+// the draws recorded so far in the same layer and priority.
+// 
+// The matrices, the shader, the palette and the shader texture are recorded with the
+// draws. Uniforms set with raw GL calls after "set_shader" apply to every draw with
+// that shader in the queue. "break_batch" draws everything recorded so far, and so do
+// "set_render_target" and "render_clear_color", so raw GL calls after them still
+// happen in order.
+// 
+// "render_end_frame" ends a queue that was left open.
+// 
+void begin_render_queue();
+void end_render_queue();
+
+// for the next draws, both start at 0
+void set_render_layer(u8 layer);
+void set_render_priority(u8 priority);
+
 void set_shader(u32 shader);
 void reset_shader();
 
+// A second texture for the next draws, bound to texture unit 1 ("u_Tiles") when drawing
+// with a shader that has it, like the tilemap shader. "reset_shader" unsets it.
+void set_shader_texture(const Texture& t);
+
+// 
+// For the palette shader ("shaders/palette.frag"): the next draws take their colors
+// from row "palette_index" of "palette", by the red channel of their texels. It's bound
+// to texture unit 1 ("u_Palette") when drawing with a shader that has it, and the
+// software renderer does the lookup itself. "reset_shader" unsets it.
+// 
+void set_palette(const Texture& palette, int palette_index);
+
 void set_render_target(const Framebuffer& f);
 void reset_render_target();
 
@@ -136,6 +255,29 @@ void render_clear_color(vec4 color);
 
 void draw_quad(const Texture& t, Vertex vertices[4]);
 
+// the vertices that "draw_texture_simple" draws, for building vertex buffers
+void get_texture_simple_vertices(Vertex vertices[4], const Texture& t, Rect src = {},
+								 vec2 pos = {}, vec2 origin = {}, vec4 color = color_white, bvec2 flip = {});
+
+// 
+// Quads that are uploaded once and drawn from their own vertex buffer with the batch's
+// index buffer, so at most BATCH_MAX_QUADS. Drawing them breaks the batch.
+// 
+// "draw_static_quads" draws any number of them with one texture, and sets up the shader
+// once for all of them.
+// 
+struct Static_Quads {
+	u32 vbo;
+	int num_quads;
+
+	Vertex* software_vertices; // the software renderer keeps a copy instead
+};
+
+void upload_static_quads(Static_Quads* q, array<Vertex> vertices);
+void free_static_quads(Static_Quads* q);
+
+void draw_static_quads(array<const Static_Quads*> quads, const Texture& t);
+
 void draw_texture(const Texture& t, Rect src = {},
 				  vec2 pos = {}, vec2 scale = {1, 1},
 				  vec2 origin = {}, float angle = 0, vec4 color = color_white, bvec2 flip = {});
@@ -0,0 +1,354 @@
+#include "rewind.h"
+
+#include "game.h"
+
+Rewind_Buffer rewind_buffer;
+
+// zero runs shorter than this are cheaper to keep in the literals
+constexpr size_t MIN_ZERO_RUN = 4;
+
+// Game struct, objects
+constexpr size_t MAX_STATE_SIZE = sizeof(Game) + MAX_OBJECTS * (sizeof(Object) + sizeof(Object_Slot));
+
+// every chunk but the first starts with at least MIN_ZERO_RUN zeros, so the header never makes it bigger
+constexpr size_t MAX_ENCODED_SIZE = MAX_STATE_SIZE + 4 * (MAX_STATE_SIZE / 0xFFFF + 2);
+
+static_assert(REWIND_MEMORY >= MAX_ENCODED_SIZE);
+
+//
+// Encoding: a sequence of chunks: u16 number of zeros, u16 number of literals, literals.
+// If "base" isn't null, the bytes are "state ^ base".
+//
+static size_t encode(const u8* state, const u8* base, size_t size, u8* out) {
+	auto byte = [&](size_t i) -> u8 {
+		return base ? (state[i] ^ base[i]) : state[i];
+	};
+
+	size_t pos = 0;
+	size_t i = 0;
+
+	while (i < size) {
+		u16 zeros = 0;
+		while (i < size && zeros < 0xFFFF && byte(i) == 0) {
+			zeros++;
+			i++;
+		}
+
+		size_t lit = i;
+		while (i < size && i - lit < 0xFFFF) {
+			if (byte(i) != 0) {
+				i++;
+				continue;
+			}
+
+			size_t z = i;
+			while (z < size && z - i < MIN_ZERO_RUN && byte(z) == 0) {
+				z++;
+			}
+
+			if (z == size || z - i >= MIN_ZERO_RUN) {
+				break;
+			}
+
+			i = min(z, lit + 0xFFFF);
+		}
+
+		u16 count = (u16) (i - lit);
+
+		memcpy(out + pos, &zeros, sizeof zeros); pos += sizeof zeros;
+		memcpy(out + pos, &count, sizeof count); pos += sizeof count;
+
+		for (size_t j = lit; j < i; j++) {
+			out[pos++] = byte(j);
+		}
+	}
+
+	return pos;
+}
+
+// If "delta" is true, XOR's the bytes onto "state", otherwise overwrites it.
+static void decode(const u8* data, size_t data_size, u8* state, size_t size, bool delta) {
+	size_t pos = 0;
+	size_t i = 0;
+
+	while (pos < data_size) {
+		u16 zeros;
+		u16 count;
+		memcpy(&zeros, data + pos, sizeof zeros); pos += sizeof zeros;
+		memcpy(&count, data + pos, sizeof count); pos += sizeof count;
+
+		Assert(i + zeros + count <= size);
+
+		if (!delta) {
+			memset(state + i, 0, zeros);
+		}
+		i += zeros;
+
+		if (delta) {
+			for (size_t j = 0; j < count; j++) {
+				state[i + j] ^= data[pos + j];
+			}
+		} else {
+			memcpy(state + i, data + pos, count);
+		}
+		i += count;
+		pos += count;
+	}
+
+	Assert(i == size);
+}
+
+static Rewind_Record* get_record(int index) {
+	Assert(index >= 0 && index < rewind_buffer.num_records);
+	return &rewind_buffer.records[(rewind_buffer.first_record + index) % REWIND_MAX_FRAMES];
+}
+
+// writes the game state into "next_state"
+static size_t write_state() {
+	auto& r = rewind_buffer;
+
+	size_t size = 0;
+
+	memcpy(r.next_state + size, &game, sizeof game);                                    size += sizeof game;
+	memcpy(r.next_state + size, game.objects.data, game.objects.count * sizeof(Object)); size += game.objects.count * sizeof(Object);
+	memcpy(r.next_state + size, game.object_slots.data, game.object_slots.count * sizeof(Object_Slot)); size += game.object_slots.count * sizeof(Object_Slot);
+
+	Assert(size <= MAX_STATE_SIZE);
+
+	if (size < r.next_state_size) {
+		memset(r.next_state + size, 0, r.next_state_size - size);
+	}
+	r.next_state_size = size;
+
+	return size;
+}
+
+// reads the game state from "state"
+static void read_state() {
+	auto& r = rewind_buffer;
+
+	size_t size = 0;
+
+	Game g;
+	memcpy(&g, r.state + size, sizeof g); size += sizeof g;
+
+	// we only rewind while the game isn't paused, and particles aren't recorded
+	auto pause_state = game.pause_state;
+	auto particles = game.particles;
+
+	restore_game(&game, g);
+
+	game.pause_state = pause_state;
+	game.particles = particles;
+
+	memcpy(game.objects.data, r.state + size, game.objects.count * sizeof(Object)); size += game.objects.count * sizeof(Object);
+	memcpy(game.object_slots.data, r.state + size, game.object_slots.count * sizeof(Object_Slot)); size += game.object_slots.count * sizeof(Object_Slot);
+
+	Assert(size == r.state_size);
+
+	game.object_derived_stale = true;
+}
+
+static void drop_oldest_keyframe() {
+	auto& r = rewind_buffer;
+
+	Assert(r.num_records > 0);
+	Assert(get_record(0)->keyframe);
+
+	// drop the keyframe and the deltas that depend on it
+	do {
+		r.memory_used -= get_record(0)->size;
+		r.first_record = (r.first_record + 1) % REWIND_MAX_FRAMES;
+		r.num_records--;
+	} while (r.num_records > 0 && !get_record(0)->keyframe);
+}
+
+// finds room for "size" bytes in the ring buffer, returns false if there's none
+static bool find_room(size_t size, u32* offset) {
+	auto& r = rewind_buffer;
+
+	if (r.num_records == 0) {
+		*offset = 0;
+		return size <= REWIND_MEMORY;
+	}
+
+	Rewind_Record* oldest = get_record(0);
+	Rewind_Record* newest = get_record(r.num_records - 1);
+
+	size_t head = newest->offset + newest->size;
+	size_t tail = oldest->offset;
+
+	if (newest->offset >= oldest->offset) {
+		// free space is [head, end) and [0, tail)
+		if (head + size <= REWIND_MEMORY) {
+			*offset = (u32) head;
+			return true;
+		}
+
+		if (size <= tail) {
+			*offset = 0;
+			return true;
+		}
+	} else {
+		// free space is [head, tail)
+		if (head + size <= tail) {
+			*offset = (u32) head;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void rewind_init() {
+	auto& r = rewind_buffer;
+
+	r = {};
+
+	r.memory     = (u8*) malloc(REWIND_MEMORY);
+	r.records    = (Rewind_Record*) malloc(REWIND_MAX_FRAMES * sizeof(Rewind_Record));
+	r.state      = (u8*) calloc(MAX_STATE_SIZE, 1);
+	r.next_state = (u8*) calloc(MAX_STATE_SIZE, 1);
+	r.encoded    = (u8*) malloc(MAX_ENCODED_SIZE);
+
+	Assert(r.memory);
+	Assert(r.records);
+	Assert(r.state);
+	Assert(r.next_state);
+	Assert(r.encoded);
+}
+
+void rewind_deinit() {
+	auto& r = rewind_buffer;
+
+	free(r.encoded);
+	free(r.next_state);
+	free(r.state);
+	free(r.records);
+	free(r.memory);
+
+	r = {};
+}
+
+void rewind_reset() {
+	auto& r = rewind_buffer;
+
+	r.first_record = 0;
+	r.num_records = 0;
+	r.memory_used = 0;
+	r.frames_since_keyframe = 0;
+}
+
+void rewind_record() {
+	auto& r = rewind_buffer;
+
+	if (!r.memory) return;
+
+	if (r.num_records == REWIND_MAX_FRAMES) {
+		drop_oldest_keyframe();
+	}
+
+	size_t state_size = write_state();
+
+	bool keyframe = (r.num_records == 0 || r.frames_since_keyframe + 1 >= REWIND_KEYFRAME_INTERVAL);
+
+	size_t size;
+	if (keyframe) {
+		size = encode(r.next_state, nullptr, state_size, r.encoded);
+	} else {
+		size = encode(r.next_state, r.state, max(state_size, r.state_size), r.encoded);
+	}
+
+	u32 offset;
+	while (!find_room(size, &offset)) {
+		drop_oldest_keyframe();
+
+		// the delta's base got dropped
+		if (r.num_records == 0 && !keyframe) {
+			keyframe = true;
+			size = encode(r.next_state, nullptr, state_size, r.encoded);
+		}
+	}
+
+	memcpy(r.memory + offset, r.encoded, size);
+
+	Rewind_Record record = {};
+	record.offset = offset;
+	record.size = (u32) size;
+	record.state_size = (u32) state_size;
+	record.keyframe = keyframe;
+
+	r.num_records++;
+	*get_record(r.num_records - 1) = record;
+	r.memory_used += size;
+
+	r.frames_since_keyframe = keyframe ? 0 : (r.frames_since_keyframe + 1);
+
+	// the new state becomes the base for the next delta
+	{
+		u8* temp = r.state;
+		r.state = r.next_state;
+		r.next_state = temp;
+
+		size_t temp_size = r.state_size;
+		r.state_size = r.next_state_size;
+		r.next_state_size = temp_size;
+	}
+}
+
+bool rewind_step_back() {
+	auto& r = rewind_buffer;
+
+	if (r.num_records < 2) return false;
+
+	Rewind_Record* last = get_record(r.num_records - 1);
+	Rewind_Record* prev = get_record(r.num_records - 2);
+
+	if (!last->keyframe) {
+		// XOR the delta back
+		decode(r.memory + last->offset, last->size, r.state, max(last->state_size, prev->state_size), true);
+	} else {
+		// rebuild the previous frame from the keyframe before it
+		int k = r.num_records - 2;
+		while (!get_record(k)->keyframe) {
+			k--;
+		}
+
+		Rewind_Record* key = get_record(k);
+		decode(r.memory + key->offset, key->size, r.state, key->state_size, false);
+
+		if (key->state_size < r.state_size) {
+			memset(r.state + key->state_size, 0, r.state_size - key->state_size);
+		}
+
+		for (int i = k + 1; i <= r.num_records - 2; i++) {
+			Rewind_Record* a = get_record(i - 1);
+			Rewind_Record* b = get_record(i);
+			decode(r.memory + b->offset, b->size, r.state, max(a->state_size, b->state_size), true);
+		}
+	}
+
+	r.state_size = prev->state_size;
+
+	r.memory_used -= last->size;
+	r.num_records--;
+
+	r.frames_since_keyframe = 0;
+	for (int i = r.num_records - 1; !get_record(i)->keyframe; i--) {
+		r.frames_since_keyframe++;
+	}
+
+	read_state();
+	return true;
+}
+
+size_t rewind_bytes_per_second() {
+	float seconds = rewind_seconds_recorded();
+	if (seconds == 0) return 0;
+
+	return (size_t) (rewind_buffer.memory_used / seconds);
+}
+
+float rewind_seconds_recorded() {
+	return rewind_buffer.num_records / 60.0f;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include "common.h"
+
+/*
+* Rewind: a rolling history of the last few seconds of gameplay.
+*
+* Every gameplay update the state (the Game struct and the used part of the objects array)
+* is written into a ring buffer. Every REWIND_KEYFRAME_INTERVAL frames it's a keyframe:
+* the whole state, run-length encoded. Frames in between store the state XOR'ed with the
+* previous frame, also run-length encoded. Most of the state doesn't change from frame to
+* frame, so deltas are mostly runs of zeros.
+*
+* XOR deltas work both ways, so stepping back is just applying the last delta again.
+* Stepping back over a keyframe rebuilds the previous frame from the keyframe before it.
+*
+* All memory is allocated in "rewind_init", the old history is dropped a keyframe at a time
+* when it runs out of room.
+*/
+
+constexpr int REWIND_SECONDS = 10;
+constexpr int REWIND_MAX_FRAMES = REWIND_SECONDS * 60;
+constexpr int REWIND_KEYFRAME_INTERVAL = 60;
+constexpr size_t REWIND_MEMORY = Megabytes(16);
+
+struct Rewind_Record {
+	u32 offset;     // into "rewind_buffer.memory"
+	u32 size;       // encoded size
+	u32 state_size; // decoded size
+	bool keyframe;
+};
+
+struct Rewind_Buffer {
+	u8* memory;
+	size_t memory_used;
+
+	// ring buffer of records, oldest first
+	Rewind_Record* records;
+	int first_record;
+	int num_records;
+
+	// state of the newest record, and scratch buffers
+	u8* state;
+	size_t state_size;
+	u8* next_state;
+	size_t next_state_size;
+	u8* encoded;
+
+	// both state buffers are kept zeroed past their size, so states of different sizes can be XOR'ed
+
+	int frames_since_keyframe;
+};
+
+extern Rewind_Buffer rewind_buffer;
+
+void rewind_init();
+void rewind_deinit();
+
+// forget the history, e.g. when the level restarts
+void rewind_reset();
+
+// call after every gameplay update
+void rewind_record();
+
+// returns false if there's no history left
+bool rewind_step_back();
+
+// bytes per second of recorded history, for the debug overlay
+size_t rewind_bytes_per_second();
+float rewind_seconds_recorded();
@@ -0,0 +1,381 @@
+#include "software_renderer.h"
+
+struct Software_Texture {
+	array<u32> pixels; // RGBA8
+	int width;
+	int height;
+	bool repeat;
+	bool has_alpha; // targets without alpha keep it at 255, like GL_RGB framebuffers
+};
+
+// position in the target in pixels, y up
+struct Screen_Vertex {
+	float x;
+	float y;
+	float u;
+	float v;
+	u32 color;
+};
+
+static dynamic_array<Software_Texture> software_textures;
+
+static Software_Texture* get_software_texture(u32 id) {
+	Assert(id > 0 && id <= software_textures.count);
+	return &software_textures[id - 1];
+}
+
+Texture load_texture_software(const u8* pixel_data, int width, int height,
+							  int wrap, u32 gl_format) {
+	Assert(gl_format == GL_RGBA || gl_format == GL_RGB);
+
+	Software_Texture st = {};
+	st.pixels = calloc_array<u32>(width * height);
+	st.width = width;
+	st.height = height;
+	st.repeat = (wrap == GL_REPEAT);
+	st.has_alpha = (gl_format == GL_RGBA);
+
+	if (pixel_data) {
+		if (gl_format == GL_RGBA) {
+			memcpy(st.pixels.data, pixel_data, st.pixels.count * sizeof(u32));
+		} else {
+			for (size_t i = 0; i < st.pixels.count; i++) {
+				const u8* p = &pixel_data[i * 3];
+				st.pixels[i] = p[0] | (p[1] << 8) | (p[2] << 16) | 0xFF000000;
+			}
+		}
+	} else if (!st.has_alpha) {
+		For (it, st.pixels) *it = 0xFF000000;
+	}
+
+	// reuse a free slot
+	u32 id = 0;
+	for (size_t i = 0; i < software_textures.count; i++) {
+		if (!software_textures[i].pixels.data) {
+			software_textures[i] = st;
+			id = (u32) i + 1;
+			break;
+		}
+	}
+
+	if (id == 0) {
+		array_add(&software_textures, st);
+		id = (u32) software_textures.count;
+	}
+
+	Texture t = {};
+	t.id = id;
+	t.width = width;
+	t.height = height;
+	return t;
+}
+
+void free_texture_software(Texture* t) {
+	if (t->id != 0) {
+		Software_Texture* st = get_software_texture(t->id);
+		free(st->pixels.data);
+		*st = {};
+	}
+
+	*t = {};
+}
+
+void deinit_software_textures() {
+	array_free(&software_textures);
+}
+
+array<u32> get_texture_pixels_software(const Texture& t) {
+	return get_software_texture(t.id)->pixels;
+}
+
+//
+// Pixel math, in 8 bits the way GL rounds it.
+//
+
+// x / 255 rounded, for x <= 255 * 255
+static inline u32 div_255(u32 x) {
+	x += 128;
+	return (x + (x >> 8)) >> 8;
+}
+
+static inline u32 blend_pixel(u32 texel, u32 dst, u32 color, u32 alpha_mask) {
+	u32 sr = div_255(( texel        & 0xFF) * ( color        & 0xFF));
+	u32 sg = div_255(((texel >> 8)  & 0xFF) * ((color >> 8)  & 0xFF));
+	u32 sb = div_255(((texel >> 16) & 0xFF) * ((color >> 16) & 0xFF));
+	u32 sa = div_255(( texel >> 24)         * ( color >> 24));
+
+	u32 ia = 255 - sa;
+
+	u32 r = div_255(sr * sa + ( dst        & 0xFF) * ia);
+	u32 g = div_255(sg * sa + ((dst >> 8)  & 0xFF) * ia);
+	u32 b = div_255(sb * sa + ((dst >> 16) & 0xFF) * ia);
+	u32 a = div_255(sa * sa + ( dst >> 24)         * ia);
+
+	return (r | (g << 8) | (b << 16) | (a << 24)) | alpha_mask;
+}
+
+// no branches in the loops, so that they vectorize
+static void blend_span_forward(u32* dst, const u32* texels, int count, u32 color, u32 alpha_mask) {
+	for (int i = 0; i < count; i++) {
+		dst[i] = blend_pixel(texels[i], dst[i], color, alpha_mask);
+	}
+}
+
+static void blend_span_backward(u32* dst, const u32* texels, int count, u32 color, u32 alpha_mask) {
+	for (int i = 0; i < count; i++) {
+		dst[i] = blend_pixel(texels[-i], dst[i], color, alpha_mask);
+	}
+}
+
+static inline int wrap_texel(int x, int size, bool repeat) {
+	if (repeat) {
+		x %= size;
+		return (x < 0) ? x + size : x;
+	}
+
+	return clamp(x, 0, size - 1);
+}
+
+// the palette shader: the color from the palette, the alpha from the texel
+static inline u32 apply_palette(u32 texel, const u32* palette) {
+	return palette ? (palette[texel & 0xFF] | (texel & 0xFF000000)) : texel;
+}
+
+static inline u32 sample_nearest(const Software_Texture* t, float u, float v) {
+	int x = wrap_texel((int) floorf(u * t->width),  t->width,  t->repeat);
+	int y = wrap_texel((int) floorf(v * t->height), t->height, t->repeat);
+	return t->pixels[x + y * t->width];
+}
+
+static inline u32 round_color(float r, float g, float b, float a) {
+	u32 ur = (u32) (r + 0.5f);
+	u32 ug = (u32) (g + 0.5f);
+	u32 ub = (u32) (b + 0.5f);
+	u32 ua = (u32) (a + 0.5f);
+	return ur | (ug << 8) | (ub << 16) | (ua << 24);
+}
+
+void clear_software(const Texture& target, vec4 color) {
+	Software_Texture* dst = get_software_texture(target.id);
+
+	u32 pixel = round_color(color.r * 255.0f, color.g * 255.0f, color.b * 255.0f, color.a * 255.0f);
+	if (!dst->has_alpha) pixel |= 0xFF000000;
+
+	For (it, dst->pixels) *it = pixel;
+}
+
+//
+// Rasterization.
+//
+
+// "a" and "b" are opposite corners
+static void draw_rect(Software_Texture* dst, const Software_Texture* src, const u32* palette,
+					  const Screen_Vertex& a, const Screen_Vertex& b, u32 color) {
+	if (a.x == b.x || a.y == b.y) {
+		return;
+	}
+
+	float du_dx = (b.u - a.u) / (b.x - a.x);
+	float dv_dy = (b.v - a.v) / (b.y - a.y);
+
+	// pixels with centers in [min, max)
+	int x0 = max((int) ceilf(fminf(a.x, b.x) - 0.5f), 0);
+	int x1 = min((int) ceilf(fmaxf(a.x, b.x) - 0.5f), dst->width);
+	int y0 = max((int) ceilf(fminf(a.y, b.y) - 0.5f), 0);
+	int y1 = min((int) ceilf(fmaxf(a.y, b.y) - 0.5f), dst->height);
+
+	int count = x1 - x0;
+	if (count <= 0) {
+		return;
+	}
+
+	u32 alpha_mask = dst->has_alpha ? 0 : 0xFF000000;
+
+	float u = a.u + (x0 + 0.5f - a.x) * du_dx;
+	float step = du_dx * src->width; // texels per pixel
+
+	int tx = (int) floorf(u * src->width);
+
+	// the spans don't look texels up in the palette
+	bool forward  = (!palette && fabsf(step - 1.0f) < 1e-4f && tx >= 0 && tx + count <= src->width);
+	bool backward = (!palette && fabsf(step + 1.0f) < 1e-4f && tx < src->width && tx - (count - 1) >= 0);
+
+	for (int y = y0; y < y1; y++) {
+		float v = a.v + (y + 0.5f - a.y) * dv_dy;
+		int ty = wrap_texel((int) floorf(v * src->height), src->height, src->repeat);
+
+		const u32* texels = &src->pixels[ty * src->width];
+		u32* out = &dst->pixels[x0 + y * dst->width];
+
+		if (forward) {
+			blend_span_forward(out, texels + tx, count, color, alpha_mask);
+		} else if (backward) {
+			blend_span_backward(out, texels + tx, count, color, alpha_mask);
+		} else {
+			// scaled, wraps around or has a palette
+			for (int i = 0; i < count; i++) {
+				int x = wrap_texel((int) floorf((u + i * du_dx) * src->width), src->width, src->repeat);
+				out[i] = blend_pixel(apply_palette(texels[x], palette), out[i], color, alpha_mask);
+			}
+		}
+	}
+}
+
+static inline float edge_function(const Screen_Vertex& a, const Screen_Vertex& b, float x, float y) {
+	return (b.x - a.x) * (y - a.y) - (b.y - a.y) * (x - a.x);
+}
+
+// for a counter-clockwise triangle with y up: pixels on top and left edges are covered,
+// so that triangles sharing an edge don't both cover it
+static inline bool is_top_left(const Screen_Vertex& a, const Screen_Vertex& b) {
+	return (a.y == b.y && b.x < a.x) || (b.y < a.y);
+}
+
+static void draw_triangle(Software_Texture* dst, const Software_Texture* src, const u32* palette,
+						  Screen_Vertex a, Screen_Vertex b, Screen_Vertex c, bool circle) {
+	float area = edge_function(a, b, c.x, c.y);
+	if (area == 0) {
+		return;
+	}
+
+	if (area < 0) {
+		Screen_Vertex temp = b;
+		b = c;
+		c = temp;
+		area = -area;
+	}
+
+	int x0 = max((int) floorf(fminf(a.x, fminf(b.x, c.x))), 0);
+	int x1 = min((int) ceilf (fmaxf(a.x, fmaxf(b.x, c.x))), dst->width);
+	int y0 = max((int) floorf(fminf(a.y, fminf(b.y, c.y))), 0);
+	int y1 = min((int) ceilf (fmaxf(a.y, fmaxf(b.y, c.y))), dst->height);
+
+	bool top_left_a = is_top_left(b, c); // edge opposite of "a"
+	bool top_left_b = is_top_left(c, a);
+	bool top_left_c = is_top_left(a, b);
+
+	u32 alpha_mask = dst->has_alpha ? 0 : 0xFF000000;
+
+	auto channel = [](u32 color, int shift) { return (float) ((color >> shift) & 0xFF); };
+
+	for (int y = y0; y < y1; y++) {
+		for (int x = x0; x < x1; x++) {
+			float px = x + 0.5f;
+			float py = y + 0.5f;
+
+			float wa = edge_function(b, c, px, py);
+			float wb = edge_function(c, a, px, py);
+			float wc = edge_function(a, b, px, py);
+
+			if (wa < 0 || (wa == 0 && !top_left_a)) continue;
+			if (wb < 0 || (wb == 0 && !top_left_b)) continue;
+			if (wc < 0 || (wc == 0 && !top_left_c)) continue;
+
+			wa /= area;
+			wb /= area;
+			wc /= area;
+
+			float u = wa * a.u + wb * b.u + wc * c.u;
+			float v = wa * a.v + wb * b.v + wc * c.v;
+
+			// the circle shader
+			if (circle) {
+				float cu = u * 2.0f - 1.0f;
+				float cv = v * 2.0f - 1.0f;
+				if (cu * cu + cv * cv >= 1.0f) continue;
+			}
+
+			u32 color = a.color;
+			if (a.color != b.color || a.color != c.color) {
+				color = round_color(wa * channel(a.color,  0) + wb * channel(b.color,  0) + wc * channel(c.color,  0),
+									wa * channel(a.color,  8) + wb * channel(b.color,  8) + wc * channel(c.color,  8),
+									wa * channel(a.color, 16) + wb * channel(b.color, 16) + wc * channel(c.color, 16),
+									wa * channel(a.color, 24) + wb * channel(b.color, 24) + wc * channel(c.color, 24));
+			}
+
+			u32* out = &dst->pixels[x + y * dst->width];
+			*out = blend_pixel(apply_palette(sample_nearest(src, u, v), palette), *out, color, alpha_mask);
+		}
+	}
+}
+
+static bool is_axis_aligned(const Screen_Vertex q[4]) {
+	// LT, RT, RB, LB, see "draw_texture_simple"
+	return (q[0].y == q[1].y && q[2].y == q[3].y
+			&& q[0].x == q[3].x && q[1].x == q[2].x
+			&& q[0].v == q[1].v && q[2].v == q[3].v
+			&& q[0].u == q[3].u && q[1].u == q[2].u
+			&& q[0].color == q[1].color && q[0].color == q[2].color && q[0].color == q[3].color);
+}
+
+void draw_software(const Texture& target, RenderMode mode, const Texture& t,
+				   array<Vertex> vertices, const mat4& mvp,
+				   const Texture& palette, int palette_index) {
+	Software_Texture* dst = get_software_texture(target.id);
+	const Software_Texture* src = get_software_texture(t.id);
+
+	// "index.r + texel_width*0.5" and row "u_PaletteIndex", sampled nearest
+	u32 palette_table[256];
+	const u32* palette_lookup = nullptr;
+
+	if (palette.id != 0) {
+		const Software_Texture* p = get_software_texture(palette.id);
+		int y = clamp(palette_index, 0, p->height - 1);
+
+		for (int i = 0; i < 256; i++) {
+			int x = wrap_texel((int) floorf((i / 255.0f + 0.5f / p->width) * p->width), p->width, p->repeat);
+			palette_table[i] = p->pixels[x + y * p->width] & 0x00FFFFFF;
+		}
+
+		palette_lookup = palette_table;
+	}
+
+	auto to_screen = [&](const Vertex& vertex) {
+		vec4 clip = mvp * vec4{vertex.pos, 1.0f};
+
+		Screen_Vertex result;
+		result.x = (clip.x / clip.w + 1.0f) * 0.5f * dst->width;
+		result.y = (clip.y / clip.w + 1.0f) * 0.5f * dst->height;
+		result.u = vertex.uv.x;
+		result.v = vertex.uv.y;
+		result.color = vertex.color;
+		return result;
+	};
+
+	switch (mode) {
+		case MODE_QUADS:
+		case MODE_CIRCLES: {
+			bool circle = (mode == MODE_CIRCLES);
+
+			for (size_t i = 0; i + 4 <= vertices.count; i += 4) {
+				Screen_Vertex q[4];
+				for (int j = 0; j < 4; j++) {
+					q[j] = to_screen(vertices[i + j]);
+				}
+
+				if (!circle && is_axis_aligned(q)) {
+					draw_rect(dst, src, palette_lookup, q[0], q[2], q[0].color);
+				} else {
+					// same triangles as the index buffer
+					draw_triangle(dst, src, palette_lookup, q[0], q[1], q[2], circle);
+					draw_triangle(dst, src, palette_lookup, q[2], q[3], q[0], circle);
+				}
+			}
+			break;
+		}
+
+		case MODE_TRIANGLES: {
+			for (size_t i = 0; i + 3 <= vertices.count; i += 3) {
+				draw_triangle(dst, src, palette_lookup, to_screen(vertices[i]), to_screen(vertices[i + 1]), to_screen(vertices[i + 2]), false);
+			}
+			break;
+		}
+
+		// not supported
+		case MODE_LINES:
+		case MODE_POINTS:
+		case MODE_NONE: {
+			break;
+		}
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+#include "renderer.h"
+
+/*
+* Software renderer: draws the batch renderer's quads and triangles on the CPU, for
+* machines without a GPU. The renderer switches to it with "init_renderer_software",
+* and then textures and framebuffers live in memory and "break_batch" draws here.
+*
+* It does what the default texture shader does: nearest sampling (with GL_REPEAT or
+* GL_CLAMP_TO_EDGE), the vertex color multiplied in, and GL_SRC_ALPHA,
+* GL_ONE_MINUS_SRC_ALPHA blending. Pixels are covered when their centers are inside,
+* like in GL, and rows are stored bottom to top, the way glReadPixels returns them,
+* so the pixels can be compared against GL output.
+*
+* Axis-aligned quads (almost everything) are drawn one row at a time. Rows that step
+* through the texture one texel per pixel, either way, blend in a loop without branches
+* that the compiler vectorizes. Other quads and triangles go through a triangle rasterizer.
+*
+* The palette shader is emulated: with a palette (see "set_palette") the texels go through
+* a 256-entry table made from its row, the same texels "shaders/palette.frag" would pick.
+*
+* Not supported: other custom shaders (everything else is drawn with the default one),
+* lines, points and linear filtering.
+*/
+
+// Texture ids are indices into the software renderer's texture table, plus one.
+Texture load_texture_software(const u8* pixel_data, int width, int height,
+							  int wrap, u32 gl_format);
+void free_texture_software(Texture* t);
+
+// Frees the texture table. Call after every texture is freed.
+void deinit_software_textures();
+
+// RGBA8, "width * height" pixels, the bottom row first.
+array<u32> get_texture_pixels_software(const Texture& t);
+
+void clear_software(const Texture& target, vec4 color);
+
+// "mvp" takes the vertices to clip space. The viewport is the whole target.
+// "palette" can be empty.
+void draw_software(const Texture& target, RenderMode mode, const Texture& t,
+				   array<Vertex> vertices, const mat4& mvp,
+				   const Texture& palette, int palette_index);
@@ -4,6 +4,8 @@
 
 Mix_Music* g_Music;
 
+static bool s_MixerInitialized;
+
 void init_mixer() {
 	SDL_Init(SDL_INIT_AUDIO);
 
@@ -31,6 +33,8 @@ void init_mixer() {
 
 	Mix_OpenAudio(MIX_DEFAULT_FREQUENCY, MIX_DEFAULT_FORMAT, MIX_DEFAULT_CHANNELS, 2048);
 
+	s_MixerInitialized = true;
+
 	{
 		int freq;
 		u16 format;
@@ -87,6 +91,8 @@ void deinit_mixer() {
 	Mix_CloseAudio();
 	Mix_Quit();
 
+	s_MixerInitialized = false;
+
 	// quit SDL audio subsystem here?
 }
 
@@ -104,6 +110,9 @@ Mix_Chunk* load_sound(const char* fname) {
 }
 
 void play_sound(Mix_Chunk* chunk, bool stop_all_instances) {
+	// headless mode doesn't open an audio device
+	if (!s_MixerInitialized) return;
+
 	if (stop_all_instances) {
 		stop_sound(chunk);
 	}
@@ -112,6 +121,8 @@ void play_sound(Mix_Chunk* chunk, bool stop_all_instances) {
 }
 
 void stop_sound(Mix_Chunk* chunk) {
+	if (!s_MixerInitialized) return;
+
 	int nchannels = Mix_AllocateChannels(-1);
 
 	for (int i = 0; i < nchannels; i++) {
@@ -124,6 +135,8 @@ void stop_sound(Mix_Chunk* chunk) {
 void play_music(const char* fname, int loops) {
 	stop_music();
 
+	if (!s_MixerInitialized) return;
+
 	g_Music = Mix_LoadMUS(fname);
 	Mix_PlayMusic(g_Music, loops);
 }
@@ -1,6 +1,7 @@
 #include "texture.h"
 
 #include "package.h"
+#include "window_creation.h"
 #include <stb/stb_image.h>
 
 u8* decode_image_data(array<u8> buffer, int* out_width, int* out_height) {
@@ -66,6 +67,15 @@ Texture load_texture_from_file(const char* fname,
 		return create_texture_stub();
 	}
 
+	// don't decode the whole image if we only need the size
+	if (window.headless && !renderer.software) {
+		Texture t = {};
+		if (!stbi_info_from_memory(buffer.data, (int)buffer.count, &t.width, &t.height, nullptr)) {
+			return create_texture_stub();
+		}
+		return t;
+	}
+
 	Texture t = load_texture_from_memory(buffer, filter, wrap);
 
 	if (t.id != 0) {
@@ -294,6 +294,23 @@ void init_window_and_opengl(const char* title,
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
+void init_window_headless(int width, int height) {
+	window.perf_counter_when_started = SDL_GetPerformanceCounter();
+	window.perf_frequency = SDL_GetPerformanceFrequency();
+	window.perf_frequency_double = (double)window.perf_frequency;
+
+	if (SDL_Init(0) != 0) {
+		Panic("Couldn't initialize SDL: %s", SDL_GetError());
+	}
+
+	log_info("Platform: %s", SDL_GetPlatform());
+	log_info("Running headless.");
+
+	window.game_width  = width;
+	window.game_height = height;
+	window.headless = true;
+}
+
 void deinit_window_and_opengl() {
 	if (window.gl_context) SDL_GL_DeleteContext(window.gl_context);
 	window.gl_context = nullptr;
@@ -367,7 +384,8 @@ void begin_frame() {
 	window.frame_took_t = get_time();
 
 	if (!window.prev_time_is_initialized) {
-		window.prev_time = get_time() - 1.0; // 1.0 / window.target_fps;
+		// one frame ago, a whole second would make the first frame catch up "max_update_steps" updates
+		window.prev_time = get_time() - 1.0 / window.target_fps;
 
 		window.prev_time_is_initialized = true;
 	}
@@ -389,6 +407,37 @@ void begin_frame() {
 		window.delta = fminf(window.delta, max_delta);
 	}
 
+	// Fixed timestep.
+	{
+		double elapsed = (time - prev_time) * 60.0;
+
+		// 
+		// Snap to a whole frame when we're close to it, otherwise
+		// vsync jitter makes us alternate between 0 and 2 updates per frame.
+		// 
+		if (fabs(elapsed - 1.0) < 0.05) {
+			elapsed = 1.0;
+		}
+
+		window.update_accumulator += elapsed;
+
+		window.update_steps = (int) window.update_accumulator;
+
+		if (window.update_steps > window.max_update_steps) {
+			// Too far behind, drop the rest.
+			window.update_steps = window.max_update_steps;
+			window.update_accumulator = window.update_steps;
+		}
+
+		if (window.frame_advance_mode) {
+			window.update_steps = 1;
+			window.update_accumulator = 1;
+		}
+
+		window.update_accumulator -= window.update_steps;
+		window.interp_t = (float) window.update_accumulator;
+	}
+
 	window.fps = (float)(1.0 / (time - prev_time));
 
 	window.avg_fps_sum += window.fps;
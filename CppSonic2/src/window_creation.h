@@ -11,6 +11,7 @@ struct Window {
 
 	bool should_quit;  // Set this to true when game should terminate.
 	double target_fps = 60; // Used if vsync is off. See "init_window_and_opengl".
+	int max_update_steps = 4; // How many fixed updates can run in one frame to catch up.
 
 	/*   read-only   */
 
@@ -23,18 +24,26 @@ struct Window {
 	float fps; // for metrics
 	float delta; // NOTE: multiplied by 60
 
+	// Fixed timestep. The game is updated "update_steps" times per frame with a delta of 1 (1/60 of a second).
+	int update_steps;
+	float interp_t; // [0..1) how far the frame is between the previous and the current update, for drawing.
+
 	float avg_fps;
 
 	double frame_took;
 
 	bool frame_advance_mode;
 	bool should_skip_frame;
+
+	bool headless; // no OS window, no GL context. See "init_window_headless".
 	
 	/*   private   */
 
 	double prev_time;
 	double frame_end_time;
 
+	double update_accumulator;
+
 	bool prev_time_is_initialized;
 	bool prefer_borderless_fullscreen;
 
@@ -68,6 +77,14 @@ void init_window_and_opengl(const char* title,
 
 void deinit_window_and_opengl();
 
+/*
+Doesn't create a window or a GL context. Only sets up the timer and the game size.
+
+Textures are still "loaded" but only keep their size, so that sprites can be created.
+Call "deinit_window_and_opengl" to deinitialize.
+*/
+void init_window_headless(int width, int height);
+
 void begin_frame();
 void swap_buffers();
 